@@ -0,0 +1,179 @@
+/*
+ * Admission control and request deadlines. Work taken from a queue is shed with an "overloaded"
+ * error instead of being computed when too many requests are already being computed, or when it
+ * waited in the queue for longer than the configured latency, so clients fail fast and can retry
+ * elsewhere while the server works off its backlog. An admitted request gets a deadline, the
+ * server's request timeout or the client's shorter deadline_ms, counted from when it was received.
+ * Requests that produce their answer in parts check it between parts. Reads and SSH handshakes are
+ * bounded by timeouts of their own. Every limit is off when set to 0.
+ */
+
+#ifndef ADMISSION_C
+#define ADMISSION_C
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// Answer to shed work, a line of it in streaming mode
+#define ADMISSION_OVERLOADED_RESPONSE "{\"error\":\"Server overloaded.\",\"code\":\"overloaded\"}"
+#define ADMISSION_OVERLOADED_LINE ADMISSION_OVERLOADED_RESPONSE "\n"
+
+// Answer to a request that ran out of time before it was computed
+#define ADMISSION_DEADLINE_RESPONSE "{\"error\":\"Deadline exceeded.\",\"code\":\"deadline_exceeded\"}"
+
+enum AdmissionShed {
+    ADMISSION_SHED_CONCURRENCY,     // too many requests in flight
+    ADMISSION_SHED_QUEUE,           // waited too long for a worker
+    ADMISSION_SHED_REASONS
+};
+
+enum AdmissionTimeout {
+    ADMISSION_TIMEOUT_READ,         // a request did not arrive in time
+    ADMISSION_TIMEOUT_HANDSHAKE,    // the SSH key exchange did not finish in time
+    ADMISSION_TIMEOUT_DEADLINE,     // a request ran out of time before it was answered
+    ADMISSION_TIMEOUTS
+};
+
+const char *admission_shed_names[ADMISSION_SHED_REASONS] = { "concurrency", "queue_latency" };
+const char *admission_timeout_names[ADMISSION_TIMEOUTS] = { "read", "handshake", "deadline" };
+
+struct AdmissionStats {
+    int inFlight;
+    int maxInFlight;
+    unsigned long long admitted;
+    unsigned long long shed[ADMISSION_SHED_REASONS];
+    unsigned long long timeouts[ADMISSION_TIMEOUTS];
+};
+
+// Limits, set once at startup before any request is served
+int admission_max_in_flight;
+uint64_t admission_max_queue_ns;
+uint64_t admission_request_ns;
+int admission_read_ms;
+int admission_handshake_ms;
+
+static struct AdmissionStats admission_stats;
+
+// The request the calling thread is computing: when it arrived and when it has to be answered by (0 for never)
+static __thread uint64_t admission_received;
+static __thread uint64_t admission_deadline;
+static __thread int admission_expired;
+
+// Monotonic time in nanoseconds
+static inline uint64_t admissionNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void admissionInit(int maxInFlight, int maxQueueMs, int requestTimeoutMs, int readTimeoutMs, int handshakeTimeoutMs)
+{
+    admission_max_in_flight = maxInFlight;
+    admission_max_queue_ns = (uint64_t) maxQueueMs * 1000000ULL;
+    admission_request_ns = (uint64_t) requestTimeoutMs * 1000000ULL;
+    admission_read_ms = readTimeoutMs;
+    admission_handshake_ms = handshakeTimeoutMs;
+}
+
+void admissionCountTimeout(enum AdmissionTimeout timeout)
+{
+    __atomic_fetch_add(&admission_stats.timeouts[timeout], 1, __ATOMIC_RELAXED);
+}
+
+// Decides whether work that waited waitedNs for a worker is computed. Returns 0 and counts it in
+// flight until admissionLeave, with the server's deadline counted from its arrival, or -1 when it
+// is to be answered with ADMISSION_OVERLOADED_RESPONSE instead.
+int admissionEnter(uint64_t waitedNs)
+{
+    if (admission_max_queue_ns && waitedNs > admission_max_queue_ns)
+    {
+        __atomic_fetch_add(&admission_stats.shed[ADMISSION_SHED_QUEUE], 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    int inFlight = __atomic_add_fetch(&admission_stats.inFlight, 1, __ATOMIC_RELAXED);
+    if (admission_max_in_flight && inFlight > admission_max_in_flight)
+    {
+        __atomic_fetch_sub(&admission_stats.inFlight, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&admission_stats.shed[ADMISSION_SHED_CONCURRENCY], 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_fetch_add(&admission_stats.admitted, 1, __ATOMIC_RELAXED);
+
+    admission_received = admissionNow() - waitedNs;
+    admission_deadline = admission_request_ns ? admission_received + admission_request_ns : 0;
+    admission_expired = 0;
+    return 0;
+}
+
+void admissionLeave(void)
+{
+    __atomic_fetch_sub(&admission_stats.inFlight, 1, __ATOMIC_RELAXED);
+    admission_received = 0;
+    admission_deadline = 0;
+}
+
+// Starts the deadline of the next request of the admitted work: the server's, or deadlineMs after
+// the work arrived when the client asked for less (deadlineMs <= 0 asks for nothing). Outside
+// admitted work the request counts as received now.
+void admissionSetDeadline(double deadlineMs)
+{
+    if (admission_received == 0)
+        admission_received = admissionNow();
+    admission_deadline = admission_request_ns ? admission_received + admission_request_ns : 0;
+    if (deadlineMs > 0 && (admission_deadline == 0 || deadlineMs * 1e6 < (double) (admission_deadline - admission_received)))
+        admission_deadline = admission_received + (uint64_t) (deadlineMs * 1e6);
+    admission_expired = 0;
+}
+
+// Whether the calling thread's request is past its deadline, counted once per request
+int admissionExpired(void)
+{
+    if (admission_expired)
+        return 1;
+    if (admission_deadline == 0 || admissionNow() < admission_deadline)
+        return 0;
+
+    admission_expired = 1;
+    admissionCountTimeout(ADMISSION_TIMEOUT_DEADLINE);
+    return 1;
+}
+
+// Deadline for a request that starts arriving now, 0 without a read timeout
+uint64_t admissionReadDeadline(void)
+{
+    return admission_read_ms ? admissionNow() + (uint64_t) admission_read_ms * 1000000ULL : 0;
+}
+
+// Non-blank lines in a run of newline-delimited requests, the number of answers it is owed
+size_t admissionCountRequests(const char *lines, size_t length)
+{
+    size_t requests = 0;
+    int blank = 1;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (lines[i] == '\n')
+        {
+            requests += !blank;
+            blank = 1;
+        }
+        else if (lines[i] != ' ' && lines[i] != '\t' && lines[i] != '\r')
+            blank = 0;
+    }
+    return requests + !blank;
+}
+
+void admissionStatsSnapshot(struct AdmissionStats *stats)
+{
+    stats->inFlight = __atomic_load_n(&admission_stats.inFlight, __ATOMIC_RELAXED);
+    stats->maxInFlight = admission_max_in_flight;
+    stats->admitted = __atomic_load_n(&admission_stats.admitted, __ATOMIC_RELAXED);
+    for (int i = 0; i < ADMISSION_SHED_REASONS; i++)
+        stats->shed[i] = __atomic_load_n(&admission_stats.shed[i], __ATOMIC_RELAXED);
+    for (int i = 0; i < ADMISSION_TIMEOUTS; i++)
+        stats->timeouts[i] = __atomic_load_n(&admission_stats.timeouts[i], __ATOMIC_RELAXED);
+}
+
+#endif
@@ -1,3 +1,10 @@
+#ifndef ASTROMATH_C
+#define ASTROMATH_C
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
 // include model struct
 #include "exoplanet.c"
 // Define constants
@@ -12,7 +19,41 @@
 #define RAD_TO_DEG(radians) ((radians) * (180.0 / PI))
 #define DEG_TO_RAD(degrees) ((degrees) * (PI / 180.0))
 
+// Kepler solvers selectable at startup
+enum KeplerSolver {
+    KEPLER_SOLVER_NEWTON,   // Original Newton-Raphson iteration starting at E = M
+    KEPLER_SOLVER_HALLEY    // Range reduction, Markley starting value and Halley steps
+};
+
+// Upper bound on Halley steps and the step size treated as converged. Halley's method is cubic, so
+// a step below 1e-6 leaves an error near 1e-18 times the curvature term, under 1e-14 for e < 0.999,
+// and saves the step that would only confirm it.
+#define KEPLER_HALLEY_MAX_ITERATIONS 8
+#define KEPLER_HALLEY_TOLERANCE 1e-6
+
+// Steps below this move sin E and cos E by the angle addition formulas instead of a new sincos
+#define KEPLER_HALLEY_ROTATE_STEP 1e-3
+
+// 2 * PI as the nearest double plus the remainder it leaves out
+#define TWO_PI_HI 6.28318530717958623200
+#define TWO_PI_LO 2.44929359829470635445E-16
+
+// Iteration histogram size, the last bucket collects everything at or above it
+#define KEPLER_STATS_BUCKETS 16
+
+struct KeplerSolverStats {
+    unsigned long long calls;
+    unsigned long long failures;        // Solves that returned NaN
+    unsigned long long iterations;      // Sum of iterations over all calls
+    unsigned long long histogram[KEPLER_STATS_BUCKETS];
+};
+
+// Solver used by calculateRaAndDistance
+enum KeplerSolver kepler_solver = KEPLER_SOLVER_NEWTON;
+
 double solveKeplersEquation(double M, double e);
+double solveKepler(double M, double e);
+double solveKeplerFrom(double M, double e, double guess);
 void equatorial_to_galactic(double ra, double dec, double *l, double *b);
 
 // Function to calculate the Right Ascension (RA) of an exoplanet for an elliptical orbit
@@ -25,7 +66,7 @@ void calculateRaAndDistance(struct Exoplanet *planet, double current_time)
     double mean_anomaly = 2 * PI * (current_time / orbital_period_seconds);
 
     // Calculate eccentric anomaly using mean anomaly
-    double eccentric_anomaly = solveKeplersEquation(mean_anomaly, planet->eccentricity);
+    double eccentric_anomaly = solveKepler(mean_anomaly, planet->eccentricity);
 
     // keplar equation solver function didnt come to a value exit early
     if (isnan(eccentric_anomaly))
@@ -79,6 +120,27 @@ void calculateRaAndDistance(struct Exoplanet *planet, double current_time)
     planet->declination = RAD_TO_DEG(dec);
 }
 
+// Function to calculate the matrix rotating orbital plane coordinates into the equatorial frame.
+// The result is stored as {px, qx, py, qy, pz, qz} so that x_eq = x_orbital * px + y_orbital * qx and so on,
+// matching the expressions used in calculateRaAndDistance.
+void calculateOrbitRotation(const struct Exoplanet *planet, double rotation[6])
+{
+    double inclination_rad = planet->inclination * (PI / 180.0);
+    double node_rad = planet->longitudeOfNode * (PI / 180.0);
+    double periapsis_rad = planet->argumentOfPeriapsis * (PI / 180.0);
+
+    double cos_node = cos(node_rad), sin_node = sin(node_rad);
+    double cos_periapsis = cos(periapsis_rad), sin_periapsis = sin(periapsis_rad);
+    double cos_inclination = cos(inclination_rad), sin_inclination = sin(inclination_rad);
+
+    rotation[0] = cos_node * cos_periapsis - sin_node * sin_periapsis * cos_inclination;
+    rotation[1] = -(sin_node * cos_periapsis + cos_node * sin_periapsis * cos_inclination);
+    rotation[2] = cos_node * sin_periapsis + sin_node * cos_periapsis * cos_inclination;
+    rotation[3] = cos_node * cos_periapsis - sin_node * sin_periapsis * cos_inclination;
+    rotation[4] = sin_periapsis * sin_inclination;
+    rotation[5] = cos_periapsis * sin_inclination;
+}
+
 void setGalacticCoordinates(struct Exoplanet *planet)
 {
     double l, b;
@@ -91,7 +153,8 @@ void setGalacticCoordinates(struct Exoplanet *planet)
 // Parameters:
 // - M: Mean anomaly
 // - e: Eccentricity of the orbit
-double solveKeplersEquation(double M, double e)
+// - iterations: Receives the number of iterations used, may be NULL
+double solveKeplersEquationNewton(double M, double e, int *iterations)
 {
     // Initial approximation for eccentric anomaly
     double E = M;
@@ -114,6 +177,9 @@ double solveKeplersEquation(double M, double e)
         // Check for convergence: if the change in E is less than the defined tolerance, the method has converged
         if (fabs(E_new - E) < delta)
         {
+            if (iterations)
+                *iterations = i + 1;
+
             // return calculated eccentric anomaly
             return E_new;
         }
@@ -122,10 +188,250 @@ double solveKeplersEquation(double M, double e)
         E = E_new;
     }
 
+    if (iterations)
+        *iterations = 100;
+
     // If the method hasn't converged after the maximum number of iterations, return NaN
     return NAN;
 }
 
+double solveKeplersEquation(double M, double e)
+{
+    return solveKeplersEquationNewton(M, e, NULL);
+}
+
+// Sine and cosine of one angle from a single libm call (sincos is a GNU extension, the builtin
+// reaches it in strict C99 builds as well)
+static inline void keplerSinCos(double x, double *sin_x, double *cos_x)
+{
+#if defined(__GNUC__)
+    __builtin_sincos(x, sin_x, cos_x);
+#else
+    *sin_x = sin(x);
+    *cos_x = cos(x);
+#endif
+}
+
+// Moves sin E and cos E to E - step for a step below KEPLER_HALLEY_ROTATE_STEP, where the Taylor
+// series of sin and cos of the step are exact to double precision after three terms
+static inline void keplerRotate(double step, double *sin_E, double *cos_E)
+{
+    double step2 = step * step;
+    double sin_step = step * (1 - step2 / 6 * (1 - step2 / 20));
+    double cos_step = 1 - step2 / 2 * (1 - step2 / 12 * (1 - step2 / 30));
+
+    double sin_moved = *sin_E * cos_step - *cos_E * sin_step;
+    *cos_E = *cos_E * cos_step + *sin_E * sin_step;
+    *sin_E = sin_moved;
+}
+
+// Reduces M to [-pi, pi]. Unlike remainder() the cost does not grow with the number of revolutions,
+// and the two-part 2 * PI keeps the result exact to a few ulps for any realistic mean anomaly.
+static inline double keplerReduce(double M)
+{
+    double k = floor(M * (1 / (2 * PI)) + 0.5);
+    return (M - k * TWO_PI_HI) - k * TWO_PI_LO;
+}
+
+// Function to solve Kepler's equation with range reduction, Markley's starting value and Halley steps.
+// Converges in at most three steps for every 0 <= e < 1, the bound below only guards against bad input.
+// Returns E in the same revolution as M, so it can be used in place of solveKeplersEquation.
+double solveKeplersEquationHalley(double M, double e, int *iterations)
+{
+    if (iterations)
+        *iterations = 0;
+
+    if (!(e >= 0 && e < 1) || !isfinite(M))
+        return NAN;
+
+    // A circular orbit's eccentric anomaly is its mean anomaly
+    if (e == 0)
+    {
+        if (iterations)
+            *iterations = 1;
+        return M;
+    }
+
+    // Reduce the mean anomaly to [-pi, pi] and solve for |M|, E(-M) = -E(M)
+    double reduced = keplerReduce(M);
+    double revolutions = M - reduced;
+    double m = fabs(reduced);
+
+    // Markley's cubic starting value, accurate to about 1e-4 across the whole (M, e) plane
+    double alpha = (3 * PI * PI + 1.6 * PI * (PI - m) / (1 + e)) / (PI * PI - 6);
+    double d = 3 * (1 - e) + alpha * e;
+    double q = 2 * alpha * d * (1 - e) - m * m;
+    double r = 3 * alpha * d * (d - 1 + e) * m + m * m * m;
+    double cube_root = cbrt(fabs(r) + sqrt(q * q * q + r * r));
+    double w = cube_root * cube_root;
+    double E = (2 * r * w / (w * w + w * q + q * q) + m) / d;
+
+    // One sincos for the starting value, the small steps after it rotate sin E and cos E along
+    double sin_E, cos_E;
+    keplerSinCos(E, &sin_E, &cos_E);
+
+    for (int i = 0; i < KEPLER_HALLEY_MAX_ITERATIONS; i++)
+    {
+        // Kepler's equation and its first two derivatives
+        double f = E - e * sin_E - m;
+        double f_prime = 1 - e * cos_E;
+        double f_second = e * sin_E;
+
+        double step = f * f_prime / (f_prime * f_prime - 0.5 * f * f_second);
+        E -= step;
+
+        if (fabs(step) < KEPLER_HALLEY_TOLERANCE)
+        {
+            if (iterations)
+                *iterations = i + 1;
+            return revolutions + (reduced < 0 ? -E : E);
+        }
+
+        if (fabs(step) < KEPLER_HALLEY_ROTATE_STEP)
+            keplerRotate(step, &sin_E, &cos_E);
+        else
+            keplerSinCos(E, &sin_E, &cos_E);
+    }
+
+    if (iterations)
+        *iterations = KEPLER_HALLEY_MAX_ITERATIONS;
+    return NAN;
+}
+
+// Iteration counts of the solves of one thread, only that thread writes them
+struct KeplerSolverThreadStats {
+    struct KeplerSolverStats stats;
+    struct KeplerSolverThreadStats *next;
+};
+
+static __thread struct KeplerSolverThreadStats *kepler_thread_stats;
+static struct KeplerSolverThreadStats *kepler_all_thread_stats;    // every thread that has solved, never freed
+
+// The calling thread's statistics, registered on first use. NULL if they could not be allocated.
+static struct KeplerSolverThreadStats *keplerThreadStats(void)
+{
+    if (kepler_thread_stats)
+        return kepler_thread_stats;
+
+    struct KeplerSolverThreadStats *thread = calloc(1, sizeof(struct KeplerSolverThreadStats));
+    if (!thread)
+        return NULL;
+
+    thread->next = __atomic_load_n(&kepler_all_thread_stats, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&kepler_all_thread_stats, &thread->next, thread, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    kepler_thread_stats = thread;
+    return thread;
+}
+
+// Single-writer increment, a snapshot may read the counter concurrently
+static inline void keplerStatsAdd(unsigned long long *counter, unsigned long long value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// Adds one solve to the calling thread's iteration statistics
+static void keplerSolverRecord(int iterations, double E)
+{
+    struct KeplerSolverThreadStats *thread = keplerThreadStats();
+    if (!thread)
+        return;
+
+    int bucket = iterations < KEPLER_STATS_BUCKETS ? iterations : KEPLER_STATS_BUCKETS - 1;
+    keplerStatsAdd(&thread->stats.calls, 1);
+    keplerStatsAdd(&thread->stats.iterations, (unsigned long long) iterations);
+    keplerStatsAdd(&thread->stats.histogram[bucket], 1);
+    if (isnan(E))
+        keplerStatsAdd(&thread->stats.failures, 1);
+}
+
+// Solves Kepler's equation with the configured solver and records iteration statistics
+double solveKepler(double M, double e)
+{
+    int iterations;
+    double E;
+
+    if (kepler_solver == KEPLER_SOLVER_NEWTON)
+        E = solveKeplersEquationNewton(M, e, &iterations);
+    else
+        E = solveKeplersEquationHalley(M, e, &iterations);
+
+    keplerSolverRecord(iterations, E);
+    return E;
+}
+
+// Solves Kepler's equation with Halley steps from guess, an eccentric anomaly close to the solution
+// such as the previous sample's of a track. A close guess converges in one or two steps instead of
+// the cold start's three. Falls back to solveKepler when guess is not finite or the steps do not converge.
+double solveKeplerFrom(double M, double e, double guess)
+{
+    if (!isfinite(guess) || !(e >= 0 && e < 1) || !isfinite(M))
+        return solveKepler(M, e);
+
+    // Steps are taken within one revolution, where the tolerance holds regardless of the revolution count
+    double reduced = keplerReduce(M);
+    double revolutions = M - reduced;
+    double E = guess - revolutions;
+
+    double sin_E, cos_E;
+    keplerSinCos(E, &sin_E, &cos_E);
+
+    for (int i = 0; i < KEPLER_HALLEY_MAX_ITERATIONS; i++)
+    {
+        double f = E - e * sin_E - reduced;
+        double f_prime = 1 - e * cos_E;
+        double f_second = e * sin_E;
+
+        double step = f * f_prime / (f_prime * f_prime - 0.5 * f * f_second);
+        E -= step;
+
+        if (fabs(step) < KEPLER_HALLEY_TOLERANCE)
+        {
+            keplerSolverRecord(i + 1, E);
+            return revolutions + E;
+        }
+
+        if (fabs(step) < KEPLER_HALLEY_ROTATE_STEP)
+            keplerRotate(step, &sin_E, &cos_E);
+        else
+            keplerSinCos(E, &sin_E, &cos_E);
+    }
+
+    return solveKepler(M, e);
+}
+
+// Sums the solver statistics of every thread, counters may be mutually off by in-flight solves
+void keplerSolverStatsSnapshot(struct KeplerSolverStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (struct KeplerSolverThreadStats *thread = __atomic_load_n(&kepler_all_thread_stats, __ATOMIC_ACQUIRE); thread; thread = thread->next)
+    {
+        stats->calls += __atomic_load_n(&thread->stats.calls, __ATOMIC_RELAXED);
+        stats->failures += __atomic_load_n(&thread->stats.failures, __ATOMIC_RELAXED);
+        stats->iterations += __atomic_load_n(&thread->stats.iterations, __ATOMIC_RELAXED);
+        for (int i = 0; i < KEPLER_STATS_BUCKETS; i++)
+            stats->histogram[i] += __atomic_load_n(&thread->stats.histogram[i], __ATOMIC_RELAXED);
+    }
+}
+
+// Parses a solver name ("newton" or "halley"), returns 0 on success
+int parseKeplerSolver(const char *name, enum KeplerSolver *solver)
+{
+    if (strcmp(name, "newton") == 0)
+        *solver = KEPLER_SOLVER_NEWTON;
+    else if (strcmp(name, "halley") == 0)
+        *solver = KEPLER_SOLVER_HALLEY;
+    else
+        return -1;
+    return 0;
+}
+
+const char *keplerSolverName(enum KeplerSolver solver)
+{
+    return solver == KEPLER_SOLVER_NEWTON ? "newton" : "halley";
+}
+
 void equatorial_to_galactic(double ra, double dec, double *l, double *b)
 {
     // Convert input angles from degrees to radians
@@ -158,3 +464,5 @@ void equatorial_to_galactic(double ra, double dec, double *l, double *b)
         *l += 360;
     }
 }
+
+#endif
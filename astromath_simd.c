@@ -0,0 +1,306 @@
+/*
+ * SIMD orbit kernel with runtime CPU dispatch (AVX-512, AVX2 + FMA, SSE2, scalar)
+ */
+
+#ifndef ASTROMATH_SIMD_C
+#define ASTROMATH_SIMD_C
+
+#include <stddef.h>
+#include <math.h>
+#include "astromath.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ASTROMATH_SIMD_X86 1
+#endif
+
+// Number of lanes handed to the kernel at once
+#define ORBIT_BLOCK_SIZE 256
+
+// Newton steps run by the vector solver, enough for e up to 0.999 from Danby's starting value
+#define KEPLER_SIMD_ITERATIONS 16
+
+// Step size below which a lane counts as converged
+#define KEPLER_SIMD_TOLERANCE 1e-12
+
+// Structure-of-arrays block of orbit evaluations. Callers fill the inputs, the kernel
+// fills radius (AU) and the equatorial x, y, z coordinates.
+struct OrbitBlock {
+    // Inputs
+    double meanAnomaly[ORBIT_BLOCK_SIZE];
+    double eccentricity[ORBIT_BLOCK_SIZE];
+    double orbitalRadius[ORBIT_BLOCK_SIZE];
+
+    // Orbital plane to equatorial rotation, see calculateOrbitRotation
+    double px[ORBIT_BLOCK_SIZE];
+    double qx[ORBIT_BLOCK_SIZE];
+    double py[ORBIT_BLOCK_SIZE];
+    double qy[ORBIT_BLOCK_SIZE];
+    double pz[ORBIT_BLOCK_SIZE];
+    double qz[ORBIT_BLOCK_SIZE];
+
+    // Outputs
+    double radius[ORBIT_BLOCK_SIZE];
+    double x[ORBIT_BLOCK_SIZE];
+    double y[ORBIT_BLOCK_SIZE];
+    double z[ORBIT_BLOCK_SIZE];
+};
+
+// Copies one orbit into lane i of the block
+void orbitBlockSetLane(struct OrbitBlock *block, size_t i, double mean_anomaly, double eccentricity, double orbital_radius, const double rotation[6])
+{
+    block->meanAnomaly[i] = mean_anomaly;
+    block->eccentricity[i] = eccentricity;
+    block->orbitalRadius[i] = orbital_radius;
+    block->px[i] = rotation[0];
+    block->qx[i] = rotation[1];
+    block->py[i] = rotation[2];
+    block->qy[i] = rotation[3];
+    block->pz[i] = rotation[4];
+    block->qz[i] = rotation[5];
+}
+
+// Reference path for lanes [start, end) using the configured scalar solver
+void orbitBlockKernelScalarRange(struct OrbitBlock *block, size_t start, size_t end)
+{
+    for (size_t i = start; i < end; i++)
+    {
+        double e = block->eccentricity[i];
+        double a = block->orbitalRadius[i];
+        double E = solveKepler(block->meanAnomaly[i], e);
+
+        double cos_E = cos(E);
+        double sin_E = sin(E);
+        double one_minus_e_cos = 1 - e * cos_E;
+
+        double x_orbital = a * ((cos_E - e) - e * one_minus_e_cos);
+        double y_orbital = a * (1 - e * e) * sin_E;
+
+        block->radius[i] = a * one_minus_e_cos;
+        block->x[i] = x_orbital * block->px[i] + y_orbital * block->qx[i];
+        block->y[i] = x_orbital * block->py[i] + y_orbital * block->qy[i];
+        block->z[i] = x_orbital * block->pz[i] + y_orbital * block->qz[i];
+    }
+}
+
+static void orbitBlockKernelScalar(struct OrbitBlock *block, size_t count)
+{
+    orbitBlockKernelScalarRange(block, 0, count);
+}
+
+#ifdef ASTROMATH_SIMD_X86
+
+// SSE2, part of the x86-64 baseline
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define VTYPE __m128d
+#define VMASK __m128d
+#define VWIDTH 2
+#define VLOAD(p) _mm_loadu_pd(p)
+#define VSTORE(p, a) _mm_storeu_pd(p, a)
+#define VSET1(a) _mm_set1_pd(a)
+#define VADD(a, b) _mm_add_pd(a, b)
+#define VSUB(a, b) _mm_sub_pd(a, b)
+#define VMUL(a, b) _mm_mul_pd(a, b)
+#define VDIV(a, b) _mm_div_pd(a, b)
+#define VFMA(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#define VABS(a) _mm_andnot_pd(_mm_set1_pd(-0.0), a)
+// SSE2 has no rounding instruction, adding 1.5 * 2^52 rounds to nearest for |a| < 2^51
+#define VROUND(a) _mm_sub_pd(_mm_add_pd(a, _mm_set1_pd(6755399441055744.0)), _mm_set1_pd(6755399441055744.0))
+#define VCMPEQ(a, b) _mm_cmpeq_pd(a, b)
+#define VCMPLT(a, b) _mm_cmplt_pd(a, b)
+#define VCMPGT(a, b) _mm_cmpgt_pd(a, b)
+#define VMASK_OR(a, b) _mm_or_pd(a, b)
+#define VMASK_AND(a, b) _mm_and_pd(a, b)
+#define VMASK_ALL(m) (_mm_movemask_pd(m) == 0x3)
+#define VSELECT(m, a, b) _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b))
+#define SIMD_SINCOS sincosSse2
+#define SIMD_KERNEL orbitBlockKernelSse2
+#include "astromath_simd_kernel.c"
+#undef VTYPE
+#undef VMASK
+#undef VWIDTH
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VFMA
+#undef VABS
+#undef VROUND
+#undef VCMPEQ
+#undef VCMPLT
+#undef VCMPGT
+#undef VMASK_OR
+#undef VMASK_AND
+#undef VMASK_ALL
+#undef VSELECT
+#undef SIMD_SINCOS
+#undef SIMD_KERNEL
+#pragma GCC pop_options
+
+// AVX2 with FMA, four lanes
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define VTYPE __m256d
+#define VMASK __m256d
+#define VWIDTH 4
+#define VLOAD(p) _mm256_loadu_pd(p)
+#define VSTORE(p, a) _mm256_storeu_pd(p, a)
+#define VSET1(a) _mm256_set1_pd(a)
+#define VADD(a, b) _mm256_add_pd(a, b)
+#define VSUB(a, b) _mm256_sub_pd(a, b)
+#define VMUL(a, b) _mm256_mul_pd(a, b)
+#define VDIV(a, b) _mm256_div_pd(a, b)
+#define VFMA(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define VABS(a) _mm256_andnot_pd(_mm256_set1_pd(-0.0), a)
+#define VROUND(a) _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VCMPEQ(a, b) _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+#define VCMPLT(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define VCMPGT(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define VMASK_OR(a, b) _mm256_or_pd(a, b)
+#define VMASK_AND(a, b) _mm256_and_pd(a, b)
+#define VMASK_ALL(m) (_mm256_movemask_pd(m) == 0xf)
+#define VSELECT(m, a, b) _mm256_blendv_pd(b, a, m)
+#define SIMD_SINCOS sincosAvx2
+#define SIMD_KERNEL orbitBlockKernelAvx2
+#include "astromath_simd_kernel.c"
+#undef VTYPE
+#undef VMASK
+#undef VWIDTH
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VFMA
+#undef VABS
+#undef VROUND
+#undef VCMPEQ
+#undef VCMPLT
+#undef VCMPGT
+#undef VMASK_OR
+#undef VMASK_AND
+#undef VMASK_ALL
+#undef VSELECT
+#undef SIMD_SINCOS
+#undef SIMD_KERNEL
+#pragma GCC pop_options
+
+// AVX-512F, eight lanes with native mask registers
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define VTYPE __m512d
+#define VMASK __mmask8
+#define VWIDTH 8
+#define VLOAD(p) _mm512_loadu_pd(p)
+#define VSTORE(p, a) _mm512_storeu_pd(p, a)
+#define VSET1(a) _mm512_set1_pd(a)
+#define VADD(a, b) _mm512_add_pd(a, b)
+#define VSUB(a, b) _mm512_sub_pd(a, b)
+#define VMUL(a, b) _mm512_mul_pd(a, b)
+#define VDIV(a, b) _mm512_div_pd(a, b)
+#define VFMA(a, b, c) _mm512_fmadd_pd(a, b, c)
+#define VABS(a) _mm512_abs_pd(a)
+#define VROUND(a) _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VCMPEQ(a, b) _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ)
+#define VCMPLT(a, b) _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ)
+#define VCMPGT(a, b) _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ)
+#define VMASK_OR(a, b) ((__mmask8)((a) | (b)))
+#define VMASK_AND(a, b) ((__mmask8)((a) & (b)))
+#define VMASK_ALL(m) ((m) == 0xff)
+#define VSELECT(m, a, b) _mm512_mask_blend_pd(m, b, a)
+#define SIMD_SINCOS sincosAvx512
+#define SIMD_KERNEL orbitBlockKernelAvx512
+#include "astromath_simd_kernel.c"
+#undef VTYPE
+#undef VMASK
+#undef VWIDTH
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VFMA
+#undef VABS
+#undef VROUND
+#undef VCMPEQ
+#undef VCMPLT
+#undef VCMPGT
+#undef VMASK_OR
+#undef VMASK_AND
+#undef VMASK_ALL
+#undef VSELECT
+#undef SIMD_SINCOS
+#undef SIMD_KERNEL
+#pragma GCC pop_options
+
+#endif
+
+// Kernel chosen for this CPU, resolved on first use
+typedef void (*OrbitBlockKernel)(struct OrbitBlock *block, size_t count);
+
+static OrbitBlockKernel selectOrbitBlockKernel(const char **name)
+{
+#ifdef ASTROMATH_SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        *name = "avx512";
+        return orbitBlockKernelAvx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        *name = "avx2";
+        return orbitBlockKernelAvx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        *name = "sse2";
+        return orbitBlockKernelSse2;
+    }
+#endif
+    *name = "scalar";
+    return orbitBlockKernelScalar;
+}
+
+// Published with release stores after the name, so a thread that loads the kernel also sees its name
+static OrbitBlockKernel orbit_block_kernel = NULL;
+static const char *orbit_block_kernel_name = NULL;
+
+// The kernel for this CPU, selected on first use. Threads racing on first use select the same
+// kernel and publish it atomically.
+static OrbitBlockKernel orbitBlockKernel(void)
+{
+    OrbitBlockKernel kernel = __atomic_load_n(&orbit_block_kernel, __ATOMIC_ACQUIRE);
+    if (kernel == NULL)
+    {
+        const char *name;
+        kernel = selectOrbitBlockKernel(&name);
+        __atomic_store_n(&orbit_block_kernel_name, name, __ATOMIC_RELEASE);
+        __atomic_store_n(&orbit_block_kernel, kernel, __ATOMIC_RELEASE);
+    }
+    return kernel;
+}
+
+// Returns the name of the kernel computeOrbitBlock dispatches to
+const char *orbitBlockKernelName(void)
+{
+    orbitBlockKernel();
+    return __atomic_load_n(&orbit_block_kernel_name, __ATOMIC_ACQUIRE);
+}
+
+// Evaluates the first count lanes of the block with the fastest kernel the CPU supports
+void computeOrbitBlock(struct OrbitBlock *block, size_t count)
+{
+    orbitBlockKernel()(block, count);
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Vectorized Kepler solve and orbital plane to equatorial rotation.
+ *
+ * This file is a template: astromath_simd.c includes it once per instruction set after
+ * defining VTYPE, VMASK, VWIDTH, the V* operation macros and the SIMD_* function names.
+ */
+
+// Computes sine and cosine of every lane, Cephes-style reduction by pi/2 and minimax polynomials
+static inline void SIMD_SINCOS(VTYPE x, VTYPE *sin_out, VTYPE *cos_out)
+{
+    // Quadrant of x and the remainder in [-pi/4, pi/4], pi/2 split in three parts to keep the remainder exact
+    VTYPE q = VROUND(VMUL(x, VSET1(2.0 / PI)));
+    VTYPE r = VSUB(x, VMUL(q, VSET1(1.57079625129699707031E0)));
+    r = VSUB(r, VMUL(q, VSET1(7.54978941586159635336E-8)));
+    r = VSUB(r, VMUL(q, VSET1(5.39030285815811905290E-15)));
+
+    VTYPE z = VMUL(r, r);
+
+    VTYPE ps = VSET1(1.58962301576546568060E-10);
+    ps = VFMA(ps, z, VSET1(-2.50507477628578072866E-8));
+    ps = VFMA(ps, z, VSET1(2.75573136213857245213E-6));
+    ps = VFMA(ps, z, VSET1(-1.98412698295895385996E-4));
+    ps = VFMA(ps, z, VSET1(8.33333333332211858878E-3));
+    ps = VFMA(ps, z, VSET1(-1.66666666666666307295E-1));
+    ps = VFMA(VMUL(r, z), ps, r);
+
+    VTYPE pc = VSET1(-1.13585365213876817300E-11);
+    pc = VFMA(pc, z, VSET1(2.08757008419747316778E-9));
+    pc = VFMA(pc, z, VSET1(-2.75573141792967388112E-7));
+    pc = VFMA(pc, z, VSET1(2.48015872888517045348E-5));
+    pc = VFMA(pc, z, VSET1(-1.38888888888730564116E-3));
+    pc = VFMA(pc, z, VSET1(4.16666666666665929218E-2));
+    pc = VFMA(VMUL(z, z), pc, VSUB(VSET1(1.0), VMUL(VSET1(0.5), z)));
+
+    // q mod 4, q is integral so q/4 - 3/8 never lands on a rounding tie
+    VTYPE quadrant = VSUB(q, VMUL(VSET1(4.0), VROUND(VSUB(VMUL(q, VSET1(0.25)), VSET1(0.375)))));
+
+    VMASK swap = VMASK_OR(VCMPEQ(quadrant, VSET1(1.0)), VCMPEQ(quadrant, VSET1(3.0)));
+    VMASK negate_sin = VCMPGT(quadrant, VSET1(1.5));
+    VMASK negate_cos = VMASK_AND(VCMPGT(quadrant, VSET1(0.5)), VCMPLT(quadrant, VSET1(2.5)));
+
+    VTYPE s = VSELECT(swap, pc, ps);
+    VTYPE c = VSELECT(swap, ps, pc);
+
+    *sin_out = VSELECT(negate_sin, VSUB(VSET1(0.0), s), s);
+    *cos_out = VSELECT(negate_cos, VSUB(VSET1(0.0), c), c);
+}
+
+// Solves Kepler's equation for each lane of the block and rotates the resulting orbital
+// position into the equatorial frame. Lanes past the last full vector go through the scalar path.
+static void SIMD_KERNEL(struct OrbitBlock *block, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + VWIDTH <= count; i += VWIDTH)
+    {
+        VTYPE e = VLOAD(block->eccentricity + i);
+        VTYPE M = VLOAD(block->meanAnomaly + i);
+
+        // Reduce the mean anomaly to [-pi, pi], 2pi split in two parts for large anomalies
+        VTYPE k = VROUND(VMUL(M, VSET1(1.0 / (2.0 * PI))));
+        M = VSUB(M, VMUL(k, VSET1(TWO_PI_HI)));
+        M = VSUB(M, VMUL(k, VSET1(TWO_PI_LO)));
+
+        // Danby's starting value keeps Newton convergent for every e < 1
+        VTYPE offset = VMUL(VSET1(0.85), e);
+        VTYPE E = VADD(M, VSELECT(VCMPLT(M, VSET1(0.0)), VSUB(VSET1(0.0), offset), offset));
+
+        VTYPE sin_E, cos_E;
+        VMASK converged = VCMPLT(e, VSET1(-1.0)); // all lanes false
+
+        // Fixed number of Newton steps, converged lanes are frozen
+        for (int iteration = 0; iteration < KEPLER_SIMD_ITERATIONS; iteration++)
+        {
+            SIMD_SINCOS(E, &sin_E, &cos_E);
+
+            VTYPE f = VSUB(VSUB(E, VMUL(e, sin_E)), M);
+            VTYPE f_prime = VSUB(VSET1(1.0), VMUL(e, cos_E));
+            VTYPE step = VDIV(f, f_prime);
+
+            E = VSELECT(converged, E, VSUB(E, step));
+            converged = VMASK_OR(converged, VCMPLT(VABS(step), VSET1(KEPLER_SIMD_TOLERANCE)));
+
+            if (VMASK_ALL(converged))
+                break;
+        }
+
+        // Lanes that never converged report NaN like the scalar solver
+        E = VSELECT(converged, E, VSET1(NAN));
+
+        SIMD_SINCOS(E, &sin_E, &cos_E);
+
+        VTYPE a = VLOAD(block->orbitalRadius + i);
+        VTYPE one_minus_e_cos = VSUB(VSET1(1.0), VMUL(e, cos_E));
+
+        // Orbital plane coordinates written in terms of E, equivalent to the true anomaly form in calculateRaAndDistance
+        VTYPE radius = VMUL(a, one_minus_e_cos);
+        VTYPE x_orbital = VMUL(a, VSUB(VSUB(cos_E, e), VMUL(e, one_minus_e_cos)));
+        VTYPE y_orbital = VMUL(VMUL(a, VSUB(VSET1(1.0), VMUL(e, e))), sin_E);
+
+        VSTORE(block->radius + i, radius);
+        VSTORE(block->x + i, VFMA(x_orbital, VLOAD(block->px + i), VMUL(y_orbital, VLOAD(block->qx + i))));
+        VSTORE(block->y + i, VFMA(x_orbital, VLOAD(block->py + i), VMUL(y_orbital, VLOAD(block->qy + i))));
+        VSTORE(block->z + i, VFMA(x_orbital, VLOAD(block->pz + i), VMUL(y_orbital, VLOAD(block->qz + i))));
+    }
+
+    orbitBlockKernelScalarRange(block, i, count);
+}
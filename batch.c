@@ -0,0 +1,231 @@
+/*
+ * Batch ephemeris evaluation: many planets at many epochs in a single pass
+ */
+
+#ifndef BATCH_C
+#define BATCH_C
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "astromath.c"
+#include "astromath_simd.c"
+#include "orbitcache.c"
+
+// Upper bound on planets * epochs for one batch, keeps a single request from exhausting memory
+#define MAX_BATCH_RESULTS 1000000
+
+// Structure-of-arrays layout for a batch of planets evaluated over a shared time grid.
+// Element columns hold one entry per planet, result columns hold numPlanets * numEpochs
+// entries stored planet-major (result for planet i at epoch j lives at i * numEpochs + j).
+struct EphemerisBatch {
+    size_t numPlanets;
+    size_t numEpochs;
+
+    // Orbital elements, one entry per planet
+    double *orbitalRadius;
+    double *orbitalPeriod;
+    double *eccentricity;
+    double *inclination;
+    double *longitudeOfNode;
+    double *argumentOfPeriapsis;
+
+    // Precompiled orbits (e.g. from the catalog), NULL entries are compiled through the orbit cache
+    const struct OrbitHandle **orbits;
+
+    // Epochs (Unix time in seconds) shared by every planet
+    double *epochs;
+
+    // Results
+    double *distance;
+    double *ra;
+    double *declination;
+    double *galacticLongitude;
+    double *galacticLatitude;
+};
+
+// Allocates the element, epoch and result columns for a batch
+// Returns 0 on success, -1 if the batch is too large or memory could not be allocated
+int ephemerisBatchInit(struct EphemerisBatch *batch, size_t numPlanets, size_t numEpochs)
+{
+    memset(batch, 0, sizeof(*batch));
+
+    if (numPlanets == 0 || numEpochs == 0 || numPlanets > MAX_BATCH_RESULTS / numEpochs)
+        return -1;
+
+    size_t numResults = numPlanets * numEpochs;
+
+    batch->numPlanets = numPlanets;
+    batch->numEpochs = numEpochs;
+
+    // Element columns share one allocation, as do the result columns
+    double *elements = malloc(sizeof(double) * numPlanets * 6);
+    double *epochs = malloc(sizeof(double) * numEpochs);
+    double *results = malloc(sizeof(double) * numResults * 5);
+    const struct OrbitHandle **orbits = calloc(numPlanets, sizeof(struct OrbitHandle *));
+
+    if (!elements || !epochs || !results || !orbits)
+    {
+        free(elements);
+        free(epochs);
+        free(results);
+        free(orbits);
+        return -1;
+    }
+
+    batch->orbitalRadius = elements;
+    batch->orbitalPeriod = elements + numPlanets;
+    batch->eccentricity = elements + numPlanets * 2;
+    batch->inclination = elements + numPlanets * 3;
+    batch->longitudeOfNode = elements + numPlanets * 4;
+    batch->argumentOfPeriapsis = elements + numPlanets * 5;
+    batch->orbits = orbits;
+
+    batch->epochs = epochs;
+
+    batch->distance = results;
+    batch->ra = results + numResults;
+    batch->declination = results + numResults * 2;
+    batch->galacticLongitude = results + numResults * 3;
+    batch->galacticLatitude = results + numResults * 4;
+
+    return 0;
+}
+
+void ephemerisBatchFree(struct EphemerisBatch *batch)
+{
+    // Each group of columns is a single allocation anchored at its first column
+    free(batch->orbitalRadius);
+    free(batch->epochs);
+    free(batch->distance);
+    free(batch->orbits);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// Copies the orbital elements of a planet into slot i of the batch
+void ephemerisBatchSetPlanet(struct EphemerisBatch *batch, size_t i, const struct Exoplanet *planet)
+{
+    batch->orbitalRadius[i] = planet->orbitalRadius;
+    batch->orbitalPeriod[i] = planet->orbitalPeriod;
+    batch->eccentricity[i] = planet->eccentricity;
+    batch->inclination[i] = planet->inclination;
+    batch->longitudeOfNode[i] = planet->longitudeOfNode;
+    batch->argumentOfPeriapsis[i] = planet->argumentOfPeriapsis;
+    batch->orbits[i] = NULL;
+}
+
+// Uses an already compiled orbit for slot i, the handle must outlive the batch
+void ephemerisBatchSetOrbit(struct EphemerisBatch *batch, size_t i, const struct OrbitHandle *orbit)
+{
+    batch->orbitalRadius[i] = orbit->orbitalRadius;
+    batch->orbitalPeriod[i] = orbit->orbitalPeriod;
+    batch->eccentricity[i] = orbit->eccentricity;
+    batch->inclination[i] = orbit->inclination;
+    batch->longitudeOfNode[i] = orbit->longitudeOfNode;
+    batch->argumentOfPeriapsis[i] = orbit->argumentOfPeriapsis;
+    batch->orbits[i] = orbit;
+}
+
+// Converts the equatorial position in a lane of the block into the distance, right ascension,
+// declination and galactic coordinates of planet
+void orbitBlockLanePosition(const struct OrbitBlock *block, size_t lane, struct Exoplanet *planet)
+{
+    if (isnan(block->radius[lane]))
+    {
+        // Same outcome as calculateRaAndDistance when Kepler's equation has no solution
+        planet->distance = NAN;
+        planet->ra = NAN;
+    }
+    else
+    {
+        double x_eq = block->x[lane];
+        double y_eq = block->y[lane];
+        double z_eq = block->z[lane];
+
+        // convert astronomical units to light years
+        planet->distance = block->radius[lane] * 0.0000158125074;
+
+        // ensures that the Right Ascension (RA) is always in the positive range
+        planet->ra = atan2(y_eq, x_eq);
+        if (planet->ra < 0)
+            planet->ra += 2 * PI;
+
+        planet->declination = RAD_TO_DEG(asin(z_eq / sqrt(x_eq * x_eq + y_eq * y_eq + z_eq * z_eq)));
+    }
+
+    setGalacticCoordinates(planet);
+}
+
+// Converts the equatorial position in a lane of the block into result slot k of the batch
+static void ephemerisBatchStoreLane(struct EphemerisBatch *batch, size_t k, const struct OrbitBlock *block, size_t lane)
+{
+    struct Exoplanet planet = get_default_exoplanet();
+    orbitBlockLanePosition(block, lane, &planet);
+
+    batch->distance[k] = planet.distance;
+    batch->ra[k] = planet.ra;
+    batch->declination[k] = planet.declination;
+    batch->galacticLongitude[k] = planet.galacticLongitude;
+    batch->galacticLatitude[k] = planet.galacticLatitude;
+}
+
+// Evaluates every planet of the batch at every epoch and fills the result columns.
+// The (planet, epoch) pairs are streamed through the vectorized orbit kernel one block at a time.
+int computeEphemerisBatch(struct EphemerisBatch *batch)
+{
+    size_t numResults = batch->numPlanets * batch->numEpochs;
+
+    // Per-planet invariants come precompiled or from the shared orbit cache
+    struct OrbitHandle *orbits = malloc(sizeof(struct OrbitHandle) * batch->numPlanets);
+    struct OrbitBlock *block = malloc(sizeof(struct OrbitBlock));
+
+    if (!orbits || !block)
+    {
+        free(orbits);
+        free(block);
+        return -1;
+    }
+
+    for (size_t i = 0; i < batch->numPlanets; i++)
+    {
+        if (batch->orbits[i])
+        {
+            orbits[i] = *batch->orbits[i];
+            continue;
+        }
+
+        struct Exoplanet planet = get_default_exoplanet();
+        planet.orbitalRadius = batch->orbitalRadius[i];
+        planet.orbitalPeriod = batch->orbitalPeriod[i];
+        planet.eccentricity = batch->eccentricity[i];
+        planet.inclination = batch->inclination[i];
+        planet.longitudeOfNode = batch->longitudeOfNode[i];
+        planet.argumentOfPeriapsis = batch->argumentOfPeriapsis[i];
+
+        orbitCacheGet(&planet, &orbits[i]);
+    }
+
+    for (size_t start = 0; start < numResults; start += ORBIT_BLOCK_SIZE)
+    {
+        size_t count = numResults - start < ORBIT_BLOCK_SIZE ? numResults - start : ORBIT_BLOCK_SIZE;
+
+        for (size_t lane = 0; lane < count; lane++)
+        {
+            size_t i = (start + lane) / batch->numEpochs;
+            size_t j = (start + lane) % batch->numEpochs;
+
+            orbitBlockSetLane(block, lane, orbitHandleMeanAnomaly(&orbits[i], batch->epochs[j]), orbits[i].eccentricity, orbits[i].orbitalRadius, orbits[i].rotation);
+        }
+
+        computeOrbitBlock(block, count);
+
+        for (size_t lane = 0; lane < count; lane++)
+            ephemerisBatchStoreLane(batch, start + lane, block, lane);
+    }
+
+    free(orbits);
+    free(block);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * Microbenchmarks for the math kernels, the JSON paths and the visualization exports
+ *
+ * Usage: exoplanet-bench [name-prefix]
+ *
+ * Prints one JSON object per line and benchmark with the time and the heap allocations per
+ * operation. The Kepler solver sweep also reports the mean iteration count, failures and the worst
+ * residual |E - e sin E - M| over the swept mean anomalies, so the solvers can be compared on both
+ * speed and accuracy. Allocations are counted by wrapping malloc and friends at link time (see the
+ * bench target in the Makefile) and by routing jansson through json_set_alloc_funcs.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <jansson.h>
+#include "astromath.c"
+#include "astromath_simd.c"
+#include "orbit.c"
+#include "exoplanetjson.c"
+#include "exoplanetcodec.c"
+#include "visualization.c"
+
+// Each benchmark is repeated with twice the operations until one run takes at least this long
+#define BENCH_MIN_SECONDS 0.2
+
+// Mean anomalies swept per eccentricity, spread over many revolutions like raw Unix times produce
+#define BENCH_ANOMALIES 1024
+#define BENCH_REVOLUTIONS 50
+
+// Planets in one visualization export
+#define BENCH_OBJ_PLANETS 1000
+
+static unsigned long long bench_allocations;
+
+// Link-time wrappers (-Wl,--wrap=...) counting every allocation made by the benchmarked code
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    bench_allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    bench_allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    bench_allocations++;
+    return __real_realloc(pointer, size);
+}
+
+// jansson allocates inside the shared library, where the link-time wrappers do not reach
+static void *bench_json_malloc(size_t size)
+{
+    bench_allocations++;
+    return __real_malloc(size);
+}
+
+// Keeps results alive so the compiler cannot drop the benchmarked work
+static volatile double bench_sink;
+
+static double bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+struct BenchContext {
+    double e;                                   // Eccentricity of the Kepler sweeps
+    double anomalies[BENCH_ANOMALIES];
+    struct Exoplanet planet;
+    struct OrbitHandle orbit;
+    struct OrbitBlock *block;
+    const char *request;
+    size_t requestLength;
+    struct Exoplanet *planets;                  // BENCH_OBJ_PLANETS planets for the exports
+};
+
+typedef void (*BenchFunction)(struct BenchContext *context, size_t operations);
+
+static void bench_kepler_newton(struct BenchContext *context, size_t operations)
+{
+    double sum = 0;
+    for (size_t i = 0; i < operations; i++)
+        sum += solveKeplersEquationNewton(context->anomalies[i % BENCH_ANOMALIES], context->e, NULL);
+    bench_sink = sum;
+}
+
+static void bench_kepler_halley(struct BenchContext *context, size_t operations)
+{
+    double sum = 0;
+    for (size_t i = 0; i < operations; i++)
+        sum += solveKeplersEquationHalley(context->anomalies[i % BENCH_ANOMALIES], context->e, NULL);
+    bench_sink = sum;
+}
+
+static void bench_ra_and_distance(struct BenchContext *context, size_t operations)
+{
+    double sum = 0;
+    for (size_t i = 0; i < operations; i++)
+    {
+        calculateRaAndDistance(&context->planet, 1691592726.0 + (double) i * 3600);
+        sum += context->planet.ra;
+    }
+    bench_sink = sum;
+}
+
+static void bench_orbit_handle(struct BenchContext *context, size_t operations)
+{
+    double sum = 0;
+    for (size_t i = 0; i < operations; i++)
+    {
+        orbitHandleEvaluate(&context->orbit, 1691592726.0 + (double) i * 3600, &context->planet);
+        sum += context->planet.ra;
+    }
+    bench_sink = sum;
+}
+
+// One operation is one lane, blocks are filled once and recomputed
+static void bench_orbit_block(struct BenchContext *context, size_t operations)
+{
+    for (size_t done = 0; done < operations; done += ORBIT_BLOCK_SIZE)
+    {
+        size_t count = operations - done < ORBIT_BLOCK_SIZE ? operations - done : ORBIT_BLOCK_SIZE;
+        computeOrbitBlock(context->block, count);
+    }
+    bench_sink = context->block->x[0];
+}
+
+static void bench_galactic(struct BenchContext *context, size_t operations)
+{
+    (void)context;
+    double sum = 0;
+    for (size_t i = 0; i < operations; i++)
+    {
+        double l, b;
+        equatorial_to_galactic((double) (i % 360), (double) (i % 180) - 90, &l, &b);
+        sum += l + b;
+    }
+    bench_sink = sum;
+}
+
+static void bench_json_parse(struct BenchContext *context, size_t operations)
+{
+    double sum = 0;
+    for (size_t i = 0; i < operations; i++)
+    {
+        json_error_t error;
+        json_t *root = json_loadb(context->request, context->requestLength, 0, &error);
+        struct Exoplanet planet = get_default_exoplanet();
+        exoplanet_from_json(root, &planet);
+        sum += planet.eccentricity;
+        json_decref(root);
+    }
+    bench_sink = sum;
+}
+
+static void bench_json_serialize(struct BenchContext *context, size_t operations)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < operations; i++)
+    {
+        json_t *response = exoplanet_to_json(&context->planet);
+        char *text = json_dumps(response, JSON_COMPACT);
+        total += strlen(text);
+        free(text);
+        json_decref(response);
+    }
+    bench_sink = (double) total;
+}
+
+static void bench_codec_decode(struct BenchContext *context, size_t operations)
+{
+    double sum = 0;
+    for (size_t i = 0; i < operations; i++)
+    {
+        struct ExoplanetRequest request;
+        size_t consumed;
+        struct Exoplanet planet = get_default_exoplanet();
+        if (exoplanet_decode_request(context->request, context->requestLength, &request, &consumed) == 0)
+            exoplanet_request_apply(&request, &planet);
+        sum += planet.eccentricity;
+    }
+    bench_sink = sum;
+}
+
+static void bench_codec_encode(struct BenchContext *context, size_t operations)
+{
+    char buffer[EXOPLANET_RESPONSE_SIZE];
+    size_t total = 0;
+    for (size_t i = 0; i < operations; i++)
+        total += exoplanet_encode(&context->planet, buffer, sizeof(buffer));
+    bench_sink = (double) total;
+}
+
+// One operation is one OBJ export of BENCH_OBJ_PLANETS planets
+static void bench_obj_dots(struct BenchContext *context, size_t operations)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < operations; i++)
+    {
+        size_t size;
+        char *obj = generateObjDataDots(context->planets, BENCH_OBJ_PLANETS, 1920, 1080, &size);
+        total += size;
+        free(obj);
+    }
+    bench_sink = (double) total;
+}
+
+// Export sink that only counts the bytes, so the binary formats are timed without I/O
+static int bench_count_bytes(void *context, const char *data, size_t length)
+{
+    (void) data;
+    *(size_t *) context += length;
+    return 0;
+}
+
+static void bench_export(struct BenchContext *context, size_t operations, enum VisualizationFormat format)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < operations; i++)
+        exportVisualization(context->planets, BENCH_OBJ_PLANETS, 1920, 1080, format, 1, bench_count_bytes, &total);
+    bench_sink = (double) total;
+}
+
+// One operation is one streamed export of BENCH_OBJ_PLANETS planets on one thread
+static void bench_export_ply(struct BenchContext *context, size_t operations)
+{
+    bench_export(context, operations, VISUALIZATION_PLY);
+}
+
+static void bench_export_glb(struct BenchContext *context, size_t operations)
+{
+    bench_export(context, operations, VISUALIZATION_GLB);
+}
+
+struct BenchResult {
+    double nsPerOp;
+    double allocationsPerOp;
+    size_t operations;
+};
+
+// Runs the benchmark with doubling operation counts until a run is long enough to time
+static void bench_run(BenchFunction function, struct BenchContext *context, struct BenchResult *result)
+{
+    size_t operations = 16;
+    for (;;)
+    {
+        unsigned long long allocations = bench_allocations;
+        double start = bench_now();
+        function(context, operations);
+        double elapsed = bench_now() - start;
+
+        if (elapsed >= BENCH_MIN_SECONDS || operations >= ((size_t) 1 << 40))
+        {
+            result->nsPerOp = elapsed * 1e9 / operations;
+            result->allocationsPerOp = (double) (bench_allocations - allocations) / operations;
+            result->operations = operations;
+            return;
+        }
+        operations *= 2;
+    }
+}
+
+static int bench_selected(const char *name, const char *filter)
+{
+    return filter == NULL || strncmp(name, filter, strlen(filter)) == 0;
+}
+
+static void bench_report(const char *name, const struct BenchResult *result)
+{
+    printf("{\"benchmark\":\"%s\",\"nsPerOp\":%.2f,\"allocationsPerOp\":%.2f,\"operations\":%zu}\n",
+           name, result->nsPerOp, result->allocationsPerOp, result->operations);
+    fflush(stdout);
+}
+
+// Sweeps one solver over the mean anomalies at the context's eccentricity, timing it and checking accuracy
+static void bench_kepler(const char *name, double (*solver)(double M, double e, int *iterations), BenchFunction function, struct BenchContext *context)
+{
+    unsigned long long iterations = 0;
+    unsigned long long failures = 0;
+    double worst = 0;
+
+    for (int i = 0; i < BENCH_ANOMALIES; i++)
+    {
+        int used;
+        double M = context->anomalies[i];
+        double E = solver(M, context->e, &used);
+        iterations += (unsigned long long) used;
+
+        if (isnan(E))
+            failures++;
+        else if (fabs(E - context->e * sin(E) - M) > worst)
+            worst = fabs(E - context->e * sin(E) - M);
+    }
+
+    struct BenchResult result;
+    bench_run(function, context, &result);
+    printf("{\"benchmark\":\"%s\",\"e\":%.2f,\"nsPerOp\":%.2f,\"allocationsPerOp\":%.2f,\"operations\":%zu,"
+           "\"meanIterations\":%.3f,\"failures\":%llu,\"maxResidual\":%.3e}\n",
+           name, context->e, result.nsPerOp, result.allocationsPerOp, result.operations,
+           (double) iterations / BENCH_ANOMALIES, failures, worst);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    json_set_alloc_funcs(bench_json_malloc, free);
+
+    struct BenchContext *context = calloc(1, sizeof(struct BenchContext));
+    if (!context)
+        return 1;
+
+    // Mean anomalies across many revolutions, both signs
+    for (int i = 0; i < BENCH_ANOMALIES; i++)
+        context->anomalies[i] = (2.0 * i / (BENCH_ANOMALIES - 1) - 1) * BENCH_REVOLUTIONS * 2 * PI + 0.37 * i;
+
+    static const double eccentricities[] = { 0.0, 0.1, 0.3, 0.5, 0.7, 0.9, 0.97, 0.99 };
+    for (size_t i = 0; i < sizeof(eccentricities) / sizeof(eccentricities[0]); i++)
+    {
+        context->e = eccentricities[i];
+        if (bench_selected("kepler_newton", filter))
+            bench_kepler("kepler_newton", solveKeplersEquationNewton, bench_kepler_newton, context);
+        if (bench_selected("kepler_halley", filter))
+            bench_kepler("kepler_halley", solveKeplersEquationHalley, bench_kepler_halley, context);
+    }
+
+    // A planet with every element set, as a request and as a computed result
+    context->planet = get_default_exoplanet();
+    context->planet.inclination = 89.7;
+    context->planet.longitudeOfNode = 12.5;
+    context->planet.argumentOfPeriapsis = 30.25;
+    orbitHandleInit(&context->orbit, &context->planet);
+
+    context->block = malloc(sizeof(struct OrbitBlock));
+    if (!context->block)
+        return 1;
+    for (size_t lane = 0; lane < ORBIT_BLOCK_SIZE; lane++)
+        orbitBlockSetLane(context->block, lane, context->anomalies[lane], 0.37, 2.774, context->orbit.rotation);
+
+    context->request = "{\"name\": \"Kepler-22 b\", \"mass\": 0.1, \"orbitalRadius\": 0.85, \"orbital_period\": 0.7, "
+                       "\"eccentricity\": 0.1, \"inclination\": 89.7, \"longitude_of_node\": 12, "
+                       "\"argument_of_periapsis\": 30, \"unixTime\": 1691592726}";
+    context->requestLength = strlen(context->request);
+
+    context->planets = malloc(sizeof(struct Exoplanet) * BENCH_OBJ_PLANETS);
+    if (!context->planets)
+        return 1;
+    for (int i = 0; i < BENCH_OBJ_PLANETS; i++)
+    {
+        context->planets[i] = context->planet;
+        context->planets[i].orbitalPeriod = 0.5 + i * 0.01;
+        calculateRaAndDistance(&context->planets[i], 1691592726.0);
+        setGalacticCoordinates(&context->planets[i]);
+    }
+
+    calculateRaAndDistance(&context->planet, 1691592726.0);
+    setGalacticCoordinates(&context->planet);
+
+    static const struct {
+        const char *name;
+        BenchFunction function;
+    } benchmarks[] = {
+        { "ra_and_distance", bench_ra_and_distance },
+        { "orbit_handle_evaluate", bench_orbit_handle },
+        { "orbit_block_lane", bench_orbit_block },
+        { "equatorial_to_galactic", bench_galactic },
+        { "json_parse", bench_json_parse },
+        { "json_serialize", bench_json_serialize },
+        { "codec_decode", bench_codec_decode },
+        { "codec_encode", bench_codec_encode },
+        { "obj_dots_1000", bench_obj_dots },
+        { "export_ply_1000", bench_export_ply },
+        { "export_glb_1000", bench_export_glb },
+    };
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (!bench_selected(benchmarks[i].name, filter))
+            continue;
+
+        struct BenchResult result;
+        bench_run(benchmarks[i].function, context, &result);
+        bench_report(benchmarks[i].name, &result);
+    }
+
+    if (bench_selected("orbit_block_lane", filter))
+        printf("{\"orbitBlockKernel\":\"%s\"}\n", orbitBlockKernelName());
+
+    free(context->block);
+    free(context->planets);
+    free(context);
+    return 0;
+}
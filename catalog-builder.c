@@ -0,0 +1,249 @@
+/*
+ * Converts a JSON or CSV planet dump into the binary catalog format read by exoplanet-finder
+ *
+ * Usage: catalog-builder [--shard INDEX/COUNT] <input.json|input.csv> <output.cat>
+ *
+ * JSON input is an array of exoplanet objects (or an object with a "planets" array) using the
+ * same keys as a request. CSV input starts with a header row naming the columns with those keys,
+ * e.g. name,mass,planetRadius,orbitalRadius,orbital_period,eccentricity,inclination,longitude_of_node,argument_of_periapsis
+ *
+ * With --shard only the planets that shard owns (see shard.c) are written, the catalog of one
+ * replica of a sharded deployment.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+#include "exoplanet.c"
+#include "exoplanetjson.c"
+#include "catalog.c"
+#include "shard.c"
+
+// Longest CSV line accepted
+#define CSV_LINE_LENGTH 4096
+
+// Reads planets from a JSON dump, names point into *root which the caller releases
+struct Exoplanet *read_json_planets(const char *path, json_t **root, size_t *count)
+{
+    json_error_t error;
+    *root = json_load_file(path, 0, &error);
+    if (!*root)
+    {
+        fprintf(stderr, "Error parsing %s line %d: %s\n", path, error.line, error.text);
+        return NULL;
+    }
+
+    json_t *planets_json = json_is_array(*root) ? *root : json_object_get(*root, "planets");
+    if (!json_is_array(planets_json))
+    {
+        fprintf(stderr, "%s must hold an array of planets or an object with a \"planets\" array\n", path);
+        return NULL;
+    }
+
+    *count = json_array_size(planets_json);
+    struct Exoplanet *planets = malloc(sizeof(struct Exoplanet) * (*count ? *count : 1));
+    if (!planets)
+        return NULL;
+
+    for (size_t i = 0; i < *count; i++)
+    {
+        planets[i] = get_default_exoplanet();
+        planets[i].name = NULL;
+
+        json_t *planet_json = json_array_get(planets_json, i);
+        if (json_is_object(planet_json))
+            exoplanet_from_json(planet_json, &planets[i]);
+    }
+
+    return planets;
+}
+
+// Splits a CSV line in place, handling double-quoted fields without embedded quotes
+int split_csv_line(char *line, char **fields, int max_fields)
+{
+    int count = 0;
+    char *c = line;
+
+    while (count < max_fields)
+    {
+        if (*c == '"')
+        {
+            fields[count++] = ++c;
+            while (*c && *c != '"')
+                c++;
+            if (*c == '"')
+                *c++ = '\0';
+        }
+        else
+        {
+            fields[count++] = c;
+        }
+
+        while (*c && *c != ',' && *c != '\n' && *c != '\r')
+            c++;
+        if (*c != ',')
+        {
+            *c = '\0';
+            break;
+        }
+        *c++ = '\0';
+    }
+
+    return count;
+}
+
+// Reads planets from a CSV dump, names are heap copies owned by the returned array
+struct Exoplanet *read_csv_planets(const char *path, size_t *count)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Error opening %s\n", path);
+        return NULL;
+    }
+
+    char line[CSV_LINE_LENGTH];
+    char *header_fields[32];
+    char header[CSV_LINE_LENGTH];
+
+    if (!fgets(header, sizeof(header), file))
+    {
+        fprintf(stderr, "%s is empty\n", path);
+        fclose(file);
+        return NULL;
+    }
+    int num_columns = split_csv_line(header, header_fields, 32);
+
+    size_t capacity = 1024;
+    struct Exoplanet *planets = malloc(sizeof(struct Exoplanet) * capacity);
+    *count = 0;
+
+    while (planets && fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '\n' || line[0] == '\r' || line[0] == '\0')
+            continue;
+
+        if (*count == capacity)
+        {
+            capacity *= 2;
+            struct Exoplanet *grown = realloc(planets, sizeof(struct Exoplanet) * capacity);
+            if (!grown)
+            {
+                free(planets);
+                planets = NULL;
+                break;
+            }
+            planets = grown;
+        }
+
+        char *fields[32];
+        int num_fields = split_csv_line(line, fields, 32);
+
+        struct Exoplanet planet = get_default_exoplanet();
+        planet.name = NULL;
+
+        for (int f = 0; f < num_fields && f < num_columns; f++)
+        {
+            const char *column = header_fields[f];
+            double value = strtod(fields[f], NULL);
+
+            if (strcmp(column, "name") == 0)
+                planet.name = strdup(fields[f]);
+            else if (strcmp(column, "mass") == 0)
+                planet.mass = value;
+            else if (strcmp(column, "planetRadius") == 0)
+                planet.planetRadius = value;
+            else if (strcmp(column, "orbitalRadius") == 0)
+                planet.orbitalRadius = value;
+            else if (strcmp(column, "orbital_period") == 0)
+                planet.orbitalPeriod = value;
+            else if (strcmp(column, "eccentricity") == 0)
+                planet.eccentricity = value;
+            else if (strcmp(column, "inclination") == 0)
+                planet.inclination = value;
+            else if (strcmp(column, "longitude_of_node") == 0)
+                planet.longitudeOfNode = value;
+            else if (strcmp(column, "argument_of_periapsis") == 0)
+                planet.argumentOfPeriapsis = value;
+        }
+
+        planets[(*count)++] = planet;
+    }
+
+    fclose(file);
+    return planets;
+}
+
+int main(int argc, char **argv)
+{
+    int shard_index = 0, shard_count = 1;
+    if (argc == 5 && strcmp(argv[1], "--shard") == 0)
+    {
+        if (shardParse(argv[2], &shard_index, &shard_count) != 0)
+        {
+            fprintf(stderr, "--shard takes INDEX/COUNT with INDEX below COUNT, e.g. 0/4, got '%s'\n", argv[2]);
+            return 1;
+        }
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s [--shard INDEX/COUNT] <input.json|input.csv> <output.cat>\n", argv[0]);
+        return 1;
+    }
+
+    const char *input = argv[1];
+    const char *output = argv[2];
+    size_t length = strlen(input);
+    int is_csv = length > 4 && strcmp(input + length - 4, ".csv") == 0;
+
+    json_t *root = NULL;
+    size_t count = 0;
+    struct Exoplanet *planets = is_csv ? read_csv_planets(input, &count) : read_json_planets(input, &root, &count);
+
+    if (!planets)
+    {
+        json_decref(root);
+        return 1;
+    }
+
+    // Keep the shard's own planets
+    if (shard_count > 1)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (shardOf(planets[i].name ? planets[i].name : "", shard_count) == shard_index)
+                planets[kept++] = planets[i];
+            else if (is_csv)
+                free((char *) planets[i].name);
+        }
+        printf("Shard %d/%d owns %zu of %zu planets\n", shard_index, shard_count, kept, count);
+        count = kept;
+    }
+
+    int ret_val = 0;
+    if (catalogWrite(output, planets, count) != 0)
+    {
+        fprintf(stderr, "Error writing catalog %s\n", output);
+        ret_val = 1;
+    }
+    else
+    {
+        printf("Wrote %zu planets to %s\n", count, output);
+    }
+
+    if (is_csv)
+    {
+        for (size_t i = 0; i < count; i++)
+            free((char *) planets[i].name);
+    }
+    free(planets);
+    json_decref(root);
+    return ret_val;
+}
@@ -0,0 +1,367 @@
+/*
+ * Binary planet catalog: fixed-size structure-of-arrays records with a hashed name index,
+ * written offline by catalog-builder and memory-mapped by the server at startup.
+ *
+ * File layout, all integers and doubles little-endian, every section 64-byte aligned:
+ *   struct CatalogHeader
+ *   CATALOG_COLUMNS columns of count doubles each (see enum CatalogColumn)
+ *   count names of CATALOG_NAME_LENGTH bytes, NUL padded
+ *   indexSlots uint32 name index slots holding record + 1, 0 for an empty slot
+ */
+
+#ifndef CATALOG_C
+#define CATALOG_C
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "exoplanet.c"
+#include "orbit.c"
+
+#define CATALOG_MAGIC "EXOCAT\0\0"
+#define CATALOG_VERSION 1
+#define CATALOG_BYTE_ORDER 0x01020304u
+
+// Bytes reserved per name, including the terminating NUL
+#define CATALOG_NAME_LENGTH 64
+
+// Largest catalog accepted, keeps offsets and the index comfortably within range
+#define CATALOG_MAX_PLANETS (16 * 1024 * 1024)
+
+enum CatalogColumn {
+    CATALOG_MASS,
+    CATALOG_PLANET_RADIUS,
+    CATALOG_ORBITAL_RADIUS,
+    CATALOG_ORBITAL_PERIOD,
+    CATALOG_ECCENTRICITY,
+    CATALOG_INCLINATION,
+    CATALOG_LONGITUDE_OF_NODE,
+    CATALOG_ARGUMENT_OF_PERIAPSIS,
+    CATALOG_COLUMNS
+};
+
+struct CatalogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;                     // CATALOG_BYTE_ORDER as written by the builder
+    uint32_t count;                         // Number of planets
+    uint32_t nameLength;                    // Bytes per name record
+    uint32_t indexSlots;                    // Power of two, at least twice count
+    uint32_t reserved;
+    uint64_t columnOffset[CATALOG_COLUMNS]; // File offset of each element column
+    uint64_t namesOffset;
+    uint64_t indexOffset;
+    uint64_t fileSize;
+};
+
+// A loaded catalog, columns point straight into the mapping
+struct Catalog {
+    void *mapping;
+    size_t mappingSize;
+    size_t count;
+    const double *columns[CATALOG_COLUMNS];
+    const char *names;
+    const uint32_t *index;
+    uint32_t indexSlots;
+
+    // Compiled orbits, computed once at load time
+    struct OrbitHandle *orbits;
+};
+
+// FNV-1a of a planet name, shared by the builder and the loader
+static uint32_t catalogNameHash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *) name; *c; c++)
+    {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint64_t catalogAlign(uint64_t offset)
+{
+    return (offset + 63) & ~(uint64_t) 63;
+}
+
+// Whether count records of size bytes starting at offset lie inside the file. Written with a
+// subtraction and a division so corrupt offsets or counts cannot wrap around past the check.
+static int catalogFits(uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize)
+{
+    return offset <= fileSize && count <= (fileSize - offset) / size;
+}
+
+static int catalogHostIsLittleEndian(void)
+{
+    uint32_t probe = 1;
+    unsigned char first;
+    memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+const char *catalogName(const struct Catalog *catalog, size_t i)
+{
+    return catalog->names + i * CATALOG_NAME_LENGTH;
+}
+
+// Returns the record number of the named planet or -1 if the catalog does not contain it
+long catalogFind(const struct Catalog *catalog, const char *name)
+{
+    if (catalog == NULL || catalog->count == 0)
+        return -1;
+
+    uint32_t mask = catalog->indexSlots - 1;
+    for (uint32_t slot = catalogNameHash(name) & mask, probes = 0; probes < catalog->indexSlots; slot = (slot + 1) & mask, probes++)
+    {
+        uint32_t entry = catalog->index[slot];
+        if (entry == 0)
+            return -1;
+        if (strcmp(catalogName(catalog, entry - 1), name) == 0)
+            return (long) entry - 1;
+    }
+    return -1;
+}
+
+// Fills the elements and name of record i into planet, other fields are left alone
+void catalogGetPlanet(const struct Catalog *catalog, size_t i, struct Exoplanet *planet)
+{
+    planet->name = catalogName(catalog, i);
+    planet->mass = catalog->columns[CATALOG_MASS][i];
+    planet->planetRadius = catalog->columns[CATALOG_PLANET_RADIUS][i];
+    planet->orbitalRadius = catalog->columns[CATALOG_ORBITAL_RADIUS][i];
+    planet->orbitalPeriod = catalog->columns[CATALOG_ORBITAL_PERIOD][i];
+    planet->eccentricity = catalog->columns[CATALOG_ECCENTRICITY][i];
+    planet->inclination = catalog->columns[CATALOG_INCLINATION][i];
+    planet->longitudeOfNode = catalog->columns[CATALOG_LONGITUDE_OF_NODE][i];
+    planet->argumentOfPeriapsis = catalog->columns[CATALOG_ARGUMENT_OF_PERIAPSIS][i];
+}
+
+// Returns the precompiled orbit of record i if planet still has exactly the catalog's elements,
+// NULL when the request overrode any of them
+const struct OrbitHandle *catalogOrbitFor(const struct Catalog *catalog, long i, const struct Exoplanet *planet)
+{
+    if (catalog == NULL || i < 0)
+        return NULL;
+
+    const struct OrbitHandle *orbit = &catalog->orbits[i];
+    if (orbit->orbitalRadius != planet->orbitalRadius || orbit->orbitalPeriod != planet->orbitalPeriod ||
+        orbit->eccentricity != planet->eccentricity || orbit->inclination != planet->inclination ||
+        orbit->longitudeOfNode != planet->longitudeOfNode || orbit->argumentOfPeriapsis != planet->argumentOfPeriapsis)
+        return NULL;
+
+    return orbit;
+}
+
+void catalogClose(struct Catalog *catalog)
+{
+    if (catalog->mapping)
+        munmap(catalog->mapping, catalog->mappingSize);
+    free(catalog->orbits);
+    memset(catalog, 0, sizeof(*catalog));
+}
+
+// Maps a catalog file and compiles the orbit of every planet, returns 0 on success.
+// On failure a message is printed to stderr and the catalog is left empty.
+int catalogOpen(const char *path, struct Catalog *catalog)
+{
+    memset(catalog, 0, sizeof(*catalog));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error opening catalog %s\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct CatalogHeader))
+    {
+        fprintf(stderr, "Catalog %s is too small\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Error mapping catalog %s\n", path);
+        return -1;
+    }
+
+    catalog->mapping = mapping;
+    catalog->mappingSize = (size_t) st.st_size;
+
+    struct CatalogHeader header;
+    memcpy(&header, mapping, sizeof(header));
+
+    // The columns are read in place, so only little-endian hosts can use the file
+    if (memcmp(header.magic, CATALOG_MAGIC, 8) != 0 || header.version != CATALOG_VERSION ||
+        header.byteOrder != CATALOG_BYTE_ORDER || !catalogHostIsLittleEndian())
+    {
+        fprintf(stderr, "Catalog %s has an unsupported format\n", path);
+        catalogClose(catalog);
+        return -1;
+    }
+
+    uint64_t count = header.count;
+    int valid = header.fileSize == catalog->mappingSize && header.nameLength == CATALOG_NAME_LENGTH &&
+                count <= CATALOG_MAX_PLANETS && header.indexSlots >= 2 * count && header.indexSlots > 0 &&
+                (header.indexSlots & (header.indexSlots - 1)) == 0;
+
+    for (int c = 0; valid && c < CATALOG_COLUMNS; c++)
+        valid = header.columnOffset[c] % 8 == 0 && catalogFits(header.columnOffset[c], count, sizeof(double), header.fileSize);
+
+    valid = valid && catalogFits(header.namesOffset, count, CATALOG_NAME_LENGTH, header.fileSize) &&
+            header.indexOffset % 4 == 0 && catalogFits(header.indexOffset, header.indexSlots, sizeof(uint32_t), header.fileSize);
+
+    if (!valid)
+    {
+        fprintf(stderr, "Catalog %s is corrupt\n", path);
+        catalogClose(catalog);
+        return -1;
+    }
+
+    const char *base = mapping;
+    catalog->count = count;
+    for (int c = 0; c < CATALOG_COLUMNS; c++)
+        catalog->columns[c] = (const double *) (base + header.columnOffset[c]);
+    catalog->names = base + header.namesOffset;
+    catalog->index = (const uint32_t *) (base + header.indexOffset);
+    catalog->indexSlots = header.indexSlots;
+
+    // Every name must be terminated inside its record and every index entry in range
+    for (size_t i = 0; i < count; i++)
+    {
+        if (memchr(catalogName(catalog, i), '\0', CATALOG_NAME_LENGTH) == NULL)
+            valid = 0;
+    }
+    for (uint32_t slot = 0; slot < catalog->indexSlots; slot++)
+    {
+        if (catalog->index[slot] > count)
+            valid = 0;
+    }
+
+    catalog->orbits = malloc(sizeof(struct OrbitHandle) * (count ? count : 1));
+    if (!valid || !catalog->orbits)
+    {
+        fprintf(stderr, "Catalog %s is corrupt\n", path);
+        catalogClose(catalog);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct Exoplanet planet = get_default_exoplanet();
+        catalogGetPlanet(catalog, i, &planet);
+        orbitHandleInit(&catalog->orbits[i], &planet);
+    }
+
+    return 0;
+}
+
+// Writes planets to path in catalog format, returns 0 on success.
+// Names longer than CATALOG_NAME_LENGTH - 1 bytes are rejected, duplicates keep the first record.
+int catalogWrite(const char *path, const struct Exoplanet *planets, size_t count)
+{
+    if (count > CATALOG_MAX_PLANETS || !catalogHostIsLittleEndian())
+        return -1;
+
+    uint32_t slots = 16;
+    while (slots < 2 * count)
+        slots *= 2;
+
+    struct CatalogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CATALOG_MAGIC, 8);
+    header.version = CATALOG_VERSION;
+    header.byteOrder = CATALOG_BYTE_ORDER;
+    header.count = (uint32_t) count;
+    header.nameLength = CATALOG_NAME_LENGTH;
+    header.indexSlots = slots;
+
+    uint64_t offset = catalogAlign(sizeof(header));
+    for (int c = 0; c < CATALOG_COLUMNS; c++)
+    {
+        header.columnOffset[c] = offset;
+        offset = catalogAlign(offset + count * sizeof(double));
+    }
+    header.namesOffset = offset;
+    offset = catalogAlign(offset + count * CATALOG_NAME_LENGTH);
+    header.indexOffset = offset;
+    header.fileSize = offset + (uint64_t) slots * sizeof(uint32_t);
+
+    char *image = calloc(1, header.fileSize);
+    if (!image)
+        return -1;
+
+    memcpy(image, &header, sizeof(header));
+
+    double *columns[CATALOG_COLUMNS];
+    for (int c = 0; c < CATALOG_COLUMNS; c++)
+        columns[c] = (double *) (image + header.columnOffset[c]);
+    char *names = image + header.namesOffset;
+    uint32_t *index = (uint32_t *) (image + header.indexOffset);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct Exoplanet *planet = &planets[i];
+        size_t name_length = planet->name ? strlen(planet->name) : 0;
+
+        if (name_length == 0 || name_length >= CATALOG_NAME_LENGTH)
+        {
+            fprintf(stderr, "Planet %zu has an empty name or one longer than %d bytes\n", i, CATALOG_NAME_LENGTH - 1);
+            free(image);
+            return -1;
+        }
+
+        columns[CATALOG_MASS][i] = planet->mass;
+        columns[CATALOG_PLANET_RADIUS][i] = planet->planetRadius;
+        columns[CATALOG_ORBITAL_RADIUS][i] = planet->orbitalRadius;
+        columns[CATALOG_ORBITAL_PERIOD][i] = planet->orbitalPeriod;
+        columns[CATALOG_ECCENTRICITY][i] = planet->eccentricity;
+        columns[CATALOG_INCLINATION][i] = planet->inclination;
+        columns[CATALOG_LONGITUDE_OF_NODE][i] = planet->longitudeOfNode;
+        columns[CATALOG_ARGUMENT_OF_PERIAPSIS][i] = planet->argumentOfPeriapsis;
+        memcpy(names + i * CATALOG_NAME_LENGTH, planet->name, name_length);
+
+        // Linear probing, the table is at most half full
+        uint32_t slot = catalogNameHash(planet->name) & (slots - 1);
+        int duplicate = 0;
+        while (index[slot] != 0)
+        {
+            if (strcmp(names + (index[slot] - 1) * (size_t) CATALOG_NAME_LENGTH, planet->name) == 0)
+            {
+                duplicate = 1;
+                break;
+            }
+            slot = (slot + 1) & (slots - 1);
+        }
+
+        if (duplicate)
+            fprintf(stderr, "Duplicate planet name '%s', keeping the first record\n", planet->name);
+        else
+            index[slot] = (uint32_t) i + 1;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        free(image);
+        return -1;
+    }
+
+    size_t written = fwrite(image, 1, header.fileSize, file);
+    int closed = fclose(file);
+    free(image);
+
+    return written == header.fileSize && closed == 0 ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,896 @@
+/*
+ * Sky searches over the catalog: every planet whose reported direction at an epoch falls within
+ * a cone, or within a box of longitude and latitude, in equatorial or galactic coordinates.
+ *
+ * Epochs are grouped into buckets. For each bucket the directions of all planets at the bucket's
+ * center are computed once, over the shared task pool with the vectorized orbit kernel, and put in
+ * two k-d trees over unit vectors, one per frame. Every planet carries a bound on how far its direction
+ * can drift within half a bucket, so a tree node can be skipped when even its fastest planet could
+ * not reach the cone. Only the planets that survive the tree are solved exactly at the requested
+ * epoch. The last few bucket indexes are kept, so searches near the same time share one build.
+ *
+ * A planet's direction always lies on the great circle of its orbital plane, so an equatorial cone
+ * that misses that circle cannot contain the planet at any epoch. Planets too fast to index and
+ * planets without a solution at the bucket's center go through this test and the exact solve.
+ * Galactic coordinates are derived from right ascension in radians read as degrees (see
+ * setGalacticCoordinates), which bends that circle, so galactic searches skip the test.
+ */
+
+#ifndef CONESEARCH_C
+#define CONESEARCH_C
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "astromath.c"
+#include "astromath_simd.c"
+#include "orbit.c"
+#include "catalog.c"
+#include "batch.c"
+#include "workerpool.c"
+
+// Bucket indexes kept, each takes about 40 bytes per planet
+#define CONE_INDEX_CACHE 4
+
+// Most points in a leaf of a k-d tree
+#define CONE_LEAF_SIZE 16
+
+// Planets whose direction can drift further than this (radians) within half a bucket are not indexed
+#define CONE_MAX_DRIFT DEG_TO_RAD(10.0)
+
+// Radians added to every bound, covers the float storage of the index and kernel rounding
+#define CONE_SLACK 1e-6
+
+// Galactic directions jump by up to 2 pi degrees when right ascension wraps around
+#define CONE_GALACTIC_WRAP DEG_TO_RAD(2 * PI)
+
+// Build tasks are only split off for this many planets each, up to the parallelism of worker_task_pool
+#define CONE_RECORDS_PER_TASK 4096
+#define CONE_MAX_BUILD_TASKS 64
+
+enum ConeFrame {
+    CONE_FRAME_EQUATORIAL,          // Right ascension and declination
+    CONE_FRAME_GALACTIC,            // Galactic longitude and latitude as reported
+    CONE_FRAMES
+};
+
+// Node of a k-d tree, children are only set on inner nodes (the root is never a child)
+struct ConeNode {
+    float lo[3];                    // Bounding box of the node's points
+    float hi[3];
+    float drift;                    // Largest drift of the node's points, radians
+    uint32_t begin;                 // Points [begin, end) in tree order
+    uint32_t end;
+    uint32_t left;
+    uint32_t right;
+};
+
+struct ConeTree {
+    float (*points)[3];             // Unit vectors at the bucket's center, in tree order
+    float *drift;                   // Radians, per point
+    uint32_t *records;              // Catalog record of each point
+    struct ConeNode *nodes;
+    size_t count;
+    size_t nodeCount;
+};
+
+// The index of one bucket of epochs
+struct ConeIndex {
+    long long bucket;
+    double epoch;                   // Center of the bucket, where the trees were built
+    struct ConeTree trees[CONE_FRAMES];
+    uint32_t *unindexed;            // Records that are checked one by one
+    size_t unindexedCount;
+    int references;
+    int state;                      // 0 while building, 1 when ready, -1 if the build failed
+    int cached;                     // Still held by the cache
+    unsigned long long lastUse;
+};
+
+struct ConeSearch {
+    const struct Catalog *catalog;
+    double bucketSeconds;
+    double *normals;                // Orbital plane normal per record, zero when the plane is degenerate
+    double *rates;                  // Fastest angular rate of the direction per record (radians per second), infinite if unbounded
+
+    pthread_mutex_t lock;
+    pthread_cond_t built;
+    struct ConeIndex *indexes[CONE_INDEX_CACHE];
+    unsigned long long clock;
+};
+
+// A search in one frame. Every match lies within radius of center, a box search also needs the
+// exact longitude and latitude ranges.
+struct ConeQuery {
+    enum ConeFrame frame;
+    double time;                    // Unix seconds
+    double center[3];               // Unit vector
+    double radius;                  // Radians
+    int box;
+    double lonMin, lonMax;          // Radians, the range wraps around when lonMin > lonMax
+    double latMin, latMax;          // Radians
+};
+
+struct ConeMatch {
+    uint32_t record;
+    double separation;              // Radians from the query's center
+    double distance;                // Light years
+    double ra;                      // Radians
+    double declination;             // Degrees
+    double galacticLongitude;       // Degrees
+    double galacticLatitude;        // Degrees
+};
+
+struct ConeSearchStats {
+    unsigned long long searches;
+    unsigned long long indexHits;           // Searches that found their bucket's index built
+    unsigned long long indexBuilds;
+    unsigned long long candidates;          // Planets solved exactly
+    unsigned long long matches;
+    size_t indexes;                         // Bucket indexes held
+};
+
+static struct ConeSearchStats cone_search_stats;
+
+static void coneUnitVector(double lon, double lat, double v[3])
+{
+    v[0] = cos(lat) * cos(lon);
+    v[1] = cos(lat) * sin(lon);
+    v[2] = sin(lat);
+}
+
+// Angle between two unit vectors, accurate for small and large angles alike
+static double coneAngle(const double a[3], const double b[3])
+{
+    double cx = a[1] * b[2] - a[2] * b[1];
+    double cy = a[2] * b[0] - a[0] * b[2];
+    double cz = a[0] * b[1] - a[1] * b[0];
+    return atan2(sqrt(cx * cx + cy * cy + cz * cz), a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+}
+
+// Squared chord length of an angle, capped at the antipode
+static double coneChord2(double angle)
+{
+    if (angle >= PI)
+        return 4.0;
+    double half = sin(angle / 2);
+    return 4 * half * half;
+}
+
+// Fastest angular rate of a planet's direction. In the orbital plane the direction of
+// (x_orbital, y_orbital) (see orbitHandlePositionAt) turns at n (1 - e^2) / ((1 + e^2 - 2e cos E)(1 - e cos E)),
+// largest at periapsis: n (1 + e) / (1 - e)^2. The rotation into the sky need not be orthogonal,
+// which can speed that up by the ratio of its singular values.
+static double coneDirectionRate(const struct OrbitHandle *orbit)
+{
+    double e = fabs(orbit->eccentricity);
+    double n = fabs(orbit->meanMotion);
+    if (!(e < 1) || !isfinite(n))
+        return INFINITY;
+
+    const double *r = orbit->rotation;
+    double pp = r[0] * r[0] + r[2] * r[2] + r[4] * r[4];
+    double qq = r[1] * r[1] + r[3] * r[3] + r[5] * r[5];
+    double pq = r[0] * r[1] + r[2] * r[3] + r[4] * r[5];
+
+    // Eigenvalues of the Gram matrix are the squared singular values, the smaller one is taken
+    // from the determinant to keep it accurate for nearly degenerate planes
+    double root = sqrt((pp - qq) * (pp - qq) + 4 * pq * pq);
+    double largest = (pp + qq + root) / 2;
+    double smallest = largest > 0 ? (pp * qq - pq * pq) / largest : 0;
+    if (!(smallest > 1e-12 * largest))
+        return INFINITY;
+
+    return sqrt(largest / smallest) * n * (1 + e) / ((1 - e) * (1 - e));
+}
+
+// Precomputes the orbital plane and fastest motion of every cataloged planet, epochs are indexed
+// in buckets of bucket_seconds. Returns -1 if memory could not be allocated.
+int coneSearchInit(struct ConeSearch *search, const struct Catalog *catalog, double bucket_seconds)
+{
+    memset(search, 0, sizeof(*search));
+    search->catalog = catalog;
+    search->bucketSeconds = bucket_seconds;
+
+    size_t count = catalog->count ? catalog->count : 1;
+    search->normals = malloc(sizeof(double) * 3 * count);
+    search->rates = malloc(sizeof(double) * count);
+    if (!search->normals || !search->rates)
+    {
+        free(search->normals);
+        free(search->rates);
+        search->catalog = NULL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < catalog->count; i++)
+    {
+        const struct OrbitHandle *orbit = &catalog->orbits[i];
+        const double *r = orbit->rotation;
+        double *normal = &search->normals[3 * i];
+
+        // Directions are combinations of the columns P = (r0, r2, r4) and Q = (r1, r3, r5)
+        normal[0] = r[2] * r[5] - r[4] * r[3];
+        normal[1] = r[4] * r[1] - r[0] * r[5];
+        normal[2] = r[0] * r[3] - r[2] * r[1];
+        double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        for (int k = 0; k < 3; k++)
+            normal[k] = length > 1e-12 && isfinite(length) ? normal[k] / length : 0;
+
+        search->rates[i] = coneDirectionRate(orbit);
+    }
+
+    pthread_mutex_init(&search->lock, NULL);
+    pthread_cond_init(&search->built, NULL);
+    return 0;
+}
+
+static void coneTreeFree(struct ConeTree *tree)
+{
+    free(tree->points);
+    free(tree->drift);
+    free(tree->records);
+    free(tree->nodes);
+    memset(tree, 0, sizeof(*tree));
+}
+
+static void coneIndexFree(struct ConeIndex *index)
+{
+    for (int frame = 0; frame < CONE_FRAMES; frame++)
+        coneTreeFree(&index->trees[frame]);
+    free(index->unindexed);
+    free(index);
+}
+
+// Moves the k-th smallest of order by the axis coordinate to position k, smaller ones before it
+static void coneSelect(uint32_t *order, size_t count, size_t k, const float (*points)[3], int axis)
+{
+    size_t lo = 0, hi = count - 1;
+    while (lo < hi)
+    {
+        // Partition [lo, hi] around the middle element, which ends up at store
+        size_t middle = lo + (hi - lo) / 2;
+        uint32_t swap = order[middle];
+        order[middle] = order[hi];
+        order[hi] = swap;
+
+        float pivot = points[order[hi]][axis];
+        size_t store = lo;
+        for (size_t i = lo; i < hi; i++)
+        {
+            if (points[order[i]][axis] < pivot)
+            {
+                swap = order[i];
+                order[i] = order[store];
+                order[store++] = swap;
+            }
+        }
+        swap = order[store];
+        order[store] = order[hi];
+        order[hi] = swap;
+
+        if (k == store)
+            return;
+        if (k < store)
+            hi = store - 1;
+        else
+            lo = store + 1;
+    }
+}
+
+// Builds the subtree over order[begin, end) into node, splitting at the median of its widest axis
+static void coneTreeBuildNode(struct ConeTree *tree, uint32_t node_index, uint32_t *order, uint32_t begin, uint32_t end,
+                              const float (*points)[3], const float *drift)
+{
+    struct ConeNode *node = &tree->nodes[node_index];
+    node->begin = begin;
+    node->end = end;
+    node->left = node->right = 0;
+    node->drift = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        node->lo[k] = INFINITY;
+        node->hi[k] = -INFINITY;
+    }
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const float *p = points[order[i]];
+        for (int k = 0; k < 3; k++)
+        {
+            node->lo[k] = p[k] < node->lo[k] ? p[k] : node->lo[k];
+            node->hi[k] = p[k] > node->hi[k] ? p[k] : node->hi[k];
+        }
+        node->drift = drift[order[i]] > node->drift ? drift[order[i]] : node->drift;
+    }
+
+    if (end - begin <= CONE_LEAF_SIZE)
+        return;
+
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+    {
+        if (node->hi[k] - node->lo[k] > node->hi[axis] - node->lo[axis])
+            axis = k;
+    }
+
+    uint32_t middle = begin + (end - begin) / 2;
+    coneSelect(order + begin, end - begin, middle - begin, points, axis);
+
+    uint32_t left = (uint32_t) tree->nodeCount++;
+    uint32_t right = (uint32_t) tree->nodeCount++;
+    node->left = left;
+    node->right = right;
+    coneTreeBuildNode(tree, left, order, begin, middle, points, drift);
+    coneTreeBuildNode(tree, right, order, middle, end, points, drift);
+}
+
+// Builds a tree over the given records, points and drift are indexed by record.
+// Returns -1 if memory could not be allocated.
+static int coneTreeBuild(struct ConeTree *tree, const uint32_t *records, size_t count, const float (*points)[3], const float *drift)
+{
+    memset(tree, 0, sizeof(*tree));
+    if (count == 0)
+        return 0;
+
+    // Leaves hold at least half of CONE_LEAF_SIZE points, so there are at most 2 count / CONE_LEAF_SIZE of them
+    size_t max_nodes = 4 * count / CONE_LEAF_SIZE + 2;
+    uint32_t *order = malloc(sizeof(uint32_t) * count);
+    tree->points = malloc(sizeof(float) * 3 * count);
+    tree->drift = malloc(sizeof(float) * count);
+    tree->nodes = malloc(sizeof(struct ConeNode) * max_nodes);
+    if (!order || !tree->points || !tree->drift || !tree->nodes)
+    {
+        free(order);
+        coneTreeFree(tree);
+        return -1;
+    }
+
+    memcpy(order, records, sizeof(uint32_t) * count);
+    tree->count = count;
+    tree->nodeCount = 1;
+    coneTreeBuildNode(tree, 0, order, 0, (uint32_t) count, points, drift);
+
+    // Store the points in tree order so a leaf is one contiguous run
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(tree->points[i], points[order[i]], sizeof(float) * 3);
+        tree->drift[i] = drift[order[i]];
+    }
+    tree->records = order;
+    return 0;
+}
+
+// Shared state of one index build
+struct ConeBuild {
+    const struct ConeSearch *search;
+    double epoch;
+    float (*points[CONE_FRAMES])[3];        // Indexed by record
+    float *drift[CONE_FRAMES];
+    unsigned char *indexed;
+};
+
+struct ConeBuildTask {
+    struct ConeBuild *build;
+    size_t begin;
+    size_t end;
+    int failed;
+
+    // Tree building pass, one task per frame
+    const uint32_t *records;
+    size_t count;
+    struct ConeTree *tree;
+    int frame;
+};
+
+// Computes the directions of records [begin, end) at the build's epoch, one orbit block at a time
+static void coneBuildEvaluate(void *arg)
+{
+    struct ConeBuildTask *task = arg;
+    struct ConeBuild *build = task->build;
+    const struct ConeSearch *search = build->search;
+    const struct OrbitHandle *orbits = search->catalog->orbits;
+    double half_bucket = search->bucketSeconds / 2;
+
+    struct OrbitBlock *block = malloc(sizeof(struct OrbitBlock));
+    if (!block)
+    {
+        task->failed = 1;
+        return;
+    }
+
+    uint32_t lane_record[ORBIT_BLOCK_SIZE];
+    size_t i = task->begin;
+    while (i < task->end)
+    {
+        size_t lanes = 0;
+        for (; i < task->end && lanes < ORBIT_BLOCK_SIZE; i++)
+        {
+            build->indexed[i] = 0;
+
+            // Fast planets would widen every node they land in, they are checked one by one instead
+            double drift = search->rates[i] * half_bucket;
+            if (!(drift <= CONE_MAX_DRIFT))
+                continue;
+
+            const struct OrbitHandle *orbit = &orbits[i];
+            orbitBlockSetLane(block, lanes, orbitHandleMeanAnomaly(orbit, build->epoch), orbit->eccentricity, orbit->orbitalRadius, orbit->rotation);
+            lane_record[lanes++] = (uint32_t) i;
+        }
+
+        if (lanes == 0)
+            continue;
+        computeOrbitBlock(block, lanes);
+
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            uint32_t record = lane_record[lane];
+            struct Exoplanet planet = get_default_exoplanet();
+            orbitBlockLanePosition(block, lane, &planet);
+
+            // Without a solution at the center there is nothing to place in the tree
+            if (isnan(planet.distance) || isnan(planet.ra))
+                continue;
+
+            double v[3];
+            float drift = (float) (search->rates[record] * half_bucket + CONE_SLACK);
+
+            coneUnitVector(planet.ra, DEG_TO_RAD(planet.declination), v);
+            for (int k = 0; k < 3; k++)
+                build->points[CONE_FRAME_EQUATORIAL][record][k] = (float) v[k];
+            build->drift[CONE_FRAME_EQUATORIAL][record] = drift;
+
+            coneUnitVector(DEG_TO_RAD(planet.galacticLongitude), DEG_TO_RAD(planet.galacticLatitude), v);
+            for (int k = 0; k < 3; k++)
+                build->points[CONE_FRAME_GALACTIC][record][k] = (float) v[k];
+            build->drift[CONE_FRAME_GALACTIC][record] = drift + (float) CONE_GALACTIC_WRAP;
+
+            build->indexed[record] = 1;
+        }
+    }
+
+    free(block);
+}
+
+static void coneBuildTree(void *arg)
+{
+    struct ConeBuildTask *task = arg;
+    struct ConeBuild *build = task->build;
+    task->failed = coneTreeBuild(task->tree, task->records, task->count,
+                                 (const float (*)[3]) build->points[task->frame], build->drift[task->frame]) != 0;
+}
+
+// Runs count tasks on the shared task pool and waits for them. Returns -1 if any task failed.
+static int coneRunTasks(struct ConeBuildTask *tasks, size_t count, void (*run)(void *))
+{
+    workerPoolRunTasks(&worker_task_pool, run, tasks, sizeof(tasks[0]), count);
+
+    int failed = 0;
+    for (size_t t = 0; t < count; t++)
+        failed |= tasks[t].failed;
+    return failed ? -1 : 0;
+}
+
+// Fills the trees and the unindexed records of index at its epoch. Returns -1 if memory could not be allocated.
+static int coneIndexBuild(const struct ConeSearch *search, struct ConeIndex *index)
+{
+    size_t count = search->catalog->count;
+    int ret_val = -1;
+
+    struct ConeBuild build;
+    memset(&build, 0, sizeof(build));
+    build.search = search;
+    build.epoch = index->epoch;
+    build.indexed = malloc(count ? count : 1);
+    uint32_t *records = malloc(sizeof(uint32_t) * (count ? count : 1));
+    index->unindexed = malloc(sizeof(uint32_t) * (count ? count : 1));
+    for (int frame = 0; frame < CONE_FRAMES; frame++)
+    {
+        build.points[frame] = malloc(sizeof(float) * 3 * (count ? count : 1));
+        build.drift[frame] = malloc(sizeof(float) * (count ? count : 1));
+    }
+
+    if (!build.indexed || !records || !index->unindexed || !build.points[CONE_FRAME_EQUATORIAL] || !build.points[CONE_FRAME_GALACTIC] ||
+        !build.drift[CONE_FRAME_EQUATORIAL] || !build.drift[CONE_FRAME_GALACTIC])
+        goto cleanup;
+
+    // Split the catalog into contiguous ranges, one per task the pool can run at once
+    size_t parallelism = (size_t) workerPoolParallelism(&worker_task_pool);
+    size_t task_count = (count + CONE_RECORDS_PER_TASK - 1) / CONE_RECORDS_PER_TASK;
+    if (task_count > parallelism)
+        task_count = parallelism;
+    if (task_count > CONE_MAX_BUILD_TASKS)
+        task_count = CONE_MAX_BUILD_TASKS;
+    if (task_count == 0)
+        task_count = 1;
+
+    struct ConeBuildTask tasks[CONE_MAX_BUILD_TASKS];
+    memset(tasks, 0, sizeof(tasks));
+    for (size_t t = 0; t < task_count; t++)
+    {
+        tasks[t].build = &build;
+        tasks[t].begin = count * t / task_count;
+        tasks[t].end = count * (t + 1) / task_count;
+    }
+    if (coneRunTasks(tasks, task_count, coneBuildEvaluate) != 0)
+        goto cleanup;
+
+    size_t indexed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (build.indexed[i])
+            records[indexed++] = (uint32_t) i;
+        else
+            index->unindexed[index->unindexedCount++] = (uint32_t) i;
+    }
+
+    // Both trees are built at once
+    memset(tasks, 0, sizeof(tasks));
+    for (int frame = 0; frame < CONE_FRAMES; frame++)
+    {
+        tasks[frame].build = &build;
+        tasks[frame].records = records;
+        tasks[frame].count = indexed;
+        tasks[frame].tree = &index->trees[frame];
+        tasks[frame].frame = frame;
+    }
+    if (coneRunTasks(tasks, CONE_FRAMES, coneBuildTree) != 0)
+        goto cleanup;
+
+    ret_val = 0;
+
+cleanup:
+    free(build.indexed);
+    free(records);
+    for (int frame = 0; frame < CONE_FRAMES; frame++)
+    {
+        free(build.points[frame]);
+        free(build.drift[frame]);
+    }
+    return ret_val;
+}
+
+// Returns the index of a bucket with a reference held, building it if no search has yet.
+// Concurrent searches in a bucket being built wait for that build. NULL if the build failed.
+static struct ConeIndex *coneAcquireIndex(struct ConeSearch *search, long long bucket)
+{
+    pthread_mutex_lock(&search->lock);
+
+    for (;;)
+    {
+        struct ConeIndex *found = NULL;
+        for (int i = 0; i < CONE_INDEX_CACHE; i++)
+        {
+            if (search->indexes[i] && search->indexes[i]->bucket == bucket)
+                found = search->indexes[i];
+        }
+        if (!found)
+            break;
+
+        if (found->state == 0)
+        {
+            pthread_cond_wait(&search->built, &search->lock);
+            continue;
+        }
+
+        found->references++;
+        found->lastUse = ++search->clock;
+        pthread_mutex_unlock(&search->lock);
+        __atomic_fetch_add(&cone_search_stats.indexHits, 1, __ATOMIC_RELAXED);
+        return found;
+    }
+
+    struct ConeIndex *index = calloc(1, sizeof(struct ConeIndex));
+    if (!index)
+    {
+        pthread_mutex_unlock(&search->lock);
+        return NULL;
+    }
+    index->bucket = bucket;
+    index->epoch = ((double) bucket + 0.5) * search->bucketSeconds;
+    index->references = 1;
+    index->lastUse = ++search->clock;
+
+    // Take a free slot or evict the least recently used index nobody holds, if every index is in
+    // use this one is built for this search alone
+    int slot = -1;
+    for (int i = 0; i < CONE_INDEX_CACHE; i++)
+    {
+        struct ConeIndex *entry = search->indexes[i];
+        if (entry == NULL)
+        {
+            slot = i;
+            break;
+        }
+        if (entry->references == 0 && (slot < 0 || entry->lastUse < search->indexes[slot]->lastUse))
+            slot = i;
+    }
+    if (slot >= 0)
+    {
+        if (search->indexes[slot])
+            coneIndexFree(search->indexes[slot]);
+        search->indexes[slot] = index;
+        index->cached = 1;
+    }
+    pthread_mutex_unlock(&search->lock);
+
+    int status = coneIndexBuild(search, index);
+    __atomic_fetch_add(&cone_search_stats.indexBuilds, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&search->lock);
+    index->state = status == 0 ? 1 : -1;
+    if (status != 0 && index->cached)
+    {
+        search->indexes[slot] = NULL;
+        index->cached = 0;
+    }
+    pthread_cond_broadcast(&search->built);
+    pthread_mutex_unlock(&search->lock);
+
+    if (status != 0)
+    {
+        coneIndexFree(index);
+        return NULL;
+    }
+    return index;
+}
+
+static void coneReleaseIndex(struct ConeSearch *search, struct ConeIndex *index)
+{
+    pthread_mutex_lock(&search->lock);
+    int unused = --index->references == 0 && !index->cached;
+    pthread_mutex_unlock(&search->lock);
+
+    if (unused)
+        coneIndexFree(index);
+}
+
+// Growable list of matches
+struct ConeResults {
+    struct ConeMatch *matches;
+    size_t count;
+    size_t capacity;
+    unsigned long long candidates;
+    int failed;
+};
+
+// Whether the orbital plane of a record can meet the cone of an equatorial query at all
+static int coneFootprintMeets(const struct ConeSearch *search, const struct ConeQuery *query, uint32_t record)
+{
+    if (query->frame != CONE_FRAME_EQUATORIAL || query->radius + CONE_SLACK >= PI / 2)
+        return 1;
+
+    const double *normal = &search->normals[3 * record];
+    double height = normal[0] * query->center[0] + normal[1] * query->center[1] + normal[2] * query->center[2];
+    return fabs(height) <= sin(query->radius + CONE_SLACK);
+}
+
+// Solves a candidate at the query's epoch and keeps it if it matches
+static void coneCheck(const struct ConeSearch *search, const struct ConeQuery *query, uint32_t record, struct ConeResults *results)
+{
+    results->candidates++;
+
+    struct Exoplanet planet = get_default_exoplanet();
+    orbitHandleEvaluate(&search->catalog->orbits[record], query->time, &planet);
+    if (isnan(planet.distance) || isnan(planet.ra))
+        return;
+    setGalacticCoordinates(&planet);
+
+    double lon, lat;
+    if (query->frame == CONE_FRAME_EQUATORIAL)
+    {
+        lon = planet.ra;
+        lat = DEG_TO_RAD(planet.declination);
+    }
+    else
+    {
+        lon = DEG_TO_RAD(planet.galacticLongitude);
+        lat = DEG_TO_RAD(planet.galacticLatitude);
+    }
+
+    double v[3];
+    coneUnitVector(lon, lat, v);
+    double separation = coneAngle(query->center, v);
+
+    if (query->box)
+    {
+        int in_longitude = query->lonMin <= query->lonMax ? lon >= query->lonMin && lon <= query->lonMax
+                                                          : lon >= query->lonMin || lon <= query->lonMax;
+        if (!in_longitude || lat < query->latMin || lat > query->latMax)
+            return;
+    }
+    else if (separation > query->radius)
+        return;
+
+    if (results->count == results->capacity)
+    {
+        size_t capacity = results->capacity ? results->capacity * 2 : 64;
+        struct ConeMatch *grown = realloc(results->matches, sizeof(struct ConeMatch) * capacity);
+        if (!grown)
+        {
+            results->failed = 1;
+            return;
+        }
+        results->matches = grown;
+        results->capacity = capacity;
+    }
+
+    struct ConeMatch *match = &results->matches[results->count++];
+    match->record = record;
+    match->separation = separation;
+    match->distance = planet.distance;
+    match->ra = planet.ra;
+    match->declination = planet.declination;
+    match->galacticLongitude = planet.galacticLongitude;
+    match->galacticLatitude = planet.galacticLatitude;
+}
+
+// Walks a tree, checking every point whose drift could bring it into the cone
+static void coneSearchTree(const struct ConeSearch *search, const struct ConeQuery *query, const struct ConeTree *tree, struct ConeResults *results)
+{
+    if (tree->count == 0)
+        return;
+
+    const double *c = query->center;
+    uint32_t stack[128];
+    int depth = 0;
+    stack[depth++] = 0;
+
+    while (depth > 0 && !results->failed)
+    {
+        const struct ConeNode *node = &tree->nodes[stack[--depth]];
+
+        // Distance from the center to the node's box, against the chord of the widest reach
+        double d2 = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            double gap = c[k] < node->lo[k] ? node->lo[k] - c[k] : c[k] > node->hi[k] ? c[k] - node->hi[k] : 0;
+            d2 += gap * gap;
+        }
+        if (d2 > coneChord2(query->radius + node->drift + CONE_SLACK))
+            continue;
+
+        if (node->left)
+        {
+            stack[depth++] = node->left;
+            stack[depth++] = node->right;
+            continue;
+        }
+
+        for (uint32_t i = node->begin; i < node->end; i++)
+        {
+            const float *p = tree->points[i];
+            double dx = p[0] - c[0], dy = p[1] - c[1], dz = p[2] - c[2];
+            if (dx * dx + dy * dy + dz * dz > coneChord2(query->radius + tree->drift[i] + CONE_SLACK))
+                continue;
+            if (coneFootprintMeets(search, query, tree->records[i]))
+                coneCheck(search, query, tree->records[i], results);
+        }
+    }
+}
+
+// Finds the cataloged planets matching query, in no particular order. On success *matches holds
+// *count matches and must be freed. Returns -1 if memory could not be allocated.
+int coneSearchRun(struct ConeSearch *search, const struct ConeQuery *query, struct ConeMatch **matches, size_t *count)
+{
+    struct ConeResults results;
+    memset(&results, 0, sizeof(results));
+
+    struct ConeIndex *index = coneAcquireIndex(search, (long long) floor(query->time / search->bucketSeconds));
+    if (!index)
+        return -1;
+
+    coneSearchTree(search, query, &index->trees[query->frame], &results);
+    for (size_t i = 0; i < index->unindexedCount && !results.failed; i++)
+    {
+        if (coneFootprintMeets(search, query, index->unindexed[i]))
+            coneCheck(search, query, index->unindexed[i], &results);
+    }
+
+    coneReleaseIndex(search, index);
+
+    __atomic_fetch_add(&cone_search_stats.searches, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cone_search_stats.candidates, results.candidates, __ATOMIC_RELAXED);
+    if (results.failed)
+    {
+        free(results.matches);
+        return -1;
+    }
+    __atomic_fetch_add(&cone_search_stats.matches, results.count, __ATOMIC_RELAXED);
+
+    *matches = results.matches;
+    *count = results.count;
+    return 0;
+}
+
+// Sets up a cone of radius (radians) around lon, lat (radians) in frame. Returns -1 for a
+// non-finite center or a radius outside [0, pi].
+int coneQueryCone(struct ConeQuery *query, enum ConeFrame frame, double time, double lon, double lat, double radius)
+{
+    memset(query, 0, sizeof(*query));
+    if (!isfinite(lon) || !(lat >= -PI / 2 && lat <= PI / 2) || !(radius >= 0 && radius <= PI))
+        return -1;
+
+    query->frame = frame;
+    query->time = time;
+    query->radius = radius;
+    coneUnitVector(lon, lat, query->center);
+    return 0;
+}
+
+// Sets up a box of longitudes [lon_min, lon_max] (radians, wrapping around when lon_min > lon_max)
+// and latitudes [lat_min, lat_max] in frame, searched through the smallest cone around its center
+// that holds the whole box. Returns -1 for invalid ranges.
+int coneQueryBox(struct ConeQuery *query, enum ConeFrame frame, double time, double lon_min, double lon_max, double lat_min, double lat_max)
+{
+    memset(query, 0, sizeof(*query));
+    if (!(lon_min >= 0 && lon_min <= 2 * PI) || !(lon_max >= 0 && lon_max <= 2 * PI) ||
+        !(lat_min >= -PI / 2 && lat_min <= lat_max && lat_max <= PI / 2))
+        return -1;
+
+    double width = lon_min <= lon_max ? lon_max - lon_min : lon_max + 2 * PI - lon_min;
+    double lon = lon_min + width / 2;
+    double lat = (lat_min + lat_max) / 2;
+
+    query->frame = frame;
+    query->time = time;
+    query->box = 1;
+    query->lonMin = lon_min;
+    query->lonMax = lon_max;
+    query->latMin = lat_min;
+    query->latMax = lat_max;
+    coneUnitVector(lon, lat, query->center);
+
+    if (width >= 2 * PI)
+    {
+        query->radius = PI;
+        return 0;
+    }
+
+    // At every latitude the farthest longitude of the box is one of its meridian edges, width / 2
+    // from the center. Along an edge the cosine of the angle to the center is
+    // sin(lat) sin(phi) + cos(lat) cos(width / 2) cos(phi), smallest at the corners or, once the box
+    // is wider than pi and cos(width / 2) turns negative, possibly at a latitude between them.
+    double extremes[3][2] = { { lon_min, lat_min }, { lon_min, lat_max }, { lon_min, NAN } };
+    int count = 2;
+    if (width > PI)
+    {
+        double phi = atan2(-sin(lat), -cos(lat) * cos(width / 2));
+        if (phi > lat_min && phi < lat_max)
+            extremes[count++][1] = phi;
+    }
+
+    // Both edges are width / 2 from the center, so lon_min stands for lon_max as well
+    for (int i = 0; i < count; i++)
+    {
+        double v[3];
+        coneUnitVector(extremes[i][0], extremes[i][1], v);
+        double angle = coneAngle(query->center, v);
+        query->radius = angle > query->radius ? angle : query->radius;
+    }
+    return 0;
+}
+
+void coneSearchStatsSnapshot(struct ConeSearch *search, struct ConeSearchStats *stats)
+{
+    stats->searches = __atomic_load_n(&cone_search_stats.searches, __ATOMIC_RELAXED);
+    stats->indexHits = __atomic_load_n(&cone_search_stats.indexHits, __ATOMIC_RELAXED);
+    stats->indexBuilds = __atomic_load_n(&cone_search_stats.indexBuilds, __ATOMIC_RELAXED);
+    stats->candidates = __atomic_load_n(&cone_search_stats.candidates, __ATOMIC_RELAXED);
+    stats->matches = __atomic_load_n(&cone_search_stats.matches, __ATOMIC_RELAXED);
+    stats->indexes = 0;
+
+    if (search->catalog == NULL)
+        return;
+    pthread_mutex_lock(&search->lock);
+    for (int i = 0; i < CONE_INDEX_CACHE; i++)
+    {
+        if (search->indexes[i] && search->indexes[i]->state == 1)
+            stats->indexes++;
+    }
+    pthread_mutex_unlock(&search->lock);
+}
+
+#endif
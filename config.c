@@ -0,0 +1,199 @@
+/*
+ * Server configuration read from environment variables at startup
+ */
+
+#ifndef CONFIG_C
+#define CONFIG_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "astromath.c"
+#include "shard.c"
+
+enum ServerMode {
+    SERVER_MODE_THREADS,            // a worker thread per session, blocking reads
+    SERVER_MODE_EVENT               // event loops multiplexing non-blocking sessions, see eventserver.c
+};
+
+struct ServerConfig {
+    const char *catalogPath;        // EXOPLANET_CATALOG, NULL when no catalog is loaded
+    const char *ephemerisPath;      // EXOPLANET_EPHEMERIS, Chebyshev tables for cataloged planets, NULL when unused
+    enum KeplerSolver solver;       // EXOPLANET_KEPLER_SOLVER
+    int workers;                    // EXOPLANET_WORKERS, session worker threads
+    int queueCapacity;              // EXOPLANET_QUEUE_CAPACITY, accepted sessions waiting for a worker
+    int queueBlock;                 // EXOPLANET_QUEUE_POLICY, 1 for "block" (backpressure), 0 for "reject"
+    enum ServerMode mode;           // EXOPLANET_SERVER_MODE
+    int eventLoops;                 // EXOPLANET_EVENT_LOOPS, event mode only
+    int computeWorkers;             // EXOPLANET_COMPUTE_WORKERS, event mode and socket transport
+    int tcpPort;                    // EXOPLANET_TCP_PORT, newline-delimited JSON over TCP, 0 when disabled
+    const char *unixSocket;         // EXOPLANET_UNIX_SOCKET, newline-delimited JSON over a Unix socket, NULL when disabled
+    int fastCodec;                  // EXOPLANET_JSON_CODEC, 1 for "fast" (exoplanetcodec.c), 0 for "jansson" only
+    int resultCacheEntries;         // EXOPLANET_RESULT_CACHE_ENTRIES, computed positions kept, 0 disables the cache
+    int resultCacheQuantumMs;       // EXOPLANET_RESULT_CACHE_QUANTUM_MS, epochs are rounded down to this, 0 for exact
+    int metricsPort;                // EXOPLANET_METRICS_PORT, Prometheus endpoint, 0 disables instrumentation
+    int coneBucketSeconds;          // EXOPLANET_CONE_BUCKET_SECONDS, epochs sharing one sky search index
+    int taskWorkers;                // EXOPLANET_TASK_WORKERS, threads of worker_task_pool next to the requesting one
+    int sceneEpochSeconds;          // EXOPLANET_SCENE_EPOCH_SECONDS, scenes are computed at epochs rounded down to this
+    int processes;                  // EXOPLANET_PROCESSES, worker processes of prefork mode, 1 serves from this process
+    int pinProcesses;               // EXOPLANET_PIN_PROCESSES, 1 pins each worker process to a core
+    int drainSeconds;               // EXOPLANET_DRAIN_SECONDS, time sessions get to finish after SIGTERM
+    int readTimeoutMs;              // EXOPLANET_READ_TIMEOUT_MS, time a request may take to arrive, 0 for none
+    int handshakeTimeoutMs;         // EXOPLANET_HANDSHAKE_TIMEOUT_MS, time the SSH key exchange may take, 0 for none
+    int requestTimeoutMs;           // EXOPLANET_REQUEST_TIMEOUT_MS, time to answer a received request, 0 for none
+    int maxInFlight;                // EXOPLANET_MAX_IN_FLIGHT, requests computed at once before load is shed, 0 for no limit
+    int maxQueueMs;                 // EXOPLANET_MAX_QUEUE_MS, time work may wait for a worker before it is shed, 0 for no limit
+    int sshPort;                    // EXOPLANET_SSH_PORT
+    int shardIndex;                 // EXOPLANET_SHARD, "index/count": the planets this replica owns, see shard.c
+    int shardCount;                 // 1 when the catalog is not sharded
+};
+
+// Reads an integer setting, leaving *value at its default when the variable is unset.
+// Returns -1 (after printing why) when the value is not an integer within [min, max].
+static int configInt(const char *name, int min, int max, int *value)
+{
+    const char *text = getenv(name);
+    if (text == NULL)
+        return 0;
+
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || parsed < min || parsed > max)
+    {
+        fprintf(stderr, "%s must be an integer between %d and %d, got '%s'\n", name, min, max, text);
+        return -1;
+    }
+
+    *value = (int) parsed;
+    return 0;
+}
+
+// Fills config from the environment, returns 0 on success or -1 if any setting is invalid
+int loadServerConfig(struct ServerConfig *config)
+{
+    config->catalogPath = getenv("EXOPLANET_CATALOG");
+    config->ephemerisPath = getenv("EXOPLANET_EPHEMERIS");
+    config->solver = KEPLER_SOLVER_NEWTON;
+    config->workers = 64;
+    config->queueCapacity = 256;
+    config->queueBlock = 0;
+    config->mode = SERVER_MODE_THREADS;
+    config->tcpPort = 0;
+    config->unixSocket = getenv("EXOPLANET_UNIX_SOCKET");
+    config->fastCodec = 1;
+    config->resultCacheEntries = 65536;
+    config->resultCacheQuantumMs = 0;
+    config->metricsPort = 0;
+    config->coneBucketSeconds = 3600;
+    config->sceneEpochSeconds = 60;
+    config->processes = 1;
+    config->pinProcesses = 1;
+    config->drainSeconds = 25;
+    config->readTimeoutMs = 0;
+    config->handshakeTimeoutMs = 10000;
+    config->requestTimeoutMs = 0;
+    config->maxInFlight = 0;
+    config->maxQueueMs = 0;
+    config->sshPort = 2222;
+    config->shardIndex = 0;
+    config->shardCount = 1;
+
+    // Event mode defaults to one loop and one compute worker per core
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    config->eventLoops = cores > 0 ? (int) cores : 1;
+    config->computeWorkers = config->eventLoops;
+    config->taskWorkers = config->eventLoops;
+
+    // Select the Kepler solver, the Newton solver is the default
+    const char *solver_name = getenv("EXOPLANET_KEPLER_SOLVER");
+    if (solver_name && parseKeplerSolver(solver_name, &config->solver) != 0)
+    {
+        fprintf(stderr, "Unknown Kepler solver '%s', expected newton or halley\n", solver_name);
+        return -1;
+    }
+
+    if (configInt("EXOPLANET_WORKERS", 1, 4096, &config->workers) != 0 ||
+        configInt("EXOPLANET_QUEUE_CAPACITY", 1, 1 << 20, &config->queueCapacity) != 0 ||
+        configInt("EXOPLANET_EVENT_LOOPS", 1, 1024, &config->eventLoops) != 0 ||
+        configInt("EXOPLANET_COMPUTE_WORKERS", 1, 4096, &config->computeWorkers) != 0 ||
+        configInt("EXOPLANET_TCP_PORT", 0, 65535, &config->tcpPort) != 0 ||
+        configInt("EXOPLANET_RESULT_CACHE_ENTRIES", 0, 1 << 24, &config->resultCacheEntries) != 0 ||
+        configInt("EXOPLANET_RESULT_CACHE_QUANTUM_MS", 0, 24 * 60 * 60 * 1000, &config->resultCacheQuantumMs) != 0 ||
+        configInt("EXOPLANET_METRICS_PORT", 0, 65535, &config->metricsPort) != 0 ||
+        configInt("EXOPLANET_CONE_BUCKET_SECONDS", 1, 7 * 24 * 60 * 60, &config->coneBucketSeconds) != 0 ||
+        configInt("EXOPLANET_TASK_WORKERS", 1, 4096, &config->taskWorkers) != 0 ||
+        configInt("EXOPLANET_SCENE_EPOCH_SECONDS", 1, 24 * 60 * 60, &config->sceneEpochSeconds) != 0 ||
+        configInt("EXOPLANET_PROCESSES", 1, 1024, &config->processes) != 0 ||
+        configInt("EXOPLANET_PIN_PROCESSES", 0, 1, &config->pinProcesses) != 0 ||
+        configInt("EXOPLANET_DRAIN_SECONDS", 0, 60 * 60, &config->drainSeconds) != 0 ||
+        configInt("EXOPLANET_READ_TIMEOUT_MS", 0, 24 * 60 * 60 * 1000, &config->readTimeoutMs) != 0 ||
+        configInt("EXOPLANET_HANDSHAKE_TIMEOUT_MS", 0, 24 * 60 * 60 * 1000, &config->handshakeTimeoutMs) != 0 ||
+        configInt("EXOPLANET_REQUEST_TIMEOUT_MS", 0, 24 * 60 * 60 * 1000, &config->requestTimeoutMs) != 0 ||
+        configInt("EXOPLANET_MAX_IN_FLIGHT", 0, 1 << 20, &config->maxInFlight) != 0 ||
+        configInt("EXOPLANET_MAX_QUEUE_MS", 0, 24 * 60 * 60 * 1000, &config->maxQueueMs) != 0 ||
+        configInt("EXOPLANET_SSH_PORT", 1, 65535, &config->sshPort) != 0)
+        return -1;
+
+    const char *mode = getenv("EXOPLANET_SERVER_MODE");
+    if (mode)
+    {
+        if (strcmp(mode, "event") == 0)
+            config->mode = SERVER_MODE_EVENT;
+        else if (strcmp(mode, "threads") == 0)
+            config->mode = SERVER_MODE_THREADS;
+        else
+        {
+            fprintf(stderr, "Unknown server mode '%s', expected threads or event\n", mode);
+            return -1;
+        }
+    }
+
+    const char *codec = getenv("EXOPLANET_JSON_CODEC");
+    if (codec)
+    {
+        if (strcmp(codec, "fast") == 0)
+            config->fastCodec = 1;
+        else if (strcmp(codec, "jansson") == 0)
+            config->fastCodec = 0;
+        else
+        {
+            fprintf(stderr, "Unknown JSON codec '%s', expected fast or jansson\n", codec);
+            return -1;
+        }
+    }
+
+    const char *shard = getenv("EXOPLANET_SHARD");
+    if (shard && shardParse(shard, &config->shardIndex, &config->shardCount) != 0)
+    {
+        fprintf(stderr, "EXOPLANET_SHARD must be INDEX/COUNT with INDEX below COUNT (at most %d), got '%s'\n", SHARD_MAX, shard);
+        return -1;
+    }
+
+    const char *policy = getenv("EXOPLANET_QUEUE_POLICY");
+    if (policy)
+    {
+        if (strcmp(policy, "block") == 0)
+            config->queueBlock = 1;
+        else if (strcmp(policy, "reject") == 0)
+            config->queueBlock = 0;
+        else
+        {
+            fprintf(stderr, "Unknown queue policy '%s', expected reject or block\n", policy);
+            return -1;
+        }
+    }
+
+    // Tables are matched to catalog records, so they are of no use without a catalog
+    if (config->ephemerisPath && !config->catalogPath)
+    {
+        fprintf(stderr, "EXOPLANET_EPHEMERIS needs EXOPLANET_CATALOG\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Fits Chebyshev ephemeris tables for the planets of a binary catalog, read by exoplanet-finder
+ * through EXOPLANET_EPHEMERIS
+ *
+ * Usage: ephemeris-builder <catalog.cat> <output.eph> [options]
+ *   --planets FILE               only tabulate the planets named in FILE, one name per line
+ *   --start UNIX, --stop UNIX    span of epochs to cover (2000-01-01 to 2100-01-01)
+ *   --degree N                   polynomial degree per segment (12)
+ *   --segments N                 segments per planet to start from, doubled until the fit holds (16)
+ *   --angle-tolerance DEG        largest error of ra, declination and galactic l/b in degrees (1e-7)
+ *   --distance-tolerance REL     largest relative error of the distance (1e-9)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "exoplanet.c"
+#include "catalog.c"
+#include "ephemeris.c"
+
+// Longest line of a planet list accepted
+#define PLANET_LINE_LENGTH 256
+
+// Reads the catalog records named in a planet list, one name per line, into planets
+struct Exoplanet *read_planet_list(const char *path, const struct Catalog *catalog, size_t *count)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Error opening %s\n", path);
+        return NULL;
+    }
+
+    size_t capacity = 64;
+    struct Exoplanet *planets = malloc(sizeof(struct Exoplanet) * capacity);
+    char line[PLANET_LINE_LENGTH];
+    *count = 0;
+
+    while (planets && fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+
+        long record = catalogFind(catalog, line);
+        if (record < 0)
+        {
+            fprintf(stderr, "Planet '%s' is not in the catalog, skipping it\n", line);
+            continue;
+        }
+
+        if (*count == capacity)
+        {
+            capacity *= 2;
+            struct Exoplanet *grown = realloc(planets, sizeof(struct Exoplanet) * capacity);
+            if (!grown)
+            {
+                free(planets);
+                planets = NULL;
+                break;
+            }
+            planets = grown;
+        }
+
+        // Names point into the mapped catalog, which stays open until the tables are written
+        struct Exoplanet planet = get_default_exoplanet();
+        catalogGetPlanet(catalog, (size_t) record, &planet);
+        planets[(*count)++] = planet;
+    }
+
+    fclose(file);
+    return planets;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argc % 2 == 0)
+    {
+        fprintf(stderr, "Usage: %s <catalog.cat> <output.eph> [--planets FILE] [--start UNIX] [--stop UNIX] [--degree N]\n"
+                        "       [--segments N] [--angle-tolerance DEG] [--distance-tolerance REL]\n", argv[0]);
+        return 1;
+    }
+
+    const char *input = argv[1];
+    const char *output = argv[2];
+    const char *planet_list = NULL;
+
+    struct EphemerisFitOptions options;
+    options.start = 946684800;          // 2000-01-01
+    options.stop = 4102444800;          // 2100-01-01
+    options.degree = 12;
+    options.segments = 16;
+    options.angleTolerance = 1e-7;
+    options.distanceTolerance = 1e-9;
+
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        const char *value = argv[i + 1];
+        if (strcmp(argv[i], "--planets") == 0)
+            planet_list = value;
+        else if (strcmp(argv[i], "--start") == 0)
+            options.start = atof(value);
+        else if (strcmp(argv[i], "--stop") == 0)
+            options.stop = atof(value);
+        else if (strcmp(argv[i], "--degree") == 0)
+            options.degree = atoi(value);
+        else if (strcmp(argv[i], "--segments") == 0)
+            options.segments = atoi(value);
+        else if (strcmp(argv[i], "--angle-tolerance") == 0)
+            options.angleTolerance = atof(value);
+        else if (strcmp(argv[i], "--distance-tolerance") == 0)
+            options.distanceTolerance = atof(value);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (options.degree < 0 || options.degree > EPHEMERIS_MAX_DEGREE || options.segments < 1 ||
+        options.segments > EPHEMERIS_MAX_SEGMENTS || !(options.stop > options.start))
+    {
+        fprintf(stderr, "The degree must be between 0 and %d, the segments between 1 and %d, and the span must not be empty\n",
+                EPHEMERIS_MAX_DEGREE, EPHEMERIS_MAX_SEGMENTS);
+        return 1;
+    }
+
+    struct Catalog catalog;
+    if (catalogOpen(input, &catalog) != 0)
+        return 1;
+
+    size_t count = 0;
+    struct Exoplanet *planets;
+    if (planet_list)
+        planets = read_planet_list(planet_list, &catalog, &count);
+    else
+    {
+        // Every record a name leads to, later records with a duplicate name are unreachable
+        planets = malloc(sizeof(struct Exoplanet) * (catalog.count ? catalog.count : 1));
+        for (size_t i = 0; planets && i < catalog.count; i++)
+        {
+            if (catalogFind(&catalog, catalogName(&catalog, i)) != (long) i)
+                continue;
+            planets[count] = get_default_exoplanet();
+            catalogGetPlanet(&catalog, i, &planets[count++]);
+        }
+    }
+
+    if (!planets)
+    {
+        catalogClose(&catalog);
+        return 1;
+    }
+
+    int ret_val = 0;
+    if (ephemerisWrite(output, planets, count, &options) != 0)
+    {
+        fprintf(stderr, "Error writing ephemeris %s\n", output);
+        ret_val = 1;
+    }
+    else
+    {
+        // Report what was written and the worst fit, straight from the file the server will map
+        struct Ephemeris ephemeris;
+        if (ephemerisOpen(output, &catalog, &ephemeris) == 0)
+        {
+            unsigned long long segments = 0, invalid = 0;
+            double worst[EPHEMERIS_QUANTITIES] = {0};
+            for (size_t i = 0; i < ephemeris.count; i++)
+            {
+                segments += ephemeris.tables[i].segments;
+                invalid += ephemeris.tables[i].invalidSegments;
+                for (int q = 0; q < EPHEMERIS_QUANTITIES; q++)
+                {
+                    if (ephemeris.tables[i].maxError[q] > worst[q])
+                        worst[q] = ephemeris.tables[i].maxError[q];
+                }
+            }
+
+            printf("Wrote %zu planets, %llu segments (%llu left to the solver) to %s\n", ephemeris.count, segments, invalid, output);
+            printf("Largest errors: distance %.3g (relative), ra %.3g, declination %.3g, galactic l %.3g, b %.3g (degrees)\n",
+                   worst[EPHEMERIS_DISTANCE], worst[EPHEMERIS_RA], worst[EPHEMERIS_DECLINATION],
+                   worst[EPHEMERIS_GALACTIC_LONGITUDE], worst[EPHEMERIS_GALACTIC_LATITUDE]);
+            ephemerisClose(&ephemeris);
+        }
+    }
+
+    free(planets);
+    catalogClose(&catalog);
+    return ret_val;
+}
@@ -0,0 +1,582 @@
+/*
+ * Chebyshev ephemeris tables: piecewise polynomial fits of the distance, right ascension,
+ * declination and galactic coordinates of cataloged planets, written offline by ephemeris-builder
+ * and memory-mapped by the server. A covered request costs a segment lookup and a few Clenshaw
+ * steps instead of a Kepler solve.
+ *
+ * A Keplerian orbit repeats every period, so when the span asked for is at least one period long
+ * a planet's segments cover one orbit starting at the span's start and every epoch in the span is
+ * folded onto it. Shorter spans are covered directly. Segments are equally long, so the segment of
+ * an epoch is found by a division.
+ *
+ * File layout, all integers and doubles little-endian, every section 64-byte aligned:
+ *   struct EphemerisHeader
+ *   count struct EphemerisTable, one per planet
+ *   segmentCount segments of EPHEMERIS_QUANTITIES * coefficients doubles, quantity by quantity
+ */
+
+#ifndef EPHEMERIS_C
+#define EPHEMERIS_C
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "astromath.c"
+#include "orbit.c"
+#include "catalog.c"
+
+#define EPHEMERIS_MAGIC "EXOEPH\0\0"
+#define EPHEMERIS_VERSION 1
+
+// Highest polynomial degree accepted, more coefficients than this only fit rounding noise
+#define EPHEMERIS_MAX_DEGREE 32
+
+// Segments per planet the builder may double up to while a fit misses its tolerance
+#define EPHEMERIS_MAX_SEGMENTS 4096
+
+// Fitted quantities, in segment order
+enum EphemerisQuantity {
+    EPHEMERIS_DISTANCE,             // Light years
+    EPHEMERIS_RA,                   // Radians, fitted unwrapped and reduced to [0, 2 pi) on lookup
+    EPHEMERIS_DECLINATION,          // Degrees
+    EPHEMERIS_GALACTIC_LONGITUDE,   // Degrees, fitted unwrapped and reduced to [0, 360) on lookup
+    EPHEMERIS_GALACTIC_LATITUDE,    // Degrees
+    EPHEMERIS_QUANTITIES
+};
+
+struct EphemerisHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;                     // CATALOG_BYTE_ORDER as written by the builder
+    uint32_t count;                         // Number of planets
+    uint32_t coefficients;                  // Per quantity and segment, the degree plus one
+    double start;                           // Unix seconds, epochs in [start, stop] are covered
+    double stop;
+    double angleTolerance;                  // Degrees, the fit bound the builder aimed for
+    double distanceTolerance;               // Relative
+    uint64_t tablesOffset;
+    uint64_t segmentsOffset;
+    uint64_t segmentCount;
+    uint64_t fileSize;
+};
+
+// The segments of one planet
+struct EphemerisTable {
+    char name[CATALOG_NAME_LENGTH];
+    double elements[6];                     // Catalog elements the table was fitted for, see ephemerisElements
+    double origin;                          // Unix time where the first segment starts
+    double length;                          // Seconds covered by all segments
+    double period;                          // Seconds the segments repeat after, 0 if they cover the span directly
+    double maxError[EPHEMERIS_QUANTITIES];  // Largest error seen while fitting: distance relative, angles in degrees
+    uint64_t firstSegment;
+    uint32_t segments;
+    uint32_t invalidSegments;               // Segments that missed the tolerance, their first coefficient is NaN
+};
+
+// A loaded ephemeris, tables and coefficients point straight into the mapping
+struct Ephemeris {
+    void *mapping;
+    size_t mappingSize;
+    size_t count;
+    size_t coefficients;
+    double start;
+    double stop;
+    const struct EphemerisTable *tables;
+    const double *segments;
+
+    // Table of each catalog record, NULL where the ephemeris has none
+    const struct EphemerisTable **byRecord;
+    size_t records;
+};
+
+struct EphemerisStats {
+    unsigned long long hits;
+    unsigned long long misses;              // Requests for a tabulated planet answered by a Kepler solve
+};
+
+static struct EphemerisStats ephemeris_stats;
+
+// Options of ephemerisWrite
+struct EphemerisFitOptions {
+    double start;
+    double stop;
+    int degree;
+    int segments;                           // Segments per planet to start from, doubled until the fit holds
+    double angleTolerance;
+    double distanceTolerance;
+};
+
+// The elements a table is keyed on, in the order of struct EphemerisTable
+static void ephemerisElements(const struct Exoplanet *planet, double elements[6])
+{
+    elements[0] = planet->orbitalRadius;
+    elements[1] = planet->orbitalPeriod;
+    elements[2] = planet->eccentricity;
+    elements[3] = planet->inclination;
+    elements[4] = planet->longitudeOfNode;
+    elements[5] = planet->argumentOfPeriapsis;
+}
+
+// Sums a Chebyshev series at x in [-1, 1] with Clenshaw's recurrence
+static inline double ephemerisChebyshev(const double *c, size_t n, double x)
+{
+    double b1 = 0, b2 = 0;
+    double x2 = 2 * x;
+    for (size_t j = n - 1; j > 0; j--)
+    {
+        double b0 = c[j] + x2 * b1 - b2;
+        b2 = b1;
+        b1 = b0;
+    }
+    return c[0] + x * b1 - b2;
+}
+
+// Answers a position of catalog record from its table: sets distance, ra, declination and the
+// galactic coordinates like evaluate_exoplanet would. Returns 1 if the epoch was covered, 0 when
+// the caller has to solve Kepler's equation instead.
+int ephemerisEvaluate(const struct Ephemeris *ephemeris, long record, double current_time, struct Exoplanet *planet)
+{
+    if (ephemeris == NULL || ephemeris->byRecord == NULL || record < 0 || (size_t) record >= ephemeris->records)
+        return 0;
+
+    const struct EphemerisTable *table = ephemeris->byRecord[record];
+    if (table == NULL)
+        return 0;
+
+    double offset = current_time - table->origin;
+    if (table->period > 0)
+        offset -= table->period * floor(offset / table->period);
+
+    double width = table->length / table->segments;
+    int covered = current_time >= ephemeris->start && current_time <= ephemeris->stop && offset >= 0 && offset <= table->length;
+
+    size_t segment = covered ? (size_t) (offset / width) : 0;
+    if (segment >= table->segments)
+        segment = table->segments - 1;
+
+    const double *c = ephemeris->segments + (table->firstSegment + segment) * EPHEMERIS_QUANTITIES * ephemeris->coefficients;
+    if (!covered || isnan(c[0]))
+    {
+        __atomic_fetch_add(&ephemeris_stats.misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    size_t n = ephemeris->coefficients;
+    double x = 2 * (offset - segment * width) / width - 1;
+
+    // Reduced with floor rather than fmod, which costs about as much as the series
+    double ra = ephemerisChebyshev(c + EPHEMERIS_RA * n, n, x);
+    ra -= 2 * PI * floor(ra / (2 * PI));
+    double l = ephemerisChebyshev(c + EPHEMERIS_GALACTIC_LONGITUDE * n, n, x);
+    l -= 360 * floor(l / 360);
+
+    planet->distance = ephemerisChebyshev(c + EPHEMERIS_DISTANCE * n, n, x);
+    planet->ra = ra;
+    planet->declination = ephemerisChebyshev(c + EPHEMERIS_DECLINATION * n, n, x);
+    planet->galacticLongitude = l;
+    planet->galacticLatitude = ephemerisChebyshev(c + EPHEMERIS_GALACTIC_LATITUDE * n, n, x);
+
+    __atomic_fetch_add(&ephemeris_stats.hits, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void ephemerisStatsSnapshot(struct EphemerisStats *stats)
+{
+    stats->hits = __atomic_load_n(&ephemeris_stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&ephemeris_stats.misses, __ATOMIC_RELAXED);
+}
+
+void ephemerisClose(struct Ephemeris *ephemeris)
+{
+    if (ephemeris->mapping)
+        munmap(ephemeris->mapping, ephemeris->mappingSize);
+    free(ephemeris->byRecord);
+    memset(ephemeris, 0, sizeof(*ephemeris));
+}
+
+// Maps an ephemeris file and attaches its tables to the records of catalog with the same name and
+// elements, returns 0 on success. On failure a message is printed to stderr and the ephemeris is
+// left empty. Tables of planets the catalog no longer has, or has with other elements, are skipped.
+int ephemerisOpen(const char *path, const struct Catalog *catalog, struct Ephemeris *ephemeris)
+{
+    memset(ephemeris, 0, sizeof(*ephemeris));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error opening ephemeris %s\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct EphemerisHeader))
+    {
+        fprintf(stderr, "Ephemeris %s is too small\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Error mapping ephemeris %s\n", path);
+        return -1;
+    }
+
+    ephemeris->mapping = mapping;
+    ephemeris->mappingSize = (size_t) st.st_size;
+
+    struct EphemerisHeader header;
+    memcpy(&header, mapping, sizeof(header));
+
+    if (memcmp(header.magic, EPHEMERIS_MAGIC, 8) != 0 || header.version != EPHEMERIS_VERSION ||
+        header.byteOrder != CATALOG_BYTE_ORDER || !catalogHostIsLittleEndian())
+    {
+        fprintf(stderr, "Ephemeris %s has an unsupported format\n", path);
+        ephemerisClose(ephemeris);
+        return -1;
+    }
+
+    uint64_t segment_size = (uint64_t) EPHEMERIS_QUANTITIES * header.coefficients * sizeof(double);
+    int valid = header.fileSize == ephemeris->mappingSize && header.count <= CATALOG_MAX_PLANETS &&
+                header.coefficients >= 1 && header.coefficients <= EPHEMERIS_MAX_DEGREE + 1 &&
+                header.segmentCount <= (uint64_t) header.count * EPHEMERIS_MAX_SEGMENTS &&
+                header.tablesOffset % 8 == 0 && catalogFits(header.tablesOffset, header.count, sizeof(struct EphemerisTable), header.fileSize) &&
+                header.segmentsOffset % 8 == 0 && catalogFits(header.segmentsOffset, header.segmentCount, segment_size, header.fileSize) &&
+                header.start <= header.stop;
+
+    const char *base = mapping;
+    const struct EphemerisTable *tables = (const struct EphemerisTable *) (base + header.tablesOffset);
+    for (uint32_t i = 0; valid && i < header.count; i++)
+    {
+        const struct EphemerisTable *table = &tables[i];
+        valid = memchr(table->name, '\0', CATALOG_NAME_LENGTH) != NULL && table->segments > 0 &&
+                catalogFits(table->firstSegment, table->segments, 1, header.segmentCount) && table->length > 0 && table->period >= 0;
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "Ephemeris %s is corrupt\n", path);
+        ephemerisClose(ephemeris);
+        return -1;
+    }
+
+    ephemeris->count = header.count;
+    ephemeris->coefficients = header.coefficients;
+    ephemeris->start = header.start;
+    ephemeris->stop = header.stop;
+    ephemeris->tables = tables;
+    ephemeris->segments = (const double *) (base + header.segmentsOffset);
+    ephemeris->records = catalog->count;
+    ephemeris->byRecord = calloc(catalog->count ? catalog->count : 1, sizeof(struct EphemerisTable *));
+    if (!ephemeris->byRecord)
+    {
+        ephemerisClose(ephemeris);
+        return -1;
+    }
+
+    size_t skipped = 0;
+    for (size_t i = 0; i < ephemeris->count; i++)
+    {
+        long record = catalogFind(catalog, tables[i].name);
+
+        double elements[6];
+        struct Exoplanet planet = get_default_exoplanet();
+        if (record >= 0)
+        {
+            catalogGetPlanet(catalog, (size_t) record, &planet);
+            ephemerisElements(&planet, elements);
+        }
+
+        if (record < 0 || memcmp(elements, tables[i].elements, sizeof(elements)) != 0)
+            skipped++;
+        else
+            ephemeris->byRecord[record] = &tables[i];
+    }
+
+    if (skipped > 0)
+        fprintf(stderr, "Skipped %zu ephemeris tables whose planets are not in the catalog with the same elements\n", skipped);
+
+    return 0;
+}
+
+// Values of the fitted quantities at time, 0 on success or -1 when Kepler's equation has no solution
+static int ephemerisSample(const struct OrbitHandle *orbit, double time, double values[EPHEMERIS_QUANTITIES])
+{
+    struct Exoplanet planet = get_default_exoplanet();
+    orbitHandleEvaluate(orbit, time, &planet);
+    if (isnan(planet.distance) || isnan(planet.ra))
+        return -1;
+    setGalacticCoordinates(&planet);
+
+    values[EPHEMERIS_DISTANCE] = planet.distance;
+    values[EPHEMERIS_RA] = planet.ra;
+    values[EPHEMERIS_DECLINATION] = planet.declination;
+    values[EPHEMERIS_GALACTIC_LONGITUDE] = planet.galacticLongitude;
+    values[EPHEMERIS_GALACTIC_LATITUDE] = planet.galacticLatitude;
+    return 0;
+}
+
+// Turn of each quantity, 0 for those that do not wrap around
+static const double ephemeris_turns[EPHEMERIS_QUANTITIES] = { 0, 2 * PI, 0, 360, 0 };
+
+// Fits n Chebyshev coefficients per quantity to the orbit over [start, start + width] and measures
+// the largest error between the nodes (distance relative, angles in degrees). Returns -1 if the
+// orbit could not be solved somewhere in the segment.
+static int ephemerisFitSegment(const struct OrbitHandle *orbit, double start, double width, size_t n,
+                               double *coefficients, double errors[EPHEMERIS_QUANTITIES])
+{
+    double samples[EPHEMERIS_QUANTITIES][EPHEMERIS_MAX_DEGREE + 1];
+
+    // Nodes in increasing time, so wrapping quantities can be unwrapped sample by sample
+    for (size_t m = 0; m < n; m++)
+    {
+        size_t k = n - 1 - m;
+        double x = cos(PI * (k + 0.5) / n);
+        double values[EPHEMERIS_QUANTITIES];
+        if (ephemerisSample(orbit, start + (x + 1) / 2 * width, values) != 0)
+            return -1;
+
+        for (int q = 0; q < EPHEMERIS_QUANTITIES; q++)
+        {
+            if (ephemeris_turns[q] > 0 && m > 0)
+            {
+                double previous = samples[q][n - m];
+                values[q] += ephemeris_turns[q] * round((previous - values[q]) / ephemeris_turns[q]);
+            }
+            samples[q][k] = values[q];
+        }
+    }
+
+    for (int q = 0; q < EPHEMERIS_QUANTITIES; q++)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            double sum = 0;
+            for (size_t k = 0; k < n; k++)
+                sum += samples[q][k] * cos(PI * j * (k + 0.5) / n);
+            coefficients[q * n + j] = (j == 0 ? 1.0 : 2.0) * sum / n;
+        }
+    }
+
+    // Check between and beyond the nodes, including both ends of the segment
+    size_t checks = 4 * n;
+    memset(errors, 0, sizeof(double) * EPHEMERIS_QUANTITIES);
+    for (size_t m = 0; m <= checks; m++)
+    {
+        double x = 2.0 * m / checks - 1;
+        double values[EPHEMERIS_QUANTITIES];
+        if (ephemerisSample(orbit, start + (x + 1) / 2 * width, values) != 0)
+            return -1;
+
+        for (int q = 0; q < EPHEMERIS_QUANTITIES; q++)
+        {
+            double error = ephemerisChebyshev(coefficients + q * n, n, x) - values[q];
+            if (ephemeris_turns[q] > 0)
+                error -= ephemeris_turns[q] * round(error / ephemeris_turns[q]);
+            error = fabs(error);
+
+            if (q == EPHEMERIS_DISTANCE)
+                error /= fabs(values[q]) > 0 ? fabs(values[q]) : 1;
+            else if (q == EPHEMERIS_RA)
+                error = RAD_TO_DEG(error);
+
+            if (!(error <= errors[q]))
+                errors[q] = error;
+        }
+    }
+
+    return 0;
+}
+
+static int ephemerisWithinTolerance(const double errors[EPHEMERIS_QUANTITIES], const struct EphemerisFitOptions *options)
+{
+    if (!(errors[EPHEMERIS_DISTANCE] <= options->distanceTolerance))
+        return 0;
+    for (int q = EPHEMERIS_RA; q < EPHEMERIS_QUANTITIES; q++)
+    {
+        if (!(errors[q] <= options->angleTolerance))
+            return 0;
+    }
+    return 1;
+}
+
+// Fits the segments of one planet into *coefficients (reallocated to fit), doubling the segment
+// count from options->segments while that reduces the segments missing the tolerances, up to
+// EPHEMERIS_MAX_SEGMENTS. Segments that still miss are marked with a NaN first coefficient. Those
+// are usually jumps no polynomial fits, e.g. galactic l and b jump where ra wraps around.
+static int ephemerisFitPlanet(const struct Exoplanet *planet, const struct EphemerisFitOptions *options,
+                              struct EphemerisTable *table, double **coefficients, size_t *capacity)
+{
+    struct OrbitHandle orbit;
+    orbitHandleInit(&orbit, planet);
+
+    double span = options->stop - options->start;
+    table->origin = options->start;
+    table->period = orbit.periodSeconds > 0 && span >= orbit.periodSeconds ? orbit.periodSeconds : 0;
+    table->length = table->period > 0 ? table->period : span;
+    if (!(table->length > 0) || !isfinite(table->length))
+        return -1;
+
+    size_t n = (size_t) options->degree + 1;
+    size_t segment_size = EPHEMERIS_QUANTITIES * n;
+    size_t previous_invalid = SIZE_MAX;
+
+    for (size_t segments = (size_t) options->segments; ; segments *= 2)
+    {
+        if (segments * segment_size > *capacity)
+        {
+            double *grown = realloc(*coefficients, segments * segment_size * sizeof(double));
+            if (!grown)
+                return -1;
+            *coefficients = grown;
+            *capacity = segments * segment_size;
+        }
+
+        double width = table->length / segments;
+        size_t invalid = 0;
+        memset(table->maxError, 0, sizeof(table->maxError));
+
+        for (size_t s = 0; s < segments; s++)
+        {
+            double *c = *coefficients + s * segment_size;
+            double errors[EPHEMERIS_QUANTITIES];
+            int fitted = ephemerisFitSegment(&orbit, table->origin + s * width, width, n, c, errors) == 0 &&
+                         ephemerisWithinTolerance(errors, options);
+
+            if (!fitted)
+            {
+                c[0] = NAN;
+                invalid++;
+                continue;
+            }
+            for (int q = 0; q < EPHEMERIS_QUANTITIES; q++)
+            {
+                if (errors[q] > table->maxError[q])
+                    table->maxError[q] = errors[q];
+            }
+        }
+
+        table->segments = (uint32_t) segments;
+        table->invalidSegments = (uint32_t) invalid;
+        if (invalid == 0 || invalid >= previous_invalid || segments * 2 > EPHEMERIS_MAX_SEGMENTS)
+            return 0;
+        previous_invalid = invalid;
+    }
+}
+
+// Fits every planet and writes the tables to path, returns 0 on success. Planets that no segment
+// could be fitted for (e.g. eccentricity of 1 or more) are left out with a message.
+int ephemerisWrite(const char *path, const struct Exoplanet *planets, size_t count, const struct EphemerisFitOptions *options)
+{
+    if (count > CATALOG_MAX_PLANETS || !catalogHostIsLittleEndian() || options->degree < 0 ||
+        options->degree > EPHEMERIS_MAX_DEGREE || options->segments < 1 || options->segments > EPHEMERIS_MAX_SEGMENTS ||
+        !(options->stop > options->start))
+        return -1;
+
+    size_t n = (size_t) options->degree + 1;
+    size_t segment_size = EPHEMERIS_QUANTITIES * n;
+
+    struct EphemerisTable *tables = calloc(count ? count : 1, sizeof(struct EphemerisTable));
+    FILE *segments_file = tmpfile();
+    if (!tables || !segments_file)
+    {
+        free(tables);
+        if (segments_file)
+            fclose(segments_file);
+        return -1;
+    }
+
+    // Segments are staged in a temporary file, tables can need far more than fits in memory at once
+    double *coefficients = NULL;
+    size_t capacity = 0;
+    size_t written = 0;
+    uint64_t segment_count = 0;
+    int ret_val = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct Exoplanet *planet = &planets[i];
+        struct EphemerisTable table;
+        memset(&table, 0, sizeof(table));
+
+        size_t name_length = planet->name ? strlen(planet->name) : 0;
+        if (name_length == 0 || name_length >= CATALOG_NAME_LENGTH)
+        {
+            fprintf(stderr, "Planet %zu has an empty name or one longer than %d bytes\n", i, CATALOG_NAME_LENGTH - 1);
+            ret_val = -1;
+            break;
+        }
+        memcpy(table.name, planet->name, name_length);
+        ephemerisElements(planet, table.elements);
+
+        if (ephemerisFitPlanet(planet, options, &table, &coefficients, &capacity) != 0 || table.invalidSegments == table.segments)
+        {
+            fprintf(stderr, "No segment of '%s' could be fitted, leaving it out\n", planet->name);
+            continue;
+        }
+
+        table.firstSegment = segment_count;
+        if (fwrite(coefficients, sizeof(double) * segment_size, table.segments, segments_file) != table.segments)
+        {
+            ret_val = -1;
+            break;
+        }
+        segment_count += table.segments;
+        tables[written++] = table;
+    }
+
+    struct EphemerisHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EPHEMERIS_MAGIC, 8);
+    header.version = EPHEMERIS_VERSION;
+    header.byteOrder = CATALOG_BYTE_ORDER;
+    header.count = (uint32_t) written;
+    header.coefficients = (uint32_t) n;
+    header.start = options->start;
+    header.stop = options->stop;
+    header.angleTolerance = options->angleTolerance;
+    header.distanceTolerance = options->distanceTolerance;
+    header.tablesOffset = catalogAlign(sizeof(header));
+    header.segmentsOffset = catalogAlign(header.tablesOffset + written * sizeof(struct EphemerisTable));
+    header.segmentCount = segment_count;
+    header.fileSize = header.segmentsOffset + segment_count * segment_size * sizeof(double);
+
+    FILE *file = ret_val == 0 ? fopen(path, "wb") : NULL;
+    if (file)
+    {
+        static const char padding[64];
+        int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(padding, 1, header.tablesOffset - sizeof(header), file) == header.tablesOffset - sizeof(header) &&
+                 fwrite(tables, sizeof(struct EphemerisTable), written, file) == written &&
+                 fwrite(padding, 1, header.segmentsOffset - header.tablesOffset - written * sizeof(struct EphemerisTable), file) ==
+                     header.segmentsOffset - header.tablesOffset - written * sizeof(struct EphemerisTable);
+
+        // Copy the staged segments behind the tables
+        rewind(segments_file);
+        for (uint64_t s = 0; ok && s < segment_count; s++)
+        {
+            ok = fread(coefficients, sizeof(double) * segment_size, 1, segments_file) == 1 &&
+                 fwrite(coefficients, sizeof(double) * segment_size, 1, file) == 1;
+        }
+
+        if (fclose(file) != 0 || !ok)
+            ret_val = -1;
+    }
+    else
+        ret_val = -1;
+
+    free(coefficients);
+    free(tables);
+    fclose(segments_file);
+    return ret_val;
+}
+
+#endif
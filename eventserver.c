@@ -0,0 +1,882 @@
+/*
+ * Event-driven SSH server: a few event loop threads multiplex many non-blocking sessions with
+ * ssh_event polling, parsed requests are computed on a worker pool and the serialized responses
+ * are written back by the loop that owns the session (libssh sessions are not thread safe)
+ */
+
+#ifndef EVENTSERVER_C
+#define EVENTSERVER_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <jansson.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+#include <libssh/callbacks.h>
+#include "workerpool.c"
+#include "exoplanetbinary.c"
+#include "admission.c"
+
+// How long a loop sleeps in poll before rechecking for shutdown, in milliseconds
+#define EVENT_LOOP_POLL_TIMEOUT 1000
+
+// Computes the response to a parsed request, takes ownership of root and returns a malloc'ed string
+typedef char *(*EventRequestHandler)(json_t *root);
+
+// Streaming mode: answers a run of newline-delimited requests with a malloc'ed block of response lines
+typedef char *(*EventLinesHandler)(const char *lines, size_t length, size_t *responseLength);
+
+// Binary mode: answers a run of complete frames (see exoplanetbinary.c) with a malloc'ed block of response frames
+typedef char *(*EventFramesHandler)(const char *frames, size_t length, size_t *responseLength);
+
+// Acknowledges {"request": "stream"}, after which the channel carries newline-delimited requests
+#define EVENT_STREAM_RESPONSE "{\"streaming\":true}\n"
+
+struct EventLoop;
+
+struct EventSession {
+    ssh_session session;
+    ssh_channel channel;
+    struct EventLoop *loop;
+    struct ssh_server_callbacks_struct serverCallbacks;
+    struct ssh_channel_callbacks_struct channelCallbacks;
+    int keyExchanged;
+    uint64_t acceptedNs;    // when the session was handed over, bounds the key exchange
+    uint64_t waitingNs;     // since when the session has been waiting for (the rest of) a request
+
+    // Bytes received on the channel that do not form a complete request yet
+    char *input;
+    size_t inputLength;
+    size_t inputCapacity;
+    int inputEof;
+
+    // Request handed to a worker (a parsed document, or in streaming and binary mode a run of lines or frames),
+    // and the response it produced
+    json_t *request;
+    char *lines;
+    size_t linesLength;
+    char *output;
+    size_t outputLength;
+    size_t outputSent;
+
+    int busy;               // a worker holds the session, only the loop clears this
+    int stayAlive;          // keep the channel open once the current response is written
+    int streaming;          // newline-delimited requests, answered in batches
+    int binary;             // binary frames, answered in batches
+    int closing;            // free the session as soon as no worker holds it
+
+    struct EventSession *next;          // the loop's list of sessions
+    struct EventSession *nextCompleted; // the loop's list of computed responses
+};
+
+struct EventServer;
+
+struct EventLoop {
+    struct EventServer *server;
+    pthread_t thread;
+    int started;
+    ssh_event event;
+    int wakeFds[2];
+
+    // Handed over by other threads
+    pthread_mutex_t lock;
+    struct EventSession *incoming;      // accepted sessions
+    struct EventSession *completed;     // sessions whose response is ready
+
+    // Owned by the loop thread
+    struct EventSession *sessions;
+    int numSessions;
+};
+
+struct EventServer {
+    int numLoops;
+    struct EventLoop *loops;
+    struct WorkerPool compute;
+    EventRequestHandler handler;
+    EventLinesHandler linesHandler;
+    EventFramesHandler framesHandler;
+    size_t maxRequestSize;
+    int stopping;
+
+    // Counters
+    unsigned long long sessionsAccepted;
+    unsigned long long requests;
+    unsigned long long rejected;
+};
+
+struct EventServerStats {
+    int loops;
+    int sessions;
+    unsigned long long sessionsAccepted;
+    unsigned long long requests;
+    unsigned long long rejected;
+    struct WorkerPoolStats compute;
+};
+
+static void eventLoopWake(struct EventLoop *loop)
+{
+    char byte = 0;
+    if (write(loop->wakeFds[1], &byte, 1) < 0)
+    {
+        // The pipe is full, so the loop is already due to wake up
+    }
+}
+
+static int eventWakeCallback(socket_t fd, int revents, void *userdata)
+{
+    (void)revents;
+    (void)userdata;
+
+    char drain[64];
+    while (read(fd, drain, sizeof(drain)) > 0)
+        ;
+    return 0;
+}
+
+static void eventSessionComplete(struct EventSession *s);
+
+// count copies of a response (a line or an error frame) in one malloc'ed block, NULL if it cannot be allocated
+static char *eventRepeatResponse(const char *response, size_t length, size_t count, size_t *outputLength)
+{
+    char *output = malloc(count * length + 1);
+    if (!output)
+        return NULL;
+    for (size_t i = 0; i < count; i++)
+        memcpy(output + i * length, response, length);
+    *outputLength = count * length;
+    return output;
+}
+
+// Runs on a compute worker: builds the response, then hands the session back to its loop
+static void eventSessionCompute(void *arg)
+{
+    struct EventSession *s = arg;
+    struct EventLoop *loop = s->loop;
+
+    // Shed load that waited too long or finds the server at its concurrency limit
+    if (admissionEnter(workerPoolWaited()) != 0)
+    {
+        json_decref(s->request);
+        s->output = strdup(ADMISSION_OVERLOADED_RESPONSE);
+    }
+    else
+    {
+        s->output = loop->server->handler(s->request);
+        admissionLeave();
+    }
+    s->outputLength = s->output ? strlen(s->output) : 0;
+    s->request = NULL;
+    __atomic_fetch_add(&loop->server->requests, 1, __ATOMIC_RELAXED);
+
+    eventSessionComplete(s);
+}
+
+// Runs on a compute worker: answers every line (or frame) of a streamed batch with one block of responses
+static void eventSessionComputeLines(void *arg)
+{
+    struct EventSession *s = arg;
+    struct EventLoop *loop = s->loop;
+
+    // Shed load, every line (or frame) of the batch still gets an answer
+    if (admissionEnter(workerPoolWaited()) != 0)
+    {
+        if (s->binary)
+        {
+            size_t frames;
+            int invalid;
+            char frame[BINARY_HEADER_SIZE];
+            binaryCompleteFrames(s->lines, s->linesLength, &frames, &invalid);
+            binaryWriteHeader(frame, BINARY_ERROR, 0, BINARY_STATUS_BUSY);
+            s->output = eventRepeatResponse(frame, sizeof(frame), frames, &s->outputLength);
+        }
+        else
+        {
+            s->output = eventRepeatResponse(ADMISSION_OVERLOADED_LINE, strlen(ADMISSION_OVERLOADED_LINE),
+                                            admissionCountRequests(s->lines, s->linesLength), &s->outputLength);
+        }
+    }
+    else
+    {
+        if (s->binary)
+            s->output = loop->server->framesHandler(s->lines, s->linesLength, &s->outputLength);
+        else
+            s->output = loop->server->linesHandler(s->lines, s->linesLength, &s->outputLength);
+        admissionLeave();
+    }
+    free(s->lines);
+    s->lines = NULL;
+    __atomic_fetch_add(&loop->server->requests, 1, __ATOMIC_RELAXED);
+
+    eventSessionComplete(s);
+}
+
+// Hands a session with a computed response back to its loop
+static void eventSessionComplete(struct EventSession *s)
+{
+    struct EventLoop *loop = s->loop;
+
+    pthread_mutex_lock(&loop->lock);
+    s->nextCompleted = loop->completed;
+    loop->completed = s;
+    pthread_mutex_unlock(&loop->lock);
+
+    eventLoopWake(loop);
+}
+
+// Queues a response that did not need a worker
+static void eventSessionRespond(struct EventSession *s, const char *response)
+{
+    s->output = strdup(response);
+    s->outputLength = s->output ? strlen(s->output) : 0;
+    s->outputSent = 0;
+}
+
+static void eventSessionCloseChannel(struct EventSession *s)
+{
+    if (s->channel && !ssh_channel_is_closed(s->channel))
+    {
+        ssh_channel_send_eof(s->channel);
+        ssh_channel_close(s->channel);
+    }
+    s->closing = 1;
+}
+
+// Streaming mode: hands every complete line received so far to a worker as one batch
+static void eventSessionPumpLines(struct EventSession *s)
+{
+    size_t length = s->inputLength;
+    if (!s->inputEof)
+    {
+        while (length > 0 && s->input[length - 1] != '\n')
+            length--;
+    }
+
+    if (length == 0)
+    {
+        if (s->inputEof)
+            eventSessionCloseChannel(s);
+        return;
+    }
+
+    s->lines = malloc(length);
+    if (!s->lines)
+    {
+        eventSessionCloseChannel(s);
+        return;
+    }
+    memcpy(s->lines, s->input, length);
+    s->linesLength = length;
+    memmove(s->input, s->input + length, s->inputLength - length);
+    s->inputLength -= length;
+
+    s->busy = 1;
+    if (workerPoolSubmit(&s->loop->server->compute, eventSessionComputeLines, s, 0) == 0)
+        return;
+    s->busy = 0;
+
+    // Shed the batch, every request line in it still gets an answer
+    size_t requests = admissionCountRequests(s->lines, length);
+    free(s->lines);
+    s->lines = NULL;
+
+    __atomic_fetch_add(&s->loop->server->rejected, requests, __ATOMIC_RELAXED);
+    s->output = eventRepeatResponse(ADMISSION_OVERLOADED_LINE, strlen(ADMISSION_OVERLOADED_LINE), requests, &s->outputLength);
+    if (!s->output)
+    {
+        eventSessionCloseChannel(s);
+        return;
+    }
+    s->outputSent = 0;
+}
+
+// Queues count error frames with the given status
+static void eventSessionRespondFrames(struct EventSession *s, enum BinaryStatus status, size_t count)
+{
+    char frame[BINARY_HEADER_SIZE];
+    binaryWriteHeader(frame, BINARY_ERROR, 0, status);
+    s->output = eventRepeatResponse(frame, sizeof(frame), count, &s->outputLength);
+    if (!s->output)
+    {
+        eventSessionCloseChannel(s);
+        return;
+    }
+    s->outputSent = 0;
+}
+
+// Binary mode: hands every complete frame received so far to a worker as one batch
+static void eventSessionPumpFrames(struct EventSession *s)
+{
+    size_t frames;
+    int invalid;
+    size_t length = binaryCompleteFrames(s->input, s->inputLength, &frames, &invalid);
+
+    if (length == 0)
+    {
+        // A bad header, or EOF in the middle of a frame, is answered with an error frame and ends the channel
+        if (invalid || (s->inputEof && s->inputLength > 0))
+        {
+            s->inputLength = 0;
+            s->stayAlive = 0;
+            eventSessionRespondFrames(s, BINARY_STATUS_INVALID_FRAME, 1);
+        }
+        else if (s->inputEof)
+            eventSessionCloseChannel(s);
+        return;
+    }
+
+    s->lines = malloc(length);
+    if (!s->lines)
+    {
+        eventSessionCloseChannel(s);
+        return;
+    }
+    memcpy(s->lines, s->input, length);
+    s->linesLength = length;
+    memmove(s->input, s->input + length, s->inputLength - length);
+    s->inputLength -= length;
+
+    s->busy = 1;
+    if (workerPoolSubmit(&s->loop->server->compute, eventSessionComputeLines, s, 0) == 0)
+        return;
+    s->busy = 0;
+
+    // Shed the batch, every frame in it still gets an answer
+    free(s->lines);
+    s->lines = NULL;
+    __atomic_fetch_add(&s->loop->server->rejected, frames, __ATOMIC_RELAXED);
+    eventSessionRespondFrames(s, BINARY_STATUS_BUSY, frames);
+}
+
+// Starts the next request in the input buffer, if a complete one has arrived and none is in flight
+static void eventSessionPump(struct EventSession *s)
+{
+    if (s->busy || s->output || s->closing)
+        return;
+
+    if (s->streaming)
+    {
+        eventSessionPumpLines(s);
+        return;
+    }
+
+    // A binary client opens with a hello frame instead of a JSON document
+    if (!s->binary && s->inputLength > 0 && s->input[0] == BINARY_MAGIC_BYTE && s->loop->server->framesHandler)
+    {
+        s->binary = 1;
+        s->stayAlive = 1;
+    }
+
+    if (s->binary)
+    {
+        eventSessionPumpFrames(s);
+        return;
+    }
+
+    // Only attempt a parse once the input could plausibly be a complete object
+    size_t last = s->inputLength;
+    while (last > 0 && (s->input[last - 1] == '\n' || s->input[last - 1] == '\r' || s->input[last - 1] == ' '))
+        last--;
+
+    if (last > 0 && s->input[last - 1] == '}')
+    {
+        // Parse just the first document, anything after it is the next request
+        json_error_t error;
+        json_t *root = json_loadb(s->input, s->inputLength, JSON_DISABLE_EOF_CHECK, &error);
+        if (root)
+        {
+            size_t consumed = (size_t) error.position < s->inputLength ? (size_t) error.position : s->inputLength;
+            memmove(s->input, s->input + consumed, s->inputLength - consumed);
+            s->inputLength -= consumed;
+
+            // Switch the channel to streaming mode, it then carries newline-delimited requests
+            json_t *request_json = json_object_get(root, "request");
+            if (json_is_string(request_json) && strcmp(json_string_value(request_json), "stream") == 0)
+            {
+                json_decref(root);
+                s->streaming = 1;
+                s->stayAlive = 1;
+                eventSessionRespond(s, EVENT_STREAM_RESPONSE);
+                return;
+            }
+
+            // Check if the client wants to stay alive
+            json_t *stay_alive_json = json_object_get(root, "stay_alive");
+            s->stayAlive = json_is_boolean(stay_alive_json) ? json_boolean_value(stay_alive_json) : 0;
+
+            s->request = root;
+            s->busy = 1;
+            if (workerPoolSubmit(&s->loop->server->compute, eventSessionCompute, s, 0) != 0)
+            {
+                // Shed the request rather than stall every session on this loop, answered like any shed work
+                json_decref(root);
+                s->request = NULL;
+                s->busy = 0;
+                __atomic_fetch_add(&s->loop->server->rejected, 1, __ATOMIC_RELAXED);
+                eventSessionRespond(s, ADMISSION_OVERLOADED_RESPONSE);
+            }
+            return;
+        }
+    }
+
+    if (s->inputEof)
+    {
+        // EOF without a parseable request, drop the session like the threaded server does
+        if (last > 0)
+            fprintf(stderr, "Error parsing JSON: incomplete request\n");
+        eventSessionCloseChannel(s);
+    }
+}
+
+// Writes as much of the pending response as the channel window takes
+static void eventSessionFlush(struct EventSession *s)
+{
+    if (s->busy || !s->output)
+        return;
+
+    if (!s->channel || ssh_channel_is_closed(s->channel))
+    {
+        s->closing = 1;
+        return;
+    }
+
+    while (s->outputSent < s->outputLength)
+    {
+        int nbytes = ssh_channel_write(s->channel, s->output + s->outputSent, s->outputLength - s->outputSent);
+        if (nbytes == SSH_ERROR)
+        {
+            s->closing = 1;
+            return;
+        }
+        if (nbytes == 0)
+            return; // window is full, retried once the client catches up
+        s->outputSent += nbytes;
+    }
+
+    free(s->output);
+    s->output = NULL;
+    s->outputLength = 0;
+    s->outputSent = 0;
+    s->waitingNs = admissionNow();
+
+    if (s->stayAlive)
+        eventSessionPump(s);
+    else
+        eventSessionCloseChannel(s);
+}
+
+static int eventChannelData(ssh_session session, ssh_channel channel, void *data, uint32_t len, int is_stderr, void *userdata)
+{
+    (void)session;
+    (void)channel;
+    (void)is_stderr;
+    struct EventSession *s = userdata;
+
+    if (s->inputLength + len > s->loop->server->maxRequestSize)
+    {
+        fprintf(stderr, "Error parsing JSON: Request too large\n");
+        eventSessionCloseChannel(s);
+        return len;
+    }
+
+    if (s->inputLength + len > s->inputCapacity)
+    {
+        size_t capacity = s->inputCapacity ? s->inputCapacity : 4096;
+        while (capacity < s->inputLength + len)
+            capacity *= 2;
+        char *grown = realloc(s->input, capacity);
+        if (!grown)
+        {
+            eventSessionCloseChannel(s);
+            return len;
+        }
+        s->input = grown;
+        s->inputCapacity = capacity;
+    }
+
+    memcpy(s->input + s->inputLength, data, len);
+    s->inputLength += len;
+
+    eventSessionPump(s);
+    return len;
+}
+
+static void eventChannelEof(ssh_session session, ssh_channel channel, void *userdata)
+{
+    (void)session;
+    (void)channel;
+    struct EventSession *s = userdata;
+    s->inputEof = 1;
+    eventSessionPump(s);
+}
+
+static void eventChannelClose(ssh_session session, ssh_channel channel, void *userdata)
+{
+    (void)session;
+    (void)channel;
+    struct EventSession *s = userdata;
+    s->closing = 1;
+}
+
+static int eventChannelWriteWontBlock(ssh_session session, ssh_channel channel, uint32_t bytes, void *userdata)
+{
+    (void)session;
+    (void)channel;
+    (void)bytes;
+    eventSessionFlush(userdata);
+    return 0;
+}
+
+// Requests are read from the channel whether the client asked for a shell, a command or a pty
+static int eventChannelAccept(ssh_session session, ssh_channel channel, void *userdata)
+{
+    (void)session;
+    (void)channel;
+    (void)userdata;
+    return SSH_OK;
+}
+
+static int eventChannelAcceptExec(ssh_session session, ssh_channel channel, const char *command, void *userdata)
+{
+    (void)command;
+    return eventChannelAccept(session, channel, userdata);
+}
+
+static int eventChannelAcceptPty(ssh_session session, ssh_channel channel, const char *term, int width, int height, int pxwidth, int pwheight, void *userdata)
+{
+    (void)term;
+    (void)width;
+    (void)height;
+    (void)pxwidth;
+    (void)pwheight;
+    return eventChannelAccept(session, channel, userdata);
+}
+
+// The server has never authenticated clients, so the "none" method is accepted
+static int eventAuthNone(ssh_session session, const char *user, void *userdata)
+{
+    (void)session;
+    (void)user;
+    (void)userdata;
+    return SSH_AUTH_SUCCESS;
+}
+
+// One channel per session carries the requests
+static ssh_channel eventChannelOpen(ssh_session session, void *userdata)
+{
+    struct EventSession *s = userdata;
+    if (s->channel)
+        return NULL;
+
+    s->channel = ssh_channel_new(session);
+    if (!s->channel)
+        return NULL;
+
+    memset(&s->channelCallbacks, 0, sizeof(s->channelCallbacks));
+    s->channelCallbacks.userdata = s;
+    s->channelCallbacks.channel_data_function = eventChannelData;
+    s->channelCallbacks.channel_eof_function = eventChannelEof;
+    s->channelCallbacks.channel_close_function = eventChannelClose;
+    s->channelCallbacks.channel_write_wontblock_function = eventChannelWriteWontBlock;
+    s->channelCallbacks.channel_shell_request_function = eventChannelAccept;
+    s->channelCallbacks.channel_exec_request_function = eventChannelAcceptExec;
+    s->channelCallbacks.channel_pty_request_function = eventChannelAcceptPty;
+    ssh_callbacks_init(&s->channelCallbacks);
+    ssh_set_channel_callbacks(s->channel, &s->channelCallbacks);
+
+    return s->channel;
+}
+
+// Takes over a newly accepted session on the loop thread
+static void eventLoopAttach(struct EventLoop *loop, struct EventSession *s)
+{
+    memset(&s->serverCallbacks, 0, sizeof(s->serverCallbacks));
+    s->serverCallbacks.userdata = s;
+    s->serverCallbacks.auth_none_function = eventAuthNone;
+    s->serverCallbacks.channel_open_request_session_function = eventChannelOpen;
+    ssh_callbacks_init(&s->serverCallbacks);
+    ssh_set_server_callbacks(s->session, &s->serverCallbacks);
+    ssh_set_auth_methods(s->session, SSH_AUTH_METHOD_NONE);
+
+    ssh_set_blocking(s->session, 0);
+    if (ssh_event_add_session(loop->event, s->session) != SSH_OK)
+    {
+        ssh_disconnect(s->session);
+        ssh_free(s->session);
+        free(s);
+        return;
+    }
+
+    s->next = loop->sessions;
+    loop->sessions = s;
+    __atomic_fetch_add(&loop->numSessions, 1, __ATOMIC_RELAXED);
+}
+
+static void eventLoopFree(struct EventLoop *loop, struct EventSession *s)
+{
+    ssh_event_remove_session(loop->event, s->session);
+    if (s->channel)
+        ssh_channel_free(s->channel);
+    ssh_disconnect(s->session);
+    ssh_free(s->session);
+
+    json_decref(s->request);
+    free(s->lines);
+    free(s->input);
+    free(s->output);
+    free(s);
+    __atomic_fetch_sub(&loop->numSessions, 1, __ATOMIC_RELAXED);
+}
+
+// Picks up handed over sessions and finished responses
+static void eventLoopDrain(struct EventLoop *loop)
+{
+    pthread_mutex_lock(&loop->lock);
+    struct EventSession *incoming = loop->incoming;
+    struct EventSession *completed = loop->completed;
+    loop->incoming = NULL;
+    loop->completed = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (incoming)
+    {
+        struct EventSession *next = incoming->next;
+        eventLoopAttach(loop, incoming);
+        incoming = next;
+    }
+
+    while (completed)
+    {
+        struct EventSession *next = completed->nextCompleted;
+        completed->busy = 0;
+        completed->outputSent = 0;
+        // A worker that could not build its response (out of memory) is answered as overloaded
+        if (!completed->output)
+            eventSessionRespond(completed, ADMISSION_OVERLOADED_RESPONSE);
+        eventSessionFlush(completed);
+        completed = next;
+    }
+}
+
+// Advances key exchanges and pending writes, and frees finished sessions
+static void eventLoopSweep(struct EventLoop *loop)
+{
+    struct EventSession **link = &loop->sessions;
+    while (*link)
+    {
+        struct EventSession *s = *link;
+
+        if (!s->keyExchanged && !s->closing)
+        {
+            int rc = ssh_handle_key_exchange(s->session);
+            if (rc == SSH_OK)
+            {
+                s->keyExchanged = 1;
+                s->waitingNs = admissionNow();
+            }
+            else if (rc != SSH_AGAIN)
+                s->closing = 1;
+            else if (admission_handshake_ms && admissionNow() - s->acceptedNs > (uint64_t) admission_handshake_ms * 1000000ULL)
+            {
+                admissionCountTimeout(ADMISSION_TIMEOUT_HANDSHAKE);
+                s->closing = 1;
+            }
+        }
+
+        // A client that leaves the session idle, or sends a request too slowly, is disconnected
+        if (s->keyExchanged && !s->busy && !s->output && !s->closing && admission_read_ms &&
+            admissionNow() - s->waitingNs > (uint64_t) admission_read_ms * 1000000ULL)
+        {
+            admissionCountTimeout(ADMISSION_TIMEOUT_READ);
+            eventSessionCloseChannel(s);
+        }
+
+        if (ssh_get_status(s->session) & (SSH_CLOSED | SSH_CLOSED_ERROR))
+            s->closing = 1;
+
+        eventSessionFlush(s);
+
+        if (s->closing && !s->busy)
+        {
+            *link = s->next;
+            eventLoopFree(loop, s);
+            continue;
+        }
+
+        link = &s->next;
+    }
+}
+
+static void *eventLoopMain(void *arg)
+{
+    struct EventLoop *loop = arg;
+
+    while (!__atomic_load_n(&loop->server->stopping, __ATOMIC_SEQ_CST))
+    {
+        eventLoopDrain(loop);
+        eventLoopSweep(loop);
+        ssh_event_dopoll(loop->event, EVENT_LOOP_POLL_TIMEOUT);
+        eventLoopDrain(loop);
+        eventLoopSweep(loop);
+    }
+
+    return NULL;
+}
+
+// Runs after the loop thread has exited and the workers are done: writes the responses that are
+// ready (blocking, there is no loop left to finish them) and closes every session
+static void eventLoopClose(struct EventLoop *loop)
+{
+    eventLoopDrain(loop);
+    while (loop->sessions)
+    {
+        struct EventSession *s = loop->sessions;
+        loop->sessions = s->next;
+        s->busy = 0;
+        ssh_set_blocking(s->session, 1);
+        eventSessionFlush(s);
+        eventLoopFree(loop, s);
+    }
+
+    if (loop->event)
+        ssh_event_free(loop->event);
+    if (loop->wakeFds[0] >= 0)
+    {
+        close(loop->wakeFds[0]);
+        close(loop->wakeFds[1]);
+    }
+}
+
+void eventServerShutdown(struct EventServer *server);
+
+// Starts numLoops event loop threads and numWorkers compute workers with at most queueCapacity
+// requests waiting for a worker. Returns 0 on success.
+int eventServerInit(struct EventServer *server, int numLoops, int numWorkers, size_t queueCapacity, size_t maxRequestSize,
+                    EventRequestHandler handler, EventLinesHandler linesHandler, EventFramesHandler framesHandler)
+{
+    memset(server, 0, sizeof(*server));
+
+    if (numLoops < 1)
+        return -1;
+
+    server->handler = handler;
+    server->linesHandler = linesHandler;
+    server->framesHandler = framesHandler;
+    server->maxRequestSize = maxRequestSize;
+
+    if (workerPoolInit(&server->compute, numWorkers, queueCapacity) != 0)
+        return -1;
+
+    server->loops = calloc(numLoops, sizeof(struct EventLoop));
+    if (!server->loops)
+    {
+        workerPoolShutdown(&server->compute);
+        return -1;
+    }
+    server->numLoops = numLoops;
+
+    for (int i = 0; i < numLoops; i++)
+    {
+        struct EventLoop *loop = &server->loops[i];
+        loop->server = server;
+        loop->wakeFds[0] = loop->wakeFds[1] = -1;
+        pthread_mutex_init(&loop->lock, NULL);
+    }
+
+    for (int i = 0; i < numLoops; i++)
+    {
+        struct EventLoop *loop = &server->loops[i];
+
+        loop->event = ssh_event_new();
+        if (!loop->event || pipe(loop->wakeFds) != 0)
+        {
+            fprintf(stderr, "Error creating event loop\n");
+            eventServerShutdown(server);
+            return -1;
+        }
+
+        fcntl(loop->wakeFds[0], F_SETFL, O_NONBLOCK);
+        fcntl(loop->wakeFds[1], F_SETFL, O_NONBLOCK);
+        ssh_event_add_fd(loop->event, loop->wakeFds[0], POLLIN, eventWakeCallback, loop);
+
+        if (pthread_create(&loop->thread, NULL, eventLoopMain, loop) != 0)
+        {
+            fprintf(stderr, "Error creating event loop thread\n");
+            eventServerShutdown(server);
+            return -1;
+        }
+        loop->started = 1;
+    }
+
+    return 0;
+}
+
+// Hands an accepted session to the loop with the fewest sessions, the loop owns it from here on
+int eventServerAdopt(struct EventServer *server, ssh_session session)
+{
+    struct EventSession *s = calloc(1, sizeof(struct EventSession));
+    if (!s)
+        return -1;
+
+    struct EventLoop *loop = &server->loops[0];
+    for (int i = 1; i < server->numLoops; i++)
+    {
+        if (__atomic_load_n(&server->loops[i].numSessions, __ATOMIC_RELAXED) < __atomic_load_n(&loop->numSessions, __ATOMIC_RELAXED))
+            loop = &server->loops[i];
+    }
+
+    s->session = session;
+    s->loop = loop;
+    s->acceptedNs = admissionNow();
+
+    pthread_mutex_lock(&loop->lock);
+    s->next = loop->incoming;
+    loop->incoming = s;
+    pthread_mutex_unlock(&loop->lock);
+
+    __atomic_fetch_add(&server->sessionsAccepted, 1, __ATOMIC_RELAXED);
+    eventLoopWake(loop);
+    return 0;
+}
+
+void eventServerStatsSnapshot(struct EventServer *server, struct EventServerStats *stats)
+{
+    stats->loops = server->numLoops;
+    stats->sessions = 0;
+    for (int i = 0; i < server->numLoops; i++)
+        stats->sessions += __atomic_load_n(&server->loops[i].numSessions, __ATOMIC_RELAXED);
+    stats->sessionsAccepted = __atomic_load_n(&server->sessionsAccepted, __ATOMIC_RELAXED);
+    stats->requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&server->rejected, __ATOMIC_RELAXED);
+    workerPoolStatsSnapshot(&server->compute, &stats->compute);
+}
+
+// Stops the loops, lets the workers finish the requests they hold, then answers and closes every session
+void eventServerShutdown(struct EventServer *server)
+{
+    __atomic_store_n(&server->stopping, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < server->numLoops; i++)
+    {
+        if (server->loops[i].started)
+        {
+            eventLoopWake(&server->loops[i]);
+            pthread_join(server->loops[i].thread, NULL);
+        }
+    }
+
+    // No loop can submit any more, so the pool can be drained safely
+    workerPoolShutdown(&server->compute);
+
+    for (int i = 0; i < server->numLoops; i++)
+        eventLoopClose(&server->loops[i]);
+
+    free(server->loops);
+    server->loops = NULL;
+    server->numLoops = 0;
+}
+
+#endif
@@ -1,3 +1,6 @@
+// POSIX 2008 plus sched_setaffinity for prefork workers (see prefork.c)
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,37 +12,1969 @@
 #include <libssh/libssh.h>
 #include <libssh/server.h>
 #include "astromath.c"
+#include "exoplanetjson.c"
+#include "exoplanetcodec.c"
+#include "exoplanetbinary.c"
+#include "orbitcache.c"
+#include "resultcache.c"
+#include "catalog.c"
+#include "ephemeris.c"
+#include "config.c"
+#include "workerpool.c"
+#include "admission.c"
+#include "eventserver.c"
+#include "socketserver.c"
+#include "metrics.c"
+#include "batch.c"
+#include "trajectory.c"
+#include "conesearch.c"
+#include "orbitevents.c"
+#include "visualization.c"
+#include "scene.c"
+#include "prefork.c"
+#include "shard.c"
+
+// Largest JSON request accepted from a client, in bytes
+#define MAX_REQUEST_SIZE (16 * 1024 * 1024)
+
+// Streaming mode writes responses once this many bytes are pending, or when no more requests are waiting
+#define STREAM_BATCH_SIZE (64 * 1024)
+
+volatile sig_atomic_t running = 1;
+
+// Startup settings, see config.c
+struct ServerConfig server_config;
+
+// Workers that run accepted sessions (threads mode)
+struct WorkerPool session_pool;
+
+// Event loops and compute workers (event mode)
+struct EventServer event_server;
+
+// Newline-delimited JSON over TCP and Unix sockets, running next to SSH when configured
+struct SocketServer socket_server;
+
+// Planet catalog mapped at startup, empty unless EXOPLANET_CATALOG names a catalog file
+struct Catalog server_catalog;
+
+// Chebyshev tables of cataloged planets, empty unless EXOPLANET_EPHEMERIS names an ephemeris file
+struct Ephemeris server_ephemeris;
+
+// Sky search indexes over the catalog, set up when a catalog is loaded
+struct ConeSearch server_cone_search;
+
+// Octrees of the catalog's positions for scene requests, set up when a catalog is loaded
+struct SceneCache server_scene_cache;
+
+// Prometheus endpoint, running when EXOPLANET_METRICS_PORT is set
+struct MetricsServer metrics_server;
+
+// Sessions currently held by a worker (threads mode)
+int active_sessions;
+
+int process_request(ssh_session session);
+
+// The function that a pool worker runs to handle the session
+void handle_session(void *arg)
+{
+    ssh_session session = (ssh_session)arg;
+    __atomic_fetch_add(&active_sessions, 1, __ATOMIC_RELAXED);
+
+    // Bounds the key exchange and every other blocking step of the session (opening a channel,
+    // waiting for the client to make room for a response)
+    if (admission_handshake_ms > 0) {
+        long seconds = admission_handshake_ms / 1000;
+        long microseconds = (admission_handshake_ms % 1000) * 1000L;
+        ssh_options_set(session, SSH_OPTIONS_TIMEOUT, &seconds);
+        ssh_options_set(session, SSH_OPTIONS_TIMEOUT_USEC, &microseconds);
+    }
+
+    process_request(session);
+    __atomic_fetch_sub(&active_sessions, 1, __ATOMIC_RELAXED);
+    ssh_disconnect(session);
+    ssh_free(session);
+}
+
+// Answer to a request that ran out of time before it was answered
+json_t *deadline_response(void)
+{
+    json_t *response = error_response("Deadline exceeded.");
+    json_object_set_new(response, "code", json_string("deadline_exceeded"));
+    return response;
+}
+
+// Starts the deadline of a parsed request: the server's request timeout, or the request's
+// "deadline_ms" when that is shorter. Returns -1 when it has passed already (the request waited
+// too long for a worker) and the request should be answered with deadline_response() instead.
+int start_request_deadline(json_t *root)
+{
+    json_t *deadline_json = json_object_get(root, "deadline_ms");
+    admissionSetDeadline(json_is_number(deadline_json) ? json_number_value(deadline_json) : 0);
+    return admissionExpired() ? -1 : 0;
+}
+
+// Convert a requested Unix time to the time used for calculations, defaulting to now
+double resolve_request_time(double unix_time)
+{
+    // Check if unixTime is provided and not null
+    if (unix_time > 0)
+        return unix_time;
+
+    // Get the current system time
+    time_t raw_time;
+    time(&raw_time);
+    return (double) raw_time;
+}
+
+// Starts a planet from its catalog record when the request (an object with a "name" or just a
+// name string) names a cataloged planet, returns the record number or -1
+long exoplanet_from_catalog(json_t *planet_json, struct Exoplanet *exoplanet)
+{
+    const char *name = json_is_string(planet_json) ? json_string_value(planet_json) : json_string_value(json_object_get(planet_json, "name"));
+    if (name == NULL)
+        return -1;
+
+    long record = catalogFind(&server_catalog, name);
+    if (record >= 0)
+        catalogGetPlanet(&server_catalog, record, exoplanet);
+    return record;
+}
+
+// The shard owning a planet named like in exoplanet_from_catalog when that is another replica,
+// -1 when this one owns it, it has no name or the catalog is not sharded
+int foreign_shard(json_t *planet_json)
+{
+    if (server_config.shardCount <= 1)
+        return -1;
+
+    const char *name = json_is_string(planet_json) ? json_string_value(planet_json) : json_string_value(json_object_get(planet_json, "name"));
+    if (name == NULL)
+        return -1;
+
+    int shard = shardOf(name, server_config.shardCount);
+    return shard == server_config.shardIndex ? -1 : shard;
+}
+
+// Answer to a request for a planet another shard owns, telling the client which one
+json_t *wrong_shard_response(int shard)
+{
+    json_t *response = error_response("Planet is owned by another shard.");
+    json_object_set_new(response, "code", json_string("wrong_shard"));
+    json_object_set_new(response, "shard", json_integer(shard));
+    return response;
+}
+
+// Computes the position of a planet filled from a request (record is its catalog record or -1):
+// distance, right ascension, declination and galactic coordinates
+void evaluate_exoplanet(struct Exoplanet *exoplanet, long record)
+{
+    // Convert system time to a double (in seconds), rounded down to the result cache's quantum
+    double current_time = resultCacheEpoch(resolve_request_time(exoplanet->unixTime));
+
+    // A cataloged planet with its catalog elements is looked up in the ephemeris tables when covered
+    const struct OrbitHandle *catalog_orbit = catalogOrbitFor(&server_catalog, record, exoplanet);
+    uint64_t stage_start = metricsStart();
+    if (catalog_orbit && ephemerisEvaluate(&server_ephemeris, record, current_time, exoplanet)) {
+        metricsRecord(METRICS_SOLVE, stage_start);
+        return;
+    }
+
+    // Repeated requests for the same orbit at the same epoch are answered from the result cache
+    if (resultCacheGet(exoplanet, current_time))
+        return;
+
+    // Calculate the distance to the exoplanet & the Right Ascension (RA) from the cached orbit
+    struct OrbitHandle orbit;
+    if (catalog_orbit)
+        orbit = *catalog_orbit;
+    else
+        orbitCacheGet(exoplanet, &orbit);
+
+    stage_start = metricsStart();
+    orbitHandleEvaluate(&orbit, current_time, exoplanet);
+    metricsRecord(METRICS_SOLVE, stage_start);
+
+    // set galactic coordinates
+    stage_start = metricsStart();
+    setGalacticCoordinates(exoplanet);
+    metricsRecord(METRICS_GALACTIC, stage_start);
+
+    // A failed solve leaves the requested declination in place, so only solved positions are shared
+    if (!isnan(exoplanet->distance))
+        resultCachePut(exoplanet, current_time);
+}
+
+// Handles the default request: one exoplanet at one point in time
+json_t *process_exoplanet_request(json_t *root)
+{
+    int shard = foreign_shard(root);
+    if (shard >= 0)
+        return wrong_shard_response(shard);
+
+    // Define the exoplanet data
+    struct Exoplanet exoplanet = get_default_exoplanet();
+
+    // Start from the catalog when the planet is known, then update exoplanet properties from JSON
+    long record = exoplanet_from_catalog(root, &exoplanet);
+    exoplanet_from_json(root, &exoplanet);
+
+    evaluate_exoplanet(&exoplanet, record);
+
+    return exoplanet_to_json(&exoplanet);
+}
+
+// Answers a plain exoplanet request with the dedicated codec, writing the response into buffer
+// without building JSON trees. Returns the response length, or 0 when the request has to go
+// through jansson (other request types, unusual input, or the codec is switched off).
+size_t answer_exoplanet_request(const char *request, size_t length, char *buffer, size_t capacity)
+{
+    if (!server_config.fastCodec)
+        return 0;
+
+    struct ExoplanetRequest decoded;
+    size_t consumed;
+    uint64_t stage_start = metricsStart();
+    int decoded_ok = exoplanet_decode_request(request, length, &decoded, &consumed) == 0 && consumed == length;
+    metricsRecord(METRICS_PARSE, stage_start);
+    if (!decoded_ok)
+        return 0;
+
+    // Planets of other shards are turned away by process_exoplanet_request
+    if (decoded.hasName && server_config.shardCount > 1 && shardOf(decoded.name, server_config.shardCount) != server_config.shardIndex)
+        return 0;
+
+    // A request that waited past its deadline is not computed, as start_request_deadline does for jansson
+    admissionSetDeadline(decoded.deadlineMs);
+    if (admissionExpired() && capacity >= sizeof(ADMISSION_DEADLINE_RESPONSE)) {
+        memcpy(buffer, ADMISSION_DEADLINE_RESPONSE, sizeof(ADMISSION_DEADLINE_RESPONSE));
+        return sizeof(ADMISSION_DEADLINE_RESPONSE) - 1;
+    }
+
+    struct Exoplanet exoplanet = get_default_exoplanet();
+    long record = decoded.hasName ? catalogFind(&server_catalog, decoded.name) : -1;
+    if (record >= 0)
+        catalogGetPlanet(&server_catalog, record, &exoplanet);
+    exoplanet_request_apply(&decoded, &exoplanet);
+
+    evaluate_exoplanet(&exoplanet, record);
+
+    stage_start = metricsStart();
+    size_t written = exoplanet_encode(&exoplanet, buffer, capacity);
+    metricsRecord(METRICS_SERIALIZE, stage_start);
+    return written;
+}
+
+// Fills the epoch column of a batch from either an explicit "times" array or a
+// "time_grid" object with start, stop and step, returns the number of epochs or 0 on bad input
+size_t batch_epoch_count(json_t *root)
+{
+    json_t *times_json = json_object_get(root, "times");
+    if (json_is_array(times_json))
+        return json_array_size(times_json);
+
+    json_t *grid_json = json_object_get(root, "time_grid");
+    if (json_is_object(grid_json)) {
+        json_t *start_json = json_object_get(grid_json, "start");
+        json_t *stop_json = json_object_get(grid_json, "stop");
+        json_t *step_json = json_object_get(grid_json, "step");
+        if (!json_is_number(start_json) || !json_is_number(stop_json) || !json_is_number(step_json))
+            return 0;
+
+        double start = json_number_value(start_json);
+        double stop = json_number_value(stop_json);
+        double step = json_number_value(step_json);
+        if (!(step > 0) || !(stop >= start))
+            return 0;
+
+        double count = floor((stop - start) / step) + 1;
+        return count > MAX_BATCH_RESULTS ? MAX_BATCH_RESULTS + 1 : (size_t) count;
+    }
+
+    // Without a time grid every planet is evaluated once at the current time
+    return 1;
+}
+
+void batch_fill_epochs(json_t *root, struct EphemerisBatch *batch)
+{
+    json_t *times_json = json_object_get(root, "times");
+    json_t *grid_json = json_object_get(root, "time_grid");
+
+    for (size_t j = 0; j < batch->numEpochs; j++) {
+        double unix_time = 0.0;
+
+        if (json_is_array(times_json)) {
+            json_t *time_json = json_array_get(times_json, j);
+            if (json_is_number(time_json))
+                unix_time = json_number_value(time_json);
+        } else if (json_is_object(grid_json)) {
+            unix_time = json_number_value(json_object_get(grid_json, "start")) + j * json_number_value(json_object_get(grid_json, "step"));
+        }
+
+        batch->epochs[j] = resolve_request_time(unix_time);
+    }
+}
+
+// Handles a batch request: every planet in "planets" evaluated at every epoch of the time grid
+json_t *process_batch_request(json_t *root)
+{
+    json_t *planets_json = json_object_get(root, "planets");
+    if (!json_is_array(planets_json) || json_array_size(planets_json) == 0)
+        return error_response("Batch request requires a non-empty \"planets\" array.");
+
+    size_t num_planets = json_array_size(planets_json);
+    size_t num_epochs = batch_epoch_count(root);
+
+    // A sharded batch only holds this replica's planets, the router splits batches by owner
+    for (size_t i = 0; i < num_planets; i++) {
+        int shard = foreign_shard(json_array_get(planets_json, i));
+        if (shard >= 0)
+            return wrong_shard_response(shard);
+    }
+
+    struct EphemerisBatch batch;
+    if (ephemerisBatchInit(&batch, num_planets, num_epochs) != 0)
+        return error_response("Batch request has an invalid time grid or too many results.");
+
+    batch_fill_epochs(root, &batch);
+
+    // Names stay in the request, the kernel only sees the orbital elements
+    const char **names = malloc(sizeof(char *) * num_planets);
+    if (!names) {
+        ephemerisBatchFree(&batch);
+        return error_response("Out of memory.");
+    }
+
+    for (size_t i = 0; i < num_planets; i++) {
+        struct Exoplanet exoplanet = get_default_exoplanet();
+        json_t *planet_json = json_array_get(planets_json, i);
+        long record = exoplanet_from_catalog(planet_json, &exoplanet);
+        if (json_is_object(planet_json))
+            exoplanet_from_json(planet_json, &exoplanet);
+
+        // A bare name carries no elements, so it has to be in the catalog
+        if (json_is_string(planet_json) && record < 0) {
+            free(names);
+            ephemerisBatchFree(&batch);
+            return error_response("Batch request names a planet that is not in the catalog.");
+        }
+
+        names[i] = exoplanet.name;
+
+        const struct OrbitHandle *catalog_orbit = catalogOrbitFor(&server_catalog, record, &exoplanet);
+        if (catalog_orbit)
+            ephemerisBatchSetOrbit(&batch, i, catalog_orbit);
+        else
+            ephemerisBatchSetPlanet(&batch, i, &exoplanet);
+    }
+
+    if (admissionExpired()) {
+        free(names);
+        ephemerisBatchFree(&batch);
+        return deadline_response();
+    }
+
+    if (computeEphemerisBatch(&batch) != 0) {
+        free(names);
+        ephemerisBatchFree(&batch);
+        return error_response("Out of memory.");
+    }
+
+    // Building the JSON of a large grid can take longer than computing it
+    if (admissionExpired()) {
+        free(names);
+        ephemerisBatchFree(&batch);
+        return deadline_response();
+    }
+
+    // Serialize one entry per planet, each holding its positions in epoch order
+    json_t *results = json_array();
+    for (size_t i = 0; i < num_planets; i++) {
+        json_t *planet_result = json_object();
+        json_t *positions = json_array();
+
+        json_object_set_new(planet_result, "name", json_string(names[i]));
+        json_object_set_new(planet_result, "index", json_integer((json_int_t) i));
+
+        for (size_t j = 0; j < num_epochs; j++) {
+            size_t k = i * num_epochs + j;
+            json_t *position = json_object();
+
+            json_object_set_new(position, "unixTime", json_real(batch.epochs[j]));
+            json_object_set_new(position, "distance", json_real_or_null(batch.distance[k]));
+            json_object_set_new(position, "ra", json_real_or_null(batch.ra[k]));
+            json_object_set_new(position, "declination", json_real_or_null(batch.declination[k]));
+            json_object_set_new(position, "galacticLongitude", json_real_or_null(batch.galacticLongitude[k]));
+            json_object_set_new(position, "galacticLatitude", json_real_or_null(batch.galacticLatitude[k]));
+
+            if (isnan(batch.distance[k]) || isnan(batch.ra[k]))
+                json_object_set_new(position, "error", json_string("Failed to solve Kepler's equation given the input."));
+
+            json_array_append_new(positions, position);
+        }
+
+        json_object_set_new(planet_result, "positions", positions);
+        json_array_append_new(results, planet_result);
+    }
+
+    free(names);
+    ephemerisBatchFree(&batch);
+
+    json_t *response = json_object();
+    json_object_set_new(response, "results", results);
+    return response;
+}
+
+// Most matches a sky search returns, and the default when the request sets no limit
+#define MAX_SKY_SEARCH_RESULTS 100000
+#define DEFAULT_SKY_SEARCH_RESULTS 1000
+
+// Reads a number from a request object into value, returns 0 when the key is absent or not a number
+int json_get_number(json_t *object, const char *key, double *value)
+{
+    json_t *number = json_object_get(object, key);
+    if (!json_is_number(number))
+        return 0;
+    *value = json_number_value(number);
+    return 1;
+}
+
+// Reads an array of three numbers from a request object, returns 0 when it is absent or malformed
+int json_get_vector(json_t *object, const char *key, double vector[3])
+{
+    json_t *array = json_object_get(object, key);
+    if (!json_is_array(array) || json_array_size(array) != 3)
+        return 0;
+    for (size_t k = 0; k < 3; k++) {
+        if (!json_is_number(json_array_get(array, k)))
+            return 0;
+        vector[k] = json_number_value(json_array_get(array, k));
+    }
+    return 1;
+}
+
+int compare_cone_matches(const void *a, const void *b)
+{
+    const struct ConeMatch *x = a, *y = b;
+    if (x->separation != y->separation)
+        return x->separation < y->separation ? -1 : 1;
+    return x->record < y->record ? -1 : x->record > y->record;
+}
+
+// Handles a cone or box search over the catalog. A cone is centered on "ra" (radians) and
+// "declination" or on "galacticLongitude" and "galacticLatitude" with a "radius" (degrees). A box
+// takes "raMin", "raMax", "declinationMin" and "declinationMax", or the same ranges of galactic
+// coordinates. Matches are sorted by separation from the center.
+json_t *process_sky_search_request(json_t *root, int box)
+{
+    if (server_cone_search.catalog == NULL)
+        return error_response("Sky searches need a planet catalog.");
+
+    double unix_time = 0;
+    json_get_number(root, "unixTime", &unix_time);
+    double current_time = resolve_request_time(unix_time);
+
+    struct ConeQuery query;
+    int valid = 0;
+    double lon, lat, radius, lon_min, lon_max, lat_min, lat_max;
+    if (!box && json_get_number(root, "radius", &radius)) {
+        if (json_get_number(root, "ra", &lon) && json_get_number(root, "declination", &lat))
+            valid = coneQueryCone(&query, CONE_FRAME_EQUATORIAL, current_time, lon, DEG_TO_RAD(lat), DEG_TO_RAD(radius)) == 0;
+        else if (json_get_number(root, "galacticLongitude", &lon) && json_get_number(root, "galacticLatitude", &lat))
+            valid = coneQueryCone(&query, CONE_FRAME_GALACTIC, current_time, DEG_TO_RAD(lon), DEG_TO_RAD(lat), DEG_TO_RAD(radius)) == 0;
+    } else if (box) {
+        if (json_get_number(root, "raMin", &lon_min) && json_get_number(root, "raMax", &lon_max) &&
+            json_get_number(root, "declinationMin", &lat_min) && json_get_number(root, "declinationMax", &lat_max))
+            valid = coneQueryBox(&query, CONE_FRAME_EQUATORIAL, current_time, lon_min, lon_max, DEG_TO_RAD(lat_min), DEG_TO_RAD(lat_max)) == 0;
+        else if (json_get_number(root, "galacticLongitudeMin", &lon_min) && json_get_number(root, "galacticLongitudeMax", &lon_max) &&
+                 json_get_number(root, "galacticLatitudeMin", &lat_min) && json_get_number(root, "galacticLatitudeMax", &lat_max))
+            valid = coneQueryBox(&query, CONE_FRAME_GALACTIC, current_time, DEG_TO_RAD(lon_min), DEG_TO_RAD(lon_max),
+                                 DEG_TO_RAD(lat_min), DEG_TO_RAD(lat_max)) == 0;
+    }
+    if (!valid)
+        return error_response(box ? "Box search requires ra and declination or galactic longitude and latitude ranges."
+                                  : "Cone search requires ra and declination or galactic coordinates, and a radius of 0 to 180 degrees.");
+
+    double limit_value = DEFAULT_SKY_SEARCH_RESULTS;
+    json_get_number(root, "limit", &limit_value);
+    if (!(limit_value >= 1 && limit_value <= MAX_SKY_SEARCH_RESULTS))
+        return error_response("Sky search limit must be between 1 and 100000.");
+    size_t limit = (size_t) limit_value;
+
+    struct ConeMatch *matches;
+    size_t count;
+    uint64_t stage_start = metricsStart();
+    int status = coneSearchRun(&server_cone_search, &query, &matches, &count);
+    metricsRecord(METRICS_SOLVE, stage_start);
+    if (status != 0)
+        return error_response("Out of memory.");
+
+    qsort(matches, count, sizeof(struct ConeMatch), compare_cone_matches);
+
+    json_t *results = json_array();
+    for (size_t i = 0; i < count && i < limit; i++) {
+        const struct ConeMatch *match = &matches[i];
+        json_t *result = json_object();
+
+        json_object_set_new(result, "name", json_string(catalogName(&server_catalog, match->record)));
+        json_object_set_new(result, "record", json_integer((json_int_t) match->record));
+        json_object_set_new(result, "separation", json_real(RAD_TO_DEG(match->separation)));
+        json_object_set_new(result, "distance", json_real(match->distance));
+        json_object_set_new(result, "ra", json_real(match->ra));
+        json_object_set_new(result, "declination", json_real(match->declination));
+        json_object_set_new(result, "galacticLongitude", json_real(match->galacticLongitude));
+        json_object_set_new(result, "galacticLatitude", json_real(match->galacticLatitude));
+        json_array_append_new(results, result);
+    }
+    free(matches);
+
+    json_t *response = json_object();
+    json_object_set_new(response, "unixTime", json_real(current_time));
+    json_object_set_new(response, "count", json_integer((json_int_t) count));
+    if (count > limit)
+        json_object_set_new(response, "truncated", json_true());
+    json_object_set_new(response, "results", results);
+    return response;
+}
+
+// Most points a scene returns, and the default when the request sets no budget
+#define MAX_SCENE_POINTS 100000
+#define DEFAULT_SCENE_POINTS 10000
+
+// Handles a scene request: the cataloged planets at "unixTime" as points in galactic Cartesian
+// coordinates (light years), at most "budget" of them. An optional "camera" with a "position", a
+// "direction", an "up" vector, a vertical "fov" (degrees), an "aspect" ratio and "near" and "far"
+// distances limits them to what it sees. Where the budget does not allow every planet, a point
+// stands for a group of nearby planets and gives their number.
+json_t *process_scene_request(json_t *root)
+{
+    if (server_scene_cache.catalog == NULL)
+        return error_response("Scenes need a planet catalog.");
+
+    double unix_time = 0;
+    json_get_number(root, "unixTime", &unix_time);
+    double current_time = resolve_request_time(unix_time);
+
+    double budget_value = DEFAULT_SCENE_POINTS;
+    json_get_number(root, "budget", &budget_value);
+    if (!(budget_value >= 1 && budget_value <= MAX_SCENE_POINTS))
+        return error_response("Scene budget must be between 1 and 100000.");
+
+    struct SceneCamera camera;
+    json_t *camera_json = json_object_get(root, "camera");
+    if (camera_json != NULL) {
+        double fov = 60;
+        memset(&camera, 0, sizeof(camera));
+        camera.up[2] = 1;
+        camera.aspect = 16.0 / 9.0;
+        camera.far = INFINITY;
+        json_get_vector(camera_json, "up", camera.up);
+        json_get_number(camera_json, "fov", &fov);
+        json_get_number(camera_json, "aspect", &camera.aspect);
+        json_get_number(camera_json, "near", &camera.near);
+        json_get_number(camera_json, "far", &camera.far);
+        camera.fov = DEG_TO_RAD(fov);
+        if (!json_is_object(camera_json) || !json_get_vector(camera_json, "position", camera.position) ||
+            !json_get_vector(camera_json, "direction", camera.direction))
+            return error_response("Scene camera requires a position and a direction.");
+    }
+
+    struct ScenePoint *points;
+    size_t count, represented;
+    double scene_epoch;
+    uint64_t stage_start = metricsStart();
+    int status = sceneSelect(&server_scene_cache, current_time, camera_json ? &camera : NULL, (size_t) budget_value,
+                             &points, &count, &represented, &scene_epoch);
+    metricsRecord(METRICS_SOLVE, stage_start);
+    if (status == -1)
+        return error_response("Scene camera needs a direction not along up, a fov between 0 and 180 degrees, a positive aspect and near below far.");
+    if (status != 0)
+        return error_response("Out of memory.");
+
+    // Each point is [x, y, z, planets]
+    json_t *points_json = json_array();
+    for (size_t i = 0; i < count; i++) {
+        json_t *point = json_array();
+        json_array_append_new(point, json_real(points[i].position[0]));
+        json_array_append_new(point, json_real(points[i].position[1]));
+        json_array_append_new(point, json_real(points[i].position[2]));
+        json_array_append_new(point, json_integer((json_int_t) points[i].count));
+        json_array_append_new(points_json, point);
+    }
+    free(points);
+
+    json_t *response = json_object();
+    json_object_set_new(response, "unixTime", json_real(scene_epoch));
+    json_object_set_new(response, "count", json_integer((json_int_t) count));
+    json_object_set_new(response, "planets", json_integer((json_int_t) represented));
+    json_object_set_new(response, "points", points_json);
+    return response;
+}
+
+// Handles a solver statistics request: which Kepler solver is active and its iteration histogram
+json_t *process_solver_stats_request(void)
+{
+    struct KeplerSolverStats stats;
+    keplerSolverStatsSnapshot(&stats);
+
+    json_t *histogram = json_array();
+    for (int i = 0; i < KEPLER_STATS_BUCKETS; i++)
+        json_array_append_new(histogram, json_integer((json_int_t) stats.histogram[i]));
+
+    json_t *response = json_object();
+    json_object_set_new(response, "solver", json_string(keplerSolverName(kepler_solver)));
+    json_object_set_new(response, "calls", json_integer((json_int_t) stats.calls));
+    json_object_set_new(response, "failures", json_integer((json_int_t) stats.failures));
+    json_object_set_new(response, "meanIterations", json_real(stats.calls ? (double) stats.iterations / stats.calls : 0.0));
+    json_object_set_new(response, "iterationHistogram", histogram);
+    return response;
+}
+
+// Requests in flight and the load shed and timeouts of admission control (see admission.c)
+json_t *admission_stats_json(void)
+{
+    struct AdmissionStats stats;
+    admissionStatsSnapshot(&stats);
+
+    json_t *admission_json = json_object();
+    json_object_set_new(admission_json, "inFlight", json_integer(stats.inFlight));
+    json_object_set_new(admission_json, "maxInFlight", json_integer(stats.maxInFlight));
+    json_object_set_new(admission_json, "admitted", json_integer((json_int_t) stats.admitted));
+
+    json_t *shed_json = json_object();
+    for (int i = 0; i < ADMISSION_SHED_REASONS; i++)
+        json_object_set_new(shed_json, admission_shed_names[i], json_integer((json_int_t) stats.shed[i]));
+    json_object_set_new(admission_json, "shed", shed_json);
+
+    json_t *timeouts_json = json_object();
+    for (int i = 0; i < ADMISSION_TIMEOUTS; i++)
+        json_object_set_new(timeouts_json, admission_timeout_names[i], json_integer((json_int_t) stats.timeouts[i]));
+    json_object_set_new(admission_json, "timeouts", timeouts_json);
+    return admission_json;
+}
+
+// Handles a server statistics request: session worker pool occupancy and backlog, or in event mode
+// the open sessions and the compute pool behind the event loops
+json_t *process_server_stats_request(void)
+{
+    json_t *response = json_object();
+    json_object_set_new(response, "admission", admission_stats_json());
+    if (server_config.shardCount > 1) {
+        json_object_set_new(response, "shard", json_integer(server_config.shardIndex));
+        json_object_set_new(response, "shardCount", json_integer(server_config.shardCount));
+    }
+
+    if (server_config.tcpPort > 0 || server_config.unixSocket) {
+        struct SocketServerStats socket_stats;
+        socketServerStatsSnapshot(&socket_server, &socket_stats);
+
+        json_t *socket_json = json_object();
+        json_object_set_new(socket_json, "connections", json_integer(socket_stats.connections));
+        json_object_set_new(socket_json, "connectionsAccepted", json_integer((json_int_t) socket_stats.connectionsAccepted));
+        json_object_set_new(socket_json, "requests", json_integer((json_int_t) socket_stats.requests));
+        json_object_set_new(socket_json, "requestsRejected", json_integer((json_int_t) socket_stats.rejected));
+        json_object_set_new(socket_json, "workers", json_integer(socket_stats.compute.workers));
+        json_object_set_new(socket_json, "busyWorkers", json_integer(socket_stats.compute.busyWorkers));
+        json_object_set_new(socket_json, "queueDepth", json_integer((json_int_t) socket_stats.compute.queueDepth));
+        json_object_set_new(response, "socket", socket_json);
+    }
+
+    if (server_config.mode == SERVER_MODE_EVENT) {
+        struct EventServerStats stats;
+        eventServerStatsSnapshot(&event_server, &stats);
+
+        json_object_set_new(response, "mode", json_string("event"));
+        json_object_set_new(response, "eventLoops", json_integer(stats.loops));
+        json_object_set_new(response, "sessions", json_integer(stats.sessions));
+        json_object_set_new(response, "sessionsAccepted", json_integer((json_int_t) stats.sessionsAccepted));
+        json_object_set_new(response, "requests", json_integer((json_int_t) stats.requests));
+        json_object_set_new(response, "requestsRejected", json_integer((json_int_t) stats.rejected));
+        json_object_set_new(response, "workers", json_integer(stats.compute.workers));
+        json_object_set_new(response, "busyWorkers", json_integer(stats.compute.busyWorkers));
+        json_object_set_new(response, "queueDepth", json_integer((json_int_t) stats.compute.queueDepth));
+        json_object_set_new(response, "queueCapacity", json_integer((json_int_t) stats.compute.queueCapacity));
+        return response;
+    }
+
+    struct WorkerPoolStats stats;
+    workerPoolStatsSnapshot(&session_pool, &stats);
+
+    json_object_set_new(response, "mode", json_string("threads"));
+    json_object_set_new(response, "workers", json_integer(stats.workers));
+    json_object_set_new(response, "busyWorkers", json_integer(stats.busyWorkers));
+    json_object_set_new(response, "queueDepth", json_integer((json_int_t) stats.queueDepth));
+    json_object_set_new(response, "queueCapacity", json_integer((json_int_t) stats.queueCapacity));
+    json_object_set_new(response, "queuePolicy", json_string(server_config.queueBlock ? "block" : "reject"));
+    json_object_set_new(response, "sessionsAccepted", json_integer((json_int_t) stats.submitted));
+    json_object_set_new(response, "sessionsRejected", json_integer((json_int_t) stats.rejected));
+    json_object_set_new(response, "sessionsStolen", json_integer((json_int_t) stats.stolen));
+    return response;
+}
+
+// Handles a cache statistics request
+json_t *process_cache_stats_request(void)
+{
+    struct OrbitCacheStats orbit_stats;
+    orbitCacheStatsSnapshot(&orbit_stats);
+
+    json_t *orbit_cache_json = json_object();
+    json_object_set_new(orbit_cache_json, "hits", json_integer((json_int_t) orbit_stats.hits));
+    json_object_set_new(orbit_cache_json, "misses", json_integer((json_int_t) orbit_stats.misses));
+    json_object_set_new(orbit_cache_json, "entries", json_integer((json_int_t) orbit_stats.entries));
+    json_object_set_new(orbit_cache_json, "capacity", json_integer((json_int_t) ORBIT_CACHE_SHARDS * ORBIT_CACHE_SLOTS_PER_SHARD));
+
+    struct ResultCacheStats result_stats;
+    resultCacheStatsSnapshot(&result_stats);
+
+    json_t *result_cache_json = json_object();
+    json_object_set_new(result_cache_json, "hits", json_integer((json_int_t) result_stats.hits));
+    json_object_set_new(result_cache_json, "misses", json_integer((json_int_t) result_stats.misses));
+    json_object_set_new(result_cache_json, "entries", json_integer((json_int_t) result_stats.entries));
+    json_object_set_new(result_cache_json, "capacity", json_integer((json_int_t) result_stats.capacity));
+    json_object_set_new(result_cache_json, "quantumSeconds", json_real(result_stats.quantum));
+
+    struct EphemerisStats table_stats;
+    ephemerisStatsSnapshot(&table_stats);
+
+    json_t *ephemeris_json = json_object();
+    json_object_set_new(ephemeris_json, "hits", json_integer((json_int_t) table_stats.hits));
+    json_object_set_new(ephemeris_json, "misses", json_integer((json_int_t) table_stats.misses));
+    json_object_set_new(ephemeris_json, "planets", json_integer((json_int_t) server_ephemeris.count));
+
+    struct ConeSearchStats cone_stats;
+    coneSearchStatsSnapshot(&server_cone_search, &cone_stats);
+
+    json_t *cone_json = json_object();
+    json_object_set_new(cone_json, "searches", json_integer((json_int_t) cone_stats.searches));
+    json_object_set_new(cone_json, "hits", json_integer((json_int_t) cone_stats.indexHits));
+    json_object_set_new(cone_json, "misses", json_integer((json_int_t) cone_stats.indexBuilds));
+    json_object_set_new(cone_json, "entries", json_integer((json_int_t) cone_stats.indexes));
+    json_object_set_new(cone_json, "capacity", json_integer(CONE_INDEX_CACHE));
+    json_object_set_new(cone_json, "bucketSeconds", json_integer(server_config.coneBucketSeconds));
+    json_object_set_new(cone_json, "candidates", json_integer((json_int_t) cone_stats.candidates));
+    json_object_set_new(cone_json, "matches", json_integer((json_int_t) cone_stats.matches));
+
+    struct SceneStats scene_stats;
+    sceneStatsSnapshot(&server_scene_cache, &scene_stats);
+
+    json_t *scene_json = json_object();
+    json_object_set_new(scene_json, "selections", json_integer((json_int_t) scene_stats.selections));
+    json_object_set_new(scene_json, "hits", json_integer((json_int_t) scene_stats.hits));
+    json_object_set_new(scene_json, "refits", json_integer((json_int_t) scene_stats.refits));
+    json_object_set_new(scene_json, "builds", json_integer((json_int_t) scene_stats.builds));
+    json_object_set_new(scene_json, "entries", json_integer((json_int_t) scene_stats.scenes));
+    json_object_set_new(scene_json, "capacity", json_integer(SCENE_CACHE));
+    json_object_set_new(scene_json, "epochSeconds", json_integer(server_config.sceneEpochSeconds));
+
+    json_t *response = json_object();
+    json_object_set_new(response, "orbitCache", orbit_cache_json);
+    json_object_set_new(response, "resultCache", result_cache_json);
+    json_object_set_new(response, "ephemeris", ephemeris_json);
+    json_object_set_new(response, "coneIndex", cone_json);
+    json_object_set_new(response, "scene", scene_json);
+    return response;
+}
+
+// Appends the server-wide gauges and counters to a metrics scrape: sessions and threads, the
+// Kepler solver and the caches. The stage histograms are written by metrics.c.
+void collect_server_metrics(struct MetricsText *text)
+{
+    // Thread pools by name, each sample family below is written as one group
+    const char *pool_names[5];
+    struct WorkerPoolStats pools[5];
+    int num_pools = 0;
+    int ssh_sessions;
+    int socket_connections = -1;
+    int event_loops = 0;
+
+    if (server_config.mode == SERVER_MODE_EVENT) {
+        struct EventServerStats stats;
+        eventServerStatsSnapshot(&event_server, &stats);
+        ssh_sessions = stats.sessions;
+        event_loops = stats.loops;
+        pool_names[num_pools] = "compute";
+        pools[num_pools++] = stats.compute;
+    } else {
+        ssh_sessions = __atomic_load_n(&active_sessions, __ATOMIC_RELAXED);
+        pool_names[num_pools] = "session";
+        workerPoolStatsSnapshot(&session_pool, &pools[num_pools++]);
+    }
+
+    if (server_config.tcpPort > 0 || server_config.unixSocket) {
+        struct SocketServerStats stats;
+        socketServerStatsSnapshot(&socket_server, &stats);
+        socket_connections = stats.connections;
+        pool_names[num_pools] = "socket_compute";
+        pools[num_pools++] = stats.compute;
+    }
+
+    pool_names[num_pools] = "tasks";
+    workerPoolStatsSnapshot(&worker_task_pool, &pools[num_pools++]);
+
+    metricsHeader(text, "exoplanet_sessions_active", "gauge", "Open sessions or connections by transport.");
+    metricsPrintf(text, "exoplanet_sessions_active{transport=\"ssh\"} %d\n", ssh_sessions);
+    if (socket_connections >= 0)
+        metricsPrintf(text, "exoplanet_sessions_active{transport=\"socket\"} %d\n", socket_connections);
+
+    metricsHeader(text, "exoplanet_threads", "gauge", "Threads by pool.");
+    if (event_loops > 0)
+        metricsPrintf(text, "exoplanet_threads{pool=\"event_loop\"} %d\n", event_loops);
+    for (int i = 0; i < num_pools; i++)
+        metricsPrintf(text, "exoplanet_threads{pool=\"%s\"} %d\n", pool_names[i], pools[i].workers);
+
+    metricsHeader(text, "exoplanet_threads_busy", "gauge", "Threads of a pool working on a session or request.");
+    for (int i = 0; i < num_pools; i++)
+        metricsPrintf(text, "exoplanet_threads_busy{pool=\"%s\"} %d\n", pool_names[i], pools[i].busyWorkers);
+
+    metricsHeader(text, "exoplanet_queue_depth", "gauge", "Sessions or requests waiting for a thread of a pool.");
+    for (int i = 0; i < num_pools; i++)
+        metricsPrintf(text, "exoplanet_queue_depth{pool=\"%s\"} %zu\n", pool_names[i], pools[i].queueDepth);
+
+    metricsHeader(text, "exoplanet_rejected_total", "counter", "Sessions or requests turned away because a pool's queue was full.");
+    for (int i = 0; i < num_pools; i++)
+        metricsPrintf(text, "exoplanet_rejected_total{pool=\"%s\"} %llu\n", pool_names[i], pools[i].rejected);
+
+    struct AdmissionStats admission_stats;
+    admissionStatsSnapshot(&admission_stats);
+
+    metricsHeader(text, "exoplanet_requests_in_flight", "gauge", "Requests being computed.");
+    metricsPrintf(text, "exoplanet_requests_in_flight %d\n", admission_stats.inFlight);
+
+    metricsHeader(text, "exoplanet_shed_total", "counter", "Requests answered with an overloaded error instead of being computed.");
+    for (int i = 0; i < ADMISSION_SHED_REASONS; i++)
+        metricsPrintf(text, "exoplanet_shed_total{reason=\"%s\"} %llu\n", admission_shed_names[i], admission_stats.shed[i]);
+
+    metricsHeader(text, "exoplanet_timeouts_total", "counter", "Reads, SSH handshakes and requests that ran out of time.");
+    for (int i = 0; i < ADMISSION_TIMEOUTS; i++)
+        metricsPrintf(text, "exoplanet_timeouts_total{kind=\"%s\"} %llu\n", admission_timeout_names[i], admission_stats.timeouts[i]);
+
+    struct KeplerSolverStats solver_stats;
+    keplerSolverStatsSnapshot(&solver_stats);
+    const char *solver = keplerSolverName(kepler_solver);
+
+    metricsHeader(text, "exoplanet_kepler_failures_total", "counter", "Kepler solves that did not converge and returned NaN.");
+    metricsPrintf(text, "exoplanet_kepler_failures_total{solver=\"%s\"} %llu\n", solver, solver_stats.failures);
+
+    // The solver's iteration histogram, its last bucket holds everything at or above its index
+    metricsHeader(text, "exoplanet_kepler_iterations", "histogram", "Iterations per Kepler solve.");
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < KEPLER_STATS_BUCKETS - 1; i++) {
+        cumulative += solver_stats.histogram[i];
+        metricsPrintf(text, "exoplanet_kepler_iterations_bucket{solver=\"%s\",le=\"%d\"} %llu\n", solver, i, cumulative);
+    }
+    metricsPrintf(text, "exoplanet_kepler_iterations_bucket{solver=\"%s\",le=\"+Inf\"} %llu\n", solver, solver_stats.calls);
+    metricsPrintf(text, "exoplanet_kepler_iterations_sum{solver=\"%s\"} %llu\n", solver, solver_stats.iterations);
+    metricsPrintf(text, "exoplanet_kepler_iterations_count{solver=\"%s\"} %llu\n", solver, solver_stats.calls);
+
+    struct OrbitCacheStats orbit_stats;
+    orbitCacheStatsSnapshot(&orbit_stats);
+    struct ResultCacheStats result_stats;
+    resultCacheStatsSnapshot(&result_stats);
+
+    struct EphemerisStats table_stats;
+    ephemerisStatsSnapshot(&table_stats);
+    struct ConeSearchStats cone_stats;
+    coneSearchStatsSnapshot(&server_cone_search, &cone_stats);
+    struct SceneStats scene_stats;
+    sceneStatsSnapshot(&server_scene_cache, &scene_stats);
+
+    metricsHeader(text, "exoplanet_cache_hits_total", "counter", "Cache lookups answered from the cache.");
+    metricsPrintf(text, "exoplanet_cache_hits_total{cache=\"orbit\"} %llu\n", orbit_stats.hits);
+    metricsPrintf(text, "exoplanet_cache_hits_total{cache=\"result\"} %llu\n", result_stats.hits);
+    metricsPrintf(text, "exoplanet_cache_hits_total{cache=\"ephemeris\"} %llu\n", table_stats.hits);
+    metricsPrintf(text, "exoplanet_cache_hits_total{cache=\"cone_index\"} %llu\n", cone_stats.indexHits);
+    metricsPrintf(text, "exoplanet_cache_hits_total{cache=\"scene\"} %llu\n", scene_stats.hits);
+    metricsHeader(text, "exoplanet_cache_misses_total", "counter", "Cache lookups that had to compute.");
+    metricsPrintf(text, "exoplanet_cache_misses_total{cache=\"orbit\"} %llu\n", orbit_stats.misses);
+    metricsPrintf(text, "exoplanet_cache_misses_total{cache=\"result\"} %llu\n", result_stats.misses);
+    metricsPrintf(text, "exoplanet_cache_misses_total{cache=\"ephemeris\"} %llu\n", table_stats.misses);
+    metricsPrintf(text, "exoplanet_cache_misses_total{cache=\"cone_index\"} %llu\n", cone_stats.indexBuilds);
+    metricsPrintf(text, "exoplanet_cache_misses_total{cache=\"scene\"} %llu\n", scene_stats.refits + scene_stats.builds);
+}
+
+// Bytes received on a channel that have not been consumed as requests yet
+struct RequestBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// Makes room for at least one more read, returns -1 once the buffer would pass MAX_REQUEST_SIZE
+int request_buffer_reserve(struct RequestBuffer *buffer)
+{
+    if (buffer->length < buffer->capacity)
+        return 0;
+
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+    if (capacity > MAX_REQUEST_SIZE)
+        return -1;
+
+    char *grown = realloc(buffer->data, capacity);
+    if (!grown)
+        return -1;
+    buffer->data = grown;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+// Drops the first count bytes of the buffer
+void request_buffer_consume(struct RequestBuffer *buffer, size_t count)
+{
+    memmove(buffer->data, buffer->data + count, buffer->length - count);
+    buffer->length -= count;
+}
+
+// Reads what the channel has received into the free space of buffer, waiting no later than
+// deadline (an admissionNow() time, 0 waits as long as it takes). Returns the number of bytes read,
+// or 0 at EOF, on error and once the deadline has passed.
+int read_channel(ssh_channel channel, struct RequestBuffer *buffer, uint64_t deadline)
+{
+    int timeout_ms = -1;
+    if (deadline) {
+        uint64_t now = admissionNow();
+        if (now >= deadline) {
+            admissionCountTimeout(ADMISSION_TIMEOUT_READ);
+            return 0;
+        }
+        timeout_ms = (int) ((deadline - now + 999999) / 1000000);
+    }
+
+    uint64_t read_start = metricsStart();
+    int nbytes = ssh_channel_read_timeout(channel, buffer->data + buffer->length, buffer->capacity - buffer->length, 0, timeout_ms);
+    metricsRecord(METRICS_READ, read_start);
+
+    // A read that times out returns nothing without EOF
+    if (nbytes == 0 && deadline && !ssh_channel_is_eof(channel))
+        admissionCountTimeout(ADMISSION_TIMEOUT_READ);
+    return nbytes > 0 ? nbytes : 0;
+}
+
+// Reads from the channel until the received bytes start with a complete JSON document,
+// growing the buffer as needed so large (batch) requests are not truncated. Bytes after the
+// document stay in the buffer for the next request. A request still incomplete at deadline (see
+// read_channel) is parsed as it is.
+json_t *read_json_request(ssh_channel channel, struct RequestBuffer *buffer, json_error_t *error, uint64_t deadline)
+{
+    snprintf(error->text, sizeof(error->text), "%s", "No request received");
+
+    for (;;) {
+        // Only attempt a parse once the input could plausibly be a complete object
+        size_t last = buffer->length;
+        while (last > 0 && (buffer->data[last - 1] == '\n' || buffer->data[last - 1] == '\r' || buffer->data[last - 1] == ' '))
+            last--;
+        if (last > 0 && buffer->data[last - 1] == '}') {
+            uint64_t parse_start = metricsStart();
+            json_t *root = json_loadb(buffer->data, buffer->length, JSON_DISABLE_EOF_CHECK, error);
+            metricsRecord(METRICS_PARSE, parse_start);
+            if (root) {
+                request_buffer_consume(buffer, (size_t) error->position < buffer->length ? (size_t) error->position : buffer->length);
+                return root;
+            }
+        }
+
+        if (request_buffer_reserve(buffer) != 0) {
+            snprintf(error->text, sizeof(error->text), "%s", "Request too large");
+            return NULL;
+        }
+
+        int nbytes = read_channel(channel, buffer, deadline);
+        if (nbytes <= 0) {
+            // EOF, error or timeout, whatever arrived is the whole request
+            json_t *root = NULL;
+            if (buffer->length > 0)
+                root = json_loadb(buffer->data, buffer->length, 0, error);
+            buffer->length = 0;
+            return root;
+        }
+        buffer->length += nbytes;
+    }
+}
+
+// Dispatch on the optional request type, a plain exoplanet object is the default
+json_t *dispatch_request(json_t *root)
+{
+    json_t *request_json = json_object_get(root, "request");
+
+    if (request_json == NULL) {
+        return process_exoplanet_request(root);
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "batch") == 0) {
+        return process_batch_request(root);
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "solver_stats") == 0) {
+        return process_solver_stats_request();
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "cache_stats") == 0) {
+        return process_cache_stats_request();
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "server_stats") == 0) {
+        return process_server_stats_request();
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "cone_search") == 0) {
+        return process_sky_search_request(root, 0);
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "box_search") == 0) {
+        return process_sky_search_request(root, 1);
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "scene") == 0) {
+        return process_scene_request(root);
+    } else if (json_is_string(request_json) && strcmp(json_string_value(request_json), "visualization") == 0) {
+        return error_response("Visualization exports are only answered as the single request of an SSH channel.");
+    }
+
+    return error_response("Unknown request type.");
+}
+
+// Makes room for count more bytes in a response batch, returns -1 if it cannot grow
+int response_batch_reserve(struct RequestBuffer *batch, size_t count)
+{
+    if (batch->length + count <= batch->capacity)
+        return 0;
+
+    size_t capacity = batch->capacity ? batch->capacity : 4096;
+    while (capacity < batch->length + count)
+        capacity *= 2;
+    char *grown = realloc(batch->data, capacity);
+    if (!grown)
+        return -1;
+    batch->data = grown;
+    batch->capacity = capacity;
+    return 0;
+}
+
+// Appends a response line to the pending batch, returns -1 if it cannot be buffered
+int append_response_line(struct RequestBuffer *batch, const char *response)
+{
+    size_t length = strlen(response);
+    if (response_batch_reserve(batch, length + 1) != 0)
+        return -1;
+
+    memcpy(batch->data + batch->length, response, length);
+    batch->data[batch->length + length] = '\n';
+    batch->length += length + 1;
+    return 0;
+}
+
+// Writes the pending responses to the channel, returns -1 if the channel failed
+int flush_response_batch(ssh_channel channel, struct RequestBuffer *batch)
+{
+    uint64_t write_start = metricsStart();
+    int written = ssh_channel_write(channel, batch->data, batch->length);
+    metricsRecord(METRICS_WRITE, write_start);
+    batch->length = 0;
+    return written == SSH_ERROR ? -1 : 0;
+}
+
+// Ends a multi-line answer that ran out of time with a deadline_response() line
+int append_deadline_line(struct RequestBuffer *batch)
+{
+    json_t *response = deadline_response();
+    char *response_str = json_dumps(response, JSON_COMPACT);
+    json_decref(response);
+    int appended = response_str ? append_response_line(batch, response_str) : -1;
+    free(response_str);
+    return appended;
+}
+
+// Answers a multi-line request for a planet of another shard with a wrong_shard_response() line
+int append_wrong_shard_line(struct RequestBuffer *batch, int shard)
+{
+    json_t *response = wrong_shard_response(shard);
+    char *response_str = json_dumps(response, JSON_COMPACT);
+    json_decref(response);
+    int appended = response_str ? append_response_line(batch, response_str) : -1;
+    free(response_str);
+    return appended;
+}
+
+// Appends a request error as a response line, returns -1 if it cannot be buffered
+int append_error_line(struct RequestBuffer *batch, const char *message)
+{
+    json_t *response = error_response(message);
+    char *response_str = json_dumps(response, JSON_COMPACT);
+    json_decref(response);
+    int appended = response_str ? append_response_line(batch, response_str) : -1;
+    free(response_str);
+    return appended;
+}
+
+// Handles a trajectory request: one planet (named or given by its elements, like a single request)
+// from time_grid.start to time_grid.stop, sampled every time_grid.step seconds or every
+// time_grid.resolution degrees of true anomaly. The samples are appended to batch as lines of
+// {"name", "positions", "done"} chunks, the last one with done true and the sample count. With a
+// channel every full batch is written out as soon as it is produced, so a long track is never held
+// in memory, without one (event mode, socket transport) the whole track stays in batch, so a track
+// past MAX_BUFFERED_TRAJECTORY_SAMPLES is dropped and answered with an error line. A track that
+// runs past the request's deadline ends with an error line instead of the last chunk.
+// Returns -1 if the channel failed or memory ran out.
+int answer_trajectory_request(json_t *root, struct RequestBuffer *batch, ssh_channel channel)
+{
+    int shard = foreign_shard(root);
+    if (shard >= 0)
+        return append_wrong_shard_line(batch, shard);
+
+    struct Exoplanet exoplanet = get_default_exoplanet();
+    long record = exoplanet_from_catalog(root, &exoplanet);
+    exoplanet_from_json(root, &exoplanet);
+
+    json_t *grid_json = json_object_get(root, "time_grid");
+    json_t *start_json = json_object_get(grid_json, "start");
+    json_t *stop_json = json_object_get(grid_json, "stop");
+    json_t *step_json = json_object_get(grid_json, "step");
+    json_t *resolution_json = json_object_get(grid_json, "resolution");
+
+    struct OrbitHandle orbit;
+    const struct OrbitHandle *catalog_orbit = catalogOrbitFor(&server_catalog, record, &exoplanet);
+    if (catalog_orbit)
+        orbit = *catalog_orbit;
+    else
+        orbitCacheGet(&exoplanet, &orbit);
+
+    struct Trajectory trajectory;
+    if (!json_is_number(start_json) || !json_is_number(stop_json) || json_is_number(step_json) == json_is_number(resolution_json) ||
+        trajectoryInit(&trajectory, &orbit, json_number_value(start_json), json_number_value(stop_json),
+                       json_is_number(step_json) ? json_number_value(step_json) : 0,
+                       json_is_number(resolution_json) ? json_number_value(resolution_json) : 0) != 0) {
+        json_t *response = error_response("Trajectory request requires a time_grid with start, stop and either step or resolution, "
+                                          "and at most 1,000,000 samples.");
+        char *response_str = json_dumps(response, JSON_COMPACT);
+        json_decref(response);
+        int appended = response_str ? append_response_line(batch, response_str) : -1;
+        free(response_str);
+        return appended;
+    }
+
+    // The name is escaped once and repeated in every chunk
+    char name[EXOPLANET_RESPONSE_SIZE];
+    struct CodecWriter name_writer = { name, name + sizeof(name) - 1, 0 };
+    codec_put_string(&name_writer, exoplanet.name ? exoplanet.name : "");
+    if (name_writer.overflow) {
+        memcpy(name, "\"\"", 2);
+        name_writer.p = name + 2;
+    }
+    size_t name_length = (size_t) (name_writer.p - name);
+
+    struct TrajectorySample samples[TRAJECTORY_CHUNK_SAMPLES];
+    size_t track_start = batch->length;
+    for (;;) {
+        if (admissionExpired())
+            return append_deadline_line(batch);
+
+        uint64_t stage_start = metricsStart();
+        size_t count = trajectoryNext(&trajectory, samples, TRAJECTORY_CHUNK_SAMPLES);
+        metricsRecord(METRICS_SOLVE, stage_start);
+
+        // Without a channel nothing has been sent yet, so the buffered chunks can be taken back
+        if (!channel && trajectory.produced > MAX_BUFFERED_TRAJECTORY_SAMPLES) {
+            batch->length = track_start;
+            return append_error_line(batch, "Trajectory exceeds 100,000 samples, the most this transport buffers. "
+                                            "Use an SSH channel to stream longer tracks.");
+        }
+
+        // The name, the fixed keys and the final count fit within name_length + 128
+        stage_start = metricsStart();
+        if (response_batch_reserve(batch, name_length + 128 + count * (TRAJECTORY_SAMPLE_SIZE + 1)) != 0)
+            return -1;
+
+        char *line = batch->data + batch->length;
+        size_t length = 0;
+        memcpy(line, "{\"name\":", 8);
+        length += 8;
+        memcpy(line + length, name, name_length);
+        length += name_length;
+        memcpy(line + length, ",\"positions\":[", 14);
+        length += 14;
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0)
+                line[length++] = ',';
+            length += trajectoryEncodeSample(&samples[i], line + length, TRAJECTORY_SAMPLE_SIZE);
+        }
+
+        if (trajectory.finished)
+            length += (size_t) sprintf(line + length, "],\"done\":true,\"count\":%zu%s}\n", trajectory.produced,
+                                       trajectory.truncated ? ",\"truncated\":true" : "");
+        else
+            length += (size_t) sprintf(line + length, "],\"done\":false}\n");
+        batch->length += length;
+        metricsRecord(METRICS_SERIALIZE, stage_start);
+
+        if (channel && batch->length >= STREAM_BATCH_SIZE && flush_response_batch(channel, batch) != 0)
+            return -1;
+        if (trajectory.finished)
+            return 0;
+    }
+}
+
+// Most events an orbit_events request returns
+#define MAX_ORBIT_EVENTS 1000000
+
+// Planets whose events are found and written out together
+#define ORBIT_EVENT_WAVE_PLANETS 16384
+
+// Buffer size that always fits one encoded event
+#define ORBIT_EVENT_ENCODED_SIZE 96
+
+// Reads the event types of an orbit_events request into a bit set. Without an "events" array the
+// apsides and nodes are found, plus the ra and declination crossings when "ra" or "declination"
+// is given. Returns 0 when a name is unknown or a crossing lacks its threshold.
+unsigned orbit_event_types(json_t *root)
+{
+    int has_ra = json_is_number(json_object_get(root, "ra"));
+    int has_declination = json_is_number(json_object_get(root, "declination"));
+    json_t *events_json = json_object_get(root, "events");
+
+    if (events_json == NULL) {
+        unsigned types = (1u << ORBIT_EVENT_PERIAPSIS) | (1u << ORBIT_EVENT_APOAPSIS) |
+                         (1u << ORBIT_EVENT_ASCENDING_NODE) | (1u << ORBIT_EVENT_DESCENDING_NODE);
+        if (has_ra)
+            types |= 1u << ORBIT_EVENT_RA_CROSSING;
+        if (has_declination)
+            types |= 1u << ORBIT_EVENT_DECLINATION_CROSSING;
+        return types;
+    }
+
+    if (!json_is_array(events_json) || json_array_size(events_json) == 0)
+        return 0;
+
+    unsigned types = 0;
+    for (size_t i = 0; i < json_array_size(events_json); i++) {
+        const char *name = json_string_value(json_array_get(events_json, i));
+        int type = name ? orbitEventType(name) : -1;
+        if (type < 0 || (type == ORBIT_EVENT_RA_CROSSING && !has_ra) || (type == ORBIT_EVENT_DECLINATION_CROSSING && !has_declination))
+            return 0;
+        types |= 1u << type;
+    }
+    return types;
+}
+
+// Appends the line of one planet of an orbit_events request: {"name", "events", "done"}, or an
+// error for an orbit that does not repeat or repeats too often. Returns -1 if it cannot be buffered.
+int append_orbit_events_line(struct RequestBuffer *batch, const char *name, const struct OrbitEvent *events, size_t count, int repeats)
+{
+    size_t capacity = strlen(name) * 6 + 160 + count * ORBIT_EVENT_ENCODED_SIZE;
+    if (response_batch_reserve(batch, capacity) != 0)
+        return -1;
+
+    struct CodecWriter w = { batch->data + batch->length, batch->data + batch->length + capacity, 0 };
+    codec_put(&w, "{\"name\":", 8);
+    codec_put_string(&w, name);
+
+    if (!repeats) {
+        const char *error = ",\"error\":\"Events need an orbital period above zero, an eccentricity in [0, 1), and at most a billion orbits between start and stop.\"";
+        codec_put(&w, error, strlen(error));
+    } else {
+        codec_put(&w, ",\"events\":[", 11);
+        for (size_t i = 0; i < count; i++) {
+            const char *type = orbit_event_names[events[i].type];
+            codec_put(&w, i > 0 ? ",{\"type\":\"" : "{\"type\":\"", i > 0 ? 10 : 9);
+            codec_put(&w, type, strlen(type));
+            CODEC_PUT_REAL(&w, "\",\"unixTime\":", events[i].unixTime);
+            if (events[i].direction != 0)
+                codec_put(&w, events[i].direction > 0 ? ",\"direction\":1" : ",\"direction\":-1", events[i].direction > 0 ? 14 : 15);
+            codec_put(&w, "}", 1);
+        }
+        codec_put(&w, "]", 1);
+    }
+    codec_put(&w, ",\"done\":false}\n", 15);
+
+    if (w.overflow)
+        return -1;
+    batch->length = (size_t) (w.p - batch->data);
+    return 0;
+}
+
+// Handles an orbit_events request: the periapsis and apoapsis passages, node crossings and ra or
+// declination crossings of the given "planets" (like a batch request) or of the whole catalog,
+// between "start" and "stop". Each planet is answered with a line of its events in time order, and
+// a last line {"done": true} carries the planet and event counts. Planets are worked through in
+// waves on the shared task pool, with a channel each wave is written out as soon as it is done.
+// Returns -1 if the channel failed or memory ran out.
+int answer_orbit_events_request(json_t *root, struct RequestBuffer *batch, ssh_channel channel)
+{
+    json_t *planets_json = json_object_get(root, "planets");
+    json_t *start_json = json_object_get(root, "start");
+    json_t *stop_json = json_object_get(root, "stop");
+
+    struct OrbitEventQuery query;
+    memset(&query, 0, sizeof(query));
+    query.types = orbit_event_types(root);
+    query.ra = json_number_value(json_object_get(root, "ra"));
+    query.declination = json_number_value(json_object_get(root, "declination"));
+    query.start = json_number_value(start_json);
+    query.stop = json_number_value(stop_json);
+
+    if (query.types == 0 || !json_is_number(start_json) || !json_is_number(stop_json) || !isfinite(query.start) ||
+        !isfinite(query.stop) || !(query.stop >= query.start) || !isfinite(query.ra) || !(fabs(query.declination) <= 90))
+        return append_error_line(batch, "Orbital events request requires start and stop, known event types, and ra or declination "
+                                        "for their crossings.");
+
+    // Either the listed planets or every cataloged one
+    size_t planets;
+    const struct OrbitHandle *orbits;
+    struct OrbitHandle *listed = NULL;
+    const char **names = NULL;
+    if (planets_json == NULL) {
+        if (server_catalog.count == 0)
+            return append_error_line(batch, "Orbital events request needs \"planets\" or a planet catalog.");
+        planets = server_catalog.count;
+        orbits = server_catalog.orbits;
+    } else {
+        if (!json_is_array(planets_json) || json_array_size(planets_json) == 0)
+            return append_error_line(batch, "Orbital events request requires a non-empty \"planets\" array.");
+
+        planets = json_array_size(planets_json);
+        for (size_t i = 0; i < planets; i++) {
+            int shard = foreign_shard(json_array_get(planets_json, i));
+            if (shard >= 0)
+                return append_wrong_shard_line(batch, shard);
+        }
+
+        listed = malloc(sizeof(struct OrbitHandle) * planets);
+        names = malloc(sizeof(char *) * planets);
+        if (!listed || !names) {
+            free(listed);
+            free(names);
+            return -1;
+        }
+
+        for (size_t i = 0; i < planets; i++) {
+            struct Exoplanet exoplanet = get_default_exoplanet();
+            json_t *planet_json = json_array_get(planets_json, i);
+            long record = exoplanet_from_catalog(planet_json, &exoplanet);
+            if (json_is_object(planet_json))
+                exoplanet_from_json(planet_json, &exoplanet);
+
+            if (json_is_string(planet_json) && record < 0) {
+                free(listed);
+                free(names);
+                return append_error_line(batch, "Orbital events request names a planet that is not in the catalog.");
+            }
+
+            names[i] = exoplanet.name ? exoplanet.name : "";
+            const struct OrbitHandle *catalog_orbit = catalogOrbitFor(&server_catalog, record, &exoplanet);
+            if (catalog_orbit)
+                listed[i] = *catalog_orbit;
+            else
+                orbitCacheGet(&exoplanet, &listed[i]);
+        }
+        orbits = listed;
+    }
+
+    int ret_val = 0;
+    size_t produced = 0;
+    int truncated = 0;
+    int expired = 0;
+    for (size_t first = 0; first < planets && ret_val == 0; first += ORBIT_EVENT_WAVE_PLANETS) {
+        // A search past its deadline stops between waves
+        if (admissionExpired()) {
+            expired = 1;
+            break;
+        }
+
+        struct OrbitEventJob job;
+        memset(&job, 0, sizeof(job));
+        job.query = &query;
+        job.orbits = orbits + first;
+        job.planets = planets - first < ORBIT_EVENT_WAVE_PLANETS ? planets - first : ORBIT_EVENT_WAVE_PLANETS;
+
+        uint64_t stage_start = metricsStart();
+        int status = orbitEventJobRun(&job, MAX_ORBIT_EVENTS - produced);
+        metricsRecord(METRICS_SOLVE, stage_start);
+        if (status != 0) {
+            orbitEventJobFree(&job);
+            ret_val = -1;
+            break;
+        }
+        produced += job.total;
+        truncated |= job.truncated;
+
+        stage_start = metricsStart();
+        for (size_t i = 0; i < job.planets && ret_val == 0; i++) {
+            size_t count;
+            const struct OrbitEvent *events = orbitEventJobEvents(&job, i, &count);
+            const char *name = names ? names[first + i] : catalogName(&server_catalog, first + i);
+            if (append_orbit_events_line(batch, name, events, count, job.rootCounts[i] >= 0) != 0)
+                ret_val = -1;
+        }
+        metricsRecord(METRICS_SERIALIZE, stage_start);
+        orbitEventJobFree(&job);
+
+        if (ret_val == 0 && channel && batch->length >= STREAM_BATCH_SIZE && flush_response_batch(channel, batch) != 0)
+            ret_val = -1;
+    }
+
+    free(listed);
+    free(names);
+    if (ret_val != 0)
+        return ret_val;
+    if (expired)
+        return append_deadline_line(batch);
+
+    char last[128];
+    snprintf(last, sizeof(last), "{\"done\":true,\"planets\":%zu,\"count\":%zu%s}", planets, produced,
+             truncated ? ",\"truncated\":true" : "");
+    return append_response_line(batch, last);
+}
+
+// Sink of a visualization export writing each chunk to the SSH channel context points to
+int write_visualization_chunk(void *context, const char *data, size_t length)
+{
+    uint64_t write_start = metricsStart();
+    int written = ssh_channel_write(*(ssh_channel *) context, data, length);
+    metricsRecord(METRICS_WRITE, write_start);
+    return written == SSH_ERROR ? -1 : 0;
+}
+
+int is_visualization_request(json_t *root)
+{
+    const char *request = json_string_value(json_object_get(root, "request"));
+    return request && strcmp(request, "visualization") == 0;
+}
+
+// Answers a visualization request with a point cloud of the given "planets" (like a batch request)
+// or of the whole catalog at "unixTime", scaled to "width" by "height" (default 1920 by 1080), as
+// "format" obj (default), ply or glb. The export is streamed to the channel as it is formatted and
+// is the channel's whole answer; an invalid request is answered with an error line instead.
+// Returns -1 if the channel failed or memory ran out.
+int answer_visualization_request(json_t *root, ssh_channel channel)
+{
+    json_t *planets_json = json_object_get(root, "planets");
+    struct RequestBuffer lines = {0};
+    const char *message = NULL;
+
+    double unix_time = 0, width = 1920, height = 1080;
+    json_get_number(root, "unixTime", &unix_time);
+    json_get_number(root, "width", &width);
+    json_get_number(root, "height", &height);
+    double current_time = resolve_request_time(unix_time);
+    int format = visualizationFormat(json_string_value(json_object_get(root, "format")));
+
+    if (format < 0)
+        message = "Visualization format must be obj, ply or glb.";
+    else if (!(width > 0) || !(height > 0) || !isfinite(width) || !isfinite(height))
+        message = "Visualization width and height must be positive.";
+    else if (planets_json == NULL && server_catalog.count == 0)
+        message = "Visualization request needs \"planets\" or a planet catalog.";
+    else if (planets_json != NULL && (!json_is_array(planets_json) || json_array_size(planets_json) == 0))
+        message = "Visualization request requires a non-empty \"planets\" array.";
+
+    size_t planets = planets_json ? json_array_size(planets_json) : server_catalog.count;
+    struct Exoplanet *exoplanets = NULL;
+    if (message == NULL) {
+        exoplanets = malloc(sizeof(struct Exoplanet) * planets);
+        if (!exoplanets)
+            return -1;
+    }
+
+    // Only the distance and galactic coordinates are exported
+    uint64_t stage_start = metricsStart();
+    for (size_t i = 0; i < planets && message == NULL; i++) {
+        struct Exoplanet *exoplanet = &exoplanets[i];
+        *exoplanet = get_default_exoplanet();
+
+        if (planets_json == NULL) {
+            orbitHandleEvaluate(&server_catalog.orbits[i], current_time, exoplanet);
+        } else {
+            json_t *planet_json = json_array_get(planets_json, i);
+            long record = exoplanet_from_catalog(planet_json, exoplanet);
+            if (json_is_object(planet_json))
+                exoplanet_from_json(planet_json, exoplanet);
+
+            if (json_is_string(planet_json) && record < 0) {
+                message = "Visualization request names a planet that is not in the catalog.";
+                break;
+            }
+
+            struct OrbitHandle orbit;
+            const struct OrbitHandle *catalog_orbit = catalogOrbitFor(&server_catalog, record, exoplanet);
+            if (catalog_orbit == NULL) {
+                orbitCacheGet(exoplanet, &orbit);
+                catalog_orbit = &orbit;
+            }
+            orbitHandleEvaluate(catalog_orbit, current_time, exoplanet);
+        }
+        setGalacticCoordinates(exoplanet);
+    }
+    metricsRecord(METRICS_SOLVE, stage_start);
+
+    // Once the export has started an error can no longer be told apart from its data
+    int expired = message == NULL && admissionExpired();
+    if (message != NULL || expired) {
+        free(exoplanets);
+        int rc = expired ? append_deadline_line(&lines) : append_error_line(&lines, message);
+        if (rc == 0)
+            rc = flush_response_batch(channel, &lines);
+        free(lines.data);
+        return rc;
+    }
+
+    int rc = exportVisualization(exoplanets, planets, width, height, (enum VisualizationFormat) format, 0,
+                                 write_visualization_chunk, &channel);
+    free(exoplanets);
+    return rc;
+}
+
+// Requests answered with several lines rather than one response
+int is_multiline_request(json_t *root)
+{
+    const char *request = json_string_value(json_object_get(root, "request"));
+    return request && (strcmp(request, "trajectory") == 0 || strcmp(request, "orbit_events") == 0);
+}
+
+// Answers a multi-line request (see is_multiline_request) into batch, with a channel writing out
+// full batches as they are produced. Returns -1 if the channel failed or memory ran out.
+int answer_multiline_request(json_t *root, struct RequestBuffer *batch, ssh_channel channel)
+{
+    if (strcmp(json_string_value(json_object_get(root, "request")), "trajectory") == 0)
+        return answer_trajectory_request(root, batch, channel);
+    return answer_orbit_events_request(root, batch, channel);
+}
+
+// Runs on a compute worker (event mode and the socket transport): answers a parsed request with
+// its serialized response
+char *handle_json_request(json_t *root)
+{
+    // A request that waited past its deadline is not computed
+    if (start_request_deadline(root) != 0) {
+        json_decref(root);
+        json_t *response = deadline_response();
+        char *response_str = json_dumps(response, JSON_COMPACT);
+        json_decref(response);
+        return response_str;
+    }
+
+    // A multi-line answer is returned all at once, the last newline left to the transport
+    if (is_multiline_request(root)) {
+        struct RequestBuffer lines = {0};
+        int rc = answer_multiline_request(root, &lines, NULL);
+        json_decref(root);
+        if (rc != 0 || lines.length == 0) {
+            free(lines.data);
+            return NULL;
+        }
+        lines.data[lines.length - 1] = '\0';
+        return lines.data;
+    }
+
+    json_t *response = dispatch_request(root);
+
+    // Exoplanet names point into the request, so release it only once the response is built
+    json_decref(root);
+
+    uint64_t serialize_start = metricsStart();
+    char *response_str = json_dumps(response, JSON_COMPACT);
+    json_decref(response);
+    metricsRecord(METRICS_SERIALIZE, serialize_start);
+    return response_str;
+}
+
+// Answers one newline-delimited request through jansson, appending the response line to batch. With
+// a channel a trajectory's chunks are written out as they are produced (see answer_trajectory_request).
+// Returns -1 if the response could not be buffered or written.
+int answer_request_line(const char *request, size_t length, struct RequestBuffer *batch, ssh_channel channel)
+{
+    json_error_t error;
+    uint64_t parse_start = metricsStart();
+    json_t *root = json_loadb(request, length, 0, &error);
+    metricsRecord(METRICS_PARSE, parse_start);
+
+    char *response_str;
+    if (!root) {
+        json_t *response = error_response("Invalid JSON.");
+        response_str = json_dumps(response, JSON_COMPACT);
+        json_decref(response);
+    } else {
+        if (channel && is_multiline_request(root)) {
+            int rc = start_request_deadline(root) == 0 ? answer_multiline_request(root, batch, channel) : append_deadline_line(batch);
+            json_decref(root);
+            return rc;
+        }
+        response_str = handle_json_request(root);
+    }
+
+    int appended = response_str ? append_response_line(batch, response_str) : -1;
+    free(response_str);
+    return appended;
+}
+
+// Runs on a socket transport compute worker: parses one newline-delimited request and answers it
+char *handle_line_request(const char *request, size_t length)
+{
+    char response[EXOPLANET_RESPONSE_SIZE];
+    if (answer_exoplanet_request(request, length, response, sizeof(response)) > 0)
+        return strdup(response);
+
+    // The transport terminates the last line itself
+    struct RequestBuffer lines = {0};
+    if (answer_request_line(request, length, &lines, NULL) != 0 || lines.length == 0) {
+        free(lines.data);
+        return NULL;
+    }
+    lines.data[lines.length - 1] = '\0';
+    return lines.data;
+}
+
+// Answers each non-blank line of data (the last one may be unterminated), appending one response
+// line per request to batch (a trajectory appends several, or with a channel writes them out as it
+// goes). Returns the number of requests handled.
+int handle_request_lines(const char *data, size_t length, struct RequestBuffer *batch, ssh_channel channel)
+{
+    int handled = 0;
+    size_t start = 0;
+
+    while (start < length) {
+        const char *newline = memchr(data + start, '\n', length - start);
+        size_t end = newline ? (size_t) (newline - data) : length;
+
+        // Skip blank lines, trim a CR
+        size_t line_end = end;
+        if (line_end > start && data[line_end - 1] == '\r')
+            line_end--;
+        size_t line_start = start;
+        while (line_start < line_end && (data[line_start] == ' ' || data[line_start] == '\t'))
+            line_start++;
+
+        // Plain exoplanet requests are encoded straight into the batch
+        if (line_start < line_end && response_batch_reserve(batch, EXOPLANET_RESPONSE_SIZE + 1) == 0) {
+            size_t written = answer_exoplanet_request(data + line_start, line_end - line_start,
+                                                      batch->data + batch->length, EXOPLANET_RESPONSE_SIZE);
+            if (written > 0) {
+                batch->data[batch->length + written] = '\n';
+                batch->length += written + 1;
+                handled++;
+                line_start = line_end;
+            }
+        }
+
+        if (line_start < line_end) {
+            if (answer_request_line(data + line_start, line_end - line_start, batch, channel) != 0)
+                break;
+            handled++;
+        }
+
+        start = end + 1;
+    }
+
+    return handled;
+}
+
+// Event mode streaming: answers a run of request lines with one block of response lines
+char *handle_request_lines_block(const char *data, size_t length, size_t *response_length)
+{
+    struct RequestBuffer batch = {0};
+    handle_request_lines(data, length, &batch, NULL);
+    *response_length = batch.length;
+    return batch.data;
+}
 
-volatile sig_atomic_t running = 1;
+// Answers the complete lines in the input (and at EOF an unterminated last line) and drops them
+void stream_handle_lines(struct RequestBuffer *input, struct RequestBuffer *batch, ssh_channel channel, int final)
+{
+    size_t length = input->length;
+    if (!final) {
+        while (length > 0 && input->data[length - 1] != '\n')
+            length--;
+    }
 
-int process_request(ssh_session session);
+    if (length > 0) {
+        // Shed load like the other transports, each request line is answered either way
+        if (admissionEnter(0) == 0) {
+            handle_request_lines(input->data, length, batch, channel);
+            admissionLeave();
+        } else {
+            size_t requests = admissionCountRequests(input->data, length);
+            for (size_t i = 0; i < requests; i++)
+                append_response_line(batch, ADMISSION_OVERLOADED_RESPONSE);
+        }
+        request_buffer_consume(input, length);
+    }
+}
 
-// The function that will run on each thread to handle the session
-void *handle_session(void *arg)
+// Streaming mode: newline-delimited requests on the one channel until the client sends EOF.
+// Responses are collected while more pipelined input is already waiting and written in batches.
+int stream_requests(ssh_channel channel, struct RequestBuffer *input)
 {
-    ssh_session session = (ssh_session)arg;
-    process_request(session);
-    ssh_disconnect(session);
-    ssh_free(session);
-    return NULL;
+    struct RequestBuffer batch = {0};
+    int ret_val = SSH_OK;
+    int eof = 0;
+
+    for (;;) {
+        stream_handle_lines(input, &batch, channel, eof);
+
+        // Flush once nothing else is waiting on the channel, or the batch is full
+        int pending = eof ? 0 : ssh_channel_poll(channel, 0);
+        if (batch.length > 0 && (pending <= 0 || batch.length >= STREAM_BATCH_SIZE)) {
+            if (flush_response_batch(channel, &batch) != 0) {
+                ret_val = SSH_ERROR;
+                break;
+            }
+        }
+
+        if (eof)
+            break;
+
+        if (request_buffer_reserve(input) != 0) {
+            append_response_line(&batch, "{\"error\":\"Request too large.\"}");
+            ssh_channel_write(channel, batch.data, batch.length);
+            ret_val = SSH_ERROR;
+            break;
+        }
+
+        // An idle channel is closed after the read timeout
+        int nbytes = read_channel(channel, input, admissionReadDeadline());
+        if (nbytes <= 0)
+            eof = 1;
+        else
+            input->length += nbytes;
+    }
+
+    free(batch.data);
+    return ret_val;
+}
+
+// Evaluates binary request records through the vectorized orbit kernel, one block at a time,
+// writing one result per record. Returns -1 if memory could not be allocated.
+int evaluate_binary_records(const struct BinaryRequestRecord *records, size_t count, struct BinaryResponseRecord *results)
+{
+    struct OrbitBlock *block = malloc(sizeof(struct OrbitBlock));
+    if (!block)
+        return -1;
+
+    size_t lane_result[ORBIT_BLOCK_SIZE];
+
+    for (size_t start = 0; start < count; start += ORBIT_BLOCK_SIZE) {
+        size_t end = count - start < ORBIT_BLOCK_SIZE ? count : start + ORBIT_BLOCK_SIZE;
+        size_t lanes = 0;
+
+        for (size_t i = start; i < end; i++) {
+            const struct BinaryRequestRecord *record = &records[i];
+            memset(&results[i], 0, sizeof(results[i]));
+
+            // Elements come from the catalog's compiled orbit or from the shared orbit cache
+            struct OrbitHandle cached;
+            const struct OrbitHandle *orbit = &cached;
+            if (record->record >= 0) {
+                if ((size_t) record->record >= server_catalog.count) {
+                    results[i].distance = results[i].ra = results[i].declination = NAN;
+                    results[i].galacticLongitude = results[i].galacticLatitude = NAN;
+                    results[i].status = BINARY_STATUS_UNKNOWN_RECORD;
+                    continue;
+                }
+                orbit = &server_catalog.orbits[record->record];
+
+                // Covered epochs of tabulated planets skip the kernel
+                struct Exoplanet planet = get_default_exoplanet();
+                if (ephemerisEvaluate(&server_ephemeris, record->record, resolve_request_time(record->unixTime), &planet)) {
+                    results[i].distance = planet.distance;
+                    results[i].ra = planet.ra;
+                    results[i].declination = planet.declination;
+                    results[i].galacticLongitude = planet.galacticLongitude;
+                    results[i].galacticLatitude = planet.galacticLatitude;
+                    results[i].status = BINARY_STATUS_OK;
+                    continue;
+                }
+            } else {
+                struct Exoplanet planet = get_default_exoplanet();
+                planet.orbitalRadius = record->orbitalRadius;
+                planet.orbitalPeriod = record->orbitalPeriod;
+                planet.eccentricity = record->eccentricity;
+                planet.inclination = record->inclination;
+                planet.longitudeOfNode = record->longitudeOfNode;
+                planet.argumentOfPeriapsis = record->argumentOfPeriapsis;
+                orbitCacheGet(&planet, &cached);
+            }
+
+            double current_time = resolve_request_time(record->unixTime);
+            orbitBlockSetLane(block, lanes, orbitHandleMeanAnomaly(orbit, current_time), orbit->eccentricity, orbit->orbitalRadius, orbit->rotation);
+            lane_result[lanes++] = i;
+        }
+
+        if (lanes == 0)
+            continue;
+        computeOrbitBlock(block, lanes);
+
+        for (size_t lane = 0; lane < lanes; lane++) {
+            struct Exoplanet planet = get_default_exoplanet();
+            orbitBlockLanePosition(block, lane, &planet);
+
+            struct BinaryResponseRecord *result = &results[lane_result[lane]];
+            result->distance = planet.distance;
+            result->ra = planet.ra;
+            result->declination = planet.declination;
+            result->galacticLongitude = planet.galacticLongitude;
+            result->galacticLatitude = planet.galacticLatitude;
+            result->status = isnan(planet.distance) || isnan(planet.ra) ? BINARY_STATUS_KEPLER_FAILED : BINARY_STATUS_OK;
+        }
+    }
+
+    free(block);
+    return 0;
+}
+
+// Answers a run of complete, valid binary frames (see binaryCompleteFrames), appending one
+// response frame per frame to batch. Returns -1 if the responses cannot be buffered.
+int answer_binary_frames(const char *frames, size_t length, struct RequestBuffer *batch)
+{
+    size_t offset = 0;
+
+    while (offset < length) {
+        const char *frame = frames + offset;
+        offset += binaryFrameLength(frame, length - offset);
+
+        size_t response_length = binaryResponseLength(frame);
+        if (response_batch_reserve(batch, response_length) != 0)
+            return -1;
+        char *response = batch->data + batch->length;
+
+        // Records are only read and written in place on a little-endian host
+        struct BinaryFrameHeader header;
+        binaryReadHeader(frame, &header);
+        if (header.version != BINARY_VERSION || !binaryHostIsLittleEndian()) {
+            binaryWriteHeader(response, BINARY_ERROR, 0, BINARY_STATUS_UNSUPPORTED_VERSION);
+            batch->length += BINARY_HEADER_SIZE;
+            continue;
+        }
+
+        if (header.type == BINARY_HELLO) {
+            binaryWriteHeader(response, BINARY_HELLO, 0, BINARY_STATUS_OK);
+            batch->length += BINARY_HEADER_SIZE;
+            continue;
+        }
+
+        // A frame that is not 8-byte aligned in the input is copied out before it is read
+        const struct BinaryRequestRecord *records = binaryRequestRecords(frame);
+        struct BinaryRequestRecord *copy = NULL;
+        if (!records && header.count > 0) {
+            copy = malloc(sizeof(struct BinaryRequestRecord) * header.count);
+            if (copy)
+                memcpy(copy, frame + BINARY_HEADER_SIZE, sizeof(struct BinaryRequestRecord) * header.count);
+            records = copy;
+        }
+
+        // Results are written straight into the response frame, which is 8-byte aligned in the batch
+        struct BinaryResponseRecord *results = (struct BinaryResponseRecord *) (response + BINARY_HEADER_SIZE);
+        if ((header.count > 0 && !records) || evaluate_binary_records(records, header.count, results) != 0) {
+            binaryWriteHeader(response, BINARY_ERROR, 0, BINARY_STATUS_BUSY);
+            batch->length += BINARY_HEADER_SIZE;
+        } else {
+            binaryWriteHeader(response, BINARY_RESPONSE, header.count, BINARY_STATUS_OK);
+            batch->length += response_length;
+        }
+        free(copy);
+    }
+
+    return 0;
+}
+
+// Event mode and the socket transport: answers a run of complete binary frames with one block of
+// response frames
+char *handle_binary_frames_block(const char *frames, size_t length, size_t *response_length)
+{
+    struct RequestBuffer batch = {0};
+    answer_binary_frames(frames, length, &batch);
+    *response_length = batch.length;
+    return batch.data;
+}
+
+// Appends an error frame to the pending batch, returns -1 if it cannot be buffered
+int append_binary_error(struct RequestBuffer *batch, enum BinaryStatus status)
+{
+    if (response_batch_reserve(batch, BINARY_HEADER_SIZE) != 0)
+        return -1;
+    binaryWriteHeader(batch->data + batch->length, BINARY_ERROR, 0, status);
+    batch->length += BINARY_HEADER_SIZE;
+    return 0;
+}
+
+// Binary mode: frames on the one channel until the client sends EOF, answered in batches like
+// streaming mode. A frame that can never be valid is answered with an error frame and ends the channel.
+int binary_requests(ssh_channel channel, struct RequestBuffer *input)
+{
+    struct RequestBuffer batch = {0};
+    int ret_val = SSH_OK;
+    int eof = 0;
+
+    for (;;) {
+        size_t frames;
+        int invalid;
+        size_t length = binaryCompleteFrames(input->data, input->length, &frames, &invalid);
+        if (length > 0) {
+            // Shed load like streaming mode, each frame is answered either way
+            int answered = 0;
+            if (admissionEnter(0) == 0) {
+                answered = answer_binary_frames(input->data, length, &batch);
+                admissionLeave();
+            } else {
+                for (size_t i = 0; i < frames && answered == 0; i++)
+                    answered = append_binary_error(&batch, BINARY_STATUS_BUSY);
+            }
+            if (answered != 0) {
+                ret_val = SSH_ERROR;
+                break;
+            }
+            request_buffer_consume(input, length);
+        }
+
+        // A bad header, or EOF in the middle of a frame, ends the channel
+        if (invalid || (eof && input->length > 0)) {
+            append_binary_error(&batch, BINARY_STATUS_INVALID_FRAME);
+            eof = 1;
+            ret_val = SSH_ERROR;
+        }
+
+        // Flush once nothing else is waiting on the channel, or the batch is full
+        int pending = eof ? 0 : ssh_channel_poll(channel, 0);
+        if (batch.length > 0 && (pending <= 0 || batch.length >= STREAM_BATCH_SIZE)) {
+            uint64_t write_start = metricsStart();
+            int written = ssh_channel_write(channel, batch.data, batch.length);
+            metricsRecord(METRICS_WRITE, write_start);
+            if (written == SSH_ERROR) {
+                ret_val = SSH_ERROR;
+                break;
+            }
+            batch.length = 0;
+        }
+
+        if (eof)
+            break;
+
+        if (request_buffer_reserve(input) != 0) {
+            ret_val = SSH_ERROR;
+            break;
+        }
+
+        // An idle channel is closed after the read timeout
+        int nbytes = read_channel(channel, input, admissionReadDeadline());
+        if (nbytes <= 0)
+            eof = 1;
+        else
+            input->length += nbytes;
+    }
+
+    free(batch.data);
+    return ret_val;
+}
+
+// Waits for the first bytes of a request on the channel until deadline (see read_channel),
+// returns -1 at EOF or when none arrived in time
+int read_request_start(ssh_channel channel, struct RequestBuffer *buffer, uint64_t deadline)
+{
+    while (buffer->length == 0) {
+        if (request_buffer_reserve(buffer) != 0)
+            return -1;
+
+        int nbytes = read_channel(channel, buffer, deadline);
+        if (nbytes <= 0)
+            return -1;
+        buffer->length = nbytes;
+    }
+    return 0;
 }
 
 int process_request(ssh_session session)
 {
 
     int stay_alive = 1;
-    while (stay_alive) {
-        printf("hello");
-
 
-        // Allocate a buffer to store data received from the SSH channel.
-        char buffer[256];
+    // Only the session's first request waited for a worker
+    uint64_t waited = workerPoolWaited();
+    while (stay_alive) {
 
         // Declare an SSH channel variable.
         ssh_channel channel;
-
-        // Declare a variable to store the number of bytes read.
-        int nbytes;
+        uint64_t stage_start = metricsStart();
 
         // Create a new SSH channel for the given session.
         channel = ssh_channel_new(session);
@@ -54,156 +1989,139 @@ int process_request(ssh_session session)
             // Return an error as the session couldn't be opened.
             return SSH_ERROR;
         }
+        metricsRecord(METRICS_CHANNEL_OPEN, stage_start);
 
-        // Define the exoplanet data
-        struct Exoplanet exoplanet = get_default_exoplanet();
+        // A binary client (see exoplanetbinary.c) opens with a hello frame instead of a JSON document
+        // The whole request has to arrive within the read timeout
+        uint64_t read_deadline = admissionReadDeadline();
+        struct RequestBuffer input = {0};
+        if (read_request_start(channel, &input, read_deadline) == 0 && input.data[0] == BINARY_MAGIC_BYTE) {
+            int rc = binary_requests(channel, &input);
 
-        // Receive JSON input from client
-        nbytes = ssh_channel_read(channel, buffer, sizeof(buffer), 0);
-        buffer[nbytes] = '\0';
+            free(input.data);
+            ssh_channel_send_eof(channel);
+            ssh_channel_close(channel);
+            ssh_channel_free(channel);
+            return rc;
+        }
 
-        // Parse JSON input using Jansson
-        json_t *root;
+        // Receive JSON input from client and parse it using Jansson
         json_error_t error;
-        root = json_loads(buffer, 0, &error);
-
-        if (root) {
-            // Update exoplanet properties from JSON
-            json_t *mass_json = json_object_get(root, "mass");
-            if (json_is_number(mass_json))
-                exoplanet.mass = json_number_value(mass_json);
+        json_t *root = read_json_request(channel, &input, &error, read_deadline);
 
-            json_t *planet_radius_json = json_object_get(root, "planetRadius");
-            if (json_is_number(planet_radius_json))
-                exoplanet.planetRadius = json_number_value(planet_radius_json);
-
-            json_t *orbital_radius_json = json_object_get(root, "orbitalRadius");
-            if (json_is_number(orbital_radius_json))
-                exoplanet.orbitalRadius = json_number_value(orbital_radius_json);
-
-            json_t *orbital_period_json = json_object_get(root, "orbital_period");
-            if (json_is_number(orbital_period_json))
-                exoplanet.orbitalPeriod = json_number_value(orbital_period_json);
-
-            json_t *eccentricity_json = json_object_get(root, "eccentricity");
-            if (json_is_number(eccentricity_json))
-                exoplanet.eccentricity = json_number_value(eccentricity_json);
+        if (!root) {
+            fprintf(stderr, "Error parsing JSON: %s\n", error.text);
+            free(input.data);
+            ssh_channel_close(channel);
+            ssh_channel_free(channel);
+            return SSH_ERROR;
+        }
 
-            json_t *inclination_json = json_object_get(root, "inclination");
-            if (json_is_number(inclination_json))
-                exoplanet.inclination = json_number_value(inclination_json);
+        // Switch this channel to streaming mode, it then carries every further request
+        json_t *request_json = json_object_get(root, "request");
+        if (json_is_string(request_json) && strcmp(json_string_value(request_json), "stream") == 0) {
+            json_decref(root);
 
-            json_t *longitude_of_node_json = json_object_get(root, "longitude_of_node");
-            if (json_is_number(longitude_of_node_json))
-                exoplanet.longitudeOfNode = json_number_value(longitude_of_node_json);
+            const char *ack = "{\"streaming\":true}\n";
+            ssh_channel_write(channel, ack, strlen(ack));
+            int rc = stream_requests(channel, &input);
 
-            json_t *argument_of_periapsis_json = json_object_get(root, "argument_of_periapsis");
-            if (json_is_number(argument_of_periapsis_json))
-                exoplanet.argumentOfPeriapsis = json_number_value(argument_of_periapsis_json);
+            free(input.data);
+            ssh_channel_send_eof(channel);
+            ssh_channel_close(channel);
+            ssh_channel_free(channel);
+            return rc;
+        }
+        free(input.data);
 
-            json_t *unixTime_json = json_object_get(root, "unixTime");
-            if (json_is_number(unixTime_json))
-                exoplanet.unixTime = json_number_value(unixTime_json);
+        // Check if the client wants to stay alive
+        json_t *stay_alive_json = json_object_get(root, "stay_alive");
+        if (json_is_boolean(stay_alive_json))
+        {
+            stay_alive = json_boolean_value(stay_alive_json);
+        }
+        else
+        {
+            stay_alive = 0; // Default to disconnect
+        }
 
-            json_t *distance_json = json_object_get(root, "distance");
-            if (json_is_number(distance_json))
-                exoplanet.distance = json_number_value(distance_json);
-            // If it's not a number, the initialized value of 0.0 will remain
+        // A draining server answers this request and then closes the session
+        if (!running)
+            stay_alive = 0;
 
-            json_t *declination_json = json_object_get(root, "declination");
-            if (json_is_number(declination_json))
-                exoplanet.declination = json_number_value(declination_json);
-            // If it's not a number, the initialized value of 0.0 will remain
+        // An overloaded server answers at once and ends the session, freeing its worker
+        if (admissionEnter(waited) != 0) {
+            json_decref(root);
+            ssh_channel_write(channel, ADMISSION_OVERLOADED_RESPONSE, strlen(ADMISSION_OVERLOADED_RESPONSE));
+            ssh_channel_send_eof(channel);
+            ssh_channel_close(channel);
+            ssh_channel_free(channel);
+            return SSH_OK;
+        }
+        waited = 0;
 
-            /// .galacticLongitude = 0.0,
-            json_t *galacticLongitude_json = json_object_get(root, "galacticLongitude");
-            if (json_is_number(galacticLongitude_json))
-                exoplanet.galacticLongitude = json_number_value(galacticLongitude_json);
+        // A request that waited past its deadline is not computed
+        if (start_request_deadline(root) != 0) {
+            json_decref(root);
+            json_t *response = deadline_response();
+            char *response_str = json_dumps(response, JSON_COMPACT);
+            json_decref(response);
+            if (response_str)
+                ssh_channel_write(channel, response_str, strlen(response_str));
+            free(response_str);
+            admissionLeave();
 
+            ssh_channel_send_eof(channel);
+            ssh_channel_close(channel);
+            ssh_channel_free(channel);
+            continue;
+        }
 
-            json_t *galacticLatitude_json = json_object_get(root, "galacticLatitude");
-            if (json_is_number(galacticLatitude_json))
-                exoplanet.galacticLatitude = json_number_value(galacticLatitude_json);
+        // A visualization export is written to the channel a chunk at a time as it is formatted
+        if (is_visualization_request(root)) {
+            answer_visualization_request(root, channel);
+            json_decref(root);
+            admissionLeave();
 
-            // Check if the client wants to stay alive
-            json_t *stay_alive_json = json_object_get(root, "stay_alive");
-            if (json_is_boolean(stay_alive_json))
-            {
-                stay_alive = json_boolean_value(stay_alive_json);
-            }
-            else
-            {
-                stay_alive = 0; // Default to disconnect
-            }
+            ssh_channel_send_eof(channel);
+            ssh_channel_close(channel);
+            ssh_channel_free(channel);
+            continue;
+        }
 
-            json_t *ra_json = json_object_get(root, "ra");
-            if (json_is_number(ra_json))
-                exoplanet.ra = json_number_value(ra_json);
-            // If it's not a number, the initialized value of 0.0 will remain
-            // ... (Parse other properties if needed)
+        // Trajectories and orbital events are written a batch of lines at a time while they are computed
+        if (is_multiline_request(root)) {
+            struct RequestBuffer batch = {0};
+            if (answer_multiline_request(root, &batch, channel) == 0 && batch.length > 0)
+                flush_response_batch(channel, &batch);
             json_decref(root);
-        } else {
-            fprintf(stderr, "Error parsing JSON: %s\n", error.text);
-            return SSH_ERROR;
+            free(batch.data);
+            admissionLeave();
+
+            ssh_channel_send_eof(channel);
+            ssh_channel_close(channel);
+            ssh_channel_free(channel);
+            continue;
         }
 
-        // Convert system time to a double (in seconds)
-        double current_time;
+        json_t *response = dispatch_request(root);
 
-        // Check if unixTime is provided and not null
-        if (exoplanet.unixTime > 0) {
-            current_time = exoplanet.unixTime;
-        } else {
-            // Get the current system time
-            time_t raw_time;
-            time(&raw_time);
-            current_time = (double) raw_time;
-        }
-
-        // Calculate the distance to the exoplanet & the Right Ascension (RA)
-        calculateRaAndDistance(&exoplanet, current_time);
-
-        // set galactic coordinates
-        setGalacticCoordinates(&exoplanet);
-
-        // Serialize the entire modified Exoplanet struct to JSON
-        json_t *response = json_object();
-
-        json_object_set_new(response, "name", json_string(exoplanet.name));
-        json_object_set_new(response, "mass", json_real(exoplanet.mass));
-        json_object_set_new(response, "planetRadius", json_real(exoplanet.planetRadius));
-        json_object_set_new(response, "orbitalRadius", json_real(exoplanet.orbitalRadius));
-        json_object_set_new(response, "orbitalPeriod", json_real(exoplanet.orbitalPeriod));
-        json_object_set_new(response, "eccentricity", json_real(exoplanet.eccentricity));
-        json_object_set_new(response, "inclination", json_real(exoplanet.inclination));
-        json_object_set_new(response, "longitudeOfNode", json_real(exoplanet.longitudeOfNode));
-        json_object_set_new(response, "argumentOfPeriapsis", json_real(exoplanet.argumentOfPeriapsis));
-        json_object_set_new(response, "galacticLongitude", json_real(exoplanet.galacticLongitude));
-        json_object_set_new(response, "galacticLatitude", json_real(exoplanet.galacticLatitude));
-        json_object_set_new(response, "declination", json_real(exoplanet.declination));
-        json_object_set_new(response, "stayAlive", json_real(exoplanet.stayAlive));
-        json_object_set_new(response, "unixTime", json_real(exoplanet.unixTime));
-
-        if (isnan(exoplanet.distance) || isnan(exoplanet.ra)) {
-            // Indicate there was an error in solving Kepler's equation
-            json_object_set_new(response, "error", json_string("Failed to solve Kepler's equation given the input."));
-
-            // You can choose to omit ra and distance or set them to null values
-            json_object_set_new(response, "distance", json_null());
-            json_object_set_new(response, "ra", json_null());
-        } else {
-            json_object_set_new(response, "distance", json_real(exoplanet.distance));
-            json_object_set_new(response, "ra", json_real(exoplanet.ra));
-        }
+        // Exoplanet names point into the request, so release it only once the response is built
+        json_decref(root);
 
         // Serialize the JSON object to a string
+        stage_start = metricsStart();
         char *response_str = json_dumps(response, JSON_COMPACT);
 
         // Clean up the JSON object
         json_decref(response);
+        metricsRecord(METRICS_SERIALIZE, stage_start);
+        admissionLeave();
 
         // Send the response
+        stage_start = metricsStart();
         ssh_channel_write(channel, response_str, strlen(response_str));
+        metricsRecord(METRICS_WRITE, stage_start);
         ssh_channel_send_eof(channel);
         ssh_channel_close(channel);
         ssh_channel_free(channel);
@@ -215,6 +2133,95 @@ int process_request(ssh_session session)
     return SSH_OK;
 }
 
+// Hands an accepted session to an event loop or the session workers
+void dispatch_session(ssh_session session)
+{
+    if (server_config.mode == SERVER_MODE_EVENT)
+    {
+        if (eventServerAdopt(&event_server, session) != 0)
+        {
+            ssh_disconnect(session);
+            ssh_free(session);
+        }
+        return;
+    }
+
+    // With a full backlog the connection is dropped (or, with the block policy, accepting pauses)
+    if (workerPoolSubmit(&session_pool, handle_session, session, server_config.queueBlock) != 0)
+    {
+        fprintf(stderr, "Session queue full, rejecting connection\n");
+        ssh_disconnect(session);
+        ssh_free(session);
+    }
+}
+
+// Accepts SSH connections and hands their sessions to the workers until running is cleared, from
+// the ssh_bind's own listener or, in a prefork worker, from listener. Returns -1 if accepting failed.
+int accept_sessions(ssh_bind sshbind, int listener)
+{
+    ssh_session session;
+
+    while (running)
+    {
+        session = ssh_new();
+        if (session == NULL)
+        {
+            fprintf(stderr, "Error creating SSH session\n");
+            return -1;
+        }
+
+        int accepted;
+        if (listener >= 0)
+        {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0)
+            {
+                ssh_free(session);
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                fprintf(stderr, "Error accepting SSH connection: %s\n", strerror(errno));
+                return -1;
+            }
+            accepted = ssh_bind_accept_fd(sshbind, session, fd);
+        }
+        else
+            accepted = ssh_bind_accept(sshbind, session);
+
+        // A drain signal interrupts the accept
+        if (accepted == SSH_ERROR)
+        {
+            ssh_free(session);
+            if (!running)
+                break;
+            fprintf(stderr, "Error accepting SSH connection\n");
+            return -1;
+        }
+
+        dispatch_session(session);
+    }
+
+    // Connections already queued on a worker's own listener would be reset when it closes, they
+    // are taken and served first
+    if (listener >= 0 && fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK) == 0)
+    {
+        int fd;
+        while ((fd = accept(listener, NULL, NULL)) >= 0)
+        {
+            session = ssh_new();
+            if (session == NULL || ssh_bind_accept_fd(sshbind, session, fd) == SSH_ERROR)
+            {
+                if (session)
+                    ssh_free(session);
+                else
+                    close(fd);
+                continue;
+            }
+            dispatch_session(session);
+        }
+    }
+    return 0;
+}
+
 void handle_signal(int signal)
 {
     (void)signal; // to avoid unused parameter warning
@@ -223,13 +2230,37 @@ void handle_signal(int signal)
 
 int main()
 {
-
-    printf("starting server");
     ssh_bind sshbind;
-    ssh_session session;
     int ret_val = 0;
+    int listener = -1;
+    int worker = 0;
+    struct Prefork prefork;
+    sigset_t drain_signals;
+
+    // SIGTERM (from the orchestrator) and SIGINT both drain. Without SA_RESTART a blocking accept
+    // returns when one arrives.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigemptyset(&drain_signals);
+    sigaddset(&drain_signals, SIGINT);
+    sigaddset(&drain_signals, SIGTERM);
+
+    if (loadServerConfig(&server_config) != 0)
+        return 1;
+
+    kepler_solver = server_config.solver;
+    admissionInit(server_config.maxInFlight, server_config.maxQueueMs, server_config.requestTimeoutMs,
+                  server_config.readTimeoutMs, server_config.handshakeTimeoutMs);
 
-    signal(SIGINT, handle_signal);
+    if (resultCacheInit((size_t) server_config.resultCacheEntries, server_config.resultCacheQuantumMs / 1000.0) != 0)
+    {
+        fprintf(stderr, "Error allocating the result cache\n");
+        return 1;
+    }
 
     sshbind = ssh_bind_new();
     if (sshbind == NULL)
@@ -239,51 +2270,195 @@ int main()
     }
 
     ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDADDR, "0.0.0.0");
-    ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDPORT_STR, "2222");
+    char ssh_port[16];
+    snprintf(ssh_port, sizeof(ssh_port), "%d", server_config.sshPort);
+    ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDPORT_STR, ssh_port);
     ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_HOSTKEY, "ssh-rsa");
-    ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_RSAKEY, "/opt/exoplanet.pem");
 
-    if (ssh_bind_listen(sshbind) < 0)
+    if (server_config.processes > 1)
     {
-        fprintf(stderr, "Error binding to address and port: %s\n", ssh_get_error(sshbind));
-        ret_val = 1;
-        goto cleanup;
+        // Each worker accepts on a listener of its own, the host key is parsed once here and shared
+        ssh_key host_key = NULL;
+        if (ssh_pki_import_privkey_file("/opt/exoplanet.pem", NULL, NULL, NULL, &host_key) != SSH_OK ||
+            ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_IMPORT_KEY, host_key) != SSH_OK)
+        {
+            fprintf(stderr, "Error loading host key: %s\n", ssh_get_error(sshbind));
+            ssh_key_free(host_key);
+            ret_val = 1;
+            goto cleanup;
+        }
     }
+    else
+    {
+        ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_RSAKEY, "/opt/exoplanet.pem");
 
-    printf("Listening on port 2222...\n");
+        if (ssh_bind_listen(sshbind) < 0)
+        {
+            fprintf(stderr, "Error binding to address and port: %s\n", ssh_get_error(sshbind));
+            ret_val = 1;
+            goto cleanup;
+        }
+    }
 
-    while (running)
+    // Map the planet catalog so requests can name planets instead of sending their elements
+    if (server_config.catalogPath)
     {
-        session = ssh_new();
-        if (session == NULL)
+        if (catalogOpen(server_config.catalogPath, &server_catalog) != 0)
         {
-            fprintf(stderr, "Error creating SSH session\n");
             ret_val = 1;
-            break;
+            goto cleanup;
         }
+        printf("Loaded %zu planets from %s\n", server_catalog.count, server_config.catalogPath);
 
-        if (ssh_bind_accept(sshbind, session) == SSH_ERROR)
+        // A shard's catalog is built with catalog-builder --shard. Planets of other shards in it are
+        // turned away like any other, so they only take up memory and show up in sky searches.
+        if (server_config.shardCount > 1)
         {
-            fprintf(stderr, "Error accepting SSH connection\n");
+            size_t foreign = 0;
+            for (size_t i = 0; i < server_catalog.count; i++)
+                foreign += shardOf(catalogName(&server_catalog, i), server_config.shardCount) != server_config.shardIndex;
+            printf("Serving shard %d/%d\n", server_config.shardIndex, server_config.shardCount);
+            if (foreign > 0)
+                fprintf(stderr, "Warning: %zu cataloged planets belong to other shards, build the catalog with --shard %d/%d\n",
+                        foreign, server_config.shardIndex, server_config.shardCount);
+        }
+
+        // Cone and box searches index the catalog per bucket of epochs on first use
+        if (coneSearchInit(&server_cone_search, &server_catalog, server_config.coneBucketSeconds) != 0)
+        {
+            fprintf(stderr, "Error allocating the sky search index\n");
             ret_val = 1;
-            ssh_free(session);
-            break;
+            goto cleanup;
         }
 
-        pthread_t thread;
-        int err = pthread_create(&thread, NULL, handle_session, session);
-        if (err)
+        // Scene octrees are built per epoch on first use and refitted as time advances
+        sceneCacheInit(&server_scene_cache, &server_catalog, server_config.sceneEpochSeconds);
+    }
+
+    // Map the ephemeris tables so covered requests for cataloged planets skip the Kepler solve
+    if (server_config.ephemerisPath)
+    {
+        if (ephemerisOpen(server_config.ephemerisPath, &server_catalog, &server_ephemeris) != 0)
         {
-            fprintf(stderr, "Error creating thread\n");
             ret_val = 1;
-            ssh_free(session);
-            break;
+            goto cleanup;
+        }
+        printf("Loaded ephemeris tables of %zu planets from %s\n", server_ephemeris.count, server_config.ephemerisPath);
+    }
+
+    // Everything above is shared copy-on-write with the workers, threads are started after the fork
+    if (server_config.processes > 1)
+    {
+        printf("Starting %d worker processes...\n", server_config.processes);
+        worker = preforkRun(&prefork, server_config.processes, server_config.drainSeconds, &running);
+        if (worker < 0)
+        {
+            printf("Restarted workers %llu times\n", prefork.restarts);
+            goto cleanup;
+        }
+
+        listener = preforkListen(server_config.sshPort);
+        if (listener < 0)
+        {
+            ret_val = 1;
+            goto cleanup;
+        }
+        if (server_config.pinProcesses && preforkPinToCore(worker) != 0)
+            fprintf(stderr, "Worker %d could not be pinned to a core\n", worker);
+    }
+
+    // Drain signals are left to the accepting thread, the threads started below inherit the mask
+    pthread_sigmask(SIG_BLOCK, &drain_signals, NULL);
+
+    // Model exports, scenes, sky search indexes and orbital event searches split their loops over the shared task pool
+    if (workerPoolInit(&worker_task_pool, server_config.taskWorkers, server_config.queueCapacity) != 0)
+    {
+        fprintf(stderr, "Error starting task workers\n");
+        ret_val = 1;
+        goto cleanup;
+    }
+
+    // Request stage timings are only recorded while something can scrape them
+    // (each worker on the port after the previous one's)
+    if (server_config.metricsPort > 0)
+    {
+        if (metricsServerInit(&metrics_server, server_config.metricsPort + worker, collect_server_metrics) != 0)
+        {
+            fprintf(stderr, "Error starting metrics endpoint\n");
+            ret_val = 1;
+            goto cleanup;
+        }
+        printf("Serving metrics on port %d...\n", server_config.metricsPort + worker);
+    }
+
+    // Plain newline-delimited JSON for clients inside the cluster that do not need SSH. Workers share
+    // the TCP port, the unix socket path can only be bound by the first.
+    const char *unix_socket = worker == 0 ? server_config.unixSocket : NULL;
+    if (server_config.tcpPort > 0 || unix_socket)
+    {
+        if (socketServerInit(&socket_server, server_config.tcpPort, unix_socket, server_config.computeWorkers,
+                             server_config.queueCapacity, MAX_REQUEST_SIZE, handle_line_request, handle_binary_frames_block) != 0)
+        {
+            fprintf(stderr, "Error starting socket transport\n");
+            ret_val = 1;
+            goto cleanup;
         }
+        if (server_config.tcpPort > 0)
+            printf("Listening for JSON lines on TCP port %d...\n", server_config.tcpPort);
+        if (unix_socket)
+            printf("Listening for JSON lines on %s...\n", unix_socket);
+    }
 
-        pthread_detach(thread);
+    if (server_config.mode == SERVER_MODE_EVENT)
+    {
+        // A few event loops hold every session, requests are computed on a separate pool
+        if (eventServerInit(&event_server, server_config.eventLoops, server_config.computeWorkers,
+                            server_config.queueCapacity, MAX_REQUEST_SIZE, handle_json_request, handle_request_lines_block,
+                            handle_binary_frames_block) != 0)
+        {
+            fprintf(stderr, "Error starting event loops\n");
+            ret_val = 1;
+            goto cleanup;
+        }
+    }
+    else if (workerPoolInit(&session_pool, server_config.workers, server_config.queueCapacity) != 0)
+    {
+        // Sessions run on a fixed set of workers, the backlog in front of them is bounded
+        fprintf(stderr, "Error starting worker pool\n");
+        ret_val = 1;
+        goto cleanup;
     }
 
+    printf("Listening on port %d...\n", server_config.sshPort);
+
+    // Signals are only taken on this thread from here on, so a blocking accept returns on them
+    pthread_sigmask(SIG_UNBLOCK, &drain_signals, NULL);
+    if (accept_sessions(sshbind, listener) != 0)
+        ret_val = 1;
+    if (listener >= 0)
+        close(listener);
+
+    // Sessions still open at the drain deadline are cut off (SIGALRM terminates the process)
+    if (!running && server_config.drainSeconds > 0)
+        alarm((unsigned) server_config.drainSeconds);
+
+    // Stop scraping before the pools it reads are torn down
+    metricsServerShutdown(&metrics_server);
+
+    // Let queued and running sessions finish before exiting
+    if (session_pool.numWorkers > 0)
+        workerPoolShutdown(&session_pool);
+    if (event_server.numLoops > 0)
+        eventServerShutdown(&event_server);
+
     cleanup:
+    if (socket_server.compute.numWorkers > 0)
+        socketServerShutdown(&socket_server);
+    metricsServerShutdown(&metrics_server);
+
+    // Sessions and socket requests may wait on task workers until they are done
+    if (worker_task_pool.numWorkers > 0)
+        workerPoolShutdown(&worker_task_pool);
     ssh_bind_free(sshbind);
     return ret_val;
 }
\ No newline at end of file
@@ -0,0 +1,932 @@
+/*
+ * Routing front-end for a sharded deployment: exoplanet-finder replicas that each own the planets
+ * of one range of name hashes (see shard.c) and serve the plain TCP transport. Clients talk to the
+ * router exactly as they would to a single replica, one newline-delimited JSON request per line.
+ *
+ * Usage: exoplanet-router --shards HOST:PORT,HOST:PORT,... [--port PORT] [--workers N] [--queue N]
+ *   --shards LIST           the replicas' EXOPLANET_TCP_PORT endpoints, in shard order (the first
+ *                           one serves EXOPLANET_SHARD=0/N)
+ *   --port PORT             port the router listens on (2300)
+ *   --workers N             clients served at once (64)
+ *   --queue N               clients that may wait for a worker, more are refused (256)
+ *
+ * Requests naming a planet (plain and trajectory requests) go to its owner, unnamed ones to the
+ * shards in turn. Batches and orbit_events requests are split by owner, the parts sent to every
+ * shard involved before any answer is read so the shards compute them in parallel, and the answers
+ * merged: batch results keep their request order, orbit_events planets arrive grouped by shard and
+ * are followed by one summary line. Cone and box searches go to every shard at one epoch and their
+ * matches are merged by separation, each tagged with its "shard" since records are numbered per
+ * shard. The statistics requests answer {"shards": [...]} with every shard's own answer. Scenes
+ * and visualizations span the whole catalog and are not routed. A shard that cannot be reached is
+ * reported with a "shard_unavailable" error.
+ *
+ * Clients are served by a fixed pool of worker threads (see workerpool.c), each client by one worker
+ * until it hangs up, with a connection of its own to each shard, opened on first use. Clients that
+ * arrive while every worker is busy wait in a bounded queue. Past that they are answered with an
+ * overloaded error and closed, like work the server sheds.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <jansson.h>
+#include "shard.c"
+#include "workerpool.c"
+
+// Largest request accepted from a client, the server's own limit
+#define ROUTER_MAX_REQUEST (16 * 1024 * 1024)
+
+// Largest response line accepted from a shard
+#define ROUTER_MAX_RESPONSE (1024 * 1024 * 1024)
+
+// Milliseconds a client may stay silent, and a shard may take to answer
+#define ROUTER_IDLE_MS 60000
+#define ROUTER_SHARD_TIMEOUT_MS 120000
+
+// Sent to a client refused because the queue of clients is full, the server's overloaded answer
+#define ROUTER_OVERLOADED_RESPONSE "{\"error\":\"Server overloaded.\",\"code\":\"overloaded\"}"
+
+// Matches a sky search returns when the request sets no limit, as on a replica
+#define ROUTER_DEFAULT_SKY_SEARCH_RESULTS 1000
+
+struct RouterShard {
+    char *host;
+    char *port;
+};
+
+// Bytes read from a socket, the lines before start already handed out
+struct RouterBuffer {
+    char *data;
+    size_t start;
+    size_t length;
+    size_t capacity;
+};
+
+struct RouterConnection {
+    int fd;                         // -1 until first used, and after a failure
+    struct RouterBuffer input;
+};
+
+struct RouterClient {
+    int fd;
+    struct RouterBuffer input;
+    struct RouterConnection *shards;
+};
+
+// A sky search match with the shard it came from
+struct RouterMatch {
+    json_t *result;
+    double separation;
+    int shard;
+};
+
+static struct RouterShard *router_shards;
+static int router_shard_count;
+static unsigned router_next;        // Round robin over the shards for unnamed requests
+
+static void router_close(struct RouterConnection *connection)
+{
+    if (connection->fd >= 0)
+        close(connection->fd);
+    connection->fd = -1;
+    connection->input.start = 0;
+    connection->input.length = 0;
+}
+
+static int router_connect(const struct RouterShard *shard)
+{
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(shard->host, shard->port, &hints, &addresses) != 0)
+        return -1;
+
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    // Requests are single writes that should leave at once
+    if (fd >= 0)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// The client's connection to a shard, opened or reopened as needed. Returns -1 if the shard cannot be reached.
+static int router_upstream(struct RouterClient *client, int shard)
+{
+    struct RouterConnection *connection = &client->shards[shard];
+
+    // A replica closes connections that stay idle past its read timeout
+    char probe;
+    if (connection->fd >= 0 && recv(connection->fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+        router_close(connection);
+
+    if (connection->fd < 0)
+        connection->fd = router_connect(&router_shards[shard]);
+    return connection->fd;
+}
+
+// Writes data followed by a newline, returns -1 on failure
+static int router_write_line(int fd, const char *data, size_t length)
+{
+    char newline = '\n';
+    struct iovec parts[2] = { { (void *) data, length }, { &newline, 1 } };
+    int part = 0;
+
+    while (part < 2)
+    {
+        ssize_t written = writev(fd, parts + part, 2 - part);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+
+        size_t left = (size_t) written;
+        while (part < 2 && left >= parts[part].iov_len)
+            left -= parts[part++].iov_len;
+        if (part < 2)
+        {
+            parts[part].iov_base = (char *) parts[part].iov_base + left;
+            parts[part].iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+// Reads until buffer holds a complete line and returns it without its newline, or NULL on EOF, an
+// error, a timeout or a line longer than limit. The line stays valid until the next read.
+static char *router_read_line(int fd, struct RouterBuffer *buffer, size_t limit, int timeout_ms, size_t *length)
+{
+    for (;;)
+    {
+        char *line = buffer->data + buffer->start;
+        char *newline = buffer->length > buffer->start ? memchr(line, '\n', buffer->length - buffer->start) : NULL;
+        if (newline)
+        {
+            *length = (size_t) (newline - line);
+            buffer->start += *length + 1;
+            return line;
+        }
+
+        // Keep the partial line at the front and make room behind it
+        if (buffer->start > 0)
+            memmove(buffer->data, line, buffer->length - buffer->start);
+        buffer->length -= buffer->start;
+        buffer->start = 0;
+        if (buffer->length > limit)
+            return NULL;
+        if (buffer->capacity - buffer->length < 4096)
+        {
+            size_t capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+            char *data = realloc(buffer->data, capacity);
+            if (!data)
+                return NULL;
+            buffer->data = data;
+            buffer->capacity = capacity;
+        }
+
+        struct pollfd readable = { fd, POLLIN, 0 };
+        int ready = poll(&readable, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            return NULL;
+
+        ssize_t nbytes = recv(fd, buffer->data + buffer->length, buffer->capacity - buffer->length, 0);
+        if (nbytes < 0 && errno == EINTR)
+            continue;
+        if (nbytes <= 0)
+            return NULL;
+        buffer->length += (size_t) nbytes;
+    }
+}
+
+// Reads the next response line of a shard, closing the connection when it fails
+static char *router_read_shard(struct RouterClient *client, int shard, size_t *length)
+{
+    struct RouterConnection *connection = &client->shards[shard];
+    char *line = router_read_line(connection->fd, &connection->input, ROUTER_MAX_RESPONSE, ROUTER_SHARD_TIMEOUT_MS, length);
+    if (!line)
+        router_close(connection);
+    return line;
+}
+
+// Sends a request line to a shard, returns -1 if it cannot be reached
+static int router_send(struct RouterClient *client, int shard, const char *request, size_t length)
+{
+    int fd = router_upstream(client, shard);
+    if (fd < 0 || router_write_line(fd, request, length) != 0)
+    {
+        router_close(&client->shards[shard]);
+        return -1;
+    }
+    return 0;
+}
+
+static json_t *router_error(const char *message)
+{
+    json_t *response = json_object();
+    json_object_set_new(response, "error", json_string(message));
+    return response;
+}
+
+static json_t *router_unavailable(int shard)
+{
+    char message[64];
+    snprintf(message, sizeof(message), "Shard %d is unavailable.", shard);
+    json_t *response = router_error(message);
+    json_object_set_new(response, "code", json_string("shard_unavailable"));
+    json_object_set_new(response, "shard", json_integer(shard));
+    return response;
+}
+
+// Writes a response line to the client and releases it, returns -1 if the client is gone
+static int router_reply(struct RouterClient *client, json_t *response)
+{
+    char *text = json_dumps(response, JSON_COMPACT);
+    json_decref(response);
+    int rc = text ? router_write_line(client->fd, text, strlen(text)) : -1;
+    free(text);
+    return rc;
+}
+
+// The shard owning a planet given by name or as an object with a "name", -1 without a name
+static int router_owner(json_t *planet_json)
+{
+    const char *name = json_is_string(planet_json) ? json_string_value(planet_json) : json_string_value(json_object_get(planet_json, "name"));
+    return name ? shardOf(name, router_shard_count) : -1;
+}
+
+static int router_next_shard(void)
+{
+    return (int) (__atomic_fetch_add(&router_next, 1, __ATOMIC_RELAXED) % (unsigned) router_shard_count);
+}
+
+// Whether a line ends a multi-line answer: every line of a trajectory or orbit_events answer but
+// the last ends with "done":false, the last is a summary or an error
+static int router_final_line(const char *line, size_t length)
+{
+    static const char more[] = "\"done\":false}";
+    return length < sizeof(more) - 1 || memcmp(line + length - (sizeof(more) - 1), more, sizeof(more) - 1) != 0;
+}
+
+// Passes a request to one shard and its answer, one line or with multiline all of its lines, back
+// to the client. Returns -1 if the client is gone.
+static int router_forward(struct RouterClient *client, int shard, const char *request, size_t length, int multiline)
+{
+    if (router_send(client, shard, request, length) != 0)
+        return router_reply(client, router_unavailable(shard));
+
+    for (;;)
+    {
+        size_t line_length;
+        char *line = router_read_shard(client, shard, &line_length);
+        if (!line)
+            return router_reply(client, router_unavailable(shard));
+        if (router_write_line(client->fd, line, line_length) != 0)
+            return -1;
+        if (!multiline || router_final_line(line, line_length))
+            return 0;
+    }
+}
+
+// Sends every shard its request (those with a NULL request are left out) before reading any
+// answer, then reads one response line from each. responses[i] is the parsed answer of shard i,
+// an error when it could not be reached, or NULL when it was left out.
+static void router_gather(struct RouterClient *client, char **requests, json_t **responses)
+{
+    for (int i = 0; i < router_shard_count; i++)
+    {
+        responses[i] = NULL;
+        if (requests[i] && router_send(client, i, requests[i], strlen(requests[i])) != 0)
+            responses[i] = router_unavailable(i);
+    }
+
+    for (int i = 0; i < router_shard_count; i++)
+    {
+        if (!requests[i] || responses[i])
+            continue;
+
+        size_t length;
+        char *line = router_read_shard(client, i, &length);
+        responses[i] = line ? json_loadb(line, length, 0, NULL) : NULL;
+        if (!json_is_object(responses[i]))
+        {
+            json_decref(responses[i]);
+            responses[i] = router_unavailable(i);
+        }
+    }
+}
+
+// The first error among the gathered responses, with a reference of its own, or NULL
+static json_t *router_first_error(json_t **responses)
+{
+    for (int i = 0; i < router_shard_count; i++)
+    {
+        if (responses[i] && json_object_get(responses[i], "error"))
+            return json_incref(responses[i]);
+    }
+    return NULL;
+}
+
+static void router_release(char **requests, json_t **responses)
+{
+    for (int i = 0; i < router_shard_count; i++)
+    {
+        free(requests[i]);
+        json_decref(responses[i]);
+    }
+}
+
+// Splits the planets of a batch or orbit_events request by owner, filling owners (unnamed planets
+// are spread by position) and a request per shard involved. Returns the number of shards involved,
+// 0 if memory ran out.
+static int router_split(json_t *root, json_t *planets_json, int *owners, char **requests)
+{
+    size_t planets = json_array_size(planets_json);
+    for (size_t i = 0; i < planets; i++)
+    {
+        owners[i] = router_owner(json_array_get(planets_json, i));
+        if (owners[i] < 0)
+            owners[i] = (int) (i % (size_t) router_shard_count);
+    }
+
+    int involved = 0;
+    for (int shard = 0; shard < router_shard_count; shard++)
+    {
+        requests[shard] = NULL;
+        json_t *part = json_array();
+        for (size_t i = 0; i < planets; i++)
+        {
+            if (owners[i] == shard)
+                json_array_append(part, json_array_get(planets_json, i));
+        }
+        if (json_array_size(part) == 0)
+        {
+            json_decref(part);
+            continue;
+        }
+
+        json_t *request = json_copy(root);
+        json_object_set_new(request, "planets", part);
+        requests[shard] = json_dumps(request, JSON_COMPACT);
+        json_decref(request);
+        if (!requests[shard])
+            return 0;
+        involved++;
+    }
+    return involved;
+}
+
+// Splits a batch by owner and merges the shards' results back into request order
+static int router_batch(struct RouterClient *client, json_t *root, const char *request, size_t length)
+{
+    // A malformed batch is left to a shard to turn down
+    json_t *planets_json = json_object_get(root, "planets");
+    size_t planets = json_array_size(planets_json);
+    if (planets == 0)
+        return router_forward(client, router_next_shard(), request, length, 0);
+
+    int *owners = malloc(planets * sizeof(int));
+    char **requests = calloc((size_t) router_shard_count, sizeof(char *));
+    json_t **responses = calloc((size_t) router_shard_count, sizeof(json_t *));
+    json_t **slots = calloc(planets, sizeof(json_t *));
+    if (!owners || !requests || !responses || !slots)
+    {
+        free(owners);
+        free(requests);
+        free(responses);
+        free(slots);
+        return router_reply(client, router_error("Out of memory."));
+    }
+
+    int involved = router_split(root, planets_json, owners, requests);
+    json_t *response = NULL;
+    if (involved == 0)
+        response = router_error("Out of memory.");
+    else if (involved == 1)
+    {
+        // A batch within one shard is passed through as it is
+        int shard = owners[0];
+        router_release(requests, responses);
+        free(owners);
+        free(requests);
+        free(responses);
+        free(slots);
+        return router_forward(client, shard, request, length, 0);
+    }
+    else
+    {
+        router_gather(client, requests, responses);
+        response = router_first_error(responses);
+    }
+
+    // Shard i's j-th result belongs to the j-th planet it owns
+    for (int shard = 0; shard < router_shard_count && !response; shard++)
+    {
+        json_t *results = json_object_get(responses[shard], "results");
+        size_t next = 0;
+        for (size_t i = 0; i < planets && responses[shard]; i++)
+        {
+            if (owners[i] != shard)
+                continue;
+            json_t *result = json_array_get(results, next++);
+            if (!json_is_object(result))
+            {
+                response = router_unavailable(shard);
+                break;
+            }
+            json_object_set_new(result, "index", json_integer((json_int_t) i));
+            slots[i] = json_incref(result);
+        }
+    }
+
+    if (!response)
+    {
+        json_t *results = json_array();
+        for (size_t i = 0; i < planets; i++)
+            json_array_append(results, slots[i]);
+        response = json_object();
+        json_object_set_new(response, "results", results);
+    }
+
+    for (size_t i = 0; i < planets; i++)
+        json_decref(slots[i]);
+    router_release(requests, responses);
+    free(owners);
+    free(requests);
+    free(responses);
+    free(slots);
+    return router_reply(client, response);
+}
+
+// Sends an orbit_events request to the owners of its planets, or to every shard when it lists
+// none, relays their planet lines and ends with one summary line over all of them
+static int router_orbit_events(struct RouterClient *client, json_t *root, const char *request, size_t length)
+{
+    json_t *planets_json = json_object_get(root, "planets");
+    if (planets_json && json_array_size(planets_json) == 0)
+        return router_forward(client, router_next_shard(), request, length, 1);
+
+    size_t planets = json_array_size(planets_json);
+    int *owners = malloc((planets ? planets : 1) * sizeof(int));
+    char **requests = calloc((size_t) router_shard_count, sizeof(char *));
+    int *sent = calloc((size_t) router_shard_count, sizeof(int));
+    if (!owners || !requests || !sent)
+    {
+        free(owners);
+        free(requests);
+        free(sent);
+        return router_reply(client, router_error("Out of memory."));
+    }
+
+    int involved = router_shard_count;
+    if (planets_json)
+        involved = router_split(root, planets_json, owners, requests);
+    else
+    {
+        for (int i = 0; i < router_shard_count; i++)
+        {
+            requests[i] = strndup(request, length);
+            if (!requests[i])
+                involved = 0;
+        }
+    }
+
+    json_t *error = involved == 0 ? router_error("Out of memory.") : NULL;
+    for (int i = 0; i < router_shard_count && !error; i++)
+    {
+        if (!requests[i])
+            continue;
+        if (router_send(client, i, requests[i], strlen(requests[i])) == 0)
+            sent[i] = 1;
+        else
+            error = router_unavailable(i);
+    }
+
+    // Each shard's lines are relayed in turn, the others keep computing meanwhile
+    json_int_t total_planets = 0, total_events = 0;
+    int truncated = 0, rc = 0;
+    for (int i = 0; i < router_shard_count && rc == 0; i++)
+    {
+        while (sent[i])
+        {
+            size_t line_length;
+            char *line = router_read_shard(client, i, &line_length);
+            if (!line)
+            {
+                if (!error)
+                    error = router_unavailable(i);
+                break;
+            }
+            if (!router_final_line(line, line_length))
+            {
+                if (router_write_line(client->fd, line, line_length) != 0)
+                {
+                    rc = -1;
+                    break;
+                }
+                continue;
+            }
+
+            json_t *summary = json_loadb(line, line_length, 0, NULL);
+            if (!json_is_object(summary) || json_object_get(summary, "error"))
+            {
+                if (!error)
+                    error = json_is_object(summary) ? json_incref(summary) : router_unavailable(i);
+            }
+            else
+            {
+                total_planets += json_integer_value(json_object_get(summary, "planets"));
+                total_events += json_integer_value(json_object_get(summary, "count"));
+                truncated |= json_is_true(json_object_get(summary, "truncated"));
+            }
+            json_decref(summary);
+            break;
+        }
+    }
+
+    // Connections left with unread lines are out of step with their shards
+    if (rc != 0)
+    {
+        for (int i = 0; i < router_shard_count; i++)
+            router_close(&client->shards[i]);
+    }
+
+    for (int i = 0; i < router_shard_count; i++)
+        free(requests[i]);
+    free(owners);
+    free(requests);
+    free(sent);
+
+    if (rc != 0)
+    {
+        json_decref(error);
+        return rc;
+    }
+    if (error)
+        return router_reply(client, error);
+
+    json_t *summary = json_object();
+    json_object_set_new(summary, "done", json_true());
+    json_object_set_new(summary, "planets", json_integer(total_planets));
+    json_object_set_new(summary, "count", json_integer(total_events));
+    if (truncated)
+        json_object_set_new(summary, "truncated", json_true());
+    return router_reply(client, summary);
+}
+
+static int router_compare_matches(const void *a, const void *b)
+{
+    const struct RouterMatch *x = a;
+    const struct RouterMatch *y = b;
+    if (x->separation != y->separation)
+        return x->separation < y->separation ? -1 : 1;
+    return x->shard - y->shard;
+}
+
+// Runs a cone or box search on every shard at one epoch and merges the closest matches
+static int router_sky_search(struct RouterClient *client, json_t *root)
+{
+    // Every shard has to place its planets at the same time
+    json_t *search = json_copy(root);
+    if (!json_is_number(json_object_get(root, "unixTime")) || json_number_value(json_object_get(root, "unixTime")) <= 0)
+        json_object_set_new(search, "unixTime", json_real((double) time(NULL)));
+    char *request = json_dumps(search, JSON_COMPACT);
+    json_decref(search);
+
+    json_t *limit_json = json_object_get(root, "limit");
+    size_t limit = json_is_number(limit_json) && json_number_value(limit_json) >= 1 ? (size_t) json_number_value(limit_json)
+                                                                                   : ROUTER_DEFAULT_SKY_SEARCH_RESULTS;
+
+    char **requests = calloc((size_t) router_shard_count, sizeof(char *));
+    json_t **responses = calloc((size_t) router_shard_count, sizeof(json_t *));
+    if (!request || !requests || !responses)
+    {
+        free(request);
+        free(requests);
+        free(responses);
+        return router_reply(client, router_error("Out of memory."));
+    }
+
+    for (int i = 0; i < router_shard_count; i++)
+        requests[i] = strdup(request);
+    free(request);
+    router_gather(client, requests, responses);
+
+    json_t *response = router_first_error(responses);
+    size_t matches = 0;
+    json_int_t count = 0;
+    for (int i = 0; i < router_shard_count && !response; i++)
+    {
+        matches += json_array_size(json_object_get(responses[i], "results"));
+        count += json_integer_value(json_object_get(responses[i], "count"));
+    }
+
+    struct RouterMatch *merged = response ? NULL : malloc((matches ? matches : 1) * sizeof(struct RouterMatch));
+    if (!response && !merged)
+        response = router_error("Out of memory.");
+
+    if (!response)
+    {
+        size_t next = 0;
+        for (int i = 0; i < router_shard_count; i++)
+        {
+            json_t *results = json_object_get(responses[i], "results");
+            for (size_t j = 0; j < json_array_size(results); j++)
+            {
+                json_t *result = json_array_get(results, j);
+                json_object_set_new(result, "shard", json_integer(i));
+                merged[next].result = result;
+                merged[next].separation = json_number_value(json_object_get(result, "separation"));
+                merged[next].shard = i;
+                next++;
+            }
+        }
+        qsort(merged, matches, sizeof(struct RouterMatch), router_compare_matches);
+
+        json_t *results = json_array();
+        for (size_t i = 0; i < matches && i < limit; i++)
+            json_array_append(results, merged[i].result);
+
+        response = json_object();
+        json_object_set(response, "unixTime", json_object_get(responses[0], "unixTime"));
+        json_object_set_new(response, "count", json_integer(count));
+        if ((size_t) count > limit)
+            json_object_set_new(response, "truncated", json_true());
+        json_object_set_new(response, "results", results);
+    }
+
+    free(merged);
+    router_release(requests, responses);
+    free(requests);
+    free(responses);
+    return router_reply(client, response);
+}
+
+// Asks every shard for its statistics, answers {"shards": [...]} in shard order
+static int router_stats(struct RouterClient *client, const char *request, size_t length)
+{
+    char **requests = calloc((size_t) router_shard_count, sizeof(char *));
+    json_t **responses = calloc((size_t) router_shard_count, sizeof(json_t *));
+    if (!requests || !responses)
+    {
+        free(requests);
+        free(responses);
+        return router_reply(client, router_error("Out of memory."));
+    }
+
+    for (int i = 0; i < router_shard_count; i++)
+        requests[i] = strndup(request, length);
+    router_gather(client, requests, responses);
+
+    json_t *shards = json_array();
+    for (int i = 0; i < router_shard_count; i++)
+        json_array_append(shards, responses[i] ? responses[i] : json_null());
+
+    router_release(requests, responses);
+    free(requests);
+    free(responses);
+
+    json_t *response = json_object();
+    json_object_set_new(response, "shards", shards);
+    return router_reply(client, response);
+}
+
+// Answers one request line, returns -1 if the client is gone
+static int router_route(struct RouterClient *client, const char *request, size_t length)
+{
+    json_t *root = json_loadb(request, length, 0, NULL);
+    if (!json_is_object(root))
+    {
+        json_decref(root);
+        return router_reply(client, router_error("Invalid JSON."));
+    }
+
+    const char *type = json_string_value(json_object_get(root, "request"));
+    int rc;
+    if (!json_object_get(root, "request") || (type && strcmp(type, "trajectory") == 0))
+    {
+        int owner = router_owner(root);
+        rc = router_forward(client, owner >= 0 ? owner : router_next_shard(), request, length, type != NULL);
+    }
+    else if (type && strcmp(type, "batch") == 0)
+        rc = router_batch(client, root, request, length);
+    else if (type && strcmp(type, "orbit_events") == 0)
+        rc = router_orbit_events(client, root, request, length);
+    else if (type && (strcmp(type, "cone_search") == 0 || strcmp(type, "box_search") == 0))
+        rc = router_sky_search(client, root);
+    else if (type && (strcmp(type, "solver_stats") == 0 || strcmp(type, "cache_stats") == 0 || strcmp(type, "server_stats") == 0))
+        rc = router_stats(client, request, length);
+    else if (type && (strcmp(type, "scene") == 0 || strcmp(type, "visualization") == 0))
+        rc = router_reply(client, router_error("Scenes and visualizations span the whole catalog and are not supported by the router."));
+    else
+        rc = router_forward(client, router_next_shard(), request, length, 0);
+
+    json_decref(root);
+    return rc;
+}
+
+// Runs on a worker: serves one client until it hangs up, stays idle too long or fails
+static void router_client_main(void *arg)
+{
+    struct RouterClient *client = arg;
+
+    for (;;)
+    {
+        size_t length;
+        char *request = router_read_line(client->fd, &client->input, ROUTER_MAX_REQUEST, ROUTER_IDLE_MS, &length);
+        if (!request)
+            break;
+
+        size_t blank = 0;
+        while (blank < length && (request[blank] == ' ' || request[blank] == '\t' || request[blank] == '\r'))
+            blank++;
+        if (blank == length)
+            continue;
+        if (router_route(client, request, length) != 0)
+            break;
+    }
+
+    for (int i = 0; i < router_shard_count; i++)
+    {
+        router_close(&client->shards[i]);
+        free(client->shards[i].input.data);
+    }
+    close(client->fd);
+    free(client->shards);
+    free(client->input.data);
+    free(client);
+}
+
+// Parses "host:port,host:port,...", returns -1 if an entry has no port or there are too many
+static int router_parse_shards(const char *text)
+{
+    int count = 1;
+    for (const char *c = text; *c; c++)
+        count += *c == ',';
+    if (count > SHARD_MAX)
+        return -1;
+
+    router_shards = calloc((size_t) count, sizeof(struct RouterShard));
+    if (!router_shards)
+        return -1;
+
+    while (*text)
+    {
+        size_t length = strcspn(text, ",");
+        char *entry = strndup(text, length);
+        char *colon = entry ? strrchr(entry, ':') : NULL;
+        if (!colon || colon == entry || colon[1] == '\0')
+        {
+            free(entry);
+            return -1;
+        }
+        *colon = '\0';
+        router_shards[router_shard_count].host = entry;
+        router_shards[router_shard_count].port = colon + 1;
+        router_shard_count++;
+
+        text += length;
+        if (*text == ',')
+            text++;
+    }
+    return router_shard_count > 0 ? 0 : -1;
+}
+
+static void router_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s --shards HOST:PORT,HOST:PORT,... [--port PORT] [--workers N] [--queue N]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    int port = 2300;
+    int workers = 64;
+    int queue = 256;
+    const char *shards = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL)
+        {
+            router_usage(argv[0]);
+            return 1;
+        }
+        i++;
+
+        if (strcmp(option, "--port") == 0)
+            port = atoi(value);
+        else if (strcmp(option, "--workers") == 0)
+            workers = atoi(value);
+        else if (strcmp(option, "--queue") == 0)
+            queue = atoi(value);
+        else if (strcmp(option, "--shards") == 0)
+            shards = value;
+        else
+        {
+            router_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (shards == NULL || port < 1 || port > 65535 || workers < 1 || workers > 4096 || queue < 1 || queue > 1 << 20)
+    {
+        router_usage(argv[0]);
+        return 1;
+    }
+    if (router_parse_shards(shards) != 0)
+    {
+        fprintf(stderr, "Invalid shard list '%s', expected up to %d HOST:PORT entries separated by commas\n", shards, SHARD_MAX);
+        return 1;
+    }
+
+    // A client or shard hanging up shows as a failed write
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short) port);
+    if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Error listening on port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+
+    struct WorkerPool pool;
+    if (workerPoolInit(&pool, workers, (size_t) queue) != 0)
+    {
+        fprintf(stderr, "Error starting %d client workers\n", workers);
+        return 1;
+    }
+
+    printf("Routing JSON lines on TCP port %d to %d shards with %d workers\n", port, router_shard_count, workers);
+    fflush(stdout);
+
+    for (;;)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+                fprintf(stderr, "Error accepting connection: %s\n", strerror(errno));
+            continue;
+        }
+
+        struct RouterClient *client = calloc(1, sizeof(struct RouterClient));
+        struct RouterConnection *connections = calloc((size_t) router_shard_count, sizeof(struct RouterConnection));
+        if (!client || !connections)
+        {
+            free(client);
+            free(connections);
+            close(fd);
+            continue;
+        }
+        for (int i = 0; i < router_shard_count; i++)
+            connections[i].fd = -1;
+        client->fd = fd;
+        client->shards = connections;
+
+        // Refuse rather than queue without bound, a client that is told so can retry elsewhere
+        if (workerPoolSubmit(&pool, router_client_main, client, 0) != 0)
+        {
+            router_write_line(fd, ROUTER_OVERLOADED_RESPONSE, strlen(ROUTER_OVERLOADED_RESPONSE));
+            free(connections);
+            free(client);
+            close(fd);
+        }
+    }
+}
@@ -1,3 +1,6 @@
+#ifndef EXOPLANET_C
+#define EXOPLANET_C
+
 struct Exoplanet {
     const char *name;               // Exoplanet name
 
@@ -38,3 +41,5 @@ struct Exoplanet get_default_exoplanet() {
 
     return exoplanet;
 }
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * Binary request/response frames for machine-to-machine clients: positions go over the wire as raw
+ * doubles instead of JSON text. A client switches any transport (SSH channel, TCP or Unix socket)
+ * to binary by sending a hello frame as its first bytes, after which the connection carries frames
+ * in both directions until EOF. Responses come back in request order.
+ *
+ * Every frame is a 16-byte header followed by count fixed-size records, all little-endian:
+ *   uint32 magic      BINARY_MAGIC, the bytes "EXOB"
+ *   uint16 version    BINARY_VERSION
+ *   uint16 type       enum BinaryFrameType
+ *   uint32 count      number of records after the header
+ *   uint32 status     enum BinaryStatus for error frames, 0 otherwise
+ *
+ * Hello and error frames carry no records. Records are 8-byte aligned within a frame, so a request
+ * frame that sits at an 8-byte aligned address is evaluated in place without decoding or copying.
+ */
+
+#ifndef EXOPLANETBINARY_C
+#define EXOPLANETBINARY_C
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define BINARY_MAGIC 0x424f5845u        // "EXOB" read as a little-endian uint32
+#define BINARY_MAGIC_BYTE 'E'           // first byte of every frame, never the start of a JSON request
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 16
+
+// Largest number of records in one frame, a full request frame is 4 MiB
+#define BINARY_MAX_RECORDS 65536
+
+// Returned by binaryFrameLength for a header that can never become a valid frame
+#define BINARY_FRAME_INVALID ((size_t) -1)
+
+enum BinaryFrameType {
+    BINARY_HELLO = 1,               // client to server, answered with the version the server speaks
+    BINARY_REQUEST = 2,             // count struct BinaryRequestRecord
+    BINARY_RESPONSE = 3,            // count struct BinaryResponseRecord, one per request record
+    BINARY_ERROR = 4                // the request frame was not answered, see status
+};
+
+enum BinaryStatus {
+    BINARY_STATUS_OK = 0,
+    BINARY_STATUS_KEPLER_FAILED = 1,        // record: Kepler's equation has no solution, positions are NaN
+    BINARY_STATUS_UNKNOWN_RECORD = 2,       // record: the catalog has no such record
+    BINARY_STATUS_BUSY = 3,                 // frame: the compute queue was full or the server shed load, the frame may be resent
+    BINARY_STATUS_INVALID_FRAME = 4,        // frame: bad magic, type or size, the server closes the connection
+    BINARY_STATUS_UNSUPPORTED_VERSION = 5   // frame: the server does not speak the frame's version
+};
+
+// One planet at one point in time, 64 bytes
+struct BinaryRequestRecord {
+    double unixTime;                // Unix time in seconds, 0 for the current time
+    double orbitalRadius;           // AU
+    double orbitalPeriod;           // Years
+    double eccentricity;
+    double inclination;             // Degrees
+    double longitudeOfNode;         // Degrees
+    double argumentOfPeriapsis;     // Degrees
+    int32_t record;                 // Catalog record to take the elements from, -1 to use the ones above
+    uint32_t reserved;
+};
+
+// Position of the matching request record, 48 bytes
+struct BinaryResponseRecord {
+    double distance;                // Light years
+    double ra;                      // Radians
+    double declination;             // Degrees
+    double galacticLongitude;       // Degrees
+    double galacticLatitude;        // Degrees
+    uint32_t status;                // enum BinaryStatus
+    uint32_t reserved;
+};
+
+struct BinaryFrameHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint32_t count;
+    uint32_t status;
+};
+
+static uint32_t binaryReadU32(const unsigned char *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void binaryWriteU32(unsigned char *p, uint32_t value)
+{
+    p[0] = (unsigned char) value;
+    p[1] = (unsigned char) (value >> 8);
+    p[2] = (unsigned char) (value >> 16);
+    p[3] = (unsigned char) (value >> 24);
+}
+
+// Records are read and written in place, which needs a little-endian host
+int binaryHostIsLittleEndian(void)
+{
+    uint32_t probe = 1;
+    unsigned char first;
+    memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+void binaryReadHeader(const char *data, struct BinaryFrameHeader *header)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    header->magic = binaryReadU32(p);
+    header->version = (uint16_t) (p[4] | p[5] << 8);
+    header->type = (uint16_t) (p[6] | p[7] << 8);
+    header->count = binaryReadU32(p + 8);
+    header->status = binaryReadU32(p + 12);
+}
+
+// Writes a frame header to out, which needs BINARY_HEADER_SIZE bytes
+void binaryWriteHeader(char *out, enum BinaryFrameType type, uint32_t count, enum BinaryStatus status)
+{
+    unsigned char *p = (unsigned char *) out;
+    binaryWriteU32(p, BINARY_MAGIC);
+    p[4] = BINARY_VERSION;
+    p[5] = 0;
+    p[6] = (unsigned char) type;
+    p[7] = 0;
+    binaryWriteU32(p + 8, count);
+    binaryWriteU32(p + 12, (uint32_t) status);
+}
+
+// Length of the client frame at the start of data: 0 while it has not fully arrived, or
+// BINARY_FRAME_INVALID if the header is not one a client may send
+size_t binaryFrameLength(const char *data, size_t available)
+{
+    if (available < 4)
+    {
+        // Reject a wrong magic as early as possible, before the whole header has arrived
+        return available > 0 && data[0] != BINARY_MAGIC_BYTE ? BINARY_FRAME_INVALID : 0;
+    }
+    if (binaryReadU32((const unsigned char *) data) != BINARY_MAGIC)
+        return BINARY_FRAME_INVALID;
+    if (available < BINARY_HEADER_SIZE)
+        return 0;
+
+    struct BinaryFrameHeader header;
+    binaryReadHeader(data, &header);
+
+    size_t length;
+    if (header.type == BINARY_HELLO && header.count == 0)
+        length = BINARY_HEADER_SIZE;
+    else if (header.type == BINARY_REQUEST && header.count <= BINARY_MAX_RECORDS)
+        length = BINARY_HEADER_SIZE + (size_t) header.count * sizeof(struct BinaryRequestRecord);
+    else
+        return BINARY_FRAME_INVALID;
+
+    return available >= length ? length : 0;
+}
+
+// Length of the run of complete frames at the start of data. *frames receives their number and
+// *invalid is set when the run ends at a frame that can never be valid.
+size_t binaryCompleteFrames(const char *data, size_t length, size_t *frames, int *invalid)
+{
+    size_t offset = 0;
+    *frames = 0;
+    *invalid = 0;
+
+    while (offset < length)
+    {
+        size_t frame = binaryFrameLength(data + offset, length - offset);
+        if (frame == BINARY_FRAME_INVALID)
+        {
+            *invalid = 1;
+            break;
+        }
+        if (frame == 0)
+            break;
+        offset += frame;
+        (*frames)++;
+    }
+
+    return offset;
+}
+
+// Size of the response to a complete, valid client frame
+size_t binaryResponseLength(const char *frame)
+{
+    struct BinaryFrameHeader header;
+    binaryReadHeader(frame, &header);
+
+    if (header.type == BINARY_REQUEST && header.version == BINARY_VERSION)
+        return BINARY_HEADER_SIZE + (size_t) header.count * sizeof(struct BinaryResponseRecord);
+    return BINARY_HEADER_SIZE;
+}
+
+// Records of a request frame, read in place, or NULL when the frame does not sit at an 8-byte
+// aligned address and the records have to be copied out first
+const struct BinaryRequestRecord *binaryRequestRecords(const char *frame)
+{
+    const char *records = frame + BINARY_HEADER_SIZE;
+    if ((uintptr_t) records % sizeof(double) != 0)
+        return NULL;
+    return (const struct BinaryRequestRecord *) records;
+}
+
+#endif
@@ -0,0 +1,799 @@
+/*
+ * Dedicated JSON codec for plain exoplanet requests: a single-pass decoder that maps the known keys
+ * straight into struct Exoplanet fields, and an encoder that writes the response into a caller
+ * provided buffer with shortest round-trip double formatting (Grisu2). Anything outside the plain
+ * request schema is left to jansson, see exoplanetjson.c.
+ */
+
+#ifndef EXOPLANETCODEC_C
+#define EXOPLANETCODEC_C
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "exoplanet.c"
+
+// Longest planet name the decoder copies out of a request, longer names go through jansson
+#define EXOPLANET_CODEC_NAME_LENGTH 128
+
+// Buffer size that always fits an encoded response to a decoded request
+#define EXOPLANET_RESPONSE_SIZE 2048
+
+// Longest number token the decoder accepts
+#define CODEC_NUMBER_LENGTH 64
+
+// ---------------------------------------------------------------------------------------------
+// Shortest round-trip double formatting, Grisu2 after Loitsch, "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers" (2010). The digits always read back as the same double and
+// are the shortest such digits in all but a tiny fraction of cases.
+// ---------------------------------------------------------------------------------------------
+
+// A double as an unbounded-exponent binary floating point number f * 2^e
+struct DiyFp {
+    uint64_t f;
+    int e;
+};
+
+#define DIYFP_SIGNIFICAND_SIZE 52
+#define DIYFP_HIDDEN_BIT 0x0010000000000000ULL
+#define DIYFP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DIYFP_EXPONENT_BIAS (0x3FF + DIYFP_SIGNIFICAND_SIZE)
+
+// Normalized 64-bit approximations of 10^k for k = -348, -340, ..., 340
+static const struct DiyFp cachedPowers[] = {
+    { 0xfa8fd5a0081c0288ULL, -1220 },
+    { 0xbaaee17fa23ebf76ULL, -1193 },
+    { 0x8b16fb203055ac76ULL, -1166 },
+    { 0xcf42894a5dce35eaULL, -1140 },
+    { 0x9a6bb0aa55653b2dULL, -1113 },
+    { 0xe61acf033d1a45dfULL, -1087 },
+    { 0xab70fe17c79ac6caULL, -1060 },
+    { 0xff77b1fcbebcdc4fULL, -1034 },
+    { 0xbe5691ef416bd60cULL, -1007 },
+    { 0x8dd01fad907ffc3cULL, -980 },
+    { 0xd3515c2831559a83ULL, -954 },
+    { 0x9d71ac8fada6c9b5ULL, -927 },
+    { 0xea9c227723ee8bcbULL, -901 },
+    { 0xaecc49914078536dULL, -874 },
+    { 0x823c12795db6ce57ULL, -847 },
+    { 0xc21094364dfb5637ULL, -821 },
+    { 0x9096ea6f3848984fULL, -794 },
+    { 0xd77485cb25823ac7ULL, -768 },
+    { 0xa086cfcd97bf97f4ULL, -741 },
+    { 0xef340a98172aace5ULL, -715 },
+    { 0xb23867fb2a35b28eULL, -688 },
+    { 0x84c8d4dfd2c63f3bULL, -661 },
+    { 0xc5dd44271ad3cdbaULL, -635 },
+    { 0x936b9fcebb25c996ULL, -608 },
+    { 0xdbac6c247d62a584ULL, -582 },
+    { 0xa3ab66580d5fdaf6ULL, -555 },
+    { 0xf3e2f893dec3f126ULL, -529 },
+    { 0xb5b5ada8aaff80b8ULL, -502 },
+    { 0x87625f056c7c4a8bULL, -475 },
+    { 0xc9bcff6034c13053ULL, -449 },
+    { 0x964e858c91ba2655ULL, -422 },
+    { 0xdff9772470297ebdULL, -396 },
+    { 0xa6dfbd9fb8e5b88fULL, -369 },
+    { 0xf8a95fcf88747d94ULL, -343 },
+    { 0xb94470938fa89bcfULL, -316 },
+    { 0x8a08f0f8bf0f156bULL, -289 },
+    { 0xcdb02555653131b6ULL, -263 },
+    { 0x993fe2c6d07b7facULL, -236 },
+    { 0xe45c10c42a2b3b06ULL, -210 },
+    { 0xaa242499697392d3ULL, -183 },
+    { 0xfd87b5f28300ca0eULL, -157 },
+    { 0xbce5086492111aebULL, -130 },
+    { 0x8cbccc096f5088ccULL, -103 },
+    { 0xd1b71758e219652cULL, -77 },
+    { 0x9c40000000000000ULL, -50 },
+    { 0xe8d4a51000000000ULL, -24 },
+    { 0xad78ebc5ac620000ULL, 3 },
+    { 0x813f3978f8940984ULL, 30 },
+    { 0xc097ce7bc90715b3ULL, 56 },
+    { 0x8f7e32ce7bea5c70ULL, 83 },
+    { 0xd5d238a4abe98068ULL, 109 },
+    { 0x9f4f2726179a2245ULL, 136 },
+    { 0xed63a231d4c4fb27ULL, 162 },
+    { 0xb0de65388cc8ada8ULL, 189 },
+    { 0x83c7088e1aab65dbULL, 216 },
+    { 0xc45d1df942711d9aULL, 242 },
+    { 0x924d692ca61be758ULL, 269 },
+    { 0xda01ee641a708deaULL, 295 },
+    { 0xa26da3999aef774aULL, 322 },
+    { 0xf209787bb47d6b85ULL, 348 },
+    { 0xb454e4a179dd1877ULL, 375 },
+    { 0x865b86925b9bc5c2ULL, 402 },
+    { 0xc83553c5c8965d3dULL, 428 },
+    { 0x952ab45cfa97a0b3ULL, 455 },
+    { 0xde469fbd99a05fe3ULL, 481 },
+    { 0xa59bc234db398c25ULL, 508 },
+    { 0xf6c69a72a3989f5cULL, 534 },
+    { 0xb7dcbf5354e9beceULL, 561 },
+    { 0x88fcf317f22241e2ULL, 588 },
+    { 0xcc20ce9bd35c78a5ULL, 614 },
+    { 0x98165af37b2153dfULL, 641 },
+    { 0xe2a0b5dc971f303aULL, 667 },
+    { 0xa8d9d1535ce3b396ULL, 694 },
+    { 0xfb9b7cd9a4a7443cULL, 720 },
+    { 0xbb764c4ca7a44410ULL, 747 },
+    { 0x8bab8eefb6409c1aULL, 774 },
+    { 0xd01fef10a657842cULL, 800 },
+    { 0x9b10a4e5e9913129ULL, 827 },
+    { 0xe7109bfba19c0c9dULL, 853 },
+    { 0xac2820d9623bf429ULL, 880 },
+    { 0x80444b5e7aa7cf85ULL, 907 },
+    { 0xbf21e44003acdd2dULL, 933 },
+    { 0x8e679c2f5e44ff8fULL, 960 },
+    { 0xd433179d9c8cb841ULL, 986 },
+    { 0x9e19db92b4e31ba9ULL, 1013 },
+    { 0xeb96bf6ebadf77d9ULL, 1039 },
+    { 0xaf87023b9bf0ee6bULL, 1066 },};
+
+static struct DiyFp diyFpFromDouble(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    int biased = (int) ((bits >> DIYFP_SIGNIFICAND_SIZE) & 0x7FF);
+    uint64_t significand = bits & DIYFP_SIGNIFICAND_MASK;
+
+    struct DiyFp fp;
+    if (biased != 0)
+    {
+        fp.f = significand + DIYFP_HIDDEN_BIT;
+        fp.e = biased - DIYFP_EXPONENT_BIAS;
+    }
+    else
+    {
+        fp.f = significand;
+        fp.e = 1 - DIYFP_EXPONENT_BIAS;
+    }
+    return fp;
+}
+
+// Product of two numbers, rounded to the upper 64 bits
+static struct DiyFp diyFpMultiply(struct DiyFp x, struct DiyFp y)
+{
+    const uint64_t mask32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & mask32;
+    uint64_t c = y.f >> 32, d = y.f & mask32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+
+    uint64_t middle = (bd >> 32) + (ad & mask32) + (bc & mask32);
+    middle += 1ULL << 31;
+
+    struct DiyFp product = { ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64 };
+    return product;
+}
+
+static struct DiyFp diyFpNormalize(struct DiyFp fp)
+{
+    int shift = __builtin_clzll(fp.f);
+    fp.f <<= shift;
+    fp.e -= shift;
+    return fp;
+}
+
+// The boundaries halfway to the neighbouring doubles, normalized to a common exponent
+static void diyFpBoundaries(struct DiyFp fp, struct DiyFp *minus, struct DiyFp *plus)
+{
+    struct DiyFp upper = { (fp.f << 1) + 1, fp.e - 1 };
+    *plus = diyFpNormalize(upper);
+
+    // The lower neighbour is closer when the significand is a power of two
+    struct DiyFp lower;
+    if (fp.f == DIYFP_HIDDEN_BIT)
+    {
+        lower.f = (fp.f << 2) - 1;
+        lower.e = fp.e - 2;
+    }
+    else
+    {
+        lower.f = (fp.f << 1) - 1;
+        lower.e = fp.e - 1;
+    }
+    lower.f <<= lower.e - plus->e;
+    lower.e = plus->e;
+    *minus = lower;
+}
+
+// Cached power c = 10^-k such that the product with a number of binary exponent e lands in [-60, -32]
+static struct DiyFp cachedPowerFor(int e, int *k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int) dk;
+    if (dk - ik > 0.0)
+        ik++;
+
+    unsigned int index = (unsigned int) ((ik >> 3) + 1);
+    *k = -(-348 + (int) (index << 3));
+    return cachedPowers[index];
+}
+
+static void grisuRound(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t distance)
+{
+    while (rest < distance && delta - rest >= tenKappa &&
+           (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance))
+    {
+        buffer[length - 1]--;
+        rest += tenKappa;
+    }
+}
+
+static int countDecimalDigits(uint32_t n)
+{
+    int digits = 1;
+    while (n >= 10)
+    {
+        n /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+static void grisuDigits(struct DiyFp w, struct DiyFp upper, uint64_t delta, char *buffer, int *length, int *k)
+{
+    static const uint32_t pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+    struct DiyFp one = { 1ULL << -upper.e, upper.e };
+    uint64_t distance = upper.f - w.f;
+    uint32_t integral = (uint32_t) (upper.f >> -one.e);
+    uint64_t fractional = upper.f & (one.f - 1);
+    int kappa = countDecimalDigits(integral);
+    *length = 0;
+
+    while (kappa > 0)
+    {
+        uint32_t digit = integral / pow10[kappa - 1];
+        integral %= pow10[kappa - 1];
+        if (digit || *length)
+            buffer[(*length)++] = (char) ('0' + digit);
+        kappa--;
+
+        uint64_t rest = ((uint64_t) integral << -one.e) + fractional;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            grisuRound(buffer, *length, delta, rest, (uint64_t) pow10[kappa] << -one.e, distance);
+            return;
+        }
+    }
+
+    for (;;)
+    {
+        fractional *= 10;
+        delta *= 10;
+        char digit = (char) (fractional >> -one.e);
+        if (digit || *length)
+            buffer[(*length)++] = (char) ('0' + digit);
+        fractional &= one.f - 1;
+        kappa--;
+
+        if (fractional < delta)
+        {
+            *k += kappa;
+            int index = -kappa;
+            grisuRound(buffer, *length, delta, fractional, one.f, distance * (index < 10 ? pow10[index] : 0));
+            return;
+        }
+    }
+}
+
+// Shortest digits of a positive finite value: value = digits * 10^k
+static void grisu2(double value, char *digits, int *length, int *k)
+{
+    struct DiyFp v = diyFpFromDouble(value);
+    struct DiyFp minus, plus;
+    diyFpBoundaries(v, &minus, &plus);
+
+    struct DiyFp cached = cachedPowerFor(plus.e, k);
+    struct DiyFp w = diyFpMultiply(diyFpNormalize(v), cached);
+    struct DiyFp upper = diyFpMultiply(plus, cached);
+    struct DiyFp lower = diyFpMultiply(minus, cached);
+    upper.f--;
+    lower.f++;
+
+    grisuDigits(w, upper, upper.f - lower.f, digits, length, k);
+}
+
+static int writeExponent(int exponent, char *buffer)
+{
+    char *start = buffer;
+    if (exponent < 0)
+    {
+        *buffer++ = '-';
+        exponent = -exponent;
+    }
+
+    if (exponent >= 100)
+    {
+        *buffer++ = (char) ('0' + exponent / 100);
+        exponent %= 100;
+        *buffer++ = (char) ('0' + exponent / 10);
+        *buffer++ = (char) ('0' + exponent % 10);
+    }
+    else if (exponent >= 10)
+    {
+        *buffer++ = (char) ('0' + exponent / 10);
+        *buffer++ = (char) ('0' + exponent % 10);
+    }
+    else
+    {
+        *buffer++ = (char) ('0' + exponent);
+    }
+
+    return (int) (buffer - start);
+}
+
+// Places the decimal point in digits (value = digits * 10^k), buffer holds the digits on entry
+static int formatDigits(char *buffer, int length, int k)
+{
+    int exponent = length + k; // 10^(exponent - 1) <= value < 10^exponent
+
+    if (k >= 0 && exponent <= 21)
+    {
+        // 1234e7 -> 12340000000.0
+        for (int i = length; i < exponent; i++)
+            buffer[i] = '0';
+        buffer[exponent] = '.';
+        buffer[exponent + 1] = '0';
+        return exponent + 2;
+    }
+    if (exponent > 0 && exponent <= 21)
+    {
+        // 1234e-2 -> 12.34
+        memmove(&buffer[exponent + 1], &buffer[exponent], length - exponent);
+        buffer[exponent] = '.';
+        return length + 1;
+    }
+    if (exponent > -6 && exponent <= 0)
+    {
+        // 1234e-6 -> 0.001234
+        int offset = 2 - exponent;
+        memmove(&buffer[offset], &buffer[0], length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        for (int i = 2; i < offset; i++)
+            buffer[i] = '0';
+        return length + offset;
+    }
+    if (length == 1)
+    {
+        // 1e30
+        buffer[1] = 'e';
+        return 2 + writeExponent(exponent - 1, &buffer[2]);
+    }
+
+    // 1234e30 -> 1.234e33
+    memmove(&buffer[2], &buffer[1], length - 1);
+    buffer[1] = '.';
+    buffer[length + 1] = 'e';
+    return length + 2 + writeExponent(exponent - 1, &buffer[length + 2]);
+}
+
+// Writes the shortest decimal form of a finite value that reads back as the same double,
+// always with a fraction or exponent so it stays a real. buffer needs room for 32 characters.
+int formatDouble(double value, char *buffer)
+{
+    char *start = buffer;
+    if (signbit(value))
+    {
+        *buffer++ = '-';
+        value = -value;
+    }
+
+    if (value == 0)
+    {
+        memcpy(buffer, "0.0", 3);
+        return (int) (buffer - start) + 3;
+    }
+
+    int length, k;
+    grisu2(value, buffer, &length, &k);
+    return (int) (buffer - start) + formatDigits(buffer, length, k);
+}
+
+// ---------------------------------------------------------------------------------------------
+// Request decoder
+// ---------------------------------------------------------------------------------------------
+
+#define CODEC_FIELD(key, member) { key, sizeof(key) - 1, offsetof(struct Exoplanet, member) }
+
+// Numeric request keys and the fields they set, the same keys exoplanet_from_json reads
+static const struct {
+    const char *key;
+    size_t length;
+    size_t offset;
+} codecFields[] = {
+    CODEC_FIELD("mass", mass),
+    CODEC_FIELD("planetRadius", planetRadius),
+    CODEC_FIELD("orbitalRadius", orbitalRadius),
+    CODEC_FIELD("orbital_period", orbitalPeriod),
+    CODEC_FIELD("eccentricity", eccentricity),
+    CODEC_FIELD("inclination", inclination),
+    CODEC_FIELD("longitude_of_node", longitudeOfNode),
+    CODEC_FIELD("argument_of_periapsis", argumentOfPeriapsis),
+    CODEC_FIELD("unixTime", unixTime),
+    CODEC_FIELD("distance", distance),
+    CODEC_FIELD("declination", declination),
+    CODEC_FIELD("galacticLongitude", galacticLongitude),
+    CODEC_FIELD("galacticLatitude", galacticLatitude),
+    CODEC_FIELD("ra", ra),
+};
+
+#define CODEC_FIELD_COUNT (sizeof(codecFields) / sizeof(codecFields[0]))
+
+// A decoded plain exoplanet request
+struct ExoplanetRequest {
+    unsigned int fields;                        // bit i is set when codecFields[i] was given as a number
+    double values[CODEC_FIELD_COUNT];
+    int hasName;
+    char name[EXOPLANET_CODEC_NAME_LENGTH];
+    int stayAlive;                              // -1 when absent
+    double deadlineMs;                          // "deadline_ms" when given as a number, 0 otherwise
+};
+
+// Index of a numeric request key in codecFields, or -1
+static int codec_field_index(const char *key, size_t length)
+{
+    for (size_t i = 0; i < CODEC_FIELD_COUNT; i++)
+    {
+        if (codecFields[i].length == length && memcmp(codecFields[i].key, key, length) == 0)
+            return (int) i;
+    }
+    return -1;
+}
+
+struct CodecCursor {
+    const char *p;
+    const char *end;
+};
+
+static void codec_skip_space(struct CodecCursor *c)
+{
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r'))
+        c->p++;
+}
+
+// Reads a string without escapes or non-ASCII bytes (those are left to jansson), returns 0 on success
+static int codec_string(struct CodecCursor *c, const char **start, size_t *length)
+{
+    if (c->p >= c->end || *c->p != '"')
+        return -1;
+    c->p++;
+
+    *start = c->p;
+    while (c->p < c->end)
+    {
+        unsigned char ch = (unsigned char) *c->p;
+        if (ch == '"')
+        {
+            *length = c->p - *start;
+            c->p++;
+            return 0;
+        }
+        if (ch == '\\' || ch < 0x20 || ch >= 0x80)
+            return -1;
+        c->p++;
+    }
+    return -1;
+}
+
+// Reads a number with JSON's grammar, returns 0 on success
+static int codec_number(struct CodecCursor *c, double *value)
+{
+    const char *start = c->p;
+    const char *p = c->p;
+    int integral = 1;
+
+    if (p < c->end && *p == '-')
+        p++;
+    if (p >= c->end)
+        return -1;
+    if (*p == '0')
+        p++;
+    else if (*p >= '1' && *p <= '9')
+    {
+        while (p < c->end && *p >= '0' && *p <= '9')
+            p++;
+    }
+    else
+        return -1;
+
+    if (p < c->end && *p == '.')
+    {
+        integral = 0;
+        p++;
+        if (p >= c->end || *p < '0' || *p > '9')
+            return -1;
+        while (p < c->end && *p >= '0' && *p <= '9')
+            p++;
+    }
+
+    if (p < c->end && (*p == 'e' || *p == 'E'))
+    {
+        integral = 0;
+        p++;
+        if (p < c->end && (*p == '+' || *p == '-'))
+            p++;
+        if (p >= c->end || *p < '0' || *p > '9')
+            return -1;
+        while (p < c->end && *p >= '0' && *p <= '9')
+            p++;
+    }
+
+    // jansson rejects integers outside json_int_t, let it report them
+    size_t length = p - start;
+    if (length >= CODEC_NUMBER_LENGTH || (integral && length > 18))
+        return -1;
+
+    char token[CODEC_NUMBER_LENGTH];
+    memcpy(token, start, length);
+    token[length] = '\0';
+    *value = strtod(token, NULL);
+
+    // jansson refuses reals that overflow
+    if (isinf(*value))
+        return -1;
+
+    c->p = p;
+    return 0;
+}
+
+static int codec_literal(struct CodecCursor *c, const char *literal, size_t length)
+{
+    if ((size_t) (c->end - c->p) < length || memcmp(c->p, literal, length) != 0)
+        return -1;
+    c->p += length;
+    return 0;
+}
+
+// Decodes a plain exoplanet request, a flat object without a "request" key, in one pass over data.
+// Returns 0 with the number of bytes consumed (including trailing whitespace), or -1 when the request
+// has to go through jansson instead: other request types, nested values, escapes, non-ASCII text,
+// or anything that is not valid JSON, so jansson reports the error.
+int exoplanet_decode_request(const char *data, size_t length, struct ExoplanetRequest *request, size_t *consumed)
+{
+    struct CodecCursor c = { data, data + length };
+
+    request->fields = 0;
+    request->hasName = 0;
+    request->stayAlive = -1;
+    request->deadlineMs = 0;
+
+    codec_skip_space(&c);
+    if (c.p >= c.end || *c.p != '{')
+        return -1;
+    c.p++;
+    codec_skip_space(&c);
+
+    int empty = c.p < c.end && *c.p == '}';
+    while (!empty)
+    {
+        const char *key;
+        size_t key_length;
+        if (codec_string(&c, &key, &key_length) != 0)
+            return -1;
+
+        // Other request types go through the dispatcher
+        if (key_length == 7 && memcmp(key, "request", 7) == 0)
+            return -1;
+        int is_name = key_length == 4 && memcmp(key, "name", 4) == 0;
+        int is_stay_alive = key_length == 10 && memcmp(key, "stay_alive", 10) == 0;
+        int is_deadline = key_length == 11 && memcmp(key, "deadline_ms", 11) == 0;
+
+        codec_skip_space(&c);
+        if (c.p >= c.end || *c.p != ':')
+            return -1;
+        c.p++;
+        codec_skip_space(&c);
+        if (c.p >= c.end)
+            return -1;
+
+        char first = *c.p;
+        if (first == '"')
+        {
+            const char *value;
+            size_t value_length;
+            if (codec_string(&c, &value, &value_length) != 0)
+                return -1;
+
+            if (is_name)
+            {
+                if (value_length >= EXOPLANET_CODEC_NAME_LENGTH)
+                    return -1;
+                memcpy(request->name, value, value_length);
+                request->name[value_length] = '\0';
+            }
+        }
+        else if (first == '-' || (first >= '0' && first <= '9'))
+        {
+            double value;
+            if (codec_number(&c, &value) != 0)
+                return -1;
+
+            int field = codec_field_index(key, key_length);
+            if (field >= 0)
+            {
+                request->values[field] = value;
+                request->fields |= 1u << field;
+            }
+            if (is_deadline)
+                request->deadlineMs = value;
+        }
+        else if (first == 't' || first == 'f')
+        {
+            int value = first == 't';
+            if (codec_literal(&c, value ? "true" : "false", value ? 4 : 5) != 0)
+                return -1;
+            if (is_stay_alive)
+                request->stayAlive = value;
+        }
+        else if (first == 'n')
+        {
+            if (codec_literal(&c, "null", 4) != 0)
+                return -1;
+        }
+        else
+        {
+            // Objects and arrays only appear in other request types
+            return -1;
+        }
+
+        // Like jansson, the last occurrence of a key wins and values of the wrong type are ignored
+        if (first == '"' || first == 't' || first == 'f' || first == 'n')
+        {
+            int field = codec_field_index(key, key_length);
+            if (field >= 0)
+                request->fields &= ~(1u << field);
+            if (is_deadline)
+                request->deadlineMs = 0;
+        }
+        if (is_name)
+            request->hasName = first == '"';
+        if (is_stay_alive && first != 't' && first != 'f')
+            request->stayAlive = -1;
+
+        codec_skip_space(&c);
+        if (c.p >= c.end)
+            return -1;
+        if (*c.p == '}')
+            break;
+        if (*c.p != ',')
+            return -1;
+        c.p++;
+        codec_skip_space(&c);
+    }
+
+    c.p++;
+    codec_skip_space(&c);
+    *consumed = c.p - data;
+    return 0;
+}
+
+// Sets the fields the request gave on exoplanet, as exoplanet_from_json does
+void exoplanet_request_apply(const struct ExoplanetRequest *request, struct Exoplanet *exoplanet)
+{
+    if (request->hasName)
+        exoplanet->name = request->name;
+
+    for (size_t i = 0; i < CODEC_FIELD_COUNT; i++)
+    {
+        if (request->fields & (1u << i))
+            *(double *) ((char *) exoplanet + codecFields[i].offset) = request->values[i];
+    }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Response encoder
+// ---------------------------------------------------------------------------------------------
+
+struct CodecWriter {
+    char *p;
+    char *end;
+    int overflow;
+};
+
+static void codec_put(struct CodecWriter *w, const char *text, size_t length)
+{
+    if (w->overflow || (size_t) (w->end - w->p) < length)
+    {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->p, text, length);
+    w->p += length;
+}
+
+// Writes "key": followed by the value, or nothing at all when the value is not finite
+static void codec_put_real(struct CodecWriter *w, const char *key, size_t key_length, double value)
+{
+    // json_real rejects non-finite values, so exoplanet_to_json leaves the key out altogether
+    if (!isfinite(value))
+        return;
+
+    codec_put(w, key, key_length);
+    if (w->overflow || w->end - w->p < 32)
+    {
+        w->overflow = 1;
+        return;
+    }
+
+    w->p += formatDouble(value, w->p);
+}
+
+static void codec_put_string(struct CodecWriter *w, const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    codec_put(w, "\"", 1);
+    for (const unsigned char *s = (const unsigned char *) text; *s && !w->overflow; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            char escaped[2] = { '\\', (char) *s };
+            codec_put(w, escaped, 2);
+        }
+        else if (*s < 0x20)
+        {
+            char escaped[6] = { '\\', 'u', '0', '0', hex[*s >> 4], hex[*s & 0xF] };
+            codec_put(w, escaped, 6);
+        }
+        else
+        {
+            codec_put(w, (const char *) s, 1);
+        }
+    }
+    codec_put(w, "\"", 1);
+}
+
+#define CODEC_PUT_REAL(w, key, value) codec_put_real(w, key, sizeof(key) - 1, value)
+
+// Serializes the planet into buffer with the keys and key order of exoplanet_to_json.
+// Returns the length written (the buffer is NUL terminated), or 0 when it does not fit.
+size_t exoplanet_encode(const struct Exoplanet *exoplanet, char *buffer, size_t capacity)
+{
+    if (capacity == 0)
+        return 0;
+
+    struct CodecWriter w = { buffer, buffer + capacity - 1, 0 };
+
+    codec_put(&w, "{\"name\":", 8);
+    codec_put_string(&w, exoplanet->name ? exoplanet->name : "");
+    CODEC_PUT_REAL(&w, ",\"mass\":", exoplanet->mass);
+    CODEC_PUT_REAL(&w, ",\"planetRadius\":", exoplanet->planetRadius);
+    CODEC_PUT_REAL(&w, ",\"orbitalRadius\":", exoplanet->orbitalRadius);
+    CODEC_PUT_REAL(&w, ",\"orbitalPeriod\":", exoplanet->orbitalPeriod);
+    CODEC_PUT_REAL(&w, ",\"eccentricity\":", exoplanet->eccentricity);
+    CODEC_PUT_REAL(&w, ",\"inclination\":", exoplanet->inclination);
+    CODEC_PUT_REAL(&w, ",\"longitudeOfNode\":", exoplanet->longitudeOfNode);
+    CODEC_PUT_REAL(&w, ",\"argumentOfPeriapsis\":", exoplanet->argumentOfPeriapsis);
+    CODEC_PUT_REAL(&w, ",\"galacticLongitude\":", exoplanet->galacticLongitude);
+    CODEC_PUT_REAL(&w, ",\"galacticLatitude\":", exoplanet->galacticLatitude);
+    CODEC_PUT_REAL(&w, ",\"declination\":", exoplanet->declination);
+    CODEC_PUT_REAL(&w, ",\"stayAlive\":", exoplanet->stayAlive);
+    CODEC_PUT_REAL(&w, ",\"unixTime\":", exoplanet->unixTime);
+
+    if (isnan(exoplanet->distance) || isnan(exoplanet->ra))
+    {
+        // Indicate there was an error in solving Kepler's equation
+        const char *failed = ",\"error\":\"Failed to solve Kepler's equation given the input.\",\"distance\":null,\"ra\":null";
+        codec_put(&w, failed, strlen(failed));
+    }
+    else
+    {
+        CODEC_PUT_REAL(&w, ",\"distance\":", exoplanet->distance);
+        CODEC_PUT_REAL(&w, ",\"ra\":", exoplanet->ra);
+    }
+    codec_put(&w, "}", 1);
+
+    if (w.overflow)
+        return 0;
+
+    *w.p = '\0';
+    return w.p - buffer;
+}
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Mapping between struct Exoplanet and its JSON representation
+ */
+
+#ifndef EXOPLANETJSON_C
+#define EXOPLANETJSON_C
+
+#include <math.h>
+#include <jansson.h>
+#include "exoplanet.c"
+
+// Update exoplanet properties from a JSON object, fields that are missing or not numbers keep their value
+void exoplanet_from_json(json_t *root, struct Exoplanet *exoplanet)
+{
+    json_t *name_json = json_object_get(root, "name");
+    if (json_is_string(name_json))
+        exoplanet->name = json_string_value(name_json);
+
+    json_t *mass_json = json_object_get(root, "mass");
+    if (json_is_number(mass_json))
+        exoplanet->mass = json_number_value(mass_json);
+
+    json_t *planet_radius_json = json_object_get(root, "planetRadius");
+    if (json_is_number(planet_radius_json))
+        exoplanet->planetRadius = json_number_value(planet_radius_json);
+
+    json_t *orbital_radius_json = json_object_get(root, "orbitalRadius");
+    if (json_is_number(orbital_radius_json))
+        exoplanet->orbitalRadius = json_number_value(orbital_radius_json);
+
+    json_t *orbital_period_json = json_object_get(root, "orbital_period");
+    if (json_is_number(orbital_period_json))
+        exoplanet->orbitalPeriod = json_number_value(orbital_period_json);
+
+    json_t *eccentricity_json = json_object_get(root, "eccentricity");
+    if (json_is_number(eccentricity_json))
+        exoplanet->eccentricity = json_number_value(eccentricity_json);
+
+    json_t *inclination_json = json_object_get(root, "inclination");
+    if (json_is_number(inclination_json))
+        exoplanet->inclination = json_number_value(inclination_json);
+
+    json_t *longitude_of_node_json = json_object_get(root, "longitude_of_node");
+    if (json_is_number(longitude_of_node_json))
+        exoplanet->longitudeOfNode = json_number_value(longitude_of_node_json);
+
+    json_t *argument_of_periapsis_json = json_object_get(root, "argument_of_periapsis");
+    if (json_is_number(argument_of_periapsis_json))
+        exoplanet->argumentOfPeriapsis = json_number_value(argument_of_periapsis_json);
+
+    json_t *unixTime_json = json_object_get(root, "unixTime");
+    if (json_is_number(unixTime_json))
+        exoplanet->unixTime = json_number_value(unixTime_json);
+
+    json_t *distance_json = json_object_get(root, "distance");
+    if (json_is_number(distance_json))
+        exoplanet->distance = json_number_value(distance_json);
+    // If it's not a number, the initialized value of 0.0 will remain
+
+    json_t *declination_json = json_object_get(root, "declination");
+    if (json_is_number(declination_json))
+        exoplanet->declination = json_number_value(declination_json);
+    // If it's not a number, the initialized value of 0.0 will remain
+
+    /// .galacticLongitude = 0.0,
+    json_t *galacticLongitude_json = json_object_get(root, "galacticLongitude");
+    if (json_is_number(galacticLongitude_json))
+        exoplanet->galacticLongitude = json_number_value(galacticLongitude_json);
+
+
+    json_t *galacticLatitude_json = json_object_get(root, "galacticLatitude");
+    if (json_is_number(galacticLatitude_json))
+        exoplanet->galacticLatitude = json_number_value(galacticLatitude_json);
+
+    json_t *ra_json = json_object_get(root, "ra");
+    if (json_is_number(ra_json))
+        exoplanet->ra = json_number_value(ra_json);
+    // If it's not a number, the initialized value of 0.0 will remain
+    // ... (Parse other properties if needed)
+}
+
+// Serialize the entire Exoplanet struct to JSON
+json_t *exoplanet_to_json(const struct Exoplanet *exoplanet)
+{
+    json_t *response = json_object();
+
+    json_object_set_new(response, "name", json_string(exoplanet->name));
+    json_object_set_new(response, "mass", json_real(exoplanet->mass));
+    json_object_set_new(response, "planetRadius", json_real(exoplanet->planetRadius));
+    json_object_set_new(response, "orbitalRadius", json_real(exoplanet->orbitalRadius));
+    json_object_set_new(response, "orbitalPeriod", json_real(exoplanet->orbitalPeriod));
+    json_object_set_new(response, "eccentricity", json_real(exoplanet->eccentricity));
+    json_object_set_new(response, "inclination", json_real(exoplanet->inclination));
+    json_object_set_new(response, "longitudeOfNode", json_real(exoplanet->longitudeOfNode));
+    json_object_set_new(response, "argumentOfPeriapsis", json_real(exoplanet->argumentOfPeriapsis));
+    json_object_set_new(response, "galacticLongitude", json_real(exoplanet->galacticLongitude));
+    json_object_set_new(response, "galacticLatitude", json_real(exoplanet->galacticLatitude));
+    json_object_set_new(response, "declination", json_real(exoplanet->declination));
+    json_object_set_new(response, "stayAlive", json_real(exoplanet->stayAlive));
+    json_object_set_new(response, "unixTime", json_real(exoplanet->unixTime));
+
+    if (isnan(exoplanet->distance) || isnan(exoplanet->ra)) {
+        // Indicate there was an error in solving Kepler's equation
+        json_object_set_new(response, "error", json_string("Failed to solve Kepler's equation given the input."));
+
+        // You can choose to omit ra and distance or set them to null values
+        json_object_set_new(response, "distance", json_null());
+        json_object_set_new(response, "ra", json_null());
+    } else {
+        json_object_set_new(response, "distance", json_real(exoplanet->distance));
+        json_object_set_new(response, "ra", json_real(exoplanet->ra));
+    }
+
+    return response;
+}
+
+// Builds a response object carrying only an error message
+json_t *error_response(const char *message)
+{
+    json_t *response = json_object();
+    json_object_set_new(response, "error", json_string(message));
+    return response;
+}
+
+// json_real refuses NaN, so failed solves are reported as null instead of dropping the key
+json_t *json_real_or_null(double value)
+{
+    return isnan(value) ? json_null() : json_real(value);
+}
+
+#endif
@@ -0,0 +1,698 @@
+/*
+ * Load generator driving exoplanet-finder over SSH
+ *
+ * Usage: exoplanet-loadgen [options]
+ *   --host HOST             server host (localhost)
+ *   --port PORT             server port (2222)
+ *   --user USER             SSH user (root)
+ *   --identity FILE         private key, only used if the server asks for public key authentication
+ *   --concurrency N         client threads, each with its own SSH session (8)
+ *   --requests N            total requests to send (10000)
+ *   --duration SECONDS      send requests for this long instead of a fixed number
+ *   --mode MODE             session:    a new SSH session per request
+ *                           stay_alive: requests carry "stay_alive": true and reuse the session
+ *                           stream:     one channel in streaming mode, requests pipelined (stay_alive)
+ *   --depth N               requests in flight per client in stream mode (1)
+ *   --mix KIND:WEIGHT,...   payload mix over plain, name, batch and stats (plain:1)
+ *   --name NAME             catalog planet used by "name" payloads
+ *
+ * Prints one JSON object with the request and error counts, the throughput and the latency
+ * percentiles in microseconds. Latency runs from the first byte of a request being written to the
+ * last byte of its response being read, so in session mode it includes the SSH handshake.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <libssh/libssh.h>
+
+// Longest request the payload generator writes
+#define LOADGEN_REQUEST_SIZE 1024
+
+// Milliseconds to wait for a response before the request counts as failed
+#define LOADGEN_TIMEOUT_MS 30000
+
+// Requests in flight per client in stream mode
+#define LOADGEN_MAX_DEPTH 1024
+
+enum LoadgenMode {
+    LOADGEN_SESSION,
+    LOADGEN_STAY_ALIVE,
+    LOADGEN_STREAM
+};
+
+enum LoadgenPayload {
+    LOADGEN_PLAIN,                  // a planet with every orbital element
+    LOADGEN_NAME,                   // a catalog planet by name
+    LOADGEN_BATCH,                  // two planets over a day in hourly steps
+    LOADGEN_STATS,                  // solver_stats
+    LOADGEN_PAYLOADS
+};
+
+static const char *loadgen_payload_names[LOADGEN_PAYLOADS] = { "plain", "name", "batch", "stats" };
+static const char *loadgen_mode_names[] = { "session", "stay_alive", "stream" };
+
+struct LoadgenConfig {
+    const char *host;
+    int port;
+    const char *user;
+    const char *identity;
+    int concurrency;
+    long requests;                  // 0 when running for a duration
+    double duration;                // Seconds, 0 when sending a fixed number of requests
+    enum LoadgenMode mode;
+    int depth;
+    int weights[LOADGEN_PAYLOADS];
+    int totalWeight;
+    const char *name;
+};
+
+// Latencies and counters of one client thread, merged once every client has finished
+struct LoadgenClient {
+    pthread_t thread;
+    unsigned long long random;      // xorshift state
+    double *latencies;              // Microseconds
+    size_t count;
+    size_t capacity;
+    unsigned long long errors;
+
+    ssh_session session;
+    ssh_channel channel;
+    char *response;                 // Bytes read but not yet matched to a request
+    size_t length;
+    size_t responseCapacity;
+};
+
+static struct LoadgenConfig loadgen_config;
+static long loadgen_issued;         // Requests claimed by clients so far
+static double loadgen_deadline;
+
+static double loadgen_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Claims the next request, returns 0 once the run is over
+static int loadgen_claim(void)
+{
+    if (loadgen_config.duration > 0)
+        return loadgen_now() < loadgen_deadline;
+    return __atomic_fetch_add(&loadgen_issued, 1, __ATOMIC_RELAXED) < loadgen_config.requests;
+}
+
+static unsigned long long loadgen_random(struct LoadgenClient *client)
+{
+    client->random ^= client->random << 13;
+    client->random ^= client->random >> 7;
+    client->random ^= client->random << 17;
+    return client->random;
+}
+
+static double loadgen_uniform(struct LoadgenClient *client, double min, double max)
+{
+    return min + (max - min) * (double) (loadgen_random(client) >> 11) / (double) (1ULL << 53);
+}
+
+static void loadgen_record(struct LoadgenClient *client, double microseconds)
+{
+    if (client->count == client->capacity)
+    {
+        size_t capacity = client->capacity ? client->capacity * 2 : 4096;
+        double *latencies = realloc(client->latencies, capacity * sizeof(double));
+        if (!latencies)
+            return;
+        client->latencies = latencies;
+        client->capacity = capacity;
+    }
+    client->latencies[client->count++] = microseconds;
+}
+
+// Writes one request of a kind drawn from the mix, returns its length
+static int loadgen_payload(struct LoadgenClient *client, char *out)
+{
+    int pick = (int) (loadgen_random(client) % (unsigned long long) loadgen_config.totalWeight);
+    enum LoadgenPayload kind = LOADGEN_PLAIN;
+    for (int i = 0; i < LOADGEN_PAYLOADS; i++)
+    {
+        if (pick < loadgen_config.weights[i])
+        {
+            kind = (enum LoadgenPayload) i;
+            break;
+        }
+        pick -= loadgen_config.weights[i];
+    }
+
+    // Random epochs keep repeated requests from all being answered by the result cache
+    double time = 1691592726.0 + (double) (loadgen_random(client) % (10ULL * 365 * 24 * 3600));
+    const char *stay_alive = loadgen_config.mode == LOADGEN_STAY_ALIVE ? ", \"stay_alive\": true" : "";
+
+    switch (kind)
+    {
+    case LOADGEN_NAME:
+        return snprintf(out, LOADGEN_REQUEST_SIZE, "{\"name\": \"%s\", \"unixTime\": %.0f%s}\n",
+                        loadgen_config.name, time, stay_alive);
+    case LOADGEN_BATCH:
+        return snprintf(out, LOADGEN_REQUEST_SIZE,
+                        "{\"request\": \"batch\", \"planets\": [{\"orbital_period\": %.4f, \"eccentricity\": %.4f}, "
+                        "{\"orbital_period\": %.4f, \"eccentricity\": %.4f}], "
+                        "\"time_grid\": {\"start\": %.0f, \"stop\": %.0f, \"step\": 3600}%s}\n",
+                        loadgen_uniform(client, 0.1, 20), loadgen_uniform(client, 0, 0.95),
+                        loadgen_uniform(client, 0.1, 20), loadgen_uniform(client, 0, 0.95),
+                        time, time + 86400, stay_alive);
+    case LOADGEN_STATS:
+        return snprintf(out, LOADGEN_REQUEST_SIZE, "{\"request\": \"solver_stats\"%s}\n", stay_alive);
+    default:
+        return snprintf(out, LOADGEN_REQUEST_SIZE,
+                        "{\"name\": \"loadgen\", \"orbitalRadius\": %.4f, \"orbital_period\": %.4f, \"eccentricity\": %.4f, "
+                        "\"inclination\": %.2f, \"longitude_of_node\": %.2f, \"argument_of_periapsis\": %.2f, \"unixTime\": %.0f%s}\n",
+                        loadgen_uniform(client, 0.01, 40), loadgen_uniform(client, 0.01, 200), loadgen_uniform(client, 0, 0.95),
+                        loadgen_uniform(client, 0, 180), loadgen_uniform(client, 0, 360), loadgen_uniform(client, 0, 360),
+                        time, stay_alive);
+    }
+}
+
+static void loadgen_disconnect(struct LoadgenClient *client)
+{
+    if (client->channel)
+    {
+        ssh_channel_close(client->channel);
+        ssh_channel_free(client->channel);
+        client->channel = NULL;
+    }
+    if (client->session)
+    {
+        ssh_disconnect(client->session);
+        ssh_free(client->session);
+        client->session = NULL;
+    }
+    client->length = 0;
+}
+
+static int loadgen_connect(struct LoadgenClient *client)
+{
+    client->session = ssh_new();
+    if (!client->session)
+        return -1;
+
+    int verbosity = SSH_LOG_NOLOG;
+    ssh_options_set(client->session, SSH_OPTIONS_HOST, loadgen_config.host);
+    ssh_options_set(client->session, SSH_OPTIONS_PORT, &loadgen_config.port);
+    ssh_options_set(client->session, SSH_OPTIONS_USER, loadgen_config.user);
+    ssh_options_set(client->session, SSH_OPTIONS_LOG_VERBOSITY, &verbosity);
+    if (loadgen_config.identity)
+        ssh_options_set(client->session, SSH_OPTIONS_IDENTITY, loadgen_config.identity);
+
+    if (ssh_connect(client->session) != SSH_OK)
+    {
+        fprintf(stderr, "Error connecting to %s:%d: %s\n", loadgen_config.host, loadgen_config.port, ssh_get_error(client->session));
+        loadgen_disconnect(client);
+        return -1;
+    }
+
+    // The server accepts the "none" method, a key is only tried for servers that insist on one
+    if (ssh_userauth_none(client->session, NULL) != SSH_AUTH_SUCCESS &&
+        ssh_userauth_publickey_auto(client->session, NULL, NULL) != SSH_AUTH_SUCCESS)
+    {
+        fprintf(stderr, "Error authenticating: %s\n", ssh_get_error(client->session));
+        loadgen_disconnect(client);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Opens a channel with a shell on it, the way `ssh host < request` does
+static int loadgen_open_channel(struct LoadgenClient *client)
+{
+    client->channel = ssh_channel_new(client->session);
+    if (!client->channel)
+        return -1;
+
+    if (ssh_channel_open_session(client->channel) != SSH_OK || ssh_channel_request_shell(client->channel) != SSH_OK)
+    {
+        ssh_channel_free(client->channel);
+        client->channel = NULL;
+        return -1;
+    }
+
+    client->length = 0;
+    return 0;
+}
+
+// Length of the JSON object at the start of data once it is complete, 0 while it is not.
+// Responses are compact objects, so only strings need care.
+static size_t loadgen_json_end(const char *data, size_t length)
+{
+    int depth = 0;
+    int in_string = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = data[i];
+        if (in_string)
+        {
+            if (c == '\\')
+                i++;
+            else if (c == '"')
+                in_string = 0;
+        }
+        else if (c == '"')
+            in_string = 1;
+        else if (c == '{' || c == '[')
+            depth++;
+        else if ((c == '}' || c == ']') && --depth == 0)
+            return i + 1;
+    }
+
+    return 0;
+}
+
+// Length of the first response in the client's buffer, 0 while it is incomplete
+static size_t loadgen_response_end(struct LoadgenClient *client)
+{
+    if (loadgen_config.mode == LOADGEN_STREAM)
+    {
+        char *newline = memchr(client->response, '\n', client->length);
+        return newline ? (size_t) (newline - client->response) + 1 : 0;
+    }
+    return loadgen_json_end(client->response, client->length);
+}
+
+// Reads until the buffer holds a complete response, returns its length, or 0 on EOF, error or timeout
+static size_t loadgen_read_response(struct LoadgenClient *client)
+{
+    for (;;)
+    {
+        size_t end = loadgen_response_end(client);
+        if (end > 0)
+            return end;
+
+        if (client->responseCapacity - client->length < 4096)
+        {
+            size_t capacity = client->responseCapacity ? client->responseCapacity * 2 : 65536;
+            char *response = realloc(client->response, capacity);
+            if (!response)
+                return 0;
+            client->response = response;
+            client->responseCapacity = capacity;
+        }
+
+        int nbytes = ssh_channel_read_timeout(client->channel, client->response + client->length,
+                                              client->responseCapacity - client->length - 1, 0, LOADGEN_TIMEOUT_MS);
+        if (nbytes <= 0)
+            return 0;
+        client->length += (size_t) nbytes;
+    }
+}
+
+// Removes the response of the given length from the buffer, returns 0 if it was an error response
+static int loadgen_consume_response(struct LoadgenClient *client, size_t end)
+{
+    char saved = client->response[end];
+    client->response[end] = '\0';
+    int ok = strstr(client->response, "\"error\"") == NULL;
+    client->response[end] = saved;
+
+    memmove(client->response, client->response + end, client->length - end);
+    client->length -= end;
+    return ok;
+}
+
+static int loadgen_write(struct LoadgenClient *client, const char *request, int length)
+{
+    return ssh_channel_write(client->channel, request, (uint32_t) length) == length ? 0 : -1;
+}
+
+// One request on a fresh session, answered up to EOF like the original one-shot clients
+static int loadgen_session_request(struct LoadgenClient *client, const char *request, int length)
+{
+    int ok = loadgen_connect(client) == 0 && loadgen_open_channel(client) == 0 &&
+             loadgen_write(client, request, length) == 0 && ssh_channel_send_eof(client->channel) == SSH_OK;
+
+    size_t end = ok ? loadgen_read_response(client) : 0;
+    ok = end > 0 && loadgen_consume_response(client, end);
+
+    loadgen_disconnect(client);
+    return ok ? 0 : -1;
+}
+
+// One request on the client's session. A threaded server closes the channel after each response
+// while an event server keeps it, so the channel is reopened whenever the server has let go of it.
+static int loadgen_stay_alive_request(struct LoadgenClient *client, const char *request, int length)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (!client->session && loadgen_connect(client) != 0)
+            return -1;
+
+        if (client->channel && (ssh_channel_is_eof(client->channel) || ssh_channel_is_closed(client->channel)))
+        {
+            ssh_channel_close(client->channel);
+            ssh_channel_free(client->channel);
+            client->channel = NULL;
+        }
+        if (!client->channel && loadgen_open_channel(client) != 0)
+        {
+            loadgen_disconnect(client);
+            continue;
+        }
+
+        size_t end = 0;
+        if (loadgen_write(client, request, length) == 0)
+            end = loadgen_read_response(client);
+
+        if (end > 0)
+            return loadgen_consume_response(client, end) ? 0 : -1;
+
+        // The server may have closed the channel just before the write, retry once on a new one
+        ssh_channel_close(client->channel);
+        ssh_channel_free(client->channel);
+        client->channel = NULL;
+    }
+
+    return -1;
+}
+
+static void loadgen_run_requests(struct LoadgenClient *client)
+{
+    char request[LOADGEN_REQUEST_SIZE];
+
+    while (loadgen_claim())
+    {
+        int length = loadgen_payload(client, request);
+
+        double start = loadgen_now();
+        int rc = loadgen_config.mode == LOADGEN_SESSION ? loadgen_session_request(client, request, length)
+                                                        : loadgen_stay_alive_request(client, request, length);
+        double elapsed = loadgen_now() - start;
+
+        if (rc == 0)
+            loadgen_record(client, elapsed * 1e6);
+        else
+            client->errors++;
+    }
+}
+
+// Streaming mode: keeps up to depth requests in flight on one channel, responses come back in order
+static void loadgen_run_stream(struct LoadgenClient *client)
+{
+    const char *stream = "{\"request\": \"stream\"}\n";
+    char request[LOADGEN_REQUEST_SIZE];
+    double sent[LOADGEN_MAX_DEPTH];
+    size_t head = 0;
+    size_t inflight = 0;
+    int more = 1;
+
+    if (loadgen_connect(client) != 0 || loadgen_open_channel(client) != 0 ||
+        loadgen_write(client, stream, (int) strlen(stream)) != 0)
+    {
+        client->errors++;
+        loadgen_disconnect(client);
+        return;
+    }
+
+    // The acknowledgement line
+    size_t end = loadgen_read_response(client);
+    if (end == 0)
+    {
+        client->errors++;
+        loadgen_disconnect(client);
+        return;
+    }
+    loadgen_consume_response(client, end);
+
+    while (more || inflight > 0)
+    {
+        while (more && inflight < (size_t) loadgen_config.depth)
+        {
+            if (!loadgen_claim())
+            {
+                more = 0;
+                break;
+            }
+
+            int length = loadgen_payload(client, request);
+            sent[(head + inflight) % LOADGEN_MAX_DEPTH] = loadgen_now();
+            if (loadgen_write(client, request, length) != 0)
+            {
+                client->errors += inflight + 1;
+                loadgen_disconnect(client);
+                return;
+            }
+            inflight++;
+        }
+
+        if (inflight == 0)
+            break;
+
+        end = loadgen_read_response(client);
+        if (end == 0)
+        {
+            client->errors += inflight;
+            loadgen_disconnect(client);
+            return;
+        }
+
+        double elapsed = loadgen_now() - sent[head];
+        head = (head + 1) % LOADGEN_MAX_DEPTH;
+        inflight--;
+
+        if (loadgen_consume_response(client, end))
+            loadgen_record(client, elapsed * 1e6);
+        else
+            client->errors++;
+    }
+
+    ssh_channel_send_eof(client->channel);
+    loadgen_disconnect(client);
+}
+
+static void *loadgen_client_main(void *arg)
+{
+    struct LoadgenClient *client = arg;
+
+    if (loadgen_config.mode == LOADGEN_STREAM)
+        loadgen_run_stream(client);
+    else
+        loadgen_run_requests(client);
+
+    loadgen_disconnect(client);
+    return NULL;
+}
+
+static int loadgen_compare(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted latencies
+static double loadgen_percentile(const double *sorted, size_t count, double p)
+{
+    if (count == 0)
+        return 0;
+    size_t rank = (size_t) (p * (double) count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return sorted[(rank < count ? rank : count) - 1];
+}
+
+// Parses "plain:8,name:1,batch:1,stats:1", returns -1 on an unknown kind or a bad weight
+static int loadgen_parse_mix(const char *text, struct LoadgenConfig *config)
+{
+    memset(config->weights, 0, sizeof(config->weights));
+    config->totalWeight = 0;
+
+    while (*text)
+    {
+        size_t length = strcspn(text, ":,");
+        int kind = -1;
+        for (int i = 0; i < LOADGEN_PAYLOADS; i++)
+            if (strlen(loadgen_payload_names[i]) == length && strncmp(text, loadgen_payload_names[i], length) == 0)
+                kind = i;
+        if (kind < 0)
+            return -1;
+
+        int weight = 1;
+        text += length;
+        if (*text == ':')
+        {
+            char *end;
+            long parsed = strtol(text + 1, &end, 10);
+            if (end == text + 1 || parsed < 0 || parsed > 1000000)
+                return -1;
+            weight = (int) parsed;
+            text = end;
+        }
+        if (*text == ',')
+            text++;
+        else if (*text)
+            return -1;
+
+        config->weights[kind] += weight;
+        config->totalWeight += weight;
+    }
+
+    return config->totalWeight > 0 ? 0 : -1;
+}
+
+static void loadgen_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--host HOST] [--port PORT] [--user USER] [--identity FILE] [--concurrency N]\n"
+                    "       [--requests N | --duration SECONDS] [--mode session|stay_alive|stream] [--depth N]\n"
+                    "       [--mix plain:W,name:W,batch:W,stats:W] [--name NAME]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    struct LoadgenConfig *config = &loadgen_config;
+    config->host = "localhost";
+    config->port = 2222;
+    config->user = "root";
+    config->identity = NULL;
+    config->concurrency = 8;
+    config->requests = 10000;
+    config->duration = 0;
+    config->mode = LOADGEN_STAY_ALIVE;
+    config->depth = 1;
+    config->name = NULL;
+    loadgen_parse_mix("plain", config);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL)
+        {
+            loadgen_usage(argv[0]);
+            return 1;
+        }
+        i++;
+
+        if (strcmp(option, "--host") == 0)
+            config->host = value;
+        else if (strcmp(option, "--port") == 0)
+            config->port = atoi(value);
+        else if (strcmp(option, "--user") == 0)
+            config->user = value;
+        else if (strcmp(option, "--identity") == 0)
+            config->identity = value;
+        else if (strcmp(option, "--concurrency") == 0)
+            config->concurrency = atoi(value);
+        else if (strcmp(option, "--requests") == 0)
+            config->requests = atol(value);
+        else if (strcmp(option, "--duration") == 0)
+            config->duration = atof(value);
+        else if (strcmp(option, "--depth") == 0)
+            config->depth = atoi(value);
+        else if (strcmp(option, "--name") == 0)
+            config->name = value;
+        else if (strcmp(option, "--mix") == 0)
+        {
+            if (loadgen_parse_mix(value, config) != 0)
+            {
+                fprintf(stderr, "Invalid mix '%s', expected kind:weight pairs over plain, name, batch and stats\n", value);
+                return 1;
+            }
+        }
+        else if (strcmp(option, "--mode") == 0)
+        {
+            if (strcmp(value, "session") == 0)
+                config->mode = LOADGEN_SESSION;
+            else if (strcmp(value, "stay_alive") == 0)
+                config->mode = LOADGEN_STAY_ALIVE;
+            else if (strcmp(value, "stream") == 0)
+                config->mode = LOADGEN_STREAM;
+            else
+            {
+                fprintf(stderr, "Unknown mode '%s', expected session, stay_alive or stream\n", value);
+                return 1;
+            }
+        }
+        else
+        {
+            loadgen_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config->concurrency < 1 || config->depth < 1 || config->depth > LOADGEN_MAX_DEPTH ||
+        config->port < 1 || config->port > 65535 || (config->duration <= 0 && config->requests < 1))
+    {
+        loadgen_usage(argv[0]);
+        return 1;
+    }
+    if (config->weights[LOADGEN_NAME] > 0 && config->name == NULL)
+    {
+        fprintf(stderr, "The name payload needs --name with a planet from the server's catalog\n");
+        return 1;
+    }
+    if (config->duration > 0)
+        config->requests = 0;
+
+    struct LoadgenClient *clients = calloc((size_t) config->concurrency, sizeof(struct LoadgenClient));
+    if (!clients)
+        return 1;
+
+    double start = loadgen_now();
+    loadgen_deadline = start + config->duration;
+
+    int started = 0;
+    for (int i = 0; i < config->concurrency; i++)
+    {
+        clients[i].random = 0x9e3779b97f4a7c15ULL * (unsigned long long) (i + 1);
+        if (pthread_create(&clients[i].thread, NULL, loadgen_client_main, &clients[i]) != 0)
+        {
+            fprintf(stderr, "Error creating client thread\n");
+            break;
+        }
+        started++;
+    }
+
+    size_t total = 0;
+    unsigned long long errors = 0;
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        total += clients[i].count;
+        errors += clients[i].errors;
+    }
+    double seconds = loadgen_now() - start;
+
+    double *latencies = malloc((total ? total : 1) * sizeof(double));
+    if (!latencies)
+        return 1;
+
+    size_t merged = 0;
+    double sum = 0;
+    for (int i = 0; i < started; i++)
+    {
+        memcpy(latencies + merged, clients[i].latencies, clients[i].count * sizeof(double));
+        merged += clients[i].count;
+        free(clients[i].latencies);
+        free(clients[i].response);
+    }
+    for (size_t i = 0; i < total; i++)
+        sum += latencies[i];
+    qsort(latencies, total, sizeof(double), loadgen_compare);
+
+    printf("{\"mode\":\"%s\",\"concurrency\":%d,\"depth\":%d,\"mix\":{", loadgen_mode_names[config->mode], config->concurrency, config->depth);
+    for (int i = 0; i < LOADGEN_PAYLOADS; i++)
+        printf("%s\"%s\":%d", i ? "," : "", loadgen_payload_names[i], config->weights[i]);
+    printf("},\"requests\":%zu,\"errors\":%llu,\"seconds\":%.3f,\"throughput\":%.1f,"
+           "\"latencyUs\":{\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+           total, errors, seconds, seconds > 0 ? total / seconds : 0,
+           total ? sum / total : 0, loadgen_percentile(latencies, total, 0.5), loadgen_percentile(latencies, total, 0.99),
+           loadgen_percentile(latencies, total, 0.999), total ? latencies[total - 1] : 0);
+
+    free(latencies);
+    free(clients);
+    return errors > 0 ? 2 : 0;
+}
@@ -0,0 +1,336 @@
+/*
+ * Request path instrumentation: per-thread latency histograms for each stage of a request, and a
+ * Prometheus text endpoint serving them on a separate port. Each thread records into its own
+ * histograms without locks or shared cache lines, a scrape sums them. While metrics are disabled
+ * recording is a single branch and no clock is read.
+ */
+
+#ifndef METRICS_C
+#define METRICS_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "socketserver.c"
+
+// Stages of a request, in the order a threaded session goes through them
+enum MetricsStage {
+    METRICS_CHANNEL_OPEN,       // opening the session channel
+    METRICS_READ,               // waiting for and reading request bytes
+    METRICS_PARSE,              // decoding the request
+    METRICS_SOLVE,              // Kepler solve and equatorial position
+    METRICS_GALACTIC,           // equatorial to galactic conversion
+    METRICS_SERIALIZE,          // encoding the response
+    METRICS_WRITE,              // writing the response to the channel
+    METRICS_STAGES
+};
+
+static const char *metrics_stage_names[METRICS_STAGES] = {
+    "channel_open", "read", "parse", "solve", "galactic", "serialize", "write"
+};
+
+// Histogram bucket upper bounds double from METRICS_FIRST_BOUND_NS, about 250 ns to 2 s,
+// with a final bucket for everything slower
+#define METRICS_BUCKETS 24
+#define METRICS_FIRST_BOUND_NS 250
+
+// Bytes of an HTTP request read before the endpoint gives up on it
+#define METRICS_REQUEST_SIZE 4096
+
+struct MetricsHistogram {
+    unsigned long long buckets[METRICS_BUCKETS + 1];
+    unsigned long long count;
+    unsigned long long sumNs;
+};
+
+// Histograms owned by one thread, only that thread writes them
+struct MetricsThread {
+    struct MetricsHistogram stages[METRICS_STAGES];
+    struct MetricsThread *next;
+};
+
+// Text of a scrape, grown as metrics are appended
+struct MetricsText {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// Appends the server's own gauges and counters to a scrape
+typedef void (*MetricsCollector)(struct MetricsText *text);
+
+struct MetricsServer {
+    int listenFd;
+    pthread_t thread;
+    int started;
+    int stopping;
+    MetricsCollector collector;
+};
+
+// Set once at startup, before any request is served
+int metrics_enabled = 0;
+
+static __thread struct MetricsThread *metrics_thread;
+static struct MetricsThread *metrics_threads;       // every thread that has recorded, never freed
+static pthread_mutex_t metrics_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Start of a timed stage, 0 while metrics are disabled
+static inline uint64_t metricsStart(void)
+{
+    if (!metrics_enabled)
+        return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+// The calling thread's histograms, registered on first use. NULL if they could not be allocated.
+static struct MetricsThread *metricsThread(void)
+{
+    if (metrics_thread)
+        return metrics_thread;
+
+    struct MetricsThread *thread = calloc(1, sizeof(struct MetricsThread));
+    if (!thread)
+        return NULL;
+
+    pthread_mutex_lock(&metrics_threads_lock);
+    thread->next = metrics_threads;
+    metrics_threads = thread;
+    pthread_mutex_unlock(&metrics_threads_lock);
+
+    metrics_thread = thread;
+    return thread;
+}
+
+// Single-writer increment, a scrape may read the counter concurrently
+static inline void metricsAdd(unsigned long long *counter, unsigned long long value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// Records the time since start (from metricsStart) against the stage
+static inline void metricsRecord(enum MetricsStage stage, uint64_t start)
+{
+    if (start == 0)
+        return;
+
+    uint64_t elapsed = metricsStart() - start;
+    struct MetricsThread *thread = metricsThread();
+    if (!thread)
+        return;
+
+    int bucket = 0;
+    uint64_t bound = METRICS_FIRST_BOUND_NS;
+    while (bucket < METRICS_BUCKETS && elapsed > bound)
+    {
+        bucket++;
+        bound *= 2;
+    }
+
+    struct MetricsHistogram *histogram = &thread->stages[stage];
+    metricsAdd(&histogram->buckets[bucket], 1);
+    metricsAdd(&histogram->count, 1);
+    metricsAdd(&histogram->sumNs, elapsed);
+}
+
+// Sums the histograms of every thread, counts may be mutually off by in-flight records
+void metricsStagesSnapshot(struct MetricsHistogram stages[METRICS_STAGES])
+{
+    memset(stages, 0, sizeof(struct MetricsHistogram) * METRICS_STAGES);
+
+    pthread_mutex_lock(&metrics_threads_lock);
+    for (struct MetricsThread *thread = metrics_threads; thread; thread = thread->next)
+    {
+        for (int s = 0; s < METRICS_STAGES; s++)
+        {
+            const struct MetricsHistogram *h = &thread->stages[s];
+            for (int b = 0; b <= METRICS_BUCKETS; b++)
+                stages[s].buckets[b] += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+            stages[s].count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+            stages[s].sumNs += __atomic_load_n(&h->sumNs, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&metrics_threads_lock);
+}
+
+// Appends formatted text to a scrape, silently truncating it if memory runs out
+void metricsPrintf(struct MetricsText *text, const char *format, ...)
+{
+    for (;;)
+    {
+        va_list args;
+        va_start(args, format);
+        int needed = text->data ? vsnprintf(text->data + text->length, text->capacity - text->length, format, args) : -1;
+        va_end(args);
+
+        if (needed >= 0 && (size_t) needed < text->capacity - text->length)
+        {
+            text->length += (size_t) needed;
+            return;
+        }
+
+        size_t capacity = text->capacity ? text->capacity * 2 : 16384;
+        char *grown = realloc(text->data, capacity);
+        if (!grown)
+            return;
+        text->data = grown;
+        text->capacity = capacity;
+    }
+}
+
+// Writes the HELP and TYPE lines of a metric
+void metricsHeader(struct MetricsText *text, const char *name, const char *type, const char *help)
+{
+    metricsPrintf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Writes the stage histograms in seconds
+static void metricsWriteStages(struct MetricsText *text)
+{
+    struct MetricsHistogram stages[METRICS_STAGES];
+    metricsStagesSnapshot(stages);
+
+    const char *name = "exoplanet_stage_duration_seconds";
+    metricsHeader(text, name, "histogram", "Time spent in each stage of a request.");
+
+    for (int s = 0; s < METRICS_STAGES; s++)
+    {
+        unsigned long long cumulative = 0;
+        double bound = METRICS_FIRST_BOUND_NS * 1e-9;
+
+        for (int b = 0; b < METRICS_BUCKETS; b++)
+        {
+            cumulative += stages[s].buckets[b];
+            metricsPrintf(text, "%s_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n", name, metrics_stage_names[s], bound, cumulative);
+            bound *= 2;
+        }
+        cumulative += stages[s].buckets[METRICS_BUCKETS];
+        metricsPrintf(text, "%s_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", name, metrics_stage_names[s], cumulative);
+        metricsPrintf(text, "%s_sum{stage=\"%s\"} %.9f\n", name, metrics_stage_names[s], stages[s].sumNs * 1e-9);
+        metricsPrintf(text, "%s_count{stage=\"%s\"} %llu\n", name, metrics_stage_names[s], stages[s].count);
+    }
+}
+
+// Answers one scrape on a connected socket, any path other than / and /metrics gets a 404
+static void metricsServeConnection(struct MetricsServer *server, int fd)
+{
+    // A client that stalls mid-request must not hold up the next scrape for long
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[METRICS_REQUEST_SIZE + 1];
+    size_t length = 0;
+    while (length < METRICS_REQUEST_SIZE)
+    {
+        ssize_t nbytes = recv(fd, request + length, METRICS_REQUEST_SIZE - length, 0);
+        if (nbytes <= 0)
+            break;
+        length += (size_t) nbytes;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[length] = '\0';
+
+    int found = strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0 ||
+                strncmp(request, "GET / ", 6) == 0;
+
+    struct MetricsText body = {0};
+    if (found)
+    {
+        metricsWriteStages(&body);
+        server->collector(&body);
+    }
+    else
+        metricsPrintf(&body, "Not found\n");
+
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                 found ? "200 OK" : "404 Not Found", body.length);
+
+    if (send(fd, header, (size_t) header_length, MSG_NOSIGNAL) == header_length)
+    {
+        size_t sent = 0;
+        while (sent < body.length)
+        {
+            ssize_t nbytes = send(fd, body.data + sent, body.length - sent, MSG_NOSIGNAL);
+            if (nbytes <= 0)
+                break;
+            sent += (size_t) nbytes;
+        }
+    }
+
+    free(body.data);
+}
+
+// Serves scrapes one at a time until the server is shut down
+static void *metricsServerMain(void *arg)
+{
+    struct MetricsServer *server = arg;
+
+    while (!__atomic_load_n(&server->stopping, __ATOMIC_SEQ_CST))
+    {
+        struct pollfd listen_poll = { server->listenFd, POLLIN, 0 };
+        if (poll(&listen_poll, 1, SOCKET_POLL_TIMEOUT) <= 0)
+            continue;
+
+        int fd = accept(server->listenFd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        metricsServeConnection(server, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+// Enables recording and serves the metrics over HTTP on port. collector appends the server-wide
+// gauges and counters to every scrape. Returns 0 on success.
+int metricsServerInit(struct MetricsServer *server, int port, MetricsCollector collector)
+{
+    memset(server, 0, sizeof(*server));
+    server->collector = collector;
+
+    server->listenFd = socketListenTcp(port);
+    if (server->listenFd < 0)
+        return -1;
+
+    if (pthread_create(&server->thread, NULL, metricsServerMain, server) != 0)
+    {
+        fprintf(stderr, "Error creating metrics server thread\n");
+        close(server->listenFd);
+        return -1;
+    }
+    server->started = 1;
+
+    metrics_enabled = 1;
+    return 0;
+}
+
+void metricsServerShutdown(struct MetricsServer *server)
+{
+    if (!server->started)
+        return;
+
+    __atomic_store_n(&server->stopping, 1, __ATOMIC_SEQ_CST);
+    pthread_join(server->thread, NULL);
+    close(server->listenFd);
+    server->started = 0;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Compiled orbit handles: everything that depends only on the orbital elements, computed once
+ */
+
+#ifndef ORBIT_C
+#define ORBIT_C
+
+#include <math.h>
+#include "astromath.c"
+
+struct OrbitHandle {
+    // Orbital elements the handle was compiled from
+    double orbitalRadius;           // AU
+    double orbitalPeriod;           // Years
+    double eccentricity;
+    double inclination;             // Degrees
+    double longitudeOfNode;         // Degrees
+    double argumentOfPeriapsis;     // Degrees
+
+    // Invariants
+    double periodSeconds;           // Orbital period in seconds
+    double meanMotion;              // Mean anomaly advance in radians per second
+    double semiLatusFactor;         // a * (1 - e^2), scales sin(E) into the orbital y coordinate
+    double rotation[6];             // Orbital plane to equatorial rotation, see calculateOrbitRotation
+};
+
+// Compiles the orbit of a planet into a handle
+void orbitHandleInit(struct OrbitHandle *orbit, const struct Exoplanet *planet)
+{
+    orbit->orbitalRadius = planet->orbitalRadius;
+    orbit->orbitalPeriod = planet->orbitalPeriod;
+    orbit->eccentricity = planet->eccentricity;
+    orbit->inclination = planet->inclination;
+    orbit->longitudeOfNode = planet->longitudeOfNode;
+    orbit->argumentOfPeriapsis = planet->argumentOfPeriapsis;
+
+    // Convert orbital period to seconds
+    orbit->periodSeconds = planet->orbitalPeriod * 365.25 * 24 * 60 * 60;
+    orbit->meanMotion = 2 * PI / orbit->periodSeconds;
+    orbit->semiLatusFactor = planet->orbitalRadius * (1 - planet->eccentricity * planet->eccentricity);
+
+    calculateOrbitRotation(planet, orbit->rotation);
+}
+
+// Mean anomaly at the given time, evaluated in the same order as calculateRaAndDistance
+static inline double orbitHandleMeanAnomaly(const struct OrbitHandle *orbit, double current_time)
+{
+    return 2 * PI * (current_time / orbit->periodSeconds);
+}
+
+// Equatorial position (AU) at an already solved eccentric anomaly, returns the distance from the
+// focus in AU, or NaN (leaving x, y, z untouched) when the eccentric anomaly is NaN.
+// The orbital plane coordinates are written in terms of E, which is equivalent to the true anomaly
+// form used in calculateRaAndDistance and avoids its atan/tan/sqrt round trip.
+static inline double orbitHandlePositionAt(const struct OrbitHandle *orbit, double eccentric_anomaly, double *x_eq, double *y_eq, double *z_eq)
+{
+    if (isnan(eccentric_anomaly))
+        return NAN;
+
+    double e = orbit->eccentricity;
+    double cos_E = cos(eccentric_anomaly);
+    double sin_E = sin(eccentric_anomaly);
+    double one_minus_e_cos = 1 - e * cos_E;
+
+    double distance = orbit->orbitalRadius * one_minus_e_cos;
+    double x_orbital = orbit->orbitalRadius * ((cos_E - e) - e * one_minus_e_cos);
+    double y_orbital = orbit->semiLatusFactor * sin_E;
+
+    const double *rotation = orbit->rotation;
+    *x_eq = x_orbital * rotation[0] + y_orbital * rotation[1];
+    *y_eq = x_orbital * rotation[2] + y_orbital * rotation[3];
+    *z_eq = x_orbital * rotation[4] + y_orbital * rotation[5];
+
+    return distance;
+}
+
+// Computes the equatorial position (AU) of the orbit at the given time, returns the distance from
+// the focus in AU, or NaN (leaving x, y, z untouched) when Kepler's equation has no solution.
+double orbitHandlePosition(const struct OrbitHandle *orbit, double current_time, double *x_eq, double *y_eq, double *z_eq)
+{
+    double eccentric_anomaly = solveKepler(orbitHandleMeanAnomaly(orbit, current_time), orbit->eccentricity);
+    return orbitHandlePositionAt(orbit, eccentric_anomaly, x_eq, y_eq, z_eq);
+}
+
+// Sets distance (light years), ra (radians) and declination (degrees) from an equatorial position
+static inline void orbitHandleSetPosition(double distance, double x_eq, double y_eq, double z_eq, struct Exoplanet *planet)
+{
+    // keplar equation solver function didnt come to a value exit early
+    if (isnan(distance))
+    {
+        planet->distance = NAN;
+        planet->ra = NAN;
+        return;
+    }
+
+    // convert astronomical units to light years
+    planet->distance = distance * 0.0000158125074;
+
+    // ensures that the Right Ascension (RA) is always in the positive range
+    double ra = atan2(y_eq, x_eq);
+    if (ra < 0)
+        ra += 2 * PI;
+
+    planet->ra = ra;
+    planet->declination = RAD_TO_DEG(asin(z_eq / sqrt(x_eq * x_eq + y_eq * y_eq + z_eq * z_eq)));
+}
+
+// Same results as calculateRaAndDistance: sets distance (light years), ra (radians) and declination (degrees)
+void orbitHandleEvaluate(const struct OrbitHandle *orbit, double current_time, struct Exoplanet *planet)
+{
+    double x_eq, y_eq, z_eq;
+    double distance = orbitHandlePosition(orbit, current_time, &x_eq, &y_eq, &z_eq);
+    orbitHandleSetPosition(distance, x_eq, y_eq, z_eq, planet);
+}
+
+// orbitHandleEvaluate with Kepler's equation solved from guess, an eccentric anomaly close to the
+// one at current_time (see solveKeplerFrom). Returns the eccentric anomaly, NaN if there was no solution.
+double orbitHandleEvaluateFrom(const struct OrbitHandle *orbit, double current_time, double guess, struct Exoplanet *planet)
+{
+    double eccentric_anomaly = solveKeplerFrom(orbitHandleMeanAnomaly(orbit, current_time), orbit->eccentricity, guess);
+
+    double x_eq = 0, y_eq = 0, z_eq = 0;
+    double distance = orbitHandlePositionAt(orbit, eccentric_anomaly, &x_eq, &y_eq, &z_eq);
+    orbitHandleSetPosition(distance, x_eq, y_eq, z_eq, planet);
+    return eccentric_anomaly;
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * Process-wide cache of compiled orbit handles keyed by the orbital element tuple
+ */
+
+#ifndef ORBITCACHE_C
+#define ORBITCACHE_C
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "orbit.c"
+
+// Shards are locked independently so concurrent sessions rarely contend
+#define ORBIT_CACHE_SHARDS 64
+
+// Slots per shard, 64 * 1024 handles in total (about 9 MB)
+#define ORBIT_CACHE_SLOTS_PER_SHARD 1024
+
+// Slots probed from the home slot before evicting the least recently used one
+#define ORBIT_CACHE_PROBE 4
+
+struct OrbitCacheEntry {
+    uint64_t hash;                  // 0 marks an empty slot
+    uint64_t lastUsed;              // Shard clock value of the last hit
+    struct OrbitHandle orbit;
+};
+
+struct OrbitCacheShard {
+    pthread_mutex_t lock;
+    uint64_t clock;
+    struct OrbitCacheEntry entries[ORBIT_CACHE_SLOTS_PER_SHARD];
+};
+
+struct OrbitCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long entries;
+};
+
+static struct OrbitCacheShard *orbit_cache = NULL;
+static pthread_once_t orbit_cache_once = PTHREAD_ONCE_INIT;
+static struct OrbitCacheStats orbit_cache_stats;
+
+static void orbitCacheAllocate(void)
+{
+    struct OrbitCacheShard *shards = calloc(ORBIT_CACHE_SHARDS, sizeof(struct OrbitCacheShard));
+    if (!shards)
+        return;
+
+    for (int i = 0; i < ORBIT_CACHE_SHARDS; i++)
+        pthread_mutex_init(&shards[i].lock, NULL);
+
+    orbit_cache = shards;
+}
+
+// FNV-1a over the element tuple, negative zero folded into zero so equal elements hash equally
+static uint64_t orbitElementsHash(const double elements[6])
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (int i = 0; i < 6; i++)
+    {
+        double value = elements[i] == 0 ? 0.0 : elements[i];
+        unsigned char bytes[sizeof(double)];
+        memcpy(bytes, &value, sizeof(double));
+
+        for (size_t j = 0; j < sizeof(double); j++)
+        {
+            hash ^= bytes[j];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    // Keep 0 free to mark empty slots
+    return hash ? hash : 1;
+}
+
+static int orbitHandleMatches(const struct OrbitHandle *orbit, const double elements[6])
+{
+    return orbit->orbitalRadius == elements[0] && orbit->orbitalPeriod == elements[1] &&
+           orbit->eccentricity == elements[2] && orbit->inclination == elements[3] &&
+           orbit->longitudeOfNode == elements[4] && orbit->argumentOfPeriapsis == elements[5];
+}
+
+// Looks up the orbit in its probe window with the shard lock held. Returns the matching entry, or
+// NULL and the empty or least recently used slot of the window in victim.
+static struct OrbitCacheEntry *orbitCacheProbe(struct OrbitCacheShard *shard, size_t home, uint64_t hash,
+                                               const double elements[6], struct OrbitCacheEntry **victim)
+{
+    *victim = NULL;
+    for (size_t probe = 0; probe < ORBIT_CACHE_PROBE; probe++)
+    {
+        struct OrbitCacheEntry *entry = &shard->entries[(home + probe) % ORBIT_CACHE_SLOTS_PER_SHARD];
+
+        if (entry->hash == hash && orbitHandleMatches(&entry->orbit, elements))
+            return entry;
+
+        if (*victim == NULL || entry->hash == 0 || ((*victim)->hash != 0 && entry->lastUsed < (*victim)->lastUsed))
+            *victim = entry;
+    }
+    return NULL;
+}
+
+// Fills orbit with the compiled orbit of the planet, compiling and caching it on a miss.
+// The handle is copied out so callers never hold references into the cache.
+void orbitCacheGet(const struct Exoplanet *planet, struct OrbitHandle *orbit)
+{
+    pthread_once(&orbit_cache_once, orbitCacheAllocate);
+
+    double elements[6] = {
+        planet->orbitalRadius, planet->orbitalPeriod, planet->eccentricity,
+        planet->inclination, planet->longitudeOfNode, planet->argumentOfPeriapsis
+    };
+
+    // Without a cache (allocation failed at startup) every request compiles its own handle
+    if (!orbit_cache)
+    {
+        orbitHandleInit(orbit, planet);
+        return;
+    }
+
+    uint64_t hash = orbitElementsHash(elements);
+    struct OrbitCacheShard *shard = &orbit_cache[hash % ORBIT_CACHE_SHARDS];
+    size_t home = (hash / ORBIT_CACHE_SHARDS) % ORBIT_CACHE_SLOTS_PER_SHARD;
+    struct OrbitCacheEntry *entry, *victim;
+
+    pthread_mutex_lock(&shard->lock);
+    shard->clock++;
+
+    entry = orbitCacheProbe(shard, home, hash, elements, &victim);
+    if (entry)
+    {
+        entry->lastUsed = shard->clock;
+        *orbit = entry->orbit;
+        pthread_mutex_unlock(&shard->lock);
+        __atomic_fetch_add(&orbit_cache_stats.hits, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    __atomic_fetch_add(&orbit_cache_stats.misses, 1, __ATOMIC_RELAXED);
+
+    // Compile outside the lock
+    orbitHandleInit(orbit, planet);
+
+    // Another thread may have stored the same orbit, or reused the chosen slot, while the lock was
+    // released, so probe again and only insert if the orbit is still missing
+    pthread_mutex_lock(&shard->lock);
+    entry = orbitCacheProbe(shard, home, hash, elements, &victim);
+    if (entry)
+    {
+        entry->lastUsed = shard->clock;
+    }
+    else
+    {
+        if (victim->hash == 0)
+            __atomic_fetch_add(&orbit_cache_stats.entries, 1, __ATOMIC_RELAXED);
+        victim->hash = hash;
+        victim->lastUsed = shard->clock;
+        victim->orbit = *orbit;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void orbitCacheStatsSnapshot(struct OrbitCacheStats *stats)
+{
+    stats->hits = __atomic_load_n(&orbit_cache_stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&orbit_cache_stats.misses, __ATOMIC_RELAXED);
+    stats->entries = __atomic_load_n(&orbit_cache_stats.entries, __ATOMIC_RELAXED);
+}
+
+#endif
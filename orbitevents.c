@@ -0,0 +1,456 @@
+/*
+ * Orbital events over a span of epochs: periapsis and apoapsis passages, node crossings (declination
+ * through zero) and crossings of a given right ascension or declination.
+ *
+ * Every event happens at a fixed eccentric anomaly of the orbit, so it is found once per planet and
+ * then repeated every period. Apsides are at E = 0 and pi. Nodes and right ascension crossings are
+ * the zeros of a linear function of the position, which in terms of E is A cos E + B sin E + C and
+ * has closed-form roots. Declination crossings are bracketed by sampling one orbit and bisected.
+ * Kepler's equation is then only needed in its easy direction, M = E - e sin E, and the epochs of
+ * the k-th orbit follow from M. Because the events of a chunk of time can be counted without
+ * producing them, results are placed and truncated up front, and chunks fill in parallel.
+ */
+
+#ifndef ORBITEVENTS_C
+#define ORBITEVENTS_C
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "astromath.c"
+#include "orbit.c"
+#include "workerpool.c"
+
+// Most events kept within a single orbit
+#define ORBIT_EVENT_MAX_ROOTS 16
+
+// Samples of eccentric anomaly per orbit used to bracket declination crossings
+#define ORBIT_EVENT_SAMPLES 256
+
+// Planets per task while finding the events of an orbit
+#define ORBIT_EVENT_TASK_PLANETS 64
+
+// Most chunks a span is split into so a few planets still keep every worker busy
+#define ORBIT_EVENT_MAX_CHUNKS 64
+
+// Most orbits a span may cover. Past it the events could never be written out, and a tiny
+// period would overflow the event counts.
+#define ORBIT_EVENT_MAX_ORBITS 1e9
+
+// Orbit numbers (time over period) stay below 2^52, where a double still counts them one by one
+#define ORBIT_EVENT_MAX_ORBIT_NUMBER 4503599627370496.0
+
+enum OrbitEventType {
+    ORBIT_EVENT_PERIAPSIS,
+    ORBIT_EVENT_APOAPSIS,
+    ORBIT_EVENT_ASCENDING_NODE,         // Declination rising through zero
+    ORBIT_EVENT_DESCENDING_NODE,
+    ORBIT_EVENT_RA_CROSSING,            // Right ascension passing the query's, direction +1 when increasing
+    ORBIT_EVENT_DECLINATION_CROSSING,   // Declination passing the query's, direction +1 when rising
+    ORBIT_EVENT_TYPES
+};
+
+static const char *const orbit_event_names[ORBIT_EVENT_TYPES] = {
+    "periapsis", "apoapsis", "ascending_node", "descending_node", "ra_crossing", "declination_crossing"
+};
+
+struct OrbitEventQuery {
+    unsigned types;                     // Bit per enum OrbitEventType
+    double ra;                          // Radians, for ORBIT_EVENT_RA_CROSSING
+    double declination;                 // Degrees, for ORBIT_EVENT_DECLINATION_CROSSING
+    double start;                       // Unix seconds, events in [start, stop]
+    double stop;
+};
+
+// An event within one orbit, at a mean anomaly in [0, 2 pi)
+struct OrbitEventRoot {
+    double meanAnomaly;
+    int type;
+    int direction;                      // +1 or -1 for crossings, 0 for apsides
+};
+
+struct OrbitEvent {
+    double unixTime;
+    int type;
+    int direction;
+};
+
+// Returns the event type with the given name, or -1
+int orbitEventType(const char *name)
+{
+    for (int type = 0; type < ORBIT_EVENT_TYPES; type++)
+    {
+        if (strcmp(name, orbit_event_names[type]) == 0)
+            return type;
+    }
+    return -1;
+}
+
+// Equatorial position at an eccentric anomaly, the same expressions as orbitHandlePositionAt
+static void orbitEventPosition(const struct OrbitHandle *orbit, double E, double v[3])
+{
+    v[0] = v[1] = v[2] = 0;
+    orbitHandlePositionAt(orbit, E, &v[0], &v[1], &v[2]);
+}
+
+static int orbitEventAddRoot(struct OrbitEventRoot *roots, int count, double E, double e, int type, int direction)
+{
+    if (count == ORBIT_EVENT_MAX_ROOTS)
+        return count;
+
+    E -= 2 * PI * floor(E / (2 * PI));
+    double M = E - e * sin(E);
+    M -= 2 * PI * floor(M / (2 * PI));
+
+    roots[count].meanAnomaly = M;
+    roots[count].type = type;
+    roots[count].direction = direction;
+    return count + 1;
+}
+
+// Zeros of c . position(E) over one orbit. The orbital coordinates are x = a ((1 + e^2) cos E - 2e)
+// and y = a (1 - e^2) sin E (see orbitHandlePositionAt), so along c the position is
+// A cos E + B sin E + C = R cos(E - phi) + C. Writes up to two roots, rising first, and returns their
+// number; a grazing touch (|C| = R) is not a crossing.
+static int orbitEventLinearRoots(const struct OrbitHandle *orbit, const double c[3], double roots[2])
+{
+    const double *r = orbit->rotation;
+    double a = orbit->orbitalRadius, e = orbit->eccentricity;
+    double cp = c[0] * r[0] + c[1] * r[2] + c[2] * r[4];
+    double cq = c[0] * r[1] + c[1] * r[3] + c[2] * r[5];
+
+    double A = a * (1 + e * e) * cp;
+    double B = a * (1 - e * e) * cq;
+    double C = -2 * a * e * cp;
+    double R = sqrt(A * A + B * B);
+    if (!(R > 0) || !(fabs(C) < R))
+        return 0;
+
+    // The derivative is -R sin(E - phi), rising below phi and falling above it
+    double phi = atan2(B, A);
+    double theta = acos(-C / R);
+    roots[0] = phi - theta;
+    roots[1] = phi + theta;
+    return 2;
+}
+
+// Declination crossings of one orbit: the sign changes of z - sin(declination) |position|,
+// bracketed on ORBIT_EVENT_SAMPLES steps of E and bisected down to rounding
+static int orbitEventDeclinationRoots(const struct OrbitHandle *orbit, double declination, struct OrbitEventRoot *roots, int count)
+{
+    double s = sin(DEG_TO_RAD(declination));
+    double step = 2 * PI / ORBIT_EVENT_SAMPLES;
+    double v[3];
+
+    orbitEventPosition(orbit, 0, v);
+    double previous = v[2] - s * sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+    for (int i = 1; i <= ORBIT_EVENT_SAMPLES; i++)
+    {
+        double E = i * step;
+        orbitEventPosition(orbit, E, v);
+        double value = v[2] - s * sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+        if ((previous < 0) != (value < 0))
+        {
+            double lo = E - step, hi = E;
+            double lo_value = previous;
+            for (int k = 0; k < 60 && hi - lo > 1e-15; k++)
+            {
+                double middle = (lo + hi) / 2;
+                orbitEventPosition(orbit, middle, v);
+                double middle_value = v[2] - s * sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+                if ((middle_value < 0) == (lo_value < 0))
+                {
+                    lo = middle;
+                    lo_value = middle_value;
+                }
+                else
+                    hi = middle;
+            }
+            count = orbitEventAddRoot(roots, count, (lo + hi) / 2, orbit->eccentricity, ORBIT_EVENT_DECLINATION_CROSSING, value < 0 ? -1 : 1);
+        }
+        previous = value;
+    }
+    return count;
+}
+
+static int orbitEventCompareRoots(const void *a, const void *b)
+{
+    const struct OrbitEventRoot *x = a, *y = b;
+    return x->meanAnomaly < y->meanAnomaly ? -1 : x->meanAnomaly > y->meanAnomaly;
+}
+
+// Finds the events of one orbit asked for by query, sorted by mean anomaly. Returns their number,
+// or -1 for an orbit that does not repeat (a period that is not positive, or e outside [0, 1)) or
+// that repeats too often: more than ORBIT_EVENT_MAX_ORBITS over the span, or orbit numbers past
+// ORBIT_EVENT_MAX_ORBIT_NUMBER at either end.
+int orbitEventRoots(const struct OrbitHandle *orbit, const struct OrbitEventQuery *query, struct OrbitEventRoot roots[ORBIT_EVENT_MAX_ROOTS])
+{
+    double e = orbit->eccentricity;
+    if (!(orbit->periodSeconds > 0) || !isfinite(orbit->periodSeconds) || !(e >= 0 && e < 1))
+        return -1;
+
+    double period = orbit->periodSeconds;
+    if (!((query->stop - query->start) / period <= ORBIT_EVENT_MAX_ORBITS) ||
+        !(fabs(query->start) / period < ORBIT_EVENT_MAX_ORBIT_NUMBER) || !(fabs(query->stop) / period < ORBIT_EVENT_MAX_ORBIT_NUMBER))
+        return -1;
+
+    int count = 0;
+    double E[2];
+
+    if (query->types & (1u << ORBIT_EVENT_PERIAPSIS))
+        count = orbitEventAddRoot(roots, count, 0, e, ORBIT_EVENT_PERIAPSIS, 0);
+    if (query->types & (1u << ORBIT_EVENT_APOAPSIS))
+        count = orbitEventAddRoot(roots, count, PI, e, ORBIT_EVENT_APOAPSIS, 0);
+
+    if (query->types & ((1u << ORBIT_EVENT_ASCENDING_NODE) | (1u << ORBIT_EVENT_DESCENDING_NODE)))
+    {
+        const double pole[3] = { 0, 0, 1 };
+        if (orbitEventLinearRoots(orbit, pole, E) == 2)
+        {
+            if (query->types & (1u << ORBIT_EVENT_ASCENDING_NODE))
+                count = orbitEventAddRoot(roots, count, E[0], e, ORBIT_EVENT_ASCENDING_NODE, 1);
+            if (query->types & (1u << ORBIT_EVENT_DESCENDING_NODE))
+                count = orbitEventAddRoot(roots, count, E[1], e, ORBIT_EVENT_DESCENDING_NODE, -1);
+        }
+    }
+
+    // The meridian plane of ra holds its opposite as well, only the roots on ra's side count
+    if (query->types & (1u << ORBIT_EVENT_RA_CROSSING))
+    {
+        const double normal[3] = { -sin(query->ra), cos(query->ra), 0 };
+        if (orbitEventLinearRoots(orbit, normal, E) == 2)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                double v[3];
+                orbitEventPosition(orbit, E[i], v);
+                if (v[0] * cos(query->ra) + v[1] * sin(query->ra) > 0)
+                    count = orbitEventAddRoot(roots, count, E[i], e, ORBIT_EVENT_RA_CROSSING, i == 0 ? 1 : -1);
+            }
+        }
+    }
+
+    if (query->types & (1u << ORBIT_EVENT_DECLINATION_CROSSING))
+        count = orbitEventDeclinationRoots(orbit, query->declination, roots, count);
+
+    qsort(roots, (size_t) count, sizeof(struct OrbitEventRoot), orbitEventCompareRoots);
+    return count;
+}
+
+// First orbit number whose event at mean anomaly M is at or after time
+static double orbitEventFirstOrbit(const struct OrbitHandle *orbit, double M, double time)
+{
+    return ceil(time / orbit->periodSeconds - M / (2 * PI));
+}
+
+// Number of events in [from, to)
+size_t orbitEventCount(const struct OrbitHandle *orbit, const struct OrbitEventRoot *roots, int count, double from, double to)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        double first = orbitEventFirstOrbit(orbit, roots[i].meanAnomaly, from);
+        double end = orbitEventFirstOrbit(orbit, roots[i].meanAnomaly, to);
+        if (end > first)
+            total += (size_t) (end - first);
+    }
+    return total;
+}
+
+// Writes the first capacity events in [from, to) in time order, the same events orbitEventCount counts
+size_t orbitEventFill(const struct OrbitHandle *orbit, const struct OrbitEventRoot *roots, int count, double from, double to,
+                      struct OrbitEvent *events, size_t capacity)
+{
+    double first[ORBIT_EVENT_MAX_ROOTS], end[ORBIT_EVENT_MAX_ROOTS];
+    double k = INFINITY, last = -INFINITY;
+    for (int i = 0; i < count; i++)
+    {
+        first[i] = orbitEventFirstOrbit(orbit, roots[i].meanAnomaly, from);
+        end[i] = orbitEventFirstOrbit(orbit, roots[i].meanAnomaly, to);
+        if (end[i] > first[i])
+        {
+            k = first[i] < k ? first[i] : k;
+            last = end[i] > last ? end[i] : last;
+        }
+    }
+
+    // Orbit by orbit, the roots are in mean anomaly order
+    size_t written = 0;
+    for (; k < last && written < capacity; k++)
+    {
+        for (int i = 0; i < count && written < capacity; i++)
+        {
+            if (k < first[i] || k >= end[i])
+                continue;
+            events[written].unixTime = (k + roots[i].meanAnomaly / (2 * PI)) * orbit->periodSeconds;
+            events[written].type = roots[i].type;
+            events[written].direction = roots[i].direction;
+            written++;
+        }
+    }
+    return written;
+}
+
+// Events of many planets over the query's span, computed on the shared task pool
+struct OrbitEventJob {
+    const struct OrbitEventQuery *query;
+    const struct OrbitHandle *orbits;
+    size_t planets;
+    size_t chunks;                      // The span is split into this many equal chunks of time
+
+    // Filled by orbitEventJobRun
+    struct OrbitEventRoot *roots;       // ORBIT_EVENT_MAX_ROOTS per planet
+    int *rootCounts;                    // Per planet, -1 for an orbit that does not repeat
+    size_t *offsets;                    // Planet i's events of chunk j start at offsets[i * chunks + j]
+    struct OrbitEvent *events;
+    size_t total;                       // Events kept, at most the budget
+    int truncated;                      // More events than the budget
+};
+
+struct OrbitEventTask {
+    struct OrbitEventJob *job;
+    size_t planetBegin;
+    size_t planetEnd;
+    size_t chunk;
+    int fill;                           // 0 finds roots and counts, 1 writes the events
+};
+
+static double orbitEventChunkStart(const struct OrbitEventJob *job, size_t chunk)
+{
+    if (chunk == job->chunks)
+        return nextafter(job->query->stop, INFINITY);
+    return job->query->start + (job->query->stop - job->query->start) * ((double) chunk / job->chunks);
+}
+
+static void orbitEventRunTask(void *arg)
+{
+    struct OrbitEventTask *task = arg;
+    struct OrbitEventJob *job = task->job;
+
+    for (size_t i = task->planetBegin; i < task->planetEnd; i++)
+    {
+        struct OrbitEventRoot *roots = &job->roots[i * ORBIT_EVENT_MAX_ROOTS];
+
+        if (!task->fill)
+        {
+            // Counts go into the offsets, which orbitEventJobRun turns into positions
+            job->rootCounts[i] = orbitEventRoots(&job->orbits[i], job->query, roots);
+            for (size_t j = 0; j < job->chunks; j++)
+            {
+                job->offsets[i * job->chunks + j] = job->rootCounts[i] < 0 ? 0 :
+                    orbitEventCount(&job->orbits[i], roots, job->rootCounts[i], orbitEventChunkStart(job, j), orbitEventChunkStart(job, j + 1));
+            }
+            continue;
+        }
+
+        size_t slot = i * job->chunks + task->chunk;
+        size_t capacity = job->offsets[slot + 1] - job->offsets[slot];
+        if (capacity > 0)
+            orbitEventFill(&job->orbits[i], roots, job->rootCounts[i], orbitEventChunkStart(job, task->chunk),
+                           orbitEventChunkStart(job, task->chunk + 1), job->events + job->offsets[slot], capacity);
+    }
+}
+
+// Finds the events of every planet of the job, keeping the first budget of them in planet order.
+// The span is split into chunks of time so that a few planets with many orbits still spread over
+// worker_task_pool. Returns -1 if memory could not be allocated.
+int orbitEventJobRun(struct OrbitEventJob *job, size_t budget)
+{
+    size_t planets = job->planets;
+    int workers = workerPoolParallelism(&worker_task_pool);
+    size_t groups = (planets + ORBIT_EVENT_TASK_PLANETS - 1) / ORBIT_EVENT_TASK_PLANETS;
+
+    job->chunks = groups >= (size_t) workers * 2 ? 1 : ((size_t) workers * 2 + groups - 1) / (groups ? groups : 1);
+    if (job->chunks > ORBIT_EVENT_MAX_CHUNKS)
+        job->chunks = ORBIT_EVENT_MAX_CHUNKS;
+    job->total = 0;
+    job->truncated = 0;
+    job->events = NULL;
+
+    size_t task_capacity = groups * job->chunks;
+    job->roots = malloc(sizeof(struct OrbitEventRoot) * ORBIT_EVENT_MAX_ROOTS * (planets ? planets : 1));
+    job->rootCounts = malloc(sizeof(int) * (planets ? planets : 1));
+    job->offsets = malloc(sizeof(size_t) * (planets * job->chunks + 1));
+    struct OrbitEventTask *tasks = malloc(sizeof(struct OrbitEventTask) * (task_capacity ? task_capacity : 1));
+    if (!job->roots || !job->rootCounts || !job->offsets || !tasks)
+    {
+        free(tasks);
+        return -1;
+    }
+
+    // Find every planet's events within an orbit and count them per chunk
+    for (size_t g = 0; g < groups; g++)
+    {
+        tasks[g].job = job;
+        tasks[g].planetBegin = g * ORBIT_EVENT_TASK_PLANETS;
+        tasks[g].planetEnd = tasks[g].planetBegin + ORBIT_EVENT_TASK_PLANETS < planets ? tasks[g].planetBegin + ORBIT_EVENT_TASK_PLANETS : planets;
+        tasks[g].chunk = 0;
+        tasks[g].fill = 0;
+    }
+    workerPoolRunTasks(&worker_task_pool, orbitEventRunTask, tasks, sizeof(tasks[0]), groups);
+
+    // Counts become positions, whatever lies past the budget is dropped
+    size_t position = 0;
+    for (size_t slot = 0; slot < planets * job->chunks; slot++)
+    {
+        size_t count = job->offsets[slot];
+        if (count > budget - position)
+        {
+            count = budget - position;
+            job->truncated = 1;
+        }
+        job->offsets[slot] = position;
+        position += count;
+    }
+    job->offsets[planets * job->chunks] = position;
+    job->total = position;
+
+    job->events = malloc(sizeof(struct OrbitEvent) * (position ? position : 1));
+    if (!job->events)
+    {
+        free(tasks);
+        return -1;
+    }
+
+    // Fill every chunk of every planet group
+    size_t count = 0;
+    for (size_t g = 0; g < groups; g++)
+    {
+        for (size_t j = 0; j < job->chunks; j++)
+        {
+            tasks[count].job = job;
+            tasks[count].planetBegin = g * ORBIT_EVENT_TASK_PLANETS;
+            tasks[count].planetEnd = tasks[count].planetBegin + ORBIT_EVENT_TASK_PLANETS < planets ? tasks[count].planetBegin + ORBIT_EVENT_TASK_PLANETS : planets;
+            tasks[count].chunk = j;
+            tasks[count].fill = 1;
+            count++;
+        }
+    }
+    workerPoolRunTasks(&worker_task_pool, orbitEventRunTask, tasks, sizeof(tasks[0]), count);
+
+    free(tasks);
+    return 0;
+}
+
+// The events of planet i, in time order
+const struct OrbitEvent *orbitEventJobEvents(const struct OrbitEventJob *job, size_t i, size_t *count)
+{
+    *count = job->offsets[(i + 1) * job->chunks] - job->offsets[i * job->chunks];
+    return job->events + job->offsets[i * job->chunks];
+}
+
+void orbitEventJobFree(struct OrbitEventJob *job)
+{
+    free(job->roots);
+    free(job->rootCounts);
+    free(job->offsets);
+    free(job->events);
+    job->roots = NULL;
+    job->rootCounts = NULL;
+    job->offsets = NULL;
+    job->events = NULL;
+}
+
+#endif
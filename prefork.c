@@ -0,0 +1,234 @@
+/*
+ * Prefork mode: a supervisor process forks worker processes that each accept SSH connections on a
+ * listener of their own. The listeners share the port through SO_REUSEPORT, so the kernel spreads
+ * new connections, and with them the key exchanges, across the workers. Whatever the supervisor
+ * loaded before forking (the host key, the catalog and ephemeris tables, the sky search planes)
+ * is shared copy-on-write. Workers that exit while the supervisor is running are restarted. On
+ * SIGTERM or SIGINT the supervisor passes SIGTERM on to every worker, which stops accepting and
+ * finishes its sessions, and kills the workers still busy once the drain timeout has passed.
+ *
+ * The includer has to define _GNU_SOURCE for sched_setaffinity.
+ */
+
+#ifndef PREFORK_C
+#define PREFORK_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// A worker is restarted no sooner than this after its last start, so one that fails right away
+// does not make the supervisor fork in a loop
+#define PREFORK_RESTART_SECONDS 1.0
+
+// How often the supervisor checks on its workers, nanoseconds
+#define PREFORK_POLL_NS 100000000L
+
+struct Prefork {
+    int count;
+    pid_t *pids;                    // 0 while a worker waits to be restarted
+    double *started;                // Monotonic seconds of each worker's last start
+    unsigned long long restarts;
+};
+
+static double preforkNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Listens on a TCP port shared with the other workers through SO_REUSEPORT, returns the socket or -1
+int preforkListen(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error creating listener: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)
+    {
+        fprintf(stderr, "Error sharing port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short) port);
+
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Error listening on port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Pins the calling process, and the threads it starts afterwards, to one core chosen by worker
+// number. Returns -1 if the affinity could not be set.
+int preforkPinToCore(int worker)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores <= 0)
+        return -1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET((int) (worker % cores), &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+// Forks worker number worker. Returns 1 in the worker process, 0 in the supervisor (also when the
+// fork failed, the worker is then retried like a crashed one).
+static int preforkStart(struct Prefork *prefork, int worker)
+{
+    pid_t supervisor = getpid();
+
+    // Buffered output would be written once by each process
+    fflush(stdout);
+    fflush(stderr);
+
+    prefork->started[worker] = preforkNow();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "Error starting worker %d: %s\n", worker, strerror(errno));
+        prefork->pids[worker] = 0;
+        return 0;
+    }
+    if (pid > 0)
+    {
+        prefork->pids[worker] = pid;
+        return 0;
+    }
+
+    // A worker does not outlive its supervisor
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != supervisor)
+        _exit(0);
+    return 1;
+}
+
+// Reaps the workers that have exited, returns how many are still running
+static int preforkReap(struct Prefork *prefork, int report)
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for (int i = 0; i < prefork->count; i++)
+        {
+            if (prefork->pids[i] != pid)
+                continue;
+            prefork->pids[i] = 0;
+            if (!report)
+                break;
+            if (WIFSIGNALED(status))
+                fprintf(stderr, "Worker %d (pid %d) killed by signal %d, restarting\n", i, (int) pid, WTERMSIG(status));
+            else
+                fprintf(stderr, "Worker %d (pid %d) exited with status %d, restarting\n", i, (int) pid, WEXITSTATUS(status));
+            break;
+        }
+    }
+
+    int live = 0;
+    for (int i = 0; i < prefork->count; i++)
+        live += prefork->pids[i] != 0;
+    return live;
+}
+
+// Starts count workers and supervises them until *running is cleared, then drains them. Returns
+// the worker's number (from 0) in a worker process, which should go on to serve, and -1 in the
+// supervisor once every worker is gone (or could not be set up).
+int preforkRun(struct Prefork *prefork, int count, double drain_seconds, volatile sig_atomic_t *running)
+{
+    memset(prefork, 0, sizeof(*prefork));
+    prefork->pids = calloc((size_t) count, sizeof(pid_t));
+    prefork->started = calloc((size_t) count, sizeof(double));
+    if (!prefork->pids || !prefork->started)
+    {
+        free(prefork->pids);
+        free(prefork->started);
+        return -1;
+    }
+    prefork->count = count;
+
+    for (int i = 0; i < count && *running; i++)
+    {
+        if (preforkStart(prefork, i))
+            return i;
+    }
+
+    // Restart workers that exit while running, a signal cuts the sleep short
+    struct timespec poll = { 0, PREFORK_POLL_NS };
+    while (*running)
+    {
+        preforkReap(prefork, 1);
+        for (int i = 0; i < count && *running; i++)
+        {
+            if (prefork->pids[i] != 0 || preforkNow() - prefork->started[i] < PREFORK_RESTART_SECONDS)
+                continue;
+            prefork->restarts++;
+            if (preforkStart(prefork, i))
+                return i;
+        }
+        nanosleep(&poll, NULL);
+    }
+
+    // Drain: every worker stops accepting and finishes its sessions, those still busy at the
+    // deadline are killed
+    printf("Draining %d workers...\n", preforkReap(prefork, 0));
+    for (int i = 0; i < count; i++)
+    {
+        if (prefork->pids[i] != 0)
+            kill(prefork->pids[i], SIGTERM);
+    }
+
+    double deadline = preforkNow() + drain_seconds;
+    int killed = 0;
+    while (preforkReap(prefork, 0) > 0)
+    {
+        if (!killed && preforkNow() >= deadline)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                if (prefork->pids[i] != 0)
+                {
+                    fprintf(stderr, "Worker %d (pid %d) still busy after %.0f seconds, killing it\n", i, (int) prefork->pids[i], drain_seconds);
+                    kill(prefork->pids[i], SIGKILL);
+                }
+            }
+            killed = 1;
+        }
+        nanosleep(&poll, NULL);
+    }
+
+    free(prefork->pids);
+    free(prefork->started);
+    prefork->pids = NULL;
+    prefork->started = NULL;
+    return -1;
+}
+
+#endif
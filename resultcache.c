@@ -0,0 +1,228 @@
+/*
+ * Process-wide cache of computed positions keyed by the orbital element tuple and the epoch.
+ * With a time quantum every epoch is rounded down to a multiple of it before the position is
+ * computed, so requests for the same planet within one quantum share a single result.
+ */
+
+#ifndef RESULTCACHE_C
+#define RESULTCACHE_C
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "orbitcache.c"
+
+// Shards are locked independently so concurrent sessions rarely contend
+#define RESULT_CACHE_SHARDS 64
+
+// Slots probed from the home slot before evicting the least recently used one
+#define RESULT_CACHE_PROBE 4
+
+struct ResultCacheEntry {
+    uint64_t hash;                  // 0 marks an empty slot
+    uint64_t lastUsed;              // Shard clock value of the last hit
+    double elements[6];
+    double epoch;                   // Unix time the position was computed for, already quantized
+
+    // Results
+    double distance;
+    double ra;
+    double declination;
+    double galacticLongitude;
+    double galacticLatitude;
+};
+
+struct ResultCacheShard {
+    pthread_mutex_t lock;
+    uint64_t clock;
+    struct ResultCacheEntry *entries;
+};
+
+struct ResultCacheStats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long entries;
+    unsigned long long capacity;
+    double quantum;
+};
+
+static struct ResultCacheShard *result_cache = NULL;
+static size_t result_cache_slots;           // Slots per shard, a power of two
+static double result_cache_quantum;         // Seconds, 0 to key on the exact epoch
+static struct ResultCacheStats result_cache_stats;
+
+// Allocates room for about capacity results, rounded up to a power of two per shard.
+// A capacity of 0 leaves the cache disabled. Returns 0 on success.
+int resultCacheInit(size_t capacity, double quantum)
+{
+    result_cache_quantum = quantum > 0 ? quantum : 0;
+    if (capacity == 0)
+        return 0;
+
+    size_t slots = 1;
+    while (slots * RESULT_CACHE_SHARDS < capacity)
+        slots *= 2;
+
+    struct ResultCacheShard *shards = calloc(RESULT_CACHE_SHARDS, sizeof(struct ResultCacheShard));
+    if (!shards)
+        return -1;
+
+    for (int i = 0; i < RESULT_CACHE_SHARDS; i++)
+    {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].entries = calloc(slots, sizeof(struct ResultCacheEntry));
+        if (!shards[i].entries)
+        {
+            for (int j = 0; j < i; j++)
+                free(shards[j].entries);
+            free(shards);
+            return -1;
+        }
+    }
+
+    result_cache_slots = slots;
+    result_cache = shards;
+    return 0;
+}
+
+// The epoch a position at current_time is computed for: current_time rounded down to the quantum
+double resultCacheEpoch(double current_time)
+{
+    if (result_cache == NULL || result_cache_quantum == 0)
+        return current_time;
+    return floor(current_time / result_cache_quantum) * result_cache_quantum;
+}
+
+static void resultCacheKey(const struct Exoplanet *planet, double elements[6])
+{
+    elements[0] = planet->orbitalRadius;
+    elements[1] = planet->orbitalPeriod;
+    elements[2] = planet->eccentricity;
+    elements[3] = planet->inclination;
+    elements[4] = planet->longitudeOfNode;
+    elements[5] = planet->argumentOfPeriapsis;
+}
+
+// Element hash continued over the epoch, negative zero folded into zero like the elements
+static uint64_t resultCacheHash(const double elements[6], double epoch)
+{
+    uint64_t hash = orbitElementsHash(elements);
+
+    double value = epoch == 0 ? 0.0 : epoch;
+    unsigned char bytes[sizeof(double)];
+    memcpy(bytes, &value, sizeof(double));
+
+    for (size_t j = 0; j < sizeof(double); j++)
+    {
+        hash ^= bytes[j];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash ? hash : 1;
+}
+
+static int resultCacheMatches(const struct ResultCacheEntry *entry, uint64_t hash, const double elements[6], double epoch)
+{
+    return entry->hash == hash && entry->epoch == epoch && memcmp(entry->elements, elements, sizeof(entry->elements)) == 0;
+}
+
+static struct ResultCacheEntry *resultCacheSlot(struct ResultCacheShard *shard, uint64_t hash, size_t probe)
+{
+    size_t home = (size_t) (hash / RESULT_CACHE_SHARDS);
+    return &shard->entries[(home + probe) & (result_cache_slots - 1)];
+}
+
+// Copies the cached position of the planet at epoch (see resultCacheEpoch) into planet's distance,
+// ra, declination and galactic coordinates. Returns 1 on a hit, 0 on a miss or without a cache.
+int resultCacheGet(struct Exoplanet *planet, double epoch)
+{
+    if (result_cache == NULL)
+        return 0;
+
+    double elements[6];
+    resultCacheKey(planet, elements);
+    uint64_t hash = resultCacheHash(elements, epoch);
+    struct ResultCacheShard *shard = &result_cache[hash % RESULT_CACHE_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+    shard->clock++;
+
+    for (size_t probe = 0; probe < RESULT_CACHE_PROBE; probe++)
+    {
+        struct ResultCacheEntry *entry = resultCacheSlot(shard, hash, probe);
+
+        if (resultCacheMatches(entry, hash, elements, epoch))
+        {
+            entry->lastUsed = shard->clock;
+            planet->distance = entry->distance;
+            planet->ra = entry->ra;
+            planet->declination = entry->declination;
+            planet->galacticLongitude = entry->galacticLongitude;
+            planet->galacticLatitude = entry->galacticLatitude;
+            pthread_mutex_unlock(&shard->lock);
+            __atomic_fetch_add(&result_cache_stats.hits, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    __atomic_fetch_add(&result_cache_stats.misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Stores the position computed for the planet at epoch, evicting the least recently used of the
+// probed slots. A concurrent miss on the same key just stores an identical result.
+void resultCachePut(const struct Exoplanet *planet, double epoch)
+{
+    if (result_cache == NULL)
+        return;
+
+    double elements[6];
+    resultCacheKey(planet, elements);
+    uint64_t hash = resultCacheHash(elements, epoch);
+    struct ResultCacheShard *shard = &result_cache[hash % RESULT_CACHE_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+
+    struct ResultCacheEntry *victim = NULL;
+    for (size_t probe = 0; probe < RESULT_CACHE_PROBE; probe++)
+    {
+        struct ResultCacheEntry *entry = resultCacheSlot(shard, hash, probe);
+
+        if (resultCacheMatches(entry, hash, elements, epoch))
+        {
+            victim = entry;
+            break;
+        }
+
+        if (victim == NULL || entry->hash == 0 || (victim->hash != 0 && entry->lastUsed < victim->lastUsed))
+            victim = entry;
+    }
+
+    if (victim->hash == 0)
+        __atomic_fetch_add(&result_cache_stats.entries, 1, __ATOMIC_RELAXED);
+    victim->hash = hash;
+    victim->lastUsed = shard->clock;
+    memcpy(victim->elements, elements, sizeof(victim->elements));
+    victim->epoch = epoch;
+    victim->distance = planet->distance;
+    victim->ra = planet->ra;
+    victim->declination = planet->declination;
+    victim->galacticLongitude = planet->galacticLongitude;
+    victim->galacticLatitude = planet->galacticLatitude;
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void resultCacheStatsSnapshot(struct ResultCacheStats *stats)
+{
+    stats->hits = __atomic_load_n(&result_cache_stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&result_cache_stats.misses, __ATOMIC_RELAXED);
+    stats->entries = __atomic_load_n(&result_cache_stats.entries, __ATOMIC_RELAXED);
+    stats->capacity = result_cache ? (unsigned long long) result_cache_slots * RESULT_CACHE_SHARDS : 0;
+    stats->quantum = result_cache_quantum;
+}
+
+#endif
@@ -0,0 +1,904 @@
+/*
+ * Scenes: the cataloged planets at an epoch as points in galactic Cartesian coordinates (light
+ * years, see convertToCartesian), indexed by an octree so a viewer can be sent just what it sees.
+ *
+ * Each node keeps the bounding box of its points and their centroid, which stands in for all of
+ * them at a coarse level of detail. A selection culls nodes against the camera's frustum and then
+ * refines the nodes that look largest from the camera first, until refining any further would pass
+ * the point budget. What is left unrefined is sent as its centroid with the number of planets it
+ * represents.
+ *
+ * Epochs are quantized and the last few scenes are cached. A scene for a new epoch starts from the
+ * cached scene nearest in time: the positions are recomputed in the same tree order and the boxes
+ * refitted bottom-up, which skips the partitioning. Planets drift out of the cells they were sorted
+ * into, so once a node's box has grown past SCENE_LOOSENESS times its cell the tree is rebuilt.
+ */
+
+#ifndef SCENE_C
+#define SCENE_C
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+#include "astromath.c"
+#include "astromath_simd.c"
+#include "orbit.c"
+#include "catalog.c"
+#include "batch.c"
+#include "visualization.c"
+#include "workerpool.c"
+
+// Scenes kept for the most recently requested epochs
+#define SCENE_CACHE 4
+
+// Nodes with at most this many points are not split
+#define SCENE_LEAF_SIZE 32
+#define SCENE_MAX_DEPTH 20
+
+// A refitted tree is rebuilt when a node's box has grown past this many times the edge of its cell
+#define SCENE_LOOSENESS 2.0
+
+// Evaluation tasks are only split off for this many planets each, up to the parallelism of worker_task_pool
+#define SCENE_PLANETS_PER_TASK 4096
+#define SCENE_MAX_TASKS 64
+
+struct SceneNode {
+    float lo[3];                    // Bounding box of the node's points
+    float hi[3];
+    float centroid[3];              // Mean of the node's points
+    float cell;                     // Edge of the octree cell the node was built for
+    uint32_t begin;                 // Points [begin, end) in tree order
+    uint32_t end;
+    uint32_t count;                 // Points with a position, a failed solve has none
+    uint32_t firstChild;            // Children are consecutive nodes
+    uint32_t childCount;            // 0 for a leaf
+};
+
+// The octree of one epoch
+struct Scene {
+    long long slot;                 // Epoch divided by the cache's epoch seconds
+    double epoch;
+    float (*points)[3];             // Light years, in tree order, NaN without a solution
+    uint32_t *records;              // Catalog record of each point
+    struct SceneNode *nodes;
+    size_t count;
+    size_t nodeCount;
+    uint32_t *unplaced;             // Records without a position when the tree was built
+    size_t unplacedCount;
+    int references;
+    int state;                      // 0 while building, 1 when ready, -1 if the build failed
+    int cached;                     // Still held by the cache
+    unsigned long long lastUse;
+};
+
+struct SceneCache {
+    const struct Catalog *catalog;
+    double epochSeconds;
+
+    pthread_mutex_t lock;
+    pthread_cond_t built;
+    struct Scene *scenes[SCENE_CACHE];
+    unsigned long long clock;
+};
+
+// A perspective camera in the scene's coordinates
+struct SceneCamera {
+    double position[3];
+    double direction[3];
+    double up[3];
+    double fov;                     // Vertical field of view, radians
+    double aspect;                  // Width over height
+    double near;
+    double far;                     // Infinite for no far plane
+};
+
+// One point of a selection: a planet, or the centroid of count planets
+struct ScenePoint {
+    float position[3];
+    uint32_t count;
+};
+
+struct SceneStats {
+    unsigned long long selections;
+    unsigned long long hits;                // Selections that found their epoch's scene built
+    unsigned long long refits;              // Scenes derived from a cached one
+    unsigned long long builds;              // Scenes built from scratch
+    size_t scenes;                          // Scenes held
+};
+
+static struct SceneStats scene_cache_stats;
+
+// Quantizes epochs to epoch_seconds for the scenes of catalog
+void sceneCacheInit(struct SceneCache *cache, const struct Catalog *catalog, double epoch_seconds)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->catalog = catalog;
+    cache->epochSeconds = epoch_seconds;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->built, NULL);
+}
+
+static void sceneFree(struct Scene *scene)
+{
+    free(scene->points);
+    free(scene->records);
+    free(scene->nodes);
+    free(scene->unplaced);
+    free(scene);
+}
+
+// Positions of records [begin, end) at an epoch, of the catalog's records in order when records is NULL
+struct SceneTask {
+    const struct Catalog *catalog;
+    double epoch;
+    const uint32_t *records;
+    size_t begin;
+    size_t end;
+    float (*points)[3];
+    int failed;
+};
+
+static void sceneEvaluateTask(void *arg)
+{
+    struct SceneTask *task = arg;
+    const struct OrbitHandle *orbits = task->catalog->orbits;
+
+    struct OrbitBlock *block = malloc(sizeof(struct OrbitBlock));
+    if (!block)
+    {
+        task->failed = 1;
+        return;
+    }
+
+    // Kepler's equation is solved a block of lanes at a time with the vectorized kernel
+    for (size_t first = task->begin; first < task->end; first += ORBIT_BLOCK_SIZE)
+    {
+        size_t lanes = task->end - first < ORBIT_BLOCK_SIZE ? task->end - first : ORBIT_BLOCK_SIZE;
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            const struct OrbitHandle *orbit = &orbits[task->records ? task->records[first + lane] : first + lane];
+            orbitBlockSetLane(block, lane, orbitHandleMeanAnomaly(orbit, task->epoch), orbit->eccentricity, orbit->orbitalRadius, orbit->rotation);
+        }
+        computeOrbitBlock(block, lanes);
+
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            struct Exoplanet planet = get_default_exoplanet();
+            orbitBlockLanePosition(block, lane, &planet);
+            setGalacticCoordinates(&planet);
+
+            struct CartesianCoordinates position = convertToCartesian(planet);
+            int placed = fabs(position.x) <= FLT_MAX && fabs(position.y) <= FLT_MAX && fabs(position.z) <= FLT_MAX;
+            float *point = task->points[first + lane];
+            point[0] = placed ? (float) position.x : NAN;
+            point[1] = placed ? (float) position.y : NAN;
+            point[2] = placed ? (float) position.z : NAN;
+        }
+    }
+
+    free(block);
+}
+
+// Evaluates count positions split over the shared task pool, like the sky search index builds.
+// Returns -1 if memory ran out.
+static int sceneEvaluate(const struct SceneCache *cache, double epoch, const uint32_t *records, size_t count, float (*points)[3])
+{
+    struct SceneTask tasks[SCENE_MAX_TASKS];
+
+    size_t tasks_wanted = (count + SCENE_PLANETS_PER_TASK - 1) / SCENE_PLANETS_PER_TASK;
+    size_t limit = (size_t) workerPoolParallelism(&worker_task_pool);
+    if (limit > SCENE_MAX_TASKS)
+        limit = SCENE_MAX_TASKS;
+    size_t task_count = tasks_wanted < 1 ? 1 : tasks_wanted < limit ? tasks_wanted : limit;
+
+    size_t per_task = (count + task_count - 1) / task_count;
+    for (size_t t = 0; t < task_count; t++)
+    {
+        tasks[t].catalog = cache->catalog;
+        tasks[t].epoch = epoch;
+        tasks[t].records = records;
+        tasks[t].points = points;
+        tasks[t].failed = 0;
+        tasks[t].begin = per_task * t < count ? per_task * t : count;
+        tasks[t].end = tasks[t].begin + per_task < count ? tasks[t].begin + per_task : count;
+    }
+
+    workerPoolRunTasks(&worker_task_pool, sceneEvaluateTask, tasks, sizeof(tasks[0]), task_count);
+
+    int failed = 0;
+    for (size_t t = 0; t < task_count; t++)
+        failed |= tasks[t].failed;
+    return failed ? -1 : 0;
+}
+
+// Recomputes the boxes, centroids and counts of every node from its points, children before their
+// parents. Returns the largest ratio of a box's extent to its cell's edge.
+static double sceneRefitNodes(struct Scene *scene)
+{
+    double looseness = 0;
+
+    // Children are always allocated after their parent
+    for (size_t n = scene->nodeCount; n-- > 0;)
+    {
+        struct SceneNode *node = &scene->nodes[n];
+        double sum[3] = { 0, 0, 0 };
+        for (int k = 0; k < 3; k++)
+        {
+            node->lo[k] = FLT_MAX;
+            node->hi[k] = -FLT_MAX;
+        }
+        node->count = 0;
+
+        if (node->childCount == 0)
+        {
+            for (uint32_t i = node->begin; i < node->end; i++)
+            {
+                const float *p = scene->points[i];
+                if (isnan(p[0]))
+                    continue;
+                node->count++;
+                for (int k = 0; k < 3; k++)
+                {
+                    node->lo[k] = fminf(node->lo[k], p[k]);
+                    node->hi[k] = fmaxf(node->hi[k], p[k]);
+                    sum[k] += p[k];
+                }
+            }
+        }
+        else
+        {
+            for (uint32_t c = node->firstChild; c < node->firstChild + node->childCount; c++)
+            {
+                const struct SceneNode *child = &scene->nodes[c];
+                if (child->count == 0)
+                    continue;
+                node->count += child->count;
+                for (int k = 0; k < 3; k++)
+                {
+                    node->lo[k] = fminf(node->lo[k], child->lo[k]);
+                    node->hi[k] = fmaxf(node->hi[k], child->hi[k]);
+                    sum[k] += (double) child->centroid[k] * child->count;
+                }
+            }
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+            node->centroid[k] = node->count ? (float) (sum[k] / node->count) : 0;
+            if (node->count && node->cell > 0)
+                looseness = fmax(looseness, (node->hi[k] - node->lo[k]) / node->cell);
+        }
+    }
+    return looseness;
+}
+
+// Node array growing while a tree is built
+struct SceneBuild {
+    struct Scene *scene;
+    size_t capacity;
+    float (*scratchPoints)[3];
+    uint32_t *scratchRecords;
+};
+
+// Appends count nodes, returns the first or -1 if memory ran out
+static long sceneAddNodes(struct SceneBuild *build, size_t count)
+{
+    struct Scene *scene = build->scene;
+    if (scene->nodeCount + count > build->capacity)
+    {
+        size_t capacity = build->capacity ? build->capacity * 2 : 64;
+        while (capacity < scene->nodeCount + count)
+            capacity *= 2;
+        struct SceneNode *grown = realloc(scene->nodes, sizeof(struct SceneNode) * capacity);
+        if (!grown)
+            return -1;
+        scene->nodes = grown;
+        build->capacity = capacity;
+    }
+
+    long first = (long) scene->nodeCount;
+    memset(&scene->nodes[first], 0, sizeof(struct SceneNode) * count);
+    scene->nodeCount += count;
+    return first;
+}
+
+// Splits points [begin, end), which lie in the cube at origin with the given edge, into octants.
+// Returns -1 if memory ran out.
+static int sceneBuildNode(struct SceneBuild *build, size_t n, uint32_t begin, uint32_t end, const float origin[3], float edge, int depth)
+{
+    struct Scene *scene = build->scene;
+    scene->nodes[n].begin = begin;
+    scene->nodes[n].end = end;
+    scene->nodes[n].cell = edge;
+    if (end - begin <= SCENE_LEAF_SIZE || depth >= SCENE_MAX_DEPTH)
+        return 0;
+
+    float half = edge / 2;
+    uint32_t counts[8] = {0};
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const float *p = scene->points[i];
+        counts[(p[0] >= origin[0] + half) | (p[1] >= origin[1] + half) << 1 | (p[2] >= origin[2] + half) << 2]++;
+    }
+
+    // Counting sort into the scratch arrays and back
+    uint32_t starts[8];
+    uint32_t next = begin;
+    uint32_t children = 0;
+    for (int o = 0; o < 8; o++)
+    {
+        starts[o] = next;
+        next += counts[o];
+        children += counts[o] > 0;
+    }
+    uint32_t fill[8];
+    memcpy(fill, starts, sizeof(fill));
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const float *p = scene->points[i];
+        int o = (p[0] >= origin[0] + half) | (p[1] >= origin[1] + half) << 1 | (p[2] >= origin[2] + half) << 2;
+        memcpy(build->scratchPoints[fill[o]], p, sizeof(float) * 3);
+        build->scratchRecords[fill[o]++] = scene->records[i];
+    }
+    memcpy(&scene->points[begin], &build->scratchPoints[begin], sizeof(float) * 3 * (end - begin));
+    memcpy(&scene->records[begin], &build->scratchRecords[begin], sizeof(uint32_t) * (end - begin));
+
+    long first = sceneAddNodes(build, children);
+    if (first < 0)
+        return -1;
+    scene->nodes[n].firstChild = (uint32_t) first;
+    scene->nodes[n].childCount = children;
+
+    long child = first;
+    for (int o = 0; o < 8; o++)
+    {
+        if (counts[o] == 0)
+            continue;
+        float child_origin[3] = { origin[0] + (o & 1 ? half : 0), origin[1] + (o & 2 ? half : 0), origin[2] + (o & 4 ? half : 0) };
+        if (sceneBuildNode(build, (size_t) child++, starts[o], starts[o] + counts[o], child_origin, half, depth + 1) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Builds the tree of scene at its epoch from scratch, from the positions of all records in catalog
+// order when already known, which the build then frees. Returns -1 if memory ran out.
+static int sceneBuild(const struct SceneCache *cache, struct Scene *scene, float (*all)[3])
+{
+    size_t count = cache->catalog->count;
+    int ret_val = -1;
+
+    struct SceneBuild build;
+    memset(&build, 0, sizeof(build));
+    build.scene = scene;
+    int evaluate = all == NULL;
+    if (evaluate)
+        all = malloc(sizeof(float) * 3 * (count ? count : 1));
+    scene->points = malloc(sizeof(float) * 3 * (count ? count : 1));
+    scene->records = malloc(sizeof(uint32_t) * (count ? count : 1));
+    scene->unplaced = malloc(sizeof(uint32_t) * (count ? count : 1));
+    build.scratchPoints = malloc(sizeof(float) * 3 * (count ? count : 1));
+    build.scratchRecords = malloc(sizeof(uint32_t) * (count ? count : 1));
+    if (!all || !scene->points || !scene->records || !scene->unplaced || !build.scratchPoints || !build.scratchRecords)
+        goto cleanup;
+
+    if (evaluate && sceneEvaluate(cache, scene->epoch, NULL, count, all) != 0)
+        goto cleanup;
+
+    // Planets without a position stay out of the tree
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < count; i++)
+    {
+        if (isnan(all[i][0]))
+        {
+            scene->unplaced[scene->unplacedCount++] = (uint32_t) i;
+            continue;
+        }
+        memcpy(scene->points[scene->count], all[i], sizeof(float) * 3);
+        scene->records[scene->count++] = (uint32_t) i;
+        for (int k = 0; k < 3; k++)
+        {
+            lo[k] = fminf(lo[k], all[i][k]);
+            hi[k] = fmaxf(hi[k], all[i][k]);
+        }
+    }
+
+    // The root cell is the cube around every point, slightly enlarged so the largest coordinates
+    // fall inside it
+    float edge = 0;
+    for (int k = 0; k < 3; k++)
+        edge = fmaxf(edge, hi[k] - lo[k]);
+    edge = edge > 0 ? edge * (1 + 1e-6f) : 1;
+    if (scene->count == 0)
+        lo[0] = lo[1] = lo[2] = 0;
+
+    if (sceneAddNodes(&build, 1) < 0 || sceneBuildNode(&build, 0, 0, (uint32_t) scene->count, lo, edge, 0) != 0)
+        goto cleanup;
+    sceneRefitNodes(scene);
+    ret_val = 0;
+
+cleanup:
+    free(all);
+    free(build.scratchPoints);
+    free(build.scratchRecords);
+    return ret_val;
+}
+
+// Derives scene from base, a scene of another epoch, by moving its points and refitting its boxes.
+// Returns 1 when the tree has to be rebuilt instead, -1 if memory ran out.
+static int sceneRefit(const struct SceneCache *cache, const struct Scene *base, struct Scene *scene)
+{
+    // A planet that now has a position has no place in the tree
+    if (base->unplacedCount > 0)
+    {
+        float (*unplaced)[3] = malloc(sizeof(float) * 3 * base->unplacedCount);
+        if (!unplaced)
+            return -1;
+        if (sceneEvaluate(cache, scene->epoch, base->unplaced, base->unplacedCount, unplaced) != 0)
+        {
+            free(unplaced);
+            return -1;
+        }
+        int placed = 0;
+        for (size_t i = 0; i < base->unplacedCount && !placed; i++)
+            placed = !isnan(unplaced[i][0]);
+        free(unplaced);
+        if (placed)
+            return 1;
+    }
+
+    scene->points = malloc(sizeof(float) * 3 * (base->count ? base->count : 1));
+    scene->records = malloc(sizeof(uint32_t) * (base->count ? base->count : 1));
+    scene->nodes = malloc(sizeof(struct SceneNode) * base->nodeCount);
+    scene->unplaced = malloc(sizeof(uint32_t) * (base->unplacedCount ? base->unplacedCount : 1));
+    if (!scene->points || !scene->records || !scene->nodes || !scene->unplaced)
+        return -1;
+
+    memcpy(scene->records, base->records, sizeof(uint32_t) * base->count);
+    memcpy(scene->nodes, base->nodes, sizeof(struct SceneNode) * base->nodeCount);
+    memcpy(scene->unplaced, base->unplaced, sizeof(uint32_t) * base->unplacedCount);
+    scene->count = base->count;
+    scene->nodeCount = base->nodeCount;
+    scene->unplacedCount = base->unplacedCount;
+
+    if (sceneEvaluate(cache, scene->epoch, scene->records, scene->count, scene->points) != 0)
+        return -1;
+    return sceneRefitNodes(scene) > SCENE_LOOSENESS ? 1 : 0;
+}
+
+// Fills scene, from the cached base when there is one and it is still tight enough
+static int sceneFill(const struct SceneCache *cache, const struct Scene *base, struct Scene *scene)
+{
+    float (*all)[3] = NULL;
+
+    if (base)
+    {
+        int status = sceneRefit(cache, base, scene);
+        if (status == 0)
+        {
+            __atomic_fetch_add(&scene_cache_stats.refits, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        // A tree that got too loose still has every position, the rebuild starts from them
+        size_t count = cache->catalog->count;
+        if (status > 0 && scene->points)
+        {
+            all = malloc(sizeof(float) * 3 * (count ? count : 1));
+            if (all)
+            {
+                for (size_t i = 0; i < scene->count; i++)
+                    memcpy(all[scene->records[i]], scene->points[i], sizeof(float) * 3);
+                for (size_t i = 0; i < scene->unplacedCount; i++)
+                    all[scene->unplaced[i]][0] = all[scene->unplaced[i]][1] = all[scene->unplaced[i]][2] = NAN;
+            }
+        }
+
+        free(scene->points);
+        free(scene->records);
+        free(scene->nodes);
+        free(scene->unplaced);
+        scene->points = NULL;
+        scene->records = NULL;
+        scene->nodes = NULL;
+        scene->unplaced = NULL;
+        scene->count = scene->nodeCount = scene->unplacedCount = 0;
+        if (status < 0)
+            return -1;
+    }
+
+    __atomic_fetch_add(&scene_cache_stats.builds, 1, __ATOMIC_RELAXED);
+    return sceneBuild(cache, scene, all);
+}
+
+// Returns the scene of a slot with a reference held, building it if no selection has yet.
+// Concurrent selections in a slot being built wait for that build. NULL if the build failed.
+static struct Scene *sceneAcquire(struct SceneCache *cache, long long slot)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    for (;;)
+    {
+        struct Scene *found = NULL;
+        for (int i = 0; i < SCENE_CACHE; i++)
+        {
+            if (cache->scenes[i] && cache->scenes[i]->slot == slot)
+                found = cache->scenes[i];
+        }
+        if (!found)
+            break;
+
+        if (found->state == 0)
+        {
+            pthread_cond_wait(&cache->built, &cache->lock);
+            continue;
+        }
+
+        found->references++;
+        found->lastUse = ++cache->clock;
+        pthread_mutex_unlock(&cache->lock);
+        __atomic_fetch_add(&scene_cache_stats.hits, 1, __ATOMIC_RELAXED);
+        return found;
+    }
+
+    struct Scene *scene = calloc(1, sizeof(struct Scene));
+    if (!scene)
+    {
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+    scene->slot = slot;
+    scene->epoch = (double) slot * cache->epochSeconds;
+    scene->references = 1;
+    scene->lastUse = ++cache->clock;
+
+    // The ready scene nearest in time is the base of a refit, held until the refit is done
+    struct Scene *base = NULL;
+    for (int i = 0; i < SCENE_CACHE; i++)
+    {
+        struct Scene *entry = cache->scenes[i];
+        if (entry && entry->state == 1 && (base == NULL || llabs(entry->slot - slot) < llabs(base->slot - slot)))
+            base = entry;
+    }
+    if (base)
+        base->references++;
+
+    // Take a free slot or evict the least recently used scene nobody holds, if every scene is in
+    // use this one is built for this selection alone
+    int entry_slot = -1;
+    for (int i = 0; i < SCENE_CACHE; i++)
+    {
+        struct Scene *entry = cache->scenes[i];
+        if (entry == NULL)
+        {
+            entry_slot = i;
+            break;
+        }
+        if (entry->references == 0 && (entry_slot < 0 || entry->lastUse < cache->scenes[entry_slot]->lastUse))
+            entry_slot = i;
+    }
+    if (entry_slot >= 0)
+    {
+        if (cache->scenes[entry_slot])
+            sceneFree(cache->scenes[entry_slot]);
+        cache->scenes[entry_slot] = scene;
+        scene->cached = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    int status = sceneFill(cache, base, scene);
+
+    pthread_mutex_lock(&cache->lock);
+    scene->state = status == 0 ? 1 : -1;
+    if (status != 0 && scene->cached)
+    {
+        cache->scenes[entry_slot] = NULL;
+        scene->cached = 0;
+    }
+    int base_unused = base && --base->references == 0 && !base->cached;
+    pthread_cond_broadcast(&cache->built);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (base_unused)
+        sceneFree(base);
+    if (status != 0)
+    {
+        sceneFree(scene);
+        return NULL;
+    }
+    return scene;
+}
+
+static void sceneRelease(struct SceneCache *cache, struct Scene *scene)
+{
+    pthread_mutex_lock(&cache->lock);
+    int unused = --scene->references == 0 && !scene->cached;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (unused)
+        sceneFree(scene);
+}
+
+// The frustum as inward planes: a point p is inside when normal . (p - origin) >= offset for all
+struct SceneFrustum {
+    double origin[3];
+    double normals[6][3];
+    double offsets[6];
+    int planes;                     // 0 without a camera, 5 without a far plane
+};
+
+static void sceneNormalize(double v[3])
+{
+    double length = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    for (int k = 0; k < 3; k++)
+        v[k] /= length;
+}
+
+static void sceneCross(const double a[3], const double b[3], double out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Sets up the frustum of camera. Returns -1 when its vectors or angles do not make one.
+static int sceneFrustumInit(struct SceneFrustum *frustum, const struct SceneCamera *camera)
+{
+    memset(frustum, 0, sizeof(*frustum));
+
+    double forward[3], right[3], up[3];
+    memcpy(forward, camera->direction, sizeof(forward));
+    sceneCross(forward, camera->up, right);
+    double forward_length = sqrt(forward[0] * forward[0] + forward[1] * forward[1] + forward[2] * forward[2]);
+    double right_length = sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+    if (!(forward_length > 0) || !isfinite(forward_length) || !(right_length > 1e-12 * forward_length) || !isfinite(right_length) ||
+        !(camera->fov > 0 && camera->fov < PI) || !(camera->aspect > 0) || !isfinite(camera->aspect) ||
+        !(camera->near >= 0) || !isfinite(camera->near) || !(camera->far > camera->near) ||
+        !isfinite(camera->position[0]) || !isfinite(camera->position[1]) || !isfinite(camera->position[2]))
+        return -1;
+    sceneNormalize(forward);
+    sceneNormalize(right);
+    sceneCross(right, forward, up);
+
+    // A point v from the camera is inside when |right . v| <= tan(h) forward . v, the same vertically
+    double tan_vertical = tan(camera->fov / 2);
+    double tan_horizontal = tan_vertical * camera->aspect;
+    for (int k = 0; k < 3; k++)
+    {
+        frustum->origin[k] = camera->position[k];
+        frustum->normals[0][k] = forward[k];
+        frustum->normals[1][k] = right[k] + tan_horizontal * forward[k];
+        frustum->normals[2][k] = -right[k] + tan_horizontal * forward[k];
+        frustum->normals[3][k] = up[k] + tan_vertical * forward[k];
+        frustum->normals[4][k] = -up[k] + tan_vertical * forward[k];
+        frustum->normals[5][k] = -forward[k];
+    }
+    frustum->offsets[0] = camera->near;
+    frustum->offsets[5] = -camera->far;
+    frustum->planes = isfinite(camera->far) ? 6 : 5;
+    return 0;
+}
+
+// Whether a box may meet the frustum: false only when it lies wholly outside one plane
+static int sceneFrustumMeetsBox(const struct SceneFrustum *frustum, const float lo[3], const float hi[3])
+{
+    for (int p = 0; p < frustum->planes; p++)
+    {
+        const double *normal = frustum->normals[p];
+        double farthest = 0;
+        for (int k = 0; k < 3; k++)
+            farthest += normal[k] * ((normal[k] >= 0 ? hi[k] : lo[k]) - frustum->origin[k]);
+        if (farthest < frustum->offsets[p])
+            return 0;
+    }
+    return 1;
+}
+
+static int sceneFrustumHolds(const struct SceneFrustum *frustum, const float point[3])
+{
+    for (int p = 0; p < frustum->planes; p++)
+    {
+        const double *normal = frustum->normals[p];
+        double height = normal[0] * (point[0] - frustum->origin[0]) + normal[1] * (point[1] - frustum->origin[1]) +
+                        normal[2] * (point[2] - frustum->origin[2]);
+        if (height < frustum->offsets[p])
+            return 0;
+    }
+    return 1;
+}
+
+// How large a node looks: its diagonal over its distance from the camera, or just its diagonal
+// without a camera. Infinite when the camera is inside its box.
+static double sceneNodePriority(const struct SceneFrustum *frustum, const struct SceneNode *node)
+{
+    double diagonal = 0, distance = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        double extent = (double) node->hi[k] - node->lo[k];
+        diagonal += extent * extent;
+        double outside = frustum->origin[k] < node->lo[k] ? node->lo[k] - frustum->origin[k]
+                       : frustum->origin[k] > node->hi[k] ? frustum->origin[k] - node->hi[k] : 0;
+        distance += outside * outside;
+    }
+    if (frustum->planes == 0)
+        return sqrt(diagonal);
+    return distance > 0 ? sqrt(diagonal / distance) : INFINITY;
+}
+
+struct SceneHeapEntry {
+    double priority;
+    uint32_t node;
+};
+
+static void sceneHeapPush(struct SceneHeapEntry *heap, size_t *size, struct SceneHeapEntry entry)
+{
+    size_t i = (*size)++;
+    while (i > 0 && heap[(i - 1) / 2].priority < entry.priority)
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = entry;
+}
+
+static struct SceneHeapEntry sceneHeapPop(struct SceneHeapEntry *heap, size_t *size)
+{
+    struct SceneHeapEntry top = heap[0];
+    struct SceneHeapEntry last = heap[--*size];
+    size_t i = 0;
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= *size)
+            break;
+        if (child + 1 < *size && heap[child + 1].priority > heap[child].priority)
+            child++;
+        if (heap[child].priority <= last.priority)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*size > 0)
+        heap[i] = last;
+    return top;
+}
+
+// Selects at most budget points of scene for camera (NULL for the whole scene). On success *points
+// holds *count points and must be freed, *represented is the number of planets they stand for.
+// Returns -1 if memory ran out.
+static int sceneSelectPoints(const struct Scene *scene, const struct SceneFrustum *frustum, size_t budget,
+                             struct ScenePoint **points, size_t *count, size_t *represented)
+{
+    *points = NULL;
+    *count = 0;
+    *represented = 0;
+    if (scene->count == 0 || scene->nodes[0].count == 0 || budget == 0)
+        return 0;
+
+    struct ScenePoint *selected = malloc(sizeof(struct ScenePoint) * budget);
+    struct SceneHeapEntry *heap = malloc(sizeof(struct SceneHeapEntry) * (budget + 8));
+    if (!selected || !heap)
+    {
+        free(selected);
+        free(heap);
+        return -1;
+    }
+
+    // Every node on the heap and every selected point takes one place in the budget
+    size_t heap_size = 0, used = 0, emitted = 0;
+    const struct SceneNode *root = &scene->nodes[0];
+    if (frustum->planes == 0 || sceneFrustumMeetsBox(frustum, root->lo, root->hi))
+    {
+        struct SceneHeapEntry entry = { sceneNodePriority(frustum, root), 0 };
+        sceneHeapPush(heap, &heap_size, entry);
+        used = 1;
+    }
+
+    while (heap_size > 0)
+    {
+        const struct SceneNode *node = &scene->nodes[sceneHeapPop(heap, &heap_size).node];
+
+        // Refine into the visible children, or for a leaf its visible points
+        size_t visible = 0;
+        if (node->childCount == 0)
+        {
+            for (uint32_t i = node->begin; i < node->end; i++)
+                visible += !isnan(scene->points[i][0]) && (frustum->planes == 0 || sceneFrustumHolds(frustum, scene->points[i]));
+        }
+        else
+        {
+            for (uint32_t c = node->firstChild; c < node->firstChild + node->childCount; c++)
+            {
+                const struct SceneNode *child = &scene->nodes[c];
+                visible += child->count > 0 && (frustum->planes == 0 || sceneFrustumMeetsBox(frustum, child->lo, child->hi));
+            }
+        }
+
+        if (used - 1 + visible > budget)
+        {
+            struct ScenePoint *point = &selected[emitted++];
+            memcpy(point->position, node->centroid, sizeof(point->position));
+            point->count = node->count;
+            *represented += node->count;
+            continue;
+        }
+        used = used - 1 + visible;
+
+        if (node->childCount == 0)
+        {
+            for (uint32_t i = node->begin; i < node->end; i++)
+            {
+                if (isnan(scene->points[i][0]) || (frustum->planes != 0 && !sceneFrustumHolds(frustum, scene->points[i])))
+                    continue;
+                struct ScenePoint *point = &selected[emitted++];
+                memcpy(point->position, scene->points[i], sizeof(point->position));
+                point->count = 1;
+                (*represented)++;
+            }
+            continue;
+        }
+
+        for (uint32_t c = node->firstChild; c < node->firstChild + node->childCount; c++)
+        {
+            const struct SceneNode *child = &scene->nodes[c];
+            if (child->count == 0 || (frustum->planes != 0 && !sceneFrustumMeetsBox(frustum, child->lo, child->hi)))
+                continue;
+            struct SceneHeapEntry entry = { sceneNodePriority(frustum, child), c };
+            sceneHeapPush(heap, &heap_size, entry);
+        }
+    }
+
+    free(heap);
+    *points = selected;
+    *count = emitted;
+    return 0;
+}
+
+// Selects at most budget points of the catalog at epoch (quantized down to the cache's epoch
+// seconds) as seen by camera, or of the whole scene when camera is NULL. On success *points holds
+// *count points and must be freed, *represented is the number of planets they stand for and
+// *scene_epoch the epoch of their positions. Returns -1 for an invalid camera, -2 if memory ran out.
+int sceneSelect(struct SceneCache *cache, double epoch, const struct SceneCamera *camera, size_t budget,
+                struct ScenePoint **points, size_t *count, size_t *represented, double *scene_epoch)
+{
+    struct SceneFrustum frustum;
+    memset(&frustum, 0, sizeof(frustum));
+    if (camera && sceneFrustumInit(&frustum, camera) != 0)
+        return -1;
+
+    struct Scene *scene = sceneAcquire(cache, (long long) floor(epoch / cache->epochSeconds));
+    if (!scene)
+        return -2;
+
+    *scene_epoch = scene->epoch;
+    int status = sceneSelectPoints(scene, &frustum, budget, points, count, represented);
+    sceneRelease(cache, scene);
+
+    __atomic_fetch_add(&scene_cache_stats.selections, 1, __ATOMIC_RELAXED);
+    return status == 0 ? 0 : -2;
+}
+
+void sceneStatsSnapshot(struct SceneCache *cache, struct SceneStats *stats)
+{
+    stats->selections = __atomic_load_n(&scene_cache_stats.selections, __ATOMIC_RELAXED);
+    stats->hits = __atomic_load_n(&scene_cache_stats.hits, __ATOMIC_RELAXED);
+    stats->refits = __atomic_load_n(&scene_cache_stats.refits, __ATOMIC_RELAXED);
+    stats->builds = __atomic_load_n(&scene_cache_stats.builds, __ATOMIC_RELAXED);
+    stats->scenes = 0;
+
+    if (cache->catalog == NULL)
+        return;
+    pthread_mutex_lock(&cache->lock);
+    for (int i = 0; i < SCENE_CACHE; i++)
+    {
+        if (cache->scenes[i] && cache->scenes[i]->state == 1)
+            stats->scenes++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Catalog sharding: planets are owned by shards according to ranges of a 64-bit hash of their
+ * name. With count shards, shard i owns the hashes from i * 2^64 / count up to the next shard's.
+ * The catalog builder, the server and the router all derive ownership from the name alone, so a
+ * replica's catalog, ephemeris tables and caches only ever hold its own planets.
+ */
+
+#ifndef SHARD_C
+#define SHARD_C
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Most shards a catalog can be split into
+#define SHARD_MAX 1024
+
+// 64-bit FNV-1a of a planet name, finished with MurmurHash3's fmix64 so that the top bits, which
+// pick the shard, vary as much as the low ones between names like "Kepler-22 b" and "Kepler-22 c"
+static uint64_t shardNameHash(const char *name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *) name; *c; c++)
+    {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// The shard (from 0) owning the named planet among count shards
+int shardOf(const char *name, int count)
+{
+    if (count <= 1)
+        return 0;
+
+    uint64_t width = UINT64_MAX / (uint64_t) count + 1;
+    return (int) (shardNameHash(name) / width);
+}
+
+// Parses a shard given as "index/count", e.g. "2/4". Returns -1 if it is malformed.
+int shardParse(const char *text, int *index, int *count)
+{
+    char *end;
+    long parsedIndex = strtol(text, &end, 10);
+    if (end == text || *end != '/')
+        return -1;
+
+    const char *countText = end + 1;
+    long parsedCount = strtol(countText, &end, 10);
+    if (end == countText || *end != '\0' || parsedCount < 1 || parsedCount > SHARD_MAX || parsedIndex < 0 || parsedIndex >= parsedCount)
+        return -1;
+
+    *index = (int) parsedIndex;
+    *count = (int) parsedCount;
+    return 0;
+}
+
+#endif
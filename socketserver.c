@@ -0,0 +1,773 @@
+/*
+ * Plain TCP and Unix-domain socket transport speaking newline-delimited JSON: one request per line,
+ * one response per line. A connection may pipeline requests, they are computed in parallel on a
+ * worker pool and answered in the order they arrived. A connection that opens with a binary hello
+ * frame carries binary frames instead (see exoplanetbinary.c), one request per frame.
+ */
+
+#ifndef SOCKETSERVER_C
+#define SOCKETSERVER_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "workerpool.c"
+#include "exoplanetbinary.c"
+#include "admission.c"
+
+// How long the loop sleeps in poll before rechecking for shutdown, in milliseconds
+#define SOCKET_POLL_TIMEOUT 1000
+
+// Requests a connection may have queued or in flight before the server stops reading from it
+#define SOCKET_MAX_PIPELINE 64
+
+// Bytes read from a connection at a time
+#define SOCKET_READ_SIZE 65536
+
+// Answers when a line exceeds the request size limit, a full compute queue is answered with
+// ADMISSION_OVERLOADED_LINE like any shed work
+#define SOCKET_TOO_LARGE_RESPONSE "{\"error\":\"Request too large.\"}\n"
+
+// Computes the response to one request line and returns it as a malloc'ed string
+typedef char *(*SocketRequestHandler)(const char *request, size_t length);
+
+// Computes the response frame to one binary request frame and returns it as a malloc'ed block
+typedef char *(*SocketFrameHandler)(const char *frame, size_t length, size_t *responseLength);
+
+struct SocketConnection;
+
+struct SocketRequest {
+    struct SocketConnection *connection;
+    struct SocketServer *server;
+    char *request;
+    size_t requestLength;
+    char *response;                     // newline terminated, or a binary frame
+    size_t responseLength;
+    int binary;                         // a binary frame rather than a line
+    int done;                           // response ready, only the loop sets this
+    struct SocketRequest *next;         // the connection's queue, in arrival order
+    struct SocketRequest *nextCompleted;
+};
+
+struct SocketConnection {
+    int fd;
+
+    // Bytes received that do not form a complete line yet
+    char *input;
+    size_t inputLength;
+    size_t inputCapacity;
+    size_t scanned;                     // input before this offset holds no newline
+    uint64_t partialNs;                 // since when the connection has held part of a request and nothing to answer
+    int inputEof;
+    int binary;                         // the connection opened with a binary hello frame
+
+    // Requests in arrival order, the head is written once it is done
+    struct SocketRequest *head;
+    struct SocketRequest *tail;
+    int queued;
+    int computing;                      // requests held by a worker
+    size_t headSent;
+
+    int closing;
+    struct SocketConnection *next;
+};
+
+struct SocketServer {
+    int listenFds[2];
+    int numListen;
+    char *unixPath;
+
+    pthread_t thread;
+    int started;
+    int wakeFds[2];
+    int stopping;
+
+    struct WorkerPool compute;
+    SocketRequestHandler handler;
+    SocketFrameHandler frameHandler;
+    size_t maxRequestSize;
+
+    // Responses handed back by the workers
+    pthread_mutex_t lock;
+    struct SocketRequest *completed;
+
+    // Owned by the loop thread
+    struct SocketConnection *connections;
+    int numConnections;
+
+    // Counters
+    unsigned long long connectionsAccepted;
+    unsigned long long requests;
+    unsigned long long rejected;
+};
+
+struct SocketServerStats {
+    int connections;
+    unsigned long long connectionsAccepted;
+    unsigned long long requests;
+    unsigned long long rejected;
+    struct WorkerPoolStats compute;
+};
+
+static int socketSetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Listens on all IPv4 interfaces at port, returns the socket or -1. The port is shared through
+// SO_REUSEPORT with the other worker processes of prefork mode.
+int socketListenTcp(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short) port);
+
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 || socketSetNonBlocking(fd) != 0)
+    {
+        fprintf(stderr, "Error listening on TCP port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Listens on a Unix-domain socket at path, replacing a stale socket file, returns the socket or -1
+int socketListenUnix(const char *path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Unix socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 || socketSetNonBlocking(fd) != 0)
+    {
+        fprintf(stderr, "Error listening on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void socketServerWake(struct SocketServer *server)
+{
+    char byte = 0;
+    if (write(server->wakeFds[1], &byte, 1) < 0)
+    {
+        // The pipe is full, so the loop is already due to wake up
+    }
+}
+
+// Computes the response to a request with the server's handler
+static void socketRequestAnswer(struct SocketServer *server, struct SocketRequest *request)
+{
+    if (request->binary)
+    {
+        request->response = server->frameHandler(request->request, request->requestLength, &request->responseLength);
+        return;
+    }
+
+    char *response = server->handler(request->request, request->requestLength);
+    size_t length = response ? strlen(response) : 0;
+
+    // Every response ends with a newline, a trajectory's is several lines
+    char *line = response ? realloc(response, length + 2) : NULL;
+    if (line)
+    {
+        line[length] = '\n';
+        line[length + 1] = '\0';
+        request->response = line;
+        request->responseLength = length + 1;
+    }
+    else
+    {
+        free(response);
+    }
+}
+
+// Runs on a compute worker
+static void socketRequestCompute(void *arg)
+{
+    struct SocketRequest *request = arg;
+    struct SocketServer *server = request->server;
+
+    // Shed load that waited too long or finds the server at its concurrency limit
+    if (admissionEnter(workerPoolWaited()) != 0)
+    {
+        char frame[BINARY_HEADER_SIZE];
+        binaryWriteHeader(frame, BINARY_ERROR, 0, BINARY_STATUS_BUSY);
+        const char *response = request->binary ? frame : ADMISSION_OVERLOADED_LINE;
+        size_t length = request->binary ? sizeof(frame) : strlen(ADMISSION_OVERLOADED_LINE);
+
+        request->response = malloc(length);
+        if (request->response)
+            memcpy(request->response, response, length);
+        request->responseLength = request->response ? length : 0;
+    }
+    else
+    {
+        socketRequestAnswer(server, request);
+        admissionLeave();
+    }
+
+    free(request->request);
+    request->request = NULL;
+    __atomic_fetch_add(&server->requests, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&server->lock);
+    request->nextCompleted = server->completed;
+    server->completed = request;
+    pthread_mutex_unlock(&server->lock);
+
+    socketServerWake(server);
+}
+
+static void socketRequestRespond(struct SocketRequest *request, const char *response, size_t length)
+{
+    request->response = malloc(length);
+    if (request->response)
+        memcpy(request->response, response, length);
+    request->responseLength = request->response ? length : 0;
+    request->done = 1;
+}
+
+// Answers a request that was shed, with an error line or an error frame
+static void socketRequestRespondBusy(struct SocketRequest *request)
+{
+    char frame[BINARY_HEADER_SIZE];
+    binaryWriteHeader(frame, BINARY_ERROR, 0, BINARY_STATUS_BUSY);
+
+    if (request->binary)
+        socketRequestRespond(request, frame, sizeof(frame));
+    else
+        socketRequestRespond(request, ADMISSION_OVERLOADED_LINE, strlen(ADMISSION_OVERLOADED_LINE));
+}
+
+// Queues an answer that does not need a worker, such as an error
+static void socketConnectionRespond(struct SocketConnection *c, const char *response, size_t length)
+{
+    struct SocketRequest *request = calloc(1, sizeof(struct SocketRequest));
+    if (!request)
+    {
+        c->closing = 1;
+        return;
+    }
+
+    request->connection = c;
+    socketRequestRespond(request, response, length);
+    if (c->tail)
+        c->tail->next = request;
+    else
+        c->head = request;
+    c->tail = request;
+    c->queued++;
+}
+
+// Queues a request for one line (or binary frame) of input
+static void socketConnectionEnqueue(struct SocketServer *server, struct SocketConnection *c, const char *line, size_t length)
+{
+    struct SocketRequest *request = calloc(1, sizeof(struct SocketRequest));
+    if (!request)
+    {
+        c->closing = 1;
+        return;
+    }
+
+    request->connection = c;
+    request->server = server;
+    request->binary = c->binary;
+
+    if (c->tail)
+        c->tail->next = request;
+    else
+        c->head = request;
+    c->tail = request;
+    c->queued++;
+
+    request->request = malloc(length + 1);
+    if (request->request)
+    {
+        memcpy(request->request, line, length);
+        request->request[length] = '\0';
+        request->requestLength = length;
+
+        c->computing++;
+        if (workerPoolSubmit(&server->compute, socketRequestCompute, request, 0) == 0)
+            return;
+        c->computing--;
+
+        free(request->request);
+        request->request = NULL;
+    }
+
+    // Shed the request, the connection still gets an answer in order
+    __atomic_fetch_add(&server->rejected, 1, __ATOMIC_RELAXED);
+    socketRequestRespondBusy(request);
+}
+
+// Binary connections: turns complete frames of input into requests while the pipeline has room,
+// returns the number of bytes consumed
+static size_t socketConnectionParseFrames(struct SocketServer *server, struct SocketConnection *c, size_t start)
+{
+    while (!c->closing && c->queued < SOCKET_MAX_PIPELINE && start < c->inputLength)
+    {
+        size_t length = binaryFrameLength(c->input + start, c->inputLength - start);
+        if (length == 0 && !c->inputEof)
+            break;
+
+        // A bad header, or EOF in the middle of a frame, is answered with an error frame and ends the connection
+        if (length == 0 || length == BINARY_FRAME_INVALID)
+        {
+            char frame[BINARY_HEADER_SIZE];
+            binaryWriteHeader(frame, BINARY_ERROR, 0, BINARY_STATUS_INVALID_FRAME);
+            socketConnectionRespond(c, frame, sizeof(frame));
+            c->inputEof = 1;
+            return c->inputLength;
+        }
+
+        socketConnectionEnqueue(server, c, c->input + start, length);
+        start += length;
+    }
+
+    return start;
+}
+
+// Turns complete lines of input into requests while the pipeline has room
+static void socketConnectionParse(struct SocketServer *server, struct SocketConnection *c)
+{
+    size_t start = 0;
+
+    while (!c->closing && c->queued < SOCKET_MAX_PIPELINE)
+    {
+        // A connection that opens with a binary hello frame carries frames from then on
+        if (!c->binary && start == 0 && c->inputLength > 0 && c->input[0] == BINARY_MAGIC_BYTE && server->frameHandler)
+            c->binary = 1;
+        if (c->binary)
+        {
+            start = socketConnectionParseFrames(server, c, start);
+            c->scanned = start;
+            break;
+        }
+
+        char *newline = memchr(c->input + c->scanned, '\n', c->inputLength - c->scanned);
+
+        // A final request without a trailing newline is still served
+        if (!newline && !(c->inputEof && c->inputLength > start))
+        {
+            c->scanned = c->inputLength;
+            break;
+        }
+
+        size_t end = newline ? (size_t) (newline - c->input) : c->inputLength;
+        size_t length = end - start;
+        if (length > 0 && c->input[start + length - 1] == '\r')
+            length--;
+
+        // Blank lines are allowed between requests
+        size_t first = start;
+        while (first < start + length && (c->input[first] == ' ' || c->input[first] == '\t'))
+            first++;
+        if (first < start + length)
+            socketConnectionEnqueue(server, c, c->input + first, start + length - first);
+
+        start = newline ? end + 1 : end;
+        c->scanned = start;
+    }
+
+    // A line longer than the request limit will never be served
+    if (c->inputLength - start > server->maxRequestSize)
+    {
+        socketConnectionRespond(c, SOCKET_TOO_LARGE_RESPONSE, strlen(SOCKET_TOO_LARGE_RESPONSE));
+        start = c->inputLength;
+        c->inputEof = 1;
+    }
+
+    memmove(c->input, c->input + start, c->inputLength - start);
+    c->inputLength -= start;
+    c->scanned -= start;
+}
+
+// Writes the responses at the head of the queue that are ready
+static void socketConnectionFlush(struct SocketServer *server, struct SocketConnection *c)
+{
+    while (c->head && c->head->done && !c->closing)
+    {
+        struct SocketRequest *request = c->head;
+
+        while (c->headSent < request->responseLength)
+        {
+            ssize_t nbytes = send(c->fd, request->response + c->headSent, request->responseLength - c->headSent, MSG_NOSIGNAL);
+            if (nbytes < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    c->closing = 1;
+                return;
+            }
+            c->headSent += nbytes;
+        }
+
+        c->head = request->next;
+        if (!c->head)
+            c->tail = NULL;
+        c->queued--;
+        c->headSent = 0;
+        free(request->response);
+        free(request);
+
+        // Room in the pipeline again
+        socketConnectionParse(server, c);
+    }
+
+    // Everything the client sent has been answered
+    if (c->inputEof && !c->head)
+        c->closing = 1;
+}
+
+static int socketConnectionRead(struct SocketServer *server, struct SocketConnection *c)
+{
+    for (;;)
+    {
+        if (c->inputCapacity - c->inputLength < SOCKET_READ_SIZE)
+        {
+            size_t capacity = c->inputCapacity ? c->inputCapacity * 2 : SOCKET_READ_SIZE * 2;
+            char *grown = realloc(c->input, capacity);
+            if (!grown)
+                return -1;
+            c->input = grown;
+            c->inputCapacity = capacity;
+        }
+
+        ssize_t nbytes = read(c->fd, c->input + c->inputLength, c->inputCapacity - c->inputLength);
+        if (nbytes == 0)
+        {
+            c->inputEof = 1;
+            break;
+        }
+        if (nbytes < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            return -1;
+        }
+
+        c->inputLength += nbytes;
+        socketConnectionParse(server, c);
+
+        // Stop reading while the pipeline is full, the kernel buffers hold the rest
+        if (c->queued >= SOCKET_MAX_PIPELINE || c->closing)
+            break;
+    }
+
+    if (c->inputEof)
+        socketConnectionParse(server, c);
+
+    return 0;
+}
+
+static void socketConnectionFree(struct SocketServer *server, struct SocketConnection *c)
+{
+    while (c->head)
+    {
+        struct SocketRequest *request = c->head;
+        c->head = request->next;
+        free(request->request);
+        free(request->response);
+        free(request);
+    }
+
+    close(c->fd);
+    free(c->input);
+    free(c);
+    __atomic_fetch_sub(&server->numConnections, 1, __ATOMIC_RELAXED);
+}
+
+static void socketServerAccept(struct SocketServer *server, int listenFd)
+{
+    for (;;)
+    {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0)
+            return;
+
+        struct SocketConnection *c = calloc(1, sizeof(struct SocketConnection));
+        if (!c || socketSetNonBlocking(fd) != 0)
+        {
+            free(c);
+            close(fd);
+            continue;
+        }
+
+        // Responses are small and sent as soon as they are ready
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        c->fd = fd;
+        c->next = server->connections;
+        server->connections = c;
+        __atomic_fetch_add(&server->numConnections, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&server->connectionsAccepted, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Marks the responses the workers finished as ready to send
+static void socketServerDrain(struct SocketServer *server)
+{
+    char drain[64];
+    while (read(server->wakeFds[0], drain, sizeof(drain)) > 0)
+        ;
+
+    pthread_mutex_lock(&server->lock);
+    struct SocketRequest *completed = server->completed;
+    server->completed = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (completed)
+    {
+        struct SocketRequest *next = completed->nextCompleted;
+        completed->done = 1;
+        completed->connection->computing--;
+        if (!completed->response)
+            socketRequestRespondBusy(completed);
+        completed = next;
+    }
+}
+
+static void *socketServerMain(void *arg)
+{
+    struct SocketServer *server = arg;
+    struct pollfd *fds = NULL;
+    struct SocketConnection **polled = NULL;
+    size_t fdsCapacity = 0;
+
+    while (!__atomic_load_n(&server->stopping, __ATOMIC_SEQ_CST))
+    {
+        size_t needed = 1 + server->numListen + server->numConnections;
+        if (needed > fdsCapacity)
+        {
+            size_t capacity = needed * 2;
+            struct pollfd *grownFds = realloc(fds, capacity * sizeof(struct pollfd));
+            if (grownFds)
+                fds = grownFds;
+            struct SocketConnection **grownPolled = realloc(polled, capacity * sizeof(struct SocketConnection *));
+            if (grownPolled)
+                polled = grownPolled;
+            if (!grownFds || !grownPolled)
+                break;
+            fdsCapacity = capacity;
+        }
+
+        size_t n = 0;
+        fds[n].fd = server->wakeFds[0];
+        fds[n].events = POLLIN;
+        polled[n++] = NULL;
+        for (int i = 0; i < server->numListen; i++)
+        {
+            fds[n].fd = server->listenFds[i];
+            fds[n].events = POLLIN;
+            polled[n++] = NULL;
+        }
+        for (struct SocketConnection *c = server->connections; c; c = c->next)
+        {
+            fds[n].fd = c->fd;
+            fds[n].events = 0;
+            if (!c->closing && !c->inputEof && c->queued < SOCKET_MAX_PIPELINE)
+                fds[n].events |= POLLIN;
+            if (!c->closing && c->head && c->head->done)
+                fds[n].events |= POLLOUT;
+            polled[n++] = c;
+        }
+
+        if (poll(fds, n, SOCKET_POLL_TIMEOUT) < 0 && errno != EINTR)
+            break;
+
+        socketServerDrain(server);
+
+        for (size_t i = 1; i < n; i++)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            struct SocketConnection *c = polled[i];
+            if (!c)
+            {
+                socketServerAccept(server, fds[i].fd);
+                continue;
+            }
+
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                if (socketConnectionRead(server, c) != 0)
+                    c->closing = 1;
+            }
+        }
+
+        // Write what is ready and drop finished connections
+        uint64_t now = admission_read_ms ? admissionNow() : 0;
+        struct SocketConnection **link = &server->connections;
+        while (*link)
+        {
+            struct SocketConnection *c = *link;
+            socketConnectionFlush(server, c);
+
+            // A request that is sent too slowly closes the connection, idle connections stay open
+            if (!admission_read_ms || c->queued > 0 || c->inputLength == 0)
+                c->partialNs = 0;
+            else if (c->partialNs == 0)
+                c->partialNs = now;
+            else if (now - c->partialNs > (uint64_t) admission_read_ms * 1000000ULL && !c->closing)
+            {
+                admissionCountTimeout(ADMISSION_TIMEOUT_READ);
+                c->closing = 1;
+            }
+
+            if (c->closing && c->computing == 0)
+            {
+                *link = c->next;
+                socketConnectionFree(server, c);
+                continue;
+            }
+            link = &c->next;
+        }
+    }
+
+    free(fds);
+    free(polled);
+    return NULL;
+}
+
+void socketServerShutdown(struct SocketServer *server);
+
+// Serves newline-delimited JSON (and binary frames, when frameHandler is set) on a TCP port (when
+// port > 0) and a Unix socket (when unixPath is set) from one poll loop thread, with numWorkers
+// compute workers behind it. Returns 0 on success.
+int socketServerInit(struct SocketServer *server, int port, const char *unixPath, int numWorkers, size_t queueCapacity, size_t maxRequestSize,
+                     SocketRequestHandler handler, SocketFrameHandler frameHandler)
+{
+    memset(server, 0, sizeof(*server));
+    server->wakeFds[0] = server->wakeFds[1] = -1;
+    server->handler = handler;
+    server->frameHandler = frameHandler;
+    server->maxRequestSize = maxRequestSize;
+    pthread_mutex_init(&server->lock, NULL);
+
+    if (port > 0)
+    {
+        int fd = socketListenTcp(port);
+        if (fd < 0)
+            return -1;
+        server->listenFds[server->numListen++] = fd;
+    }
+
+    if (unixPath)
+    {
+        int fd = socketListenUnix(unixPath);
+        if (fd < 0)
+        {
+            socketServerShutdown(server);
+            return -1;
+        }
+        server->listenFds[server->numListen++] = fd;
+        server->unixPath = strdup(unixPath);
+    }
+
+    if (pipe(server->wakeFds) != 0 || workerPoolInit(&server->compute, numWorkers, queueCapacity) != 0)
+    {
+        socketServerShutdown(server);
+        return -1;
+    }
+    socketSetNonBlocking(server->wakeFds[0]);
+    socketSetNonBlocking(server->wakeFds[1]);
+
+    if (pthread_create(&server->thread, NULL, socketServerMain, server) != 0)
+    {
+        fprintf(stderr, "Error creating socket server thread\n");
+        socketServerShutdown(server);
+        return -1;
+    }
+    server->started = 1;
+
+    return 0;
+}
+
+void socketServerStatsSnapshot(struct SocketServer *server, struct SocketServerStats *stats)
+{
+    stats->connections = __atomic_load_n(&server->numConnections, __ATOMIC_RELAXED);
+    stats->connectionsAccepted = __atomic_load_n(&server->connectionsAccepted, __ATOMIC_RELAXED);
+    stats->requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&server->rejected, __ATOMIC_RELAXED);
+    workerPoolStatsSnapshot(&server->compute, &stats->compute);
+}
+
+// Stops the loop, lets the workers finish, then closes every connection and listener
+void socketServerShutdown(struct SocketServer *server)
+{
+    __atomic_store_n(&server->stopping, 1, __ATOMIC_SEQ_CST);
+    if (server->started)
+    {
+        socketServerWake(server);
+        pthread_join(server->thread, NULL);
+        server->started = 0;
+    }
+
+    if (server->compute.numWorkers > 0)
+        workerPoolShutdown(&server->compute);
+
+    if (server->wakeFds[0] >= 0)
+    {
+        socketServerDrain(server);
+        close(server->wakeFds[0]);
+        close(server->wakeFds[1]);
+        server->wakeFds[0] = server->wakeFds[1] = -1;
+    }
+
+    while (server->connections)
+    {
+        struct SocketConnection *c = server->connections;
+        server->connections = c->next;
+        socketConnectionFree(server, c);
+    }
+
+    for (int i = 0; i < server->numListen; i++)
+        close(server->listenFds[i]);
+    server->numListen = 0;
+
+    if (server->unixPath)
+    {
+        unlink(server->unixPath);
+        free(server->unixPath);
+        server->unixPath = NULL;
+    }
+}
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * Accuracy checks of the fast paths against their reference implementations
+ *
+ * Usage: exoplanet-tests [name-prefix]
+ *
+ * Prints one line per check and exits with status 1 if any of them failed.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "astromath.c"
+#include "astromath_simd.c"
+#include "orbit.c"
+#include "conesearch.c"
+#include "exoplanetcodec.c"
+#include "admission.c"
+
+// Random orbits compared per check
+#define TEST_ORBITS (64 * ORBIT_BLOCK_SIZE)
+
+// Largest difference allowed between a SIMD kernel and the scalar path, relative to the orbital
+// radius: the vector solver stops at steps below 1e-12 and its sine and cosine are within a few ulps
+#define TEST_ORBIT_BLOCK_TOLERANCE 1e-9
+
+// Longitude and latitude steps of the grid a box is sampled on, edges included
+#define TEST_BOX_GRID 256
+
+// Random boxes compared per check
+#define TEST_BOXES 2000
+
+// A box's covering cone may exceed the farthest grid point by up to this much (radians): the grid
+// can miss the true farthest point by half a cell, and a wider cone only costs extra candidates
+#define TEST_BOX_SLACK 0.02
+
+// How long the plain requests of the deadline check count as having waited in a queue
+#define TEST_QUEUE_WAIT_MS 50
+
+static int test_failures;
+
+static unsigned long long test_random_state = 0x9e3779b97f4a7c15ULL;
+
+static double test_uniform(double min, double max)
+{
+    test_random_state ^= test_random_state << 13;
+    test_random_state ^= test_random_state >> 7;
+    test_random_state ^= test_random_state << 17;
+    return min + (max - min) * (double) (test_random_state >> 11) / (double) (1ULL << 53);
+}
+
+static void test_report(const char *name, int passed, const char *detail)
+{
+    printf("%s %s: %s\n", passed ? "PASS" : "FAIL", name, detail);
+    test_failures += !passed;
+}
+
+static int test_selected(const char *name, const char *filter)
+{
+    return filter == NULL || strncmp(name, filter, strlen(filter)) == 0;
+}
+
+// Fills a block with random planets and the times they are evaluated at: over a thousand
+// revolutions either way like raw Unix times produce, eccentricities up to 0.99 and random
+// orientations. Each lane gets the mean anomaly and rotation its planet compiles to.
+static void test_fill_orbit_block(struct OrbitBlock *block, struct Exoplanet planets[], double times[])
+{
+    for (size_t i = 0; i < ORBIT_BLOCK_SIZE; i++)
+    {
+        struct Exoplanet planet = get_default_exoplanet();
+        planet.orbitalRadius = test_uniform(0.01, 100);
+        planet.orbitalPeriod = test_uniform(0.1, 100);
+        planet.eccentricity = test_uniform(0, 0.99);
+        planet.inclination = test_uniform(0, 180);
+        planet.longitudeOfNode = test_uniform(0, 360);
+        planet.argumentOfPeriapsis = test_uniform(0, 360);
+
+        struct OrbitHandle orbit;
+        orbitHandleInit(&orbit, &planet);
+        planets[i] = planet;
+        times[i] = test_uniform(-1600, 1600) * orbit.periodSeconds;
+        orbitBlockSetLane(block, i, orbitHandleMeanAnomaly(&orbit, times[i]), planet.eccentricity, planet.orbitalRadius, orbit.rotation);
+    }
+}
+
+// Differences between lane i of a block and calculateRaAndDistance, the per-planet path with the
+// original true anomaly form, on the planet the lane was filled from: distance relative to the
+// orbital radius, and ra (scaled by the cosine of the declination) and declination in radians.
+// The per-planet path only reports distance, ra and declination, so the lane is converted the way
+// the server converts block results.
+static void test_planet_errors(const struct OrbitBlock *block, size_t i, struct Exoplanet planet, double time, double errors[3])
+{
+    struct Exoplanet lane = planet;
+    orbitHandleSetPosition(block->radius[i], block->x[i], block->y[i], block->z[i], &lane);
+    calculateRaAndDistance(&planet, time);
+
+    double declination = DEG_TO_RAD(planet.declination);
+    errors[0] = (lane.distance - planet.distance) / 0.0000158125074 / planet.orbitalRadius;
+    errors[1] = remainder(lane.ra - planet.ra, 2 * PI) * cos(declination);
+    errors[2] = DEG_TO_RAD(lane.declination) - declination;
+}
+
+// Raises worst to the largest of the errors, NaN counts as infinite
+static void test_track_error(double *worst, const double errors[], int count)
+{
+    for (int k = 0; k < count; k++)
+    {
+        double error = fabs(errors[k]);
+        if (!(error <= *worst))
+            *worst = isnan(error) ? INFINITY : error;
+    }
+}
+
+// Runs one SIMD kernel, the scalar block path and calculateRaAndDistance on the same random orbits.
+// The kernel's radius and coordinates must agree with the scalar block path within
+// TEST_ORBIT_BLOCK_TOLERANCE of the orbital radius, and its distance, ra and declination with
+// calculateRaAndDistance within the same tolerance (radians for the angles). The per-planet path catches a mistake in the E form the kernels share
+// with the scalar block path. Lanes the scalar Newton solver does not converge on (it starts from
+// E = M) are counted but not compared, a kernel that fails to solve a lane fails the check.
+static void test_orbit_block_kernel(const char *name, OrbitBlockKernel kernel)
+{
+    static struct OrbitBlock simd, scalar;
+    static struct Exoplanet planets[ORBIT_BLOCK_SIZE];
+    static double times[ORBIT_BLOCK_SIZE];
+    double worst = 0, worst_planet = 0;
+    size_t unsolved = 0;
+
+    for (size_t done = 0; done < TEST_ORBITS; done += ORBIT_BLOCK_SIZE)
+    {
+        test_fill_orbit_block(&simd, planets, times);
+        scalar = simd;
+
+        // Partial blocks exercise the scalar tail of the vector kernels
+        size_t count = done == 0 ? ORBIT_BLOCK_SIZE - 3 : ORBIT_BLOCK_SIZE;
+        kernel(&simd, count);
+        orbitBlockKernelScalarRange(&scalar, 0, count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (isnan(scalar.radius[i]))
+            {
+                unsolved++;
+                continue;
+            }
+
+            double a = simd.orbitalRadius[i];
+            double errors[4] = { (simd.radius[i] - scalar.radius[i]) / a, (simd.x[i] - scalar.x[i]) / a,
+                                 (simd.y[i] - scalar.y[i]) / a, (simd.z[i] - scalar.z[i]) / a };
+            test_track_error(&worst, errors, 4);
+
+            double planet_errors[3];
+            test_planet_errors(&simd, i, planets[i], times[i], planet_errors);
+            test_track_error(&worst_planet, planet_errors, 3);
+        }
+    }
+
+    char test_name[64], detail[224];
+    snprintf(test_name, sizeof(test_name), "orbit_block_%s", name);
+    snprintf(detail, sizeof(detail), "worst error %.3g against the scalar path and %.3g against calculateRaAndDistance over %d orbits (tolerance %g), %zu unsolved by the scalar path",
+             worst, worst_planet, TEST_ORBITS, TEST_ORBIT_BLOCK_TOLERANCE, unsolved);
+    test_report(test_name, worst <= TEST_ORBIT_BLOCK_TOLERANCE && worst_planet <= TEST_ORBIT_BLOCK_TOLERANCE, detail);
+}
+
+// Checks every SIMD kernel this CPU can run against the scalar path, with both scalar solvers
+static void test_orbit_blocks(void)
+{
+    enum KeplerSolver solvers[2] = { KEPLER_SOLVER_NEWTON, KEPLER_SOLVER_HALLEY };
+    enum KeplerSolver configured = kepler_solver;
+
+    for (int s = 0; s < 2; s++)
+    {
+        kepler_solver = solvers[s];
+        printf("# scalar solver %s\n", keplerSolverName(kepler_solver));
+#ifdef ASTROMATH_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+            test_orbit_block_kernel("sse2", orbitBlockKernelSse2);
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            test_orbit_block_kernel("avx2", orbitBlockKernelAvx2);
+        if (__builtin_cpu_supports("avx512f"))
+            test_orbit_block_kernel("avx512", orbitBlockKernelAvx512);
+#endif
+        test_orbit_block_kernel("dispatched", computeOrbitBlock);
+    }
+    kepler_solver = configured;
+}
+
+// Builds random boxes, mostly wider than pi so the farthest point can lie between the corners of
+// a meridian edge, and checks the covering cone of coneQueryBox against the farthest point of a
+// dense grid over the box: no grid point may lie outside the cone, and the cone may not be much wider
+static void test_box_search(void)
+{
+    double worst_outside = 0, worst_slack = 0;
+
+    for (int b = 0; b < TEST_BOXES; b++)
+    {
+        double lon_min = test_uniform(0, 2 * PI);
+        double width = b % 4 == 0 ? test_uniform(0, PI) : test_uniform(PI, 2 * PI - 1e-6);
+        double lon_max = lon_min + width > 2 * PI ? lon_min + width - 2 * PI : lon_min + width;
+        double lat_a = test_uniform(-PI / 2, PI / 2), lat_b = test_uniform(-PI / 2, PI / 2);
+        double lat_min = lat_a < lat_b ? lat_a : lat_b, lat_max = lat_a < lat_b ? lat_b : lat_a;
+
+        struct ConeQuery query;
+        if (coneQueryBox(&query, CONE_FRAME_EQUATORIAL, 0, lon_min, lon_max, lat_min, lat_max) != 0)
+        {
+            worst_outside = INFINITY;
+            continue;
+        }
+
+        double farthest = 0;
+        for (int i = 0; i <= TEST_BOX_GRID; i++)
+        {
+            for (int j = 0; j <= TEST_BOX_GRID; j++)
+            {
+                double v[3];
+                coneUnitVector(lon_min + width * i / TEST_BOX_GRID, lat_min + (lat_max - lat_min) * j / TEST_BOX_GRID, v);
+                double angle = coneAngle(query.center, v);
+                farthest = angle > farthest ? angle : farthest;
+            }
+        }
+
+        if (farthest - query.radius > worst_outside)
+            worst_outside = farthest - query.radius;
+        if (query.radius - farthest > worst_slack)
+            worst_slack = query.radius - farthest;
+    }
+
+    char detail[160];
+    snprintf(detail, sizeof(detail), "farthest grid point %.3g outside the cone, cone at most %.3g wider, over %d boxes (slack %g)",
+             worst_outside, worst_slack, TEST_BOXES, TEST_BOX_SLACK);
+    test_report("box_search_radius", worst_outside <= 1e-12 && worst_slack <= TEST_BOX_SLACK, detail);
+}
+
+// Decodes plain requests with the codec and starts their deadline the way answer_exoplanet_request
+// does, as if they had waited TEST_QUEUE_WAIT_MS for a worker: a deadline_ms shorter than the wait
+// must have expired, a longer one or none must not, and deadline_ms values that are not numbers
+// are ignored like jansson ignores them
+static void test_plain_request_deadline(void)
+{
+    static const struct {
+        const char *request;
+        int expired;
+    } cases[] = {
+        { "{\"name\":\"Default\",\"deadline_ms\":5}", 1 },
+        { "{\"deadline_ms\":5,\"unixTime\":1700000000}", 1 },
+        { "{\"name\":\"Default\",\"deadline_ms\":60000}", 0 },
+        { "{\"name\":\"Default\"}", 0 },
+        { "{\"name\":\"Default\",\"deadline_ms\":\"5\"}", 0 },
+        { "{\"deadline_ms\":5,\"deadline_ms\":null}", 0 },
+    };
+    size_t count = sizeof(cases) / sizeof(cases[0]), wrong = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct ExoplanetRequest decoded;
+        size_t length = strlen(cases[i].request), consumed;
+        if (exoplanet_decode_request(cases[i].request, length, &decoded, &consumed) != 0 || consumed != length ||
+            admissionEnter((uint64_t) TEST_QUEUE_WAIT_MS * 1000000ULL) != 0)
+        {
+            wrong++;
+            continue;
+        }
+
+        admissionSetDeadline(decoded.deadlineMs);
+        wrong += admissionExpired() != cases[i].expired;
+        admissionLeave();
+    }
+
+    char detail[160];
+    snprintf(detail, sizeof(detail), "%zu of %zu plain requests queued for %d ms expired or not as their deadline_ms asks",
+             count - wrong, count, TEST_QUEUE_WAIT_MS);
+    test_report("plain_request_deadline", wrong == 0, detail);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : NULL;
+
+    if (test_selected("orbit_block", filter))
+        test_orbit_blocks();
+    if (test_selected("box_search", filter))
+        test_box_search();
+    if (test_selected("plain_request_deadline", filter))
+        test_plain_request_deadline();
+
+    if (test_failures > 0)
+        printf("%d checks failed\n", test_failures);
+    return test_failures > 0 ? 1 : 0;
+}
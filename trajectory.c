@@ -0,0 +1,187 @@
+/*
+ * Trajectories: the positions of one planet over a span of epochs, produced a chunk at a time.
+ * The orbit is compiled once and every solve of Kepler's equation starts from the previous
+ * sample's eccentric anomaly advanced by the change in mean anomaly, so a track costs about one
+ * Halley step per sample. Samples are either equally spaced in time or, with a resolution, spaced
+ * by a fixed advance of the true anomaly, which puts them closer together near periapsis.
+ */
+
+#ifndef TRAJECTORY_C
+#define TRAJECTORY_C
+
+#include <string.h>
+#include <math.h>
+#include "astromath.c"
+#include "orbit.c"
+#include "exoplanetcodec.c"
+
+// Most samples a trajectory produces, the same bound as the positions of a batch
+#define MAX_TRAJECTORY_SAMPLES 1000000
+
+// Most samples of a trajectory answered without a channel to stream to (event mode, socket
+// transport), where the whole track is buffered before it is sent: about 25 MB of JSON
+#define MAX_BUFFERED_TRAJECTORY_SAMPLES 100000
+
+// Samples per chunk of a streamed trajectory
+#define TRAJECTORY_CHUNK_SAMPLES 512
+
+// Buffer size that always fits one encoded sample
+#define TRAJECTORY_SAMPLE_SIZE 256
+
+struct TrajectorySample {
+    double unixTime;
+    double distance;                // Light years, NaN when Kepler's equation had no solution
+    double ra;                      // Radians
+    double declination;             // Degrees
+    double galacticLongitude;       // Degrees
+    double galacticLatitude;        // Degrees
+};
+
+struct Trajectory {
+    struct OrbitHandle orbit;
+    double start;
+    double stop;
+    double step;                    // Seconds between samples, 0 when spaced by resolution
+    double resolution;              // Radians of true anomaly between samples
+    double time;                    // Epoch of the next sample
+    double eccentricAnomaly;        // Of the last sample, NaN before the first or after a failed solve
+    double meanAnomaly;             // Of the last sample
+    size_t produced;
+    int truncated;                  // Stopped at MAX_TRAJECTORY_SAMPLES before reaching stop
+    int finished;
+};
+
+// Starts a trajectory of orbit from start to stop, both included, with samples step seconds apart,
+// or when step is 0, resolution degrees of true anomaly apart. Returns -1 for an empty span or
+// spacing, or a fixed step that would pass MAX_TRAJECTORY_SAMPLES.
+int trajectoryInit(struct Trajectory *trajectory, const struct OrbitHandle *orbit, double start, double stop, double step, double resolution)
+{
+    memset(trajectory, 0, sizeof(*trajectory));
+
+    if (!isfinite(start) || !isfinite(stop) || !(stop >= start))
+        return -1;
+    if (step > 0)
+    {
+        if (floor((stop - start) / step) + 1 > MAX_TRAJECTORY_SAMPLES)
+            return -1;
+    }
+    else if (!(resolution > 0) || !isfinite(resolution))
+        return -1;
+
+    trajectory->orbit = *orbit;
+    trajectory->start = start;
+    trajectory->stop = stop;
+    trajectory->step = step > 0 ? step : 0;
+    trajectory->resolution = DEG_TO_RAD(resolution);
+    trajectory->time = start;
+    trajectory->eccentricAnomaly = NAN;
+    return 0;
+}
+
+// Seconds until the true anomaly has advanced by the resolution, from the eccentric anomaly E of
+// the last sample: dv/dt = n sqrt(1 - e^2) / (1 - e cos E)^2
+static double trajectoryAdaptiveStep(const struct Trajectory *trajectory)
+{
+    const struct OrbitHandle *orbit = &trajectory->orbit;
+    double e = orbit->eccentricity;
+
+    // Without a solution the step of a circular orbit keeps the track moving
+    if (isnan(trajectory->eccentricAnomaly))
+        return trajectory->resolution / orbit->meanMotion;
+
+    double one_minus_e_cos = 1 - e * cos(trajectory->eccentricAnomaly);
+    return trajectory->resolution * one_minus_e_cos * one_minus_e_cos / (orbit->meanMotion * sqrt(1 - e * e));
+}
+
+// Computes the next samples of the trajectory, at most capacity of them. Returns the number written,
+// 0 once the trajectory is finished.
+size_t trajectoryNext(struct Trajectory *trajectory, struct TrajectorySample *samples, size_t capacity)
+{
+    size_t count = 0;
+
+    while (count < capacity && !trajectory->finished)
+    {
+        if (trajectory->produced == MAX_TRAJECTORY_SAMPLES)
+        {
+            trajectory->truncated = 1;
+            trajectory->finished = 1;
+            break;
+        }
+
+        double time = trajectory->time;
+        const struct OrbitHandle *orbit = &trajectory->orbit;
+
+        // Advance the last eccentric anomaly to first order in the mean anomaly: dE = dM / (1 - e cos E)
+        double mean_anomaly = orbitHandleMeanAnomaly(orbit, time);
+        double guess = NAN;
+        if (!isnan(trajectory->eccentricAnomaly))
+            guess = trajectory->eccentricAnomaly + (mean_anomaly - trajectory->meanAnomaly) /
+                    (1 - orbit->eccentricity * cos(trajectory->eccentricAnomaly));
+
+        struct Exoplanet planet = get_default_exoplanet();
+        trajectory->eccentricAnomaly = orbitHandleEvaluateFrom(orbit, time, guess, &planet);
+        trajectory->meanAnomaly = mean_anomaly;
+        setGalacticCoordinates(&planet);
+
+        // A failed solve reports no angles at all rather than the planet's defaults
+        struct TrajectorySample *sample = &samples[count++];
+        int solved = !isnan(planet.distance);
+        sample->unixTime = time;
+        sample->distance = planet.distance;
+        sample->ra = planet.ra;
+        sample->declination = solved ? planet.declination : NAN;
+        sample->galacticLongitude = solved ? planet.galacticLongitude : NAN;
+        sample->galacticLatitude = solved ? planet.galacticLatitude : NAN;
+        trajectory->produced++;
+
+        // Fixed steps are counted from the start so rounding does not accumulate
+        double next = trajectory->step > 0 ? trajectory->start + trajectory->produced * trajectory->step
+                                           : time + trajectoryAdaptiveStep(trajectory);
+
+        // An adaptive track ends exactly at stop, a step too small to move the time ends it as well
+        if (time >= trajectory->stop || (trajectory->step > 0 && next > trajectory->stop) || !(next > time))
+            trajectory->finished = 1;
+        else
+            trajectory->time = next < trajectory->stop ? next : trajectory->stop;
+    }
+
+    return count;
+}
+
+static void trajectoryPutReal(struct CodecWriter *w, const char *key, size_t key_length, double value)
+{
+    if (isfinite(value))
+    {
+        codec_put_real(w, key, key_length, value);
+        return;
+    }
+    codec_put(w, key, key_length);
+    codec_put(w, "null", 4);
+}
+
+#define TRAJECTORY_PUT_REAL(w, key, value) trajectoryPutReal(w, key, sizeof(key) - 1, value)
+
+// Serializes one sample with the keys of a batch position. Returns the length written (not NUL
+// terminated), 0 when it does not fit.
+size_t trajectoryEncodeSample(const struct TrajectorySample *sample, char *buffer, size_t capacity)
+{
+    struct CodecWriter w = { buffer, buffer + capacity, 0 };
+
+    TRAJECTORY_PUT_REAL(&w, "{\"unixTime\":", sample->unixTime);
+    TRAJECTORY_PUT_REAL(&w, ",\"distance\":", sample->distance);
+    TRAJECTORY_PUT_REAL(&w, ",\"ra\":", sample->ra);
+    TRAJECTORY_PUT_REAL(&w, ",\"declination\":", sample->declination);
+    TRAJECTORY_PUT_REAL(&w, ",\"galacticLongitude\":", sample->galacticLongitude);
+    TRAJECTORY_PUT_REAL(&w, ",\"galacticLatitude\":", sample->galacticLatitude);
+
+    if (isnan(sample->distance))
+    {
+        const char *failed = ",\"error\":\"Failed to solve Kepler's equation given the input.\"";
+        codec_put(&w, failed, strlen(failed));
+    }
+    codec_put(&w, "}", 1);
+
+    return w.overflow ? 0 : (size_t) (w.p - buffer);
+}
+
+#endif
@@ -1,12 +1,50 @@
 /*
  * Generate a 3d model for computer screens based on exoplanet coordinates for visualization
+ *
+ * Exports are streamed: points are converted and formatted a chunk at a time and handed to a sink
+ * (a file descriptor, an SSH channel, a growing buffer), so a scene is never held in memory as a
+ * whole. Each round of chunks is split by index range over the shared task pool (worker_task_pool)
+ * and written out in order.
+ * Three formats are produced: OBJ points as text, and binary little-endian PLY and glTF 2.0 (GLB)
+ * point clouds, which store float32 positions and need no text formatting at all.
  */
 
+#ifndef VISUALIZATION_C
+#define VISUALIZATION_C
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <math.h>
 #include <float.h>
-#include "exoplanet.c"
+#include <unistd.h>
+#include "astromath.c"
+#include "workerpool.c"
+
+// Points converted and formatted by one task per round
+#define VISUALIZATION_CHUNK_POINTS 2048
+
+// Buffer size that always fits one OBJ point line
+#define VISUALIZATION_LINE_SIZE 96
+
+// Bytes per point of the binary formats, three float32
+#define VISUALIZATION_POINT_SIZE 12
+
+#define VISUALIZATION_MAX_THREADS 64
+
+// Coordinates at least this large are written in exponent notation, which bounds the line length
+#define VISUALIZATION_FIXED_LIMIT 1e12
+
+enum VisualizationFormat {
+    VISUALIZATION_OBJ,
+    VISUALIZATION_PLY,
+    VISUALIZATION_GLB
+};
+
+// Receives the export a chunk at a time, in order. Returns 0, or -1 to stop the export.
+typedef int (*VisualizationSink)(void *context, const char *data, size_t length);
 
 struct CartesianCoordinates {
     double x;
@@ -20,8 +58,8 @@ struct CartesianCoordinates convertToCartesian(struct Exoplanet exoplanet) {
 
     // Convert galactic coordinates to spherical coordinates
     double r = exoplanet.distance; // Assuming 'distance' is the radius in light years
-    double theta = exoplanet.galacticLongitude * (M_PI / 180.0); // Convert degrees to radians
-    double phi = exoplanet.galacticLatitude * (M_PI / 180.0); // Convert degrees to radians
+    double theta = DEG_TO_RAD(exoplanet.galacticLongitude);
+    double phi = DEG_TO_RAD(exoplanet.galacticLatitude);
 
     // Convert spherical coordinates to Cartesian coordinates
     cartesianCoord.x = r * cos(theta) * cos(phi);
@@ -53,16 +91,265 @@ double calculateScalingFactor(double maxDistance, double minDistance, double scr
     return fmin(scaleX, fmin(scaleY, scaleZ));
 }
 
-// Generates OBJ data for exoplanets and returns a pointer to the data
-// Memory management responsibility is with the caller
-// Generates OBJ data for exoplanets as dots and returns a pointer to the data
-// Memory management responsibility is with the caller
-char *generateObjDataDots(struct Exoplanet *exoplanets, int numExoplanets, double screenWidth, double screenHeight, size_t *objSize) {
+// Returns the format with the given name ("obj", "ply" or "glb"), -1 for any other
+int visualizationFormat(const char *name) {
+    if (name == NULL || strcmp(name, "obj") == 0)
+        return VISUALIZATION_OBJ;
+    if (strcmp(name, "ply") == 0)
+        return VISUALIZATION_PLY;
+    if (strcmp(name, "glb") == 0)
+        return VISUALIZATION_GLB;
+    return -1;
+}
+
+// Sink writing to the file descriptor context points to
+int visualizationWriteFd(void *context, const char *data, size_t length) {
+    int fd = *(const int *) context;
+
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        length -= (size_t) written;
+    }
+    return 0;
+}
+
+struct VisualizationBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// Sink appending to the VisualizationBuffer context points to
+int visualizationWriteBuffer(void *context, const char *data, size_t length) {
+    struct VisualizationBuffer *buffer = context;
+
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length)
+            capacity *= 2;
+        char *grown = realloc(buffer->data, capacity);
+        if (!grown)
+            return -1;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+// Writes value with six decimals like "%.6f" without going through printf: the value is rounded to
+// an integer count of millionths, which can differ from printf in the last digit on exact ties.
+// Returns the length written, at most 32.
+static size_t visualizationFormatFixed(char *out, double value) {
+    if (!(fabs(value) < VISUALIZATION_FIXED_LIMIT))
+        return (size_t) snprintf(out, 32, "%.6e", value);
+
+    char *p = out;
+    if (signbit(value))
+        *p++ = '-';
+
+    uint64_t millionths = (uint64_t) llround(fabs(value) * 1e6);
+    uint64_t whole = millionths / 1000000;
+    uint32_t fraction = (uint32_t) (millionths % 1000000);
+
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + whole % 10);
+        whole /= 10;
+    } while (whole > 0);
+    while (count > 0)
+        *p++ = digits[--count];
+
+    *p++ = '.';
+    for (int i = 5; i >= 0; i--) {
+        p[i] = (char) ('0' + fraction % 10);
+        fraction /= 10;
+    }
+    p += 6;
+
+    return (size_t) (p - out);
+}
+
+// Stores a float32 in little-endian byte order
+static void visualizationPutFloat(char *out, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    out[0] = (char) (bits & 0xff);
+    out[1] = (char) ((bits >> 8) & 0xff);
+    out[2] = (char) ((bits >> 16) & 0xff);
+    out[3] = (char) (bits >> 24);
+}
+
+static void visualizationPutUint32(char *out, uint32_t value) {
+    out[0] = (char) (value & 0xff);
+    out[1] = (char) ((value >> 8) & 0xff);
+    out[2] = (char) ((value >> 16) & 0xff);
+    out[3] = (char) (value >> 24);
+}
+
+// Scaled position of a planet, returns 0 when it does not fit a float32 (a failed solve is NaN) and
+// the point is left out of the export
+static int visualizationPoint(const struct Exoplanet *exoplanet, double scalingFactor, struct CartesianCoordinates *point) {
+    *point = convertToCartesian(*exoplanet);
+    scaleCoordinates(point, scalingFactor);
+
+    return fabs(point->x) <= FLT_MAX && fabs(point->y) <= FLT_MAX && fabs(point->z) <= FLT_MAX;
+}
+
+// One task's index range of a round, or of the counting pass
+struct VisualizationTask {
+    const struct Exoplanet *exoplanets;
+    size_t begin;
+    size_t end;
+    double scalingFactor;
+    enum VisualizationFormat format;
+    char *buffer;                   // Formatted chunk
+    size_t length;
+    size_t count;                   // Points kept
+    float min[3];
+    float max[3];
+};
+
+// Counts the kept points of the task's range and their bounds
+static void visualizationCountTask(void *arg) {
+    struct VisualizationTask *task = arg;
+
+    for (int axis = 0; axis < 3; axis++) {
+        task->min[axis] = FLT_MAX;
+        task->max[axis] = -FLT_MAX;
+    }
+
+    for (size_t i = task->begin; i < task->end; i++) {
+        struct CartesianCoordinates point;
+        if (!visualizationPoint(&task->exoplanets[i], task->scalingFactor, &point))
+            continue;
+        task->count++;
+
+        // Rounding to float32 is monotonic, so these are the bounds of the stored positions
+        float coordinates[3] = { (float) point.x, (float) point.y, (float) point.z };
+        for (int axis = 0; axis < 3; axis++) {
+            task->min[axis] = fminf(task->min[axis], coordinates[axis]);
+            task->max[axis] = fmaxf(task->max[axis], coordinates[axis]);
+        }
+    }
+}
+
+// Formats the kept points of the task's range into its buffer
+static void visualizationChunkTask(void *arg) {
+    struct VisualizationTask *task = arg;
+    char *p = task->buffer;
+
+    for (size_t i = task->begin; i < task->end; i++) {
+        struct CartesianCoordinates point;
+        if (!visualizationPoint(&task->exoplanets[i], task->scalingFactor, &point))
+            continue;
+
+        // Text keeps the double precision of the coordinates
+        if (task->format == VISUALIZATION_OBJ) {
+            *p++ = 'p';
+            *p++ = ' ';
+            p += visualizationFormatFixed(p, point.x);
+            *p++ = ' ';
+            p += visualizationFormatFixed(p, point.y);
+            *p++ = ' ';
+            p += visualizationFormatFixed(p, point.z);
+            *p++ = '\n';
+        } else {
+            visualizationPutFloat(p, (float) point.x);
+            visualizationPutFloat(p + 4, (float) point.y);
+            visualizationPutFloat(p + 8, (float) point.z);
+            p += VISUALIZATION_POINT_SIZE;
+        }
+    }
+
+    task->length = (size_t) (p - task->buffer);
+}
+
+// Splits [0, numExoplanets) into one contiguous range per task
+static void visualizationSplit(struct VisualizationTask *tasks, int count, size_t begin, size_t end) {
+    size_t per_task = (end - begin + (size_t) count - 1) / (size_t) count;
+
+    for (int t = 0; t < count; t++) {
+        tasks[t].begin = begin + per_task * (size_t) t < end ? begin + per_task * (size_t) t : end;
+        tasks[t].end = tasks[t].begin + per_task < end ? tasks[t].begin + per_task : end;
+        tasks[t].count = 0;
+        tasks[t].length = 0;
+    }
+}
+
+// Writes the PLY header for count points
+static int visualizationPlyHeader(size_t count, VisualizationSink sink, void *context) {
+    char header[256];
+    int length = snprintf(header, sizeof(header),
+                          "ply\nformat binary_little_endian 1.0\ncomment exoplanet-finder\nelement vertex %zu\n"
+                          "property float x\nproperty float y\nproperty float z\nend_header\n", count);
+    return sink(context, header, (size_t) length);
+}
+
+// Writes the GLB header, the JSON chunk and the header of the BIN chunk holding count positions
+// within min and max. An empty scene is an asset without meshes or a BIN chunk.
+static int visualizationGlbHeader(size_t count, const float min[3], const float max[3], VisualizationSink sink, void *context) {
+    char json[1024];
+    int length;
+
+    if (count == 0)
+        length = snprintf(json, sizeof(json), "{\"asset\":{\"version\":\"2.0\",\"generator\":\"exoplanet-finder\"}}");
+    else
+        length = snprintf(json, sizeof(json),
+                          "{\"asset\":{\"version\":\"2.0\",\"generator\":\"exoplanet-finder\"},\"scene\":0,"
+                          "\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+                          "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0},\"mode\":0}]}],"
+                          "\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":%zu,\"type\":\"VEC3\","
+                          "\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]}],"
+                          "\"bufferViews\":[{\"buffer\":0,\"byteLength\":%zu}],\"buffers\":[{\"byteLength\":%zu}]}",
+                          count, min[0], min[1], min[2], max[0], max[1], max[2],
+                          count * VISUALIZATION_POINT_SIZE, count * VISUALIZATION_POINT_SIZE);
+
+    // Chunks are 4-byte aligned, the JSON chunk is padded with spaces
+    size_t json_length = ((size_t) length + 3) & ~(size_t) 3;
+    memset(json + length, ' ', json_length - (size_t) length);
+
+    size_t binary_length = count * VISUALIZATION_POINT_SIZE;
+    size_t total = 12 + 8 + json_length + (count ? 8 + binary_length : 0);
+
+    char header[20];
+    memcpy(header, "glTF", 4);
+    visualizationPutUint32(header + 4, 2);
+    visualizationPutUint32(header + 8, (uint32_t) total);
+    visualizationPutUint32(header + 12, (uint32_t) json_length);
+    memcpy(header + 16, "JSON", 4);
+    if (sink(context, header, sizeof(header)) != 0 || sink(context, json, json_length) != 0)
+        return -1;
+
+    if (count == 0)
+        return 0;
+
+    char binary_header[8];
+    visualizationPutUint32(binary_header, (uint32_t) binary_length);
+    memcpy(binary_header + 4, "BIN", 4);
+    return sink(context, binary_header, sizeof(binary_header));
+}
+
+// Streams the exoplanets as points in format to sink, scaled to fit screenWidth by screenHeight.
+// Planets without finite coordinates are left out. threads limits the tasks formatting a round in
+// parallel, 0 keeps every worker of worker_task_pool busy. Returns 0, or -1 if memory ran out, the scene is too large for the format or the sink
+// failed.
+int exportVisualization(const struct Exoplanet *exoplanets, size_t numExoplanets, double screenWidth, double screenHeight,
+                        enum VisualizationFormat format, int threads, VisualizationSink sink, void *context) {
     double maxDistance = 0.0;
     double minDistance = DBL_MAX;
 
     // Find maximum and minimum distances among exoplanets
-    for (int i = 0; i < numExoplanets; i++) {
+    for (size_t i = 0; i < numExoplanets; i++) {
         if (exoplanets[i].distance > maxDistance) {
             maxDistance = exoplanets[i].distance;
         }
@@ -74,26 +361,92 @@ char *generateObjDataDots(struct Exoplanet *exoplanets, int numExoplanets, doubl
     // Calculate scaling factor for visualization
     double scalingFactor = calculateScalingFactor(maxDistance, minDistance, screenWidth, screenHeight);
 
-    // Allocate memory for OBJ data
-    size_t bufferSize = numExoplanets * 128; // Adjust buffer size as needed
-    char *objData = (char *)malloc(bufferSize);
-    if (!objData) {
-        printf("Memory allocation error\n");
-        return NULL;
+    if (threads <= 0)
+        threads = workerPoolParallelism(&worker_task_pool);
+    if (threads > VISUALIZATION_MAX_THREADS)
+        threads = VISUALIZATION_MAX_THREADS;
+    size_t chunks = (numExoplanets + VISUALIZATION_CHUNK_POINTS - 1) / VISUALIZATION_CHUNK_POINTS;
+    if ((size_t) threads > chunks)
+        threads = chunks > 0 ? (int) chunks : 1;
+
+    struct VisualizationTask tasks[VISUALIZATION_MAX_THREADS];
+    memset(tasks, 0, sizeof(tasks));
+    for (int t = 0; t < threads; t++) {
+        tasks[t].exoplanets = exoplanets;
+        tasks[t].scalingFactor = scalingFactor;
+        tasks[t].format = format;
+    }
+
+    // The binary formats declare the point count (and GLB the bounds) up front
+    if (format != VISUALIZATION_OBJ) {
+        visualizationSplit(tasks, threads, 0, numExoplanets);
+        workerPoolRunTasks(&worker_task_pool, visualizationCountTask, tasks, sizeof(tasks[0]), (size_t) threads);
+
+        size_t count = 0;
+        float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (int t = 0; t < threads; t++) {
+            count += tasks[t].count;
+            for (int axis = 0; axis < 3; axis++) {
+                min[axis] = fminf(min[axis], tasks[t].min[axis]);
+                max[axis] = fmaxf(max[axis], tasks[t].max[axis]);
+            }
+        }
+
+        if (format == VISUALIZATION_PLY) {
+            if (visualizationPlyHeader(count, sink, context) != 0)
+                return -1;
+        } else {
+            // GLB lengths are 32-bit
+            if (count > (UINT32_MAX - 4096) / VISUALIZATION_POINT_SIZE)
+                return -1;
+            if (visualizationGlbHeader(count, min, max, sink, context) != 0)
+                return -1;
+        }
     }
 
-    // Generate vertex data and format it as OBJ points
-    size_t offset = 0;
-    for (int i = 0; i < numExoplanets; i++) {
-        struct CartesianCoordinates cartesianCoord = convertToCartesian(exoplanets[i]);
-        scaleCoordinates(&cartesianCoord, scalingFactor);
+    size_t chunk_size = VISUALIZATION_CHUNK_POINTS * (format == VISUALIZATION_OBJ ? VISUALIZATION_LINE_SIZE : VISUALIZATION_POINT_SIZE);
+    char *buffers = malloc(chunk_size * (size_t) threads);
+    if (!buffers)
+        return -1;
+    for (int t = 0; t < threads; t++)
+        tasks[t].buffer = buffers + chunk_size * (size_t) t;
+
+    // Each round formats one chunk per task, then writes them out in order
+    int ret_val = 0;
+    size_t round_points = (size_t) VISUALIZATION_CHUNK_POINTS * (size_t) threads;
+    for (size_t begin = 0; begin < numExoplanets && ret_val == 0; begin += round_points) {
+        size_t end = numExoplanets - begin > round_points ? begin + round_points : numExoplanets;
+        visualizationSplit(tasks, threads, begin, end);
+        workerPoolRunTasks(&worker_task_pool, visualizationChunkTask, tasks, sizeof(tasks[0]), (size_t) threads);
 
-        // Format the point line for OBJ format
-        offset += snprintf(objData + offset, bufferSize - offset, "p %.6f %.6f %.6f\n", cartesianCoord.x, cartesianCoord.y, cartesianCoord.z);
+        for (int t = 0; t < threads && ret_val == 0; t++) {
+            if (tasks[t].length > 0 && sink(context, tasks[t].buffer, tasks[t].length) != 0)
+                ret_val = -1;
+        }
+    }
+
+    free(buffers);
+    return ret_val;
+}
+
+// Generates OBJ data for exoplanets as dots and returns a pointer to the data
+// Memory management responsibility is with the caller
+char *generateObjDataDots(struct Exoplanet *exoplanets, int numExoplanets, double screenWidth, double screenHeight, size_t *objSize) {
+    struct VisualizationBuffer buffer = {0};
+
+    if (exportVisualization(exoplanets, numExoplanets > 0 ? (size_t) numExoplanets : 0, screenWidth, screenHeight,
+                            VISUALIZATION_OBJ, 0, visualizationWriteBuffer, &buffer) != 0 ||
+        visualizationWriteBuffer(&buffer, "", 1) != 0) {
+        printf("Memory allocation error\n");
+        free(buffer.data);
+        return NULL;
     }
 
-    *objSize = offset;
+    // The terminating NUL is not part of the size
+    *objSize = buffer.length - 1;
 
-    return objData;
+    return buffer.data;
 }
 
+#endif
@@ -0,0 +1,401 @@
+/*
+ * Fixed-size worker pool with bounded per-worker queues and work stealing
+ *
+ * worker_task_pool is shared by the data-parallel loops (model exports, scene and sky index builds,
+ * orbital event searches), which split their work into a few tasks with workerPoolRunTasks and
+ * wait for them.
+ */
+
+#ifndef WORKERPOOL_C
+#define WORKERPOOL_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+struct WorkItem {
+    void (*run)(void *arg);
+    void *arg;
+    uint64_t queuedNs;              // monotonic time it was submitted
+};
+
+// Ring buffer of work items, owners take from the head, thieves from the tail
+struct WorkerQueue {
+    pthread_mutex_t lock;
+    struct WorkItem *items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+};
+
+struct WorkerPool {
+    int numWorkers;
+    struct WorkerQueue *queues;
+    pthread_t *threads;
+
+    // Items admitted but not yet picked up by a worker, bounded by capacity
+    size_t queued;
+    size_t capacity;
+
+    // Items sitting in a queue, what idle workers wait for
+    size_t available;
+
+    // Guards sleeping workers and blocked submitters
+    pthread_mutex_t lock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t spaceAvailable;
+    int blockedSubmitters;
+    int stopping;
+
+    unsigned int nextQueue;
+
+    // Counters
+    unsigned long long submitted;
+    unsigned long long rejected;
+    unsigned long long stolen;
+    int busyWorkers;
+};
+
+struct WorkerPoolStats {
+    int workers;
+    int busyWorkers;
+    size_t queueDepth;
+    size_t queueCapacity;
+    unsigned long long submitted;
+    unsigned long long rejected;
+    unsigned long long stolen;
+};
+
+void workerPoolShutdown(struct WorkerPool *pool);
+
+// Pool workerPoolRunTasks callers split their work over, started by the server. Until it is (tools,
+// tests) it has no workers and every task runs on its caller.
+struct WorkerPool worker_task_pool;
+
+// Tasks of one workerPoolRunTasks call still running
+struct WorkerTaskGroup {
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    size_t pending;
+};
+
+struct WorkerTask {
+    struct WorkerTaskGroup *group;
+    void (*run)(void *task);
+    void *task;
+};
+
+// How long the item the calling worker runs waited in the queue, in nanoseconds
+static __thread uint64_t worker_pool_waited_ns;
+
+static uint64_t workerPoolNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+// Argument of each worker thread
+struct WorkerContext {
+    struct WorkerPool *pool;
+    int index;
+};
+
+static int workerQueuePopHead(struct WorkerQueue *queue, struct WorkItem *item)
+{
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0)
+    {
+        *item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static int workerQueuePopTail(struct WorkerQueue *queue, struct WorkItem *item)
+{
+    int found = 0;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0)
+    {
+        queue->count--;
+        *item = queue->items[(queue->head + queue->count) % queue->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+// Takes the next item for worker index: its own queue first, then the other queues in turn
+static int workerPoolTake(struct WorkerPool *pool, int index, struct WorkItem *item)
+{
+    if (workerQueuePopHead(&pool->queues[index], item))
+        return 1;
+
+    for (int offset = 1; offset < pool->numWorkers; offset++)
+    {
+        if (workerQueuePopTail(&pool->queues[(index + offset) % pool->numWorkers], item))
+        {
+            __atomic_fetch_add(&pool->stolen, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void *workerMain(void *arg)
+{
+    struct WorkerContext *context = arg;
+    struct WorkerPool *pool = context->pool;
+    int index = context->index;
+    free(context);
+
+    for (;;)
+    {
+        struct WorkItem item;
+
+        if (workerPoolTake(pool, index, &item))
+        {
+            __atomic_fetch_sub(&pool->available, 1, __ATOMIC_SEQ_CST);
+            __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_SEQ_CST);
+
+            // Wake a submitter waiting for queue space
+            pthread_mutex_lock(&pool->lock);
+            if (pool->blockedSubmitters > 0)
+                pthread_cond_signal(&pool->spaceAvailable);
+            pthread_mutex_unlock(&pool->lock);
+
+            uint64_t now = workerPoolNow();
+            worker_pool_waited_ns = now > item.queuedNs ? now - item.queuedNs : 0;
+            __atomic_fetch_add(&pool->busyWorkers, 1, __ATOMIC_RELAXED);
+            item.run(item.arg);
+            __atomic_fetch_sub(&pool->busyWorkers, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->available, __ATOMIC_SEQ_CST) == 0 && !pool->stopping)
+            pthread_cond_wait(&pool->workAvailable, &pool->lock);
+        int stop = pool->stopping && __atomic_load_n(&pool->available, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop)
+            break;
+    }
+
+    return NULL;
+}
+
+// Starts numWorkers threads sharing at most capacity queued items, returns 0 on success
+int workerPoolInit(struct WorkerPool *pool, int numWorkers, size_t capacity)
+{
+    memset(pool, 0, sizeof(*pool));
+
+    if (numWorkers < 1 || capacity < 1)
+        return -1;
+
+    pool->numWorkers = numWorkers;
+    pool->capacity = capacity;
+    pool->queues = calloc(numWorkers, sizeof(struct WorkerQueue));
+    pool->threads = calloc(numWorkers, sizeof(pthread_t));
+    if (!pool->queues || !pool->threads)
+        return -1;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workAvailable, NULL);
+    pthread_cond_init(&pool->spaceAvailable, NULL);
+
+    // Each queue can hold the whole admitted backlog, so a push after admission never fails
+    for (int i = 0; i < numWorkers; i++)
+    {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+        pool->queues[i].capacity = capacity;
+        pool->queues[i].items = malloc(sizeof(struct WorkItem) * capacity);
+        if (!pool->queues[i].items)
+            return -1;
+    }
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        struct WorkerContext *context = malloc(sizeof(struct WorkerContext));
+        if (!context)
+            return -1;
+        context->pool = pool;
+        context->index = i;
+
+        if (pthread_create(&pool->threads[i], NULL, workerMain, context) != 0)
+        {
+            free(context);
+            fprintf(stderr, "Error creating worker thread\n");
+            pool->numWorkers = i;
+            workerPoolShutdown(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Queues run(arg) on the pool. When the backlog is full the call either waits for space (block != 0)
+// or returns -1 straight away so the caller can shed the work. Returns 0 once the item is queued.
+int workerPoolSubmit(struct WorkerPool *pool, void (*run)(void *arg), void *arg, int block)
+{
+    // Reserve a slot in the backlog
+    for (;;)
+    {
+        size_t queued = __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST);
+        if (queued < pool->capacity)
+        {
+            if (__atomic_compare_exchange_n(&pool->queued, &queued, queued + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                break;
+            continue;
+        }
+
+        if (!block)
+        {
+            __atomic_fetch_add(&pool->rejected, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->blockedSubmitters++;
+        while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) >= pool->capacity && !pool->stopping)
+            pthread_cond_wait(&pool->spaceAvailable, &pool->lock);
+        pool->blockedSubmitters--;
+        int stopping = pool->stopping;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stopping)
+            return -1;
+    }
+
+    struct WorkItem item = { run, arg, workerPoolNow() };
+    struct WorkerQueue *queue = &pool->queues[__atomic_fetch_add(&pool->nextQueue, 1, __ATOMIC_RELAXED) % pool->numWorkers];
+
+    pthread_mutex_lock(&queue->lock);
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+
+    __atomic_fetch_add(&pool->available, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&pool->submitted, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+// Called from a running item: how long it waited for a worker, in nanoseconds (0 outside a pool)
+uint64_t workerPoolWaited(void)
+{
+    return worker_pool_waited_ns;
+}
+
+// Number of items waiting for a worker
+size_t workerPoolQueueDepth(struct WorkerPool *pool)
+{
+    return __atomic_load_n(&pool->queued, __ATOMIC_RELAXED);
+}
+
+void workerPoolStatsSnapshot(struct WorkerPool *pool, struct WorkerPoolStats *stats)
+{
+    stats->workers = pool->numWorkers;
+    stats->busyWorkers = __atomic_load_n(&pool->busyWorkers, __ATOMIC_RELAXED);
+    stats->queueDepth = workerPoolQueueDepth(pool);
+    stats->queueCapacity = pool->capacity;
+    stats->submitted = __atomic_load_n(&pool->submitted, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&pool->rejected, __ATOMIC_RELAXED);
+    stats->stolen = __atomic_load_n(&pool->stolen, __ATOMIC_RELAXED);
+}
+
+// Tasks a workerPoolRunTasks caller can keep busy at once: the pool's workers plus itself
+int workerPoolParallelism(const struct WorkerPool *pool)
+{
+    return pool->numWorkers + 1;
+}
+
+static void workerTaskRun(void *arg)
+{
+    struct WorkerTask *task = arg;
+    struct WorkerTaskGroup *group = task->group;
+
+    task->run(task->task);
+
+    pthread_mutex_lock(&group->lock);
+    if (--group->pending == 0)
+        pthread_cond_signal(&group->finished);
+    pthread_mutex_unlock(&group->lock);
+}
+
+// Runs run on each of count tasks of size bytes and returns once all of them are done. The first
+// task runs on the caller, the others on pool. A task the pool has no room for runs on the caller
+// as well, so a full backlog only costs parallelism. Tasks must not call this on the same pool.
+void workerPoolRunTasks(struct WorkerPool *pool, void (*run)(void *task), void *tasks, size_t size, size_t count)
+{
+    struct WorkerTask *wrapped = count > 1 && pool->numWorkers > 0 ? malloc(sizeof(struct WorkerTask) * (count - 1)) : NULL;
+    if (!wrapped)
+    {
+        for (size_t t = 0; t < count; t++)
+            run((char *) tasks + size * t);
+        return;
+    }
+
+    struct WorkerTaskGroup group;
+    pthread_mutex_init(&group.lock, NULL);
+    pthread_cond_init(&group.finished, NULL);
+    group.pending = count - 1;
+
+    for (size_t t = 1; t < count; t++)
+    {
+        struct WorkerTask *task = &wrapped[t - 1];
+        task->group = &group;
+        task->run = run;
+        task->task = (char *) tasks + size * t;
+        if (workerPoolSubmit(pool, workerTaskRun, task, 0) != 0)
+            workerTaskRun(task);
+    }
+    run(tasks);
+
+    pthread_mutex_lock(&group.lock);
+    while (group.pending > 0)
+        pthread_cond_wait(&group.finished, &group.lock);
+    pthread_mutex_unlock(&group.lock);
+
+    pthread_cond_destroy(&group.finished);
+    pthread_mutex_destroy(&group.lock);
+    free(wrapped);
+}
+
+// Lets the workers finish everything already queued, then joins them and frees the pool
+void workerPoolShutdown(struct WorkerPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->workAvailable);
+    pthread_cond_broadcast(&pool->spaceAvailable);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->numWorkers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; pool->queues && i < pool->numWorkers; i++)
+        free(pool->queues[i].items);
+
+    free(pool->queues);
+    free(pool->threads);
+    pool->queues = NULL;
+    pool->threads = NULL;
+    pool->numWorkers = 0;
+}
+
+#endif